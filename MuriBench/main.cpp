@@ -0,0 +1,665 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Micro-benchmarks of the host side hot paths: hex import, packet planning,
+ * image compare, the post-sign erase block rebuild, bundle image switching
+ * and PICData setup.
+ *
+ * Every dataset is generated from a fixed seed, so the numbers of two runs
+ * (or two builds) are measured on the same bytes; the checksum of each
+ * dataset is reported next to its results to catch a change of generator.
+ * Each benchmark runs for at least --min-time, doubling its iterations the
+ * way Google Benchmark does, and --json prints results in the same shape as
+ * Google Benchmark's JSON output so the usual comparison scripts work.
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+#include <algorithm>
+#include <stdio.h>
+
+#include "../MuriCore/USB.h"
+#include "../MuriCore/PICData.h"
+#include "../MuriCore/HexLoader.h"
+#include "../MuriCore/Bootloader.h"
+#include "../MuriCore/ImageDiff.h"
+#include "../MuriCore/Programmer.h"
+#include "../MuriCore/ImageBundle.h"
+#include "../MuriCore/Log.h"
+#include "../version.h"
+
+// Seed of every generated dataset, changing it changes all reference data
+#define BENCH_SEED              0x4D555249
+// Granularity of the blank and programmed parts of a generated image
+#define BENCH_BLOCK_BYTES       256
+// Start and size of the PROGRAM_MEM region, see PICData()
+#define BENCH_FLASH_START       4096
+#define BENCH_FLASH_BYTES       60416
+// Bytes between mismatches in the scattered compare
+#define BENCH_MISMATCH_STRIDE   1021
+// Signature location used for the erase block rebuild
+#define BENCH_SIGNATURE_ADDRESS 0x1006
+#define BENCH_ERASE_PAGE_SIZE   1024
+// Record type of a data line, see HexLoader::hexRecord
+#define BENCH_DATA_RECORD       "00"
+// Default time each benchmark runs for
+#define BENCH_MIN_TIME_MS       500
+
+// One benchmark.  run() does one iteration and returns the items (packets,
+// extents...) it handled, bytes is what one iteration processes.
+struct Benchmark
+{
+    QString name;
+    qint64 (*run)(void* context);
+    void* context;
+    qint64 bytes;
+    quint16 dataset;            // qChecksum of the input, 0 for none
+};
+
+// Measurement of one benchmark
+struct Measurement
+{
+    qint64 iterations;
+    double nanoseconds;         // Per iteration
+    double items;               // Per iteration
+};
+
+/*
+ * Transport that accepts every packet and answers with zeros, so USB's
+ * packet planning can be timed without a device.  Uses reports of
+ * packetSize bytes and compressed payloads, as if negotiated with the
+ * firmware.
+ */
+class NullUSB : public USB
+{
+public:
+    NullUSB(unsigned int packetSize = USB_PACKET_SIZE, bool compressed = false) { packets = 0; packetBytes = packetSize; compress = compressed; }
+
+    ErrorCode open(QString path) { devicePath = path; connected = true; return Success; }
+    void close(void) { connected = false; }
+    ErrorCode SendPacket(unsigned char *data, int size, int msecs) { Q_UNUSED(data); Q_UNUSED(size); Q_UNUSED(msecs); packets++; return Success; }
+    ErrorCode ReceivePacket(unsigned char *data, int size) { memset(data, 0x00, size); return Success; }
+
+    qint64 packets;
+};
+
+struct HexContext
+{
+    QString fileName;
+    PICData* data;
+    Bootloader* device;
+};
+
+struct ProgramContext
+{
+    NullUSB* usb;
+    const unsigned char* image;
+};
+
+struct CompareContext
+{
+    ImageDiff diff;
+    const unsigned char* expected;
+    const unsigned char* actual;
+    uint32_t length;
+};
+
+struct BundleContext
+{
+    ImageBundle bundle;
+    PICData* data;
+    int next;
+};
+
+struct SignContext
+{
+    PICData* hexData;
+    USB::FirmwareInfo firmwareInfo;
+    unsigned char block[MAX_ERASE_BLOCK_SIZE];
+};
+
+static uint32_t Next(uint32_t* state)
+{
+    // xorshift32
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/*
+ * Fills image with a program of the given density: blocks of random code
+ * between erased gaps, like a linker leaves them
+ */
+static void GenerateImage(unsigned char* image, uint32_t length, int densityPercent, uint32_t seed)
+{
+    uint32_t state = seed;
+    uint32_t i, j;
+
+    memset(image, IMAGE_DIFF_BLANK, length);
+    for(i = 0; i < length; i += BENCH_BLOCK_BYTES)
+    {
+        if((int)(Next(&state) % 100) >= densityPercent)
+            continue;
+
+        for(j = i; (j < i + BENCH_BLOCK_BYTES) && (j < length); j++)
+            image[j] = (unsigned char)Next(&state);
+    }
+}
+
+/*
+ * Writes the programmed 16 byte lines of image as an Intel hex file
+ * starting at device address start
+ */
+static bool WriteHexFile(QString fileName, const unsigned char* image, uint32_t length, uint32_t start)
+{
+    QFile file(fileName);
+    uint32_t offset, address, i, count;
+    unsigned char checksum;
+
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return false;
+
+    QTextStream stream(&file);
+    stream << ":020000040000FA\n";
+    for(offset = 0; offset < length; offset += 16)
+    {
+        count = qMin((uint32_t)16, length - offset);
+        if(ImageDiff::Mismatch(IMAGE_DIFF_BLANK, image + offset, count) >= count)
+            continue;
+
+        address = start + offset;
+        checksum = (unsigned char)(count + ((address >> 8) & 0xFF) + (address & 0xFF));
+        stream << QString(":%1%2%3").arg(count, 2, 16, QChar('0')).arg(address & 0xFFFF, 4, 16, QChar('0')).arg(BENCH_DATA_RECORD).toUpper();
+        for(i = 0; i < count; i++)
+        {
+            stream << QString("%1").arg(image[offset + i], 2, 16, QChar('0')).toUpper();
+            checksum += image[offset + i];
+        }
+        stream << QString("%1\n").arg((unsigned char)(0x100 - checksum) & 0xFF, 2, 16, QChar('0')).toUpper();
+    }
+    stream << ":00000001FF\n";
+
+    return stream.status() == QTextStream::Ok;
+}
+
+static void FreeBuffers(PICData* data)
+{
+    PICData::MemoryRange range;
+
+    foreach(range, data->ranges)
+        delete[] range.pDataBuffer;
+    data->ranges.clear();
+}
+
+static qint64 RunHexImport(void* context)
+{
+    HexContext* hex = (HexContext*)context;
+    HexLoader import;
+
+    return (import.ImportHexFile(hex->fileName, hex->data, hex->device) == HexLoader::Success) ? 1 : 0;
+}
+
+static qint64 RunProgram(void* context)
+{
+    ProgramContext* program = (ProgramContext*)context;
+    qint64 before = program->usb->packets;
+
+    program->usb->Program(BENCH_FLASH_START, program->usb->payloadSize(), Bootloader::bytesPerAddressFLASH, Bootloader::bytesPerWordFLASH,
+                          BENCH_FLASH_START + BENCH_FLASH_BYTES, program->image);
+    return program->usb->packets - before;
+}
+
+static qint64 RunCompare(void* context)
+{
+    CompareContext* compare = (CompareContext*)context;
+
+    compare->diff.Clear();
+    compare->diff.Compare(PROGRAM_MEM, BENCH_FLASH_START, 1, compare->expected, compare->actual, compare->length);
+    return compare->diff.extentCount;
+}
+
+static qint64 RunBlankCheck(void* context)
+{
+    CompareContext* compare = (CompareContext*)context;
+
+    return (ImageDiff::Mismatch(IMAGE_DIFF_BLANK, compare->actual, compare->length) < compare->length) ? 1 : 0;
+}
+
+static qint64 RunSignBlock(void* context)
+{
+    SignContext* sign = (SignContext*)context;
+
+    Programmer::SignedEraseBlock(sign->hexData, sign->firmwareInfo, sign->block);
+    return 1;
+}
+
+/*
+ * Switches to the next image of a bundle, what picking a lesson costs
+ */
+static qint64 RunBundleSelect(void* context)
+{
+    BundleContext* bundle = (BundleContext*)context;
+
+    bundle->next = (bundle->next + 1) % bundle->bundle.count();
+    return (bundle->bundle.Select(bundle->next, bundle->data) == ImageBundle::Success) ? 1 : 0;
+}
+
+static qint64 RunPICDataAlloc(void* context)
+{
+    PICData* data;
+
+    Q_UNUSED(context);
+    data = new PICData();
+    FreeBuffers(data);
+    delete data;
+    return 1;
+}
+
+/*
+ * Back to erased, what loading a new file does to every buffer
+ */
+static qint64 RunPICDataReset(void* context)
+{
+    PICData* data = (PICData*)context;
+    PICData::MemoryRange range;
+
+    foreach(range, data->ranges)
+        memset(range.pDataBuffer, IMAGE_DIFF_BLANK, range.dataBufferLength);
+    return data->ranges.count();
+}
+
+/*
+ * Runs a benchmark for at least minTime milliseconds, doubling the
+ * iterations of each round until one round lasts that long
+ */
+static Measurement Measure(const Benchmark& benchmark, qint64 minTime)
+{
+    Measurement result;
+    QElapsedTimer timer;
+    qint64 iterations = 1, i, items, elapsed;
+
+    benchmark.run(benchmark.context);      // Warm up caches and lazy setup
+
+    forever
+    {
+        items = 0;
+        timer.start();
+        for(i = 0; i < iterations; i++)
+            items += benchmark.run(benchmark.context);
+        elapsed = timer.nsecsElapsed();
+
+        if((elapsed >= minTime * 1000000) || (iterations >= ((qint64)1 << 40)))
+            break;
+
+        // Aim a little past the minimum instead of doubling blindly
+        if(elapsed > 0)
+            iterations = qMax(iterations * 2, (qint64)(iterations * 1.4 * minTime * 1000000 / elapsed));
+        else
+            iterations *= 100;
+    }
+
+    result.iterations = iterations;
+    result.nanoseconds = (double)elapsed / iterations;
+    result.items = (double)items / iterations;
+    return result;
+}
+
+/*
+ * Median over the repetitions, by time per iteration
+ */
+static Measurement Median(QList<Measurement> runs)
+{
+    QVector<double> times;
+    Measurement run;
+
+    foreach(run, runs)
+        times.append(run.nanoseconds);
+    std::sort(times.begin(), times.end());
+
+    foreach(run, runs)
+    {
+        if(run.nanoseconds == times.at(times.count() / 2))
+            return run;
+    }
+    return runs.first();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setOrganizationName("Mid-Ohio Area Robotics");
+    QCoreApplication::setOrganizationDomain("moarobotics.com");
+    QCoreApplication::setApplicationName("muriprog-bench");
+    QCoreApplication::setApplicationVersion(VERSION);
+
+    QCommandLineParser parser;
+    QCommandLineOption filterOption("filter", "Only run the benchmarks whose name contains text.", "text");
+    QCommandLineOption minTimeOption("min-time", "Milliseconds each benchmark runs for at least.", "ms", QString::number(BENCH_MIN_TIME_MS));
+    QCommandLineOption repetitionsOption("repetitions", "Runs of each benchmark, the median is reported.", "count", "1");
+    QCommandLineOption jsonOption("json", "Print the results as JSON instead of a table.");
+    QCommandLineOption outOption("out", "Also write the JSON results to file.", "file");
+    QCommandLineOption listOption("list", "Only list the benchmarks.");
+
+    parser.setApplicationDescription("Times the parse, packetize, compare and sign hot paths on fixed generated\n"
+                                     "datasets, no Muribot needed.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addOption(filterOption);
+    parser.addOption(minTimeOption);
+    parser.addOption(repetitionsOption);
+    parser.addOption(jsonOption);
+    parser.addOption(outOption);
+    parser.addOption(listOption);
+    parser.process(a);
+
+    // Log statements cost what they cost with logging off, the default
+    Log::Init();
+    Log::SetLevel(Log::Off);
+
+    QTemporaryDir dir;
+    QList<Benchmark> benchmarks;
+    Benchmark benchmark;
+    int sizes[] = { 4096, 16384, BENCH_FLASH_BYTES };
+    int densities[] = { 25, 100 };
+    int programDensities[] = { 0, 25, 100 };
+    unsigned char* image;
+    unsigned char* flash[3];
+    unsigned char* scattered;
+    unsigned char* blank;
+    HexContext* fullImage = NULL;
+    int i, j, repetitions;
+    qint64 minTime;
+    uint32_t k;
+
+    if(!dir.isValid())
+    {
+        fprintf(stderr, "Could not create a temporary directory.\n");
+        return 2;
+    }
+
+    minTime = parser.value(minTimeOption).toLongLong();
+    repetitions = qMax(1, parser.value(repetitionsOption).toInt());
+
+    // Hex import of several sizes and densities, into the device layout
+    image = new unsigned char[BENCH_FLASH_BYTES];
+    for(i = 0; i < 3; i++)
+    {
+        for(j = 0; j < 2; j++)
+        {
+            HexContext* hex = new HexContext;
+
+            GenerateImage(image, sizes[i], densities[j], BENCH_SEED + i * 16 + j);
+            hex->fileName = dir.path() + QString("/image-%1-%2.hex").arg(sizes[i]).arg(densities[j]);
+            hex->data = new PICData();
+            hex->device = new Bootloader(hex->data);
+            if(!WriteHexFile(hex->fileName, image, sizes[i], BENCH_FLASH_START))
+            {
+                fprintf(stderr, "Could not write %s.\n", qPrintable(hex->fileName));
+                return 2;
+            }
+
+            QFile file(hex->fileName);
+            file.open(QIODevice::ReadOnly);
+            benchmark.name = QString("hex/import/%1/%2").arg(sizes[i]).arg(densities[j]);
+            benchmark.run = RunHexImport;
+            benchmark.context = hex;
+            benchmark.bytes = file.size();
+            benchmark.dataset = qChecksum(file.readAll().constData(), file.size());
+            benchmarks.append(benchmark);
+
+            if((sizes[i] == BENCH_FLASH_BYTES) && (densities[j] == 100))
+                fullImage = hex;
+        }
+    }
+
+    // Packet planning over the whole flash region
+    for(i = 0; i < 3; i++)
+    {
+        ProgramContext* program = new ProgramContext;
+
+        flash[i] = new unsigned char[BENCH_FLASH_BYTES];
+        GenerateImage(flash[i], BENCH_FLASH_BYTES, programDensities[i], BENCH_SEED + 0x100 + i);
+        program->usb = new NullUSB();
+        program->usb->open("null");
+        program->image = flash[i];
+
+        benchmark.name = QString("usb/program/%1").arg(programDensities[i]);
+        benchmark.run = RunProgram;
+        benchmark.context = program;
+        benchmark.bytes = BENCH_FLASH_BYTES;
+        benchmark.dataset = qChecksum((const char*)flash[i], BENCH_FLASH_BYTES);
+        benchmarks.append(benchmark);
+
+        // Same image in the largest reports a bootloader may offer
+        program = new ProgramContext;
+        program->usb = new NullUSB(USB_MAX_PACKET_SIZE);
+        program->usb->open("null");
+        program->image = flash[i];
+
+        benchmark.name = QString("usb/program/%1/%2").arg(programDensities[i]).arg(USB_MAX_PACKET_SIZE);
+        benchmark.context = program;
+        benchmarks.append(benchmark);
+
+        // Standard reports with compressed payloads
+        program = new ProgramContext;
+        program->usb = new NullUSB(USB_PACKET_SIZE, true);
+        program->usb->open("null");
+        program->image = flash[i];
+
+        benchmark.name = QString("usb/program/%1/compressed").arg(programDensities[i]);
+        benchmark.context = program;
+        benchmarks.append(benchmark);
+    }
+
+    // Verify compares: a matching image, one with scattered bad bytes and a
+    // blank check
+    scattered = new unsigned char[BENCH_FLASH_BYTES];
+    memcpy(scattered, flash[1], BENCH_FLASH_BYTES);
+    for(k = BENCH_MISMATCH_STRIDE / 2; k < BENCH_FLASH_BYTES; k += BENCH_MISMATCH_STRIDE)
+        scattered[k] ^= 0x5A;
+    blank = new unsigned char[BENCH_FLASH_BYTES];
+    memset(blank, IMAGE_DIFF_BLANK, BENCH_FLASH_BYTES);
+
+    {
+        CompareContext* identical = new CompareContext;
+        CompareContext* mismatched = new CompareContext;
+        CompareContext* erased = new CompareContext;
+
+        identical->expected = flash[1];
+        identical->actual = flash[1];
+        identical->length = BENCH_FLASH_BYTES;
+        mismatched->expected = flash[1];
+        mismatched->actual = scattered;
+        mismatched->length = BENCH_FLASH_BYTES;
+        erased->expected = NULL;
+        erased->actual = blank;
+        erased->length = BENCH_FLASH_BYTES;
+
+        benchmark.bytes = BENCH_FLASH_BYTES;
+        benchmark.name = "diff/compare/identical";
+        benchmark.run = RunCompare;
+        benchmark.context = identical;
+        benchmark.dataset = qChecksum((const char*)flash[1], BENCH_FLASH_BYTES);
+        benchmarks.append(benchmark);
+
+        benchmark.name = "diff/compare/scattered";
+        benchmark.context = mismatched;
+        benchmark.dataset = qChecksum((const char*)scattered, BENCH_FLASH_BYTES);
+        benchmarks.append(benchmark);
+
+        benchmark.name = "diff/blankcheck";
+        benchmark.run = RunBlankCheck;
+        benchmark.context = erased;
+        benchmark.dataset = 0;
+        benchmarks.append(benchmark);
+    }
+
+    // Erase block rebuilt after signing, from a full image
+    {
+        SignContext* sign = new SignContext;
+
+        sign->hexData = fullImage->data;
+        RunHexImport(fullImage);
+        memset((void*)&sign->firmwareInfo, 0x00, sizeof(sign->firmwareInfo));
+        sign->firmwareInfo.signatureAddress = BENCH_SIGNATURE_ADDRESS;
+        sign->firmwareInfo.erasePageSize = BENCH_ERASE_PAGE_SIZE;
+
+        benchmark.name = "sign/eraseblock";
+        benchmark.run = RunSignBlock;
+        benchmark.context = sign;
+        benchmark.bytes = BENCH_ERASE_PAGE_SIZE;
+        benchmark.dataset = qChecksum((const char*)fullImage->data->ranges.first().pDataBuffer, BENCH_FLASH_BYTES);
+        benchmarks.append(benchmark);
+    }
+
+    // Switching between the images of a bundle built from the hex files above
+    {
+        BundleContext* bundle = new BundleContext;
+        QStringList hexFiles, failed;
+        QString bundleName = dir.path() + "/course." BUNDLE_SUFFIX;
+
+        foreach(QString name, QDir(dir.path()).entryList(QStringList() << "*.hex", QDir::Files, QDir::Name))
+            hexFiles.append(dir.path() + "/" + name);
+        if((ImageBundle::Build(bundleName, hexFiles, &failed) != ImageBundle::Success) || (bundle->bundle.Open(bundleName) != ImageBundle::Success))
+        {
+            fprintf(stderr, "Could not build %s.\n", qPrintable(bundleName));
+            return 2;
+        }
+        bundle->data = new PICData();
+        bundle->next = 0;
+
+        QFile file(bundleName);
+        file.open(QIODevice::ReadOnly);
+        benchmark.name = "bundle/select";
+        benchmark.run = RunBundleSelect;
+        benchmark.context = bundle;
+        benchmark.bytes = BENCH_FLASH_BYTES;
+        benchmark.dataset = qChecksum(file.readAll().constData(), file.size());
+        benchmarks.append(benchmark);
+    }
+
+    // PICData setup
+    benchmark.name = "picdata/alloc";
+    benchmark.run = RunPICDataAlloc;
+    benchmark.context = NULL;
+    benchmark.bytes = 0;
+    benchmark.dataset = 0;
+    benchmarks.append(benchmark);
+
+    benchmark.name = "picdata/reset";
+    benchmark.run = RunPICDataReset;
+    benchmark.context = new PICData();
+    benchmarks.append(benchmark);
+
+    // Run them
+    QTextStream out(stdout);
+    QJsonArray results;
+    QJsonObject context, report;
+
+    if(!parser.isSet(jsonOption) && !parser.isSet(listOption))
+        out << QString("%1 %2 %3 %4 %5\n").arg("Benchmark", -28).arg("Time/iter", 14).arg("Iterations", 12).arg("Bytes/s", 12).arg("Items/iter", 11);
+
+    foreach(benchmark, benchmarks)
+    {
+        QList<Measurement> runs;
+        Measurement result;
+        double bytesPerSecond;
+
+        if(parser.isSet(filterOption) && !benchmark.name.contains(parser.value(filterOption)))
+            continue;
+        if(parser.isSet(listOption))
+        {
+            out << benchmark.name << "\n";
+            continue;
+        }
+
+        for(i = 0; i < repetitions; i++)
+            runs.append(Measure(benchmark, minTime));
+        result = Median(runs);
+        bytesPerSecond = (result.nanoseconds > 0) ? benchmark.bytes * 1e9 / result.nanoseconds : 0;
+
+        QJsonObject item;
+        item["name"] = benchmark.name;
+        item["iterations"] = (double)result.iterations;
+        item["repetitions"] = repetitions;
+        item["real_time"] = result.nanoseconds;
+        item["time_unit"] = QString("ns");
+        item["bytes_per_second"] = bytesPerSecond;
+        item["items_per_second"] = (result.nanoseconds > 0) ? result.items * 1e9 / result.nanoseconds : 0;
+        item["items_per_iteration"] = result.items;
+        item["dataset"] = QString("%1").arg(benchmark.dataset, 4, 16, QChar('0'));
+        results.append(item);
+
+        if(!parser.isSet(jsonOption))
+        {
+            out << QString("%1 %2 %3 %4 %5\n").arg(benchmark.name, -28)
+                                              .arg(QString::number(result.nanoseconds, 'f', 0) + " ns", 14)
+                                              .arg(result.iterations, 12)
+                                              .arg(QString::number(bytesPerSecond / (1024 * 1024), 'f', 1) + "M", 12)
+                                              .arg(QString::number(result.items, 'f', 1), 11);
+            out.flush();
+        }
+    }
+
+    if(parser.isSet(listOption))
+        return 0;
+
+    context["date"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    context["executable"] = QCoreApplication::applicationFilePath();
+    context["version"] = QString(VERSION);
+    context["qt_version"] = QString(qVersion());
+    context["num_cpus"] = QThread::idealThreadCount();
+#ifdef QT_NO_DEBUG
+    context["library_build_type"] = QString("release");
+#else
+    context["library_build_type"] = QString("debug");
+#endif
+    context["seed"] = QString::number(BENCH_SEED, 16);
+    context["min_time_ms"] = (double)minTime;
+    report["context"] = context;
+    report["benchmarks"] = results;
+
+    if(parser.isSet(jsonOption))
+        out << QJsonDocument(report).toJson();
+
+    if(parser.isSet(outOption))
+    {
+        QFile file(parser.value(outOption));
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || (file.write(QJsonDocument(report).toJson()) < 0))
+        {
+            fprintf(stderr, "Could not write %s.\n", qPrintable(parser.value(outOption)));
+            return 2;
+        }
+    }
+
+    return 0;
+}
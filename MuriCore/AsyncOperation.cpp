@@ -0,0 +1,1028 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "AsyncOperation.h"
+#include "Bootloader.h"
+#include "Programmer.h"
+#include "EraseHistory.h"
+#include "Trace.h"
+#include "Log.h"
+
+CancelToken::CancelToken() : flag(new QAtomicInt(0))
+{
+}
+
+void CancelToken::Cancel(void)
+{
+    flag->storeRelease(1);
+}
+
+bool CancelToken::isCancelled(void) const
+{
+    return flag->loadAcquire() != 0;
+}
+
+AsyncStep::AsyncStep(QString name, QString startMessage)
+{
+    stepName = name;
+    message = startMessage;
+}
+
+AsyncStep::~AsyncStep()
+{
+}
+
+QString AsyncStep::name(void) const
+{
+    return stepName;
+}
+
+/*
+ * Shown to the user when the step starts, empty for none
+ */
+QString AsyncStep::startMessage(void) const
+{
+    return message;
+}
+
+/*
+ * Milliseconds until Resume() has anything to do, 0 when it is ready
+ */
+int AsyncStep::WaitMs(void) const
+{
+    return 0;
+}
+
+/*
+ * Whether the step runs on a closed device, every other step fails with
+ * NotConnected once the device is gone
+ */
+bool AsyncStep::opensDevice(void) const
+{
+    return false;
+}
+
+ReplyWait::ReplyWait()
+{
+    nextPoll = 0;
+    waiting = false;
+}
+
+/*
+ * Call once the command has been sent
+ */
+void ReplyWait::Start(void)
+{
+    elapsed.start();
+    nextPoll = 0;
+    waiting = true;
+}
+
+/*
+ * Looks for the answer when a poll is due.  received is set once it has
+ * arrived, Timeout is returned when it has not within STEP_REPLY_TIMEOUT_MS.
+ */
+USB::ErrorCode ReplyWait::Poll(USB* comm, unsigned char* reply, int size, bool* received)
+{
+    USB::ErrorCode result;
+
+    *received = false;
+    if(WaitMs() > 0)
+        return USB::Success;
+
+    result = comm->TryReceivePacket(reply, size, received);
+    if(result != USB::Success)
+        return result;
+
+    if(*received)
+    {
+        waiting = false;
+        return USB::Success;
+    }
+
+    if(elapsed.elapsed() > STEP_REPLY_TIMEOUT_MS)
+    {
+        LOG_WARNING("No answer within %dms.", STEP_REPLY_TIMEOUT_MS);
+        waiting = false;
+        return USB::Timeout;
+    }
+
+    nextPoll = elapsed.elapsed() + STEP_REPLY_POLL_MS;
+    return USB::Success;
+}
+
+int ReplyWait::WaitMs(void) const
+{
+    if(!waiting)
+        return 0;
+
+    return (int)qMax(nextPoll - elapsed.elapsed(), (qint64)0);
+}
+
+PacketStep::PacketStep(QString name, unsigned char command, USB::ReadPacket* reply) : AsyncStep(name)
+{
+    this->command = command;
+    this->reply = reply;
+    sent = false;
+}
+
+/*
+ * Sends the command, then polls for the reply on later calls
+ */
+USB::ErrorCode PacketStep::Resume(USB* comm, bool* done)
+{
+    USB::WritePacket sendPacket;
+    USB::ErrorCode result;
+    bool received = false;
+
+    if(!sent)
+    {
+        memset((void*)&sendPacket, 0x00, sizeof(sendPacket));
+        sendPacket.command = command;
+
+        result = comm->SendWithRetry(&sendPacket);
+        sent = true;
+        *done = (reply == NULL) || (result != USB::Success);
+        if(!*done)
+        {
+            memset((void*)reply, 0x00, sizeof(USB::ReadPacket));
+            answer.Start();
+        }
+        return result;
+    }
+
+    result = answer.Poll(comm, (unsigned char*)reply, sizeof(USB::ReadPacket), &received);
+    *done = received || (result != USB::Success);
+    return result;
+}
+
+int PacketStep::WaitMs(void) const
+{
+    return answer.WaitMs();
+}
+
+FirmwareInfoStep::FirmwareInfoStep(USB::FirmwareInfo* firmwareInfo) : AsyncStep("Firmware Info")
+{
+    this->firmwareInfo = firmwareInfo;
+    sent = false;
+}
+
+/*
+ * Same as USB::ReadFirmwareInfo(), without blocking on the answer
+ */
+USB::ErrorCode FirmwareInfoStep::Resume(USB* comm, bool* done)
+{
+    USB::WritePacket sendPacket;
+    USB::ErrorCode result;
+    bool received = false;
+
+    *done = false;
+    if(!sent)
+    {
+        memset((void*)&sendPacket, 0x00, sizeof(sendPacket));
+        sendPacket.command = FIRMWARE_INFO;
+
+        memset((void*)firmwareInfo, 0x00, sizeof(USB::FirmwareInfo));
+        sent = true;
+        answer.Start();
+        return comm->SendWithRetry(&sendPacket);
+    }
+
+    result = answer.Poll(comm, (unsigned char*)firmwareInfo, sizeof(USB::FirmwareInfo), &received);
+    if((result != USB::Success) || !received)
+        return result;
+
+    *done = true;
+    return comm->FirmwareInfoAnswered(firmwareInfo);
+}
+
+int FirmwareInfoStep::WaitMs(void) const
+{
+    return answer.WaitMs();
+}
+
+OpenStep::OpenStep(QString path, USB::FirmwareInfo* firmwareInfo) : AsyncStep("Open"), info(firmwareInfo)
+{
+    this->path = path;
+    opened = false;
+}
+
+/*
+ * Same as Session::Open(), the firmware information is polled for like
+ * FirmwareInfoStep does
+ */
+USB::ErrorCode OpenStep::Resume(USB* comm, bool* done)
+{
+    USB::ErrorCode result;
+
+    *done = false;
+    if(!opened)
+    {
+        if(comm->isConnected())
+            comm->close();
+
+        result = path.isEmpty() ? comm->open() : comm->open(path);
+        if(result != USB::Success)
+            return result;
+
+        opened = true;
+        comm->EngageBootloader();
+        return USB::Success;
+    }
+
+    return info.Resume(comm, done);
+}
+
+int OpenStep::WaitMs(void) const
+{
+    return info.WaitMs();
+}
+
+bool OpenStep::opensDevice(void) const
+{
+    return true;
+}
+
+EraseStep::EraseStep() : AsyncStep("Erase", "Erasing memory... (no status update until complete, may take several seconds)")
+{
+    stage = 0;
+    limit = 0;
+    poll = 0;
+    nextPoll = 0;
+}
+
+/*
+ * Sends the erase command, then reads the firmware information since the
+ * erase itself does not answer.  The answer arrives once the erase is done,
+ * so the first poll waits for most of the usual erase time, then the
+ * interval grows until the erase takes longer than EraseHistory allows.
+ */
+USB::ErrorCode EraseStep::Resume(USB* comm, bool* done)
+{
+    USB::WritePacket sendPacket;
+    USB::ErrorCode result;
+    bool received = false;
+
+    *done = false;
+    if(WaitMs() > 0)
+        return USB::Success;
+
+    switch(stage)
+    {
+        case 0:
+            comm->progressCounter()->BeginPhase(ProgressCounter::Erase, 0);
+
+            memset((void*)&sendPacket, 0x00, sizeof(sendPacket));
+            sendPacket.command = ERASE_DEVICE;
+
+            elapsed.start();
+            limit = EraseHistory::Limit(comm->deviceType());
+            nextPoll = EraseHistory::Expected(comm->deviceType()) * ERASE_SLEEP_PERCENT / 100;
+            stage++;
+            return comm->SendWithRetry(&sendPacket);
+
+        case 1:
+            memset((void*)&sendPacket, 0x00, sizeof(sendPacket));
+            sendPacket.command = FIRMWARE_INFO;
+
+            memset((void*)&acknowledge, 0x00, sizeof(acknowledge));
+            poll = ERASE_POLL_MIN_MS;
+            stage++;
+            return comm->SendWithRetry(&sendPacket);
+
+        default:
+            result = comm->TryReceivePacket((unsigned char*)&acknowledge, sizeof(acknowledge), &received);
+            if(result != USB::Success)
+                return result;
+
+            if(received)
+            {
+                *done = true;
+                return comm->EraseAnswered(&acknowledge, (int)elapsed.elapsed());
+            }
+
+            if(elapsed.elapsed() > limit)
+            {
+                LOG_WARNING("Erase did not finish within %dms.", limit);
+                return USB::Timeout;
+            }
+
+            nextPoll = elapsed.elapsed() + poll;
+            poll = qMin(poll * 2, ERASE_POLL_MAX_MS);
+            return USB::Success;
+    }
+}
+
+int EraseStep::WaitMs(void) const
+{
+    if(stage == 0)
+        return 0;
+
+    return (int)qMax(nextPoll - elapsed.elapsed(), (qint64)0);
+}
+
+RegionStep::RegionStep(QString name, QString startMessage, ProgressCounter::Phase phase, const PICData* data, bool flash, bool eeprom) : AsyncStep(name, startMessage)
+{
+    PICData::MemoryRange range;
+
+    index = 0;
+    started = false;
+    this->phase = phase;
+    bytesTotal = 0;
+    memset((void*)&transfer, 0x00, sizeof(transfer));
+
+    foreach(range, data->ranges)
+    {
+        if((flash && (range.type == PROGRAM_MEM)) || (eeprom && (range.type == EEPROM_MEM)))
+        {
+            regions.append(range);
+            bytesTotal += (range.end - range.start) * BytesPerAddress(range);
+        }
+    }
+}
+
+unsigned char RegionStep::BytesPerAddress(const PICData::MemoryRange& range)
+{
+    if(range.type == EEPROM_MEM)
+        return Bootloader::bytesPerAddressEEPROM;
+
+    return Bootloader::bytesPerAddressFLASH;
+}
+
+unsigned char RegionStep::BytesPerWord(const PICData::MemoryRange& range)
+{
+    if(range.type == EEPROM_MEM)
+        return Bootloader::bytesPerWordEEPROM;
+
+    return Bootloader::bytesPerWordFLASH;
+}
+
+/*
+ * Programs or reads the next packet, moving on to the next region once the
+ * current one is done.
+ */
+USB::ErrorCode RegionStep::Advance(USB* comm, bool* done, bool program)
+{
+    USB::ErrorCode result;
+
+    *done = false;
+    if((index == 0) && !started)
+        comm->progressCounter()->BeginPhase(phase, bytesTotal);
+
+    if(index >= regions.count())
+    {
+        *done = true;
+        return USB::Success;
+    }
+
+    if(!started)
+    {
+        const PICData::MemoryRange& range = regions.at(index);
+
+        if(program)
+            result = comm->BeginProgram(&transfer, range.start, comm->payloadSize(), BytesPerAddress(range), BytesPerWord(range), range.end, range.pDataBuffer);
+        else
+            result = comm->BeginGetData(&transfer, range.start, comm->payloadSize(), BytesPerAddress(range), BytesPerWord(range), range.end, range.pDataBuffer);
+
+        if(result != USB::Success)
+            return result;
+        started = true;
+    }
+
+    result = program ? comm->ProgramPacket(&transfer) : comm->GetDataPacket(&transfer);
+    if(result != USB::Success)
+        return result;
+
+    if(transfer.done())
+    {
+        index++;
+        started = false;
+    }
+
+    *done = (index >= regions.count());
+    return USB::Success;
+}
+
+ProgramStep::ProgramStep(ImageSnapshot hexData, bool flash, bool eeprom) : RegionStep("Write", "Writing memory...", ProgressCounter::Program, hexData.data(), flash, eeprom)
+{
+    image = hexData;
+}
+
+USB::ErrorCode ProgramStep::Resume(USB* comm, bool* done)
+{
+    return Advance(comm, done, true);
+}
+
+ReadStep::ReadStep(PICData* deviceData, bool flash, bool eeprom) : RegionStep("Read", "Reading memory...", ProgressCounter::Verify, deviceData, flash, eeprom)
+{
+}
+
+ReadStep::ReadStep(QString name, QString startMessage, PICData* deviceData, bool flash, bool eeprom) : RegionStep(name, startMessage, ProgressCounter::Verify, deviceData, flash, eeprom)
+{
+}
+
+USB::ErrorCode ReadStep::Resume(USB* comm, bool* done)
+{
+    return Advance(comm, done, false);
+}
+
+/*
+ * Only reads back the parts of the device plan picks
+ */
+VerifyStep::VerifyStep(PICData* deviceData, ImageSnapshot hexData, bool flash, bool eeprom, const VerifyPlan& plan) : ReadStep("Verify", "Verifying memory...", deviceData, flash, eeprom)
+{
+    PICData::MemoryRange range;
+
+    this->deviceData = deviceData;
+    this->hexData = hexData;
+    this->plan = plan;
+
+    selectedBytes = bytesTotal;
+    regions = plan.Ranges(deviceData, hexData.data(), flash, eeprom);
+    bytesTotal = 0;
+    foreach(range, regions)
+        bytesTotal += range.dataBufferLength;
+}
+
+USB::ErrorCode VerifyStep::Resume(USB* comm, bool* done)
+{
+    USB::ErrorCode result;
+
+    result = ReadStep::Resume(comm, done);
+    if((result == USB::Success) && *done && !Matches())
+        return USB::Fail;
+
+    return result;
+}
+
+const ImageDiff& VerifyStep::mismatches(void) const
+{
+    return diff;
+}
+
+/*
+ * Compares every region read back against the image region starting at the
+ * same address, and logs all the extents that differ
+ */
+bool VerifyStep::Matches(void)
+{
+    PICData::MemoryRange range;
+
+    diff.Clear();
+    foreach(range, regions)
+        diff.CompareRange(hexData.data(), range);
+    diff.skippedBytes = selectedBytes - diff.comparedBytes;
+    LOG_DEBUG("Verify policy %s: %u bytes compared, %u skipped", qPrintable(plan.name()), diff.comparedBytes, diff.skippedBytes);
+
+    foreach(QString line, diff.Describe())
+        LOG_WARNING("Failed to verify %s", qPrintable(line));
+
+    return diff.isEmpty();
+}
+
+WriteVerifyStep::WriteVerifyStep(PICData* deviceData, ImageSnapshot hexData, bool flash, bool eeprom, uint32_t erasePageSize,
+                                 const VerifyPlan& plan, ProgressJournal* journal) : RegionStep("WriteVerify", "Writing and verifying memory...", ProgressCounter::Program, hexData.data(), flash, eeprom)
+{
+    PICData::MemoryRange hexRange, deviceRange, readRange;
+    int i;
+
+    image = hexData;
+    this->erasePageSize = erasePageSize;
+    this->plan = plan;
+    this->journal = journal;
+    plannedBytes = 0;
+    for(i = 0; i < regions.count(); i++)
+    {
+        hexRange = regions.at(i);
+
+        // Without a device region there is nothing to read back into, same
+        // as a verify of an image region the device does not have
+        readRange = hexRange;
+        readRange.pDataBuffer = NULL;
+        foreach(deviceRange, deviceData->ranges)
+        {
+            if(deviceRange.start == hexRange.start)
+                readRange = deviceRange;
+        }
+        deviceRanges.append(readRange);
+
+        if(readRange.pDataBuffer != NULL)
+        {
+            foreach(readRange, plan.Ranges(hexRange, readRange, hexRange.start, hexRange.end))
+                plannedBytes += readRange.dataBufferLength;
+        }
+    }
+
+    phaseStarted = false;
+    reading = false;
+    writeAddress = regions.isEmpty() ? 0 : regions.first().start;
+    pendingStart = 0;
+    pendingEnd = 0;
+    readStart = 0;
+    readEnd = 0;
+    memset((void*)&readTransfer, 0x00, sizeof(readTransfer));
+}
+
+/*
+ * One packet of the pipeline: W0 W1 R0 W2 R1 ... Wn Rn-1 Rn for every
+ * region, where W is a span programmed and R the parts of the same span
+ * the plan reads back
+ */
+USB::ErrorCode WriteVerifyStep::Resume(USB* comm, bool* done)
+{
+    USB::ErrorCode result;
+
+    *done = false;
+    if(!phaseStarted)
+    {
+        comm->progressCounter()->BeginPhase(phase, bytesTotal + plannedBytes);
+        diff.Clear();
+        phaseStarted = true;
+    }
+
+    if(index >= regions.count())
+    {
+        *done = true;
+        return USB::Success;
+    }
+
+    if(reading)
+    {
+        result = comm->GetDataPacket(&readTransfer);
+        if((result != USB::Success) || !readTransfer.done())
+            return result;
+
+        reading = false;
+        if(!ReadMatches())
+            return USB::Fail;
+        if(!readQueue.isEmpty())
+            return NextRead(comm);
+        SpanVerified();
+    }
+    else if(started)
+    {
+        result = comm->ProgramPacket(&transfer);
+        if((result != USB::Success) || !transfer.done())
+            return result;
+
+        started = false;
+        return SpanWritten(comm, transfer.start, transfer.endAddress);
+    }
+
+    if(writeAddress < regions.at(index).end)
+        return BeginSpan(comm);
+
+    if(pendingEnd > pendingStart)
+    {
+        result = BeginReadBack(comm);
+        pendingStart = pendingEnd = 0;
+        return result;
+    }
+
+    // Region done, move on to the next one
+    index++;
+    if(index < regions.count())
+        writeAddress = regions.at(index).start;
+
+    *done = (index >= regions.count());
+    if(*done)
+        LOG_DEBUG("Verify policy %s: %u bytes compared, %u skipped", qPrintable(plan.name()), diff.comparedBytes, diff.skippedBytes);
+    return USB::Success;
+}
+
+/*
+ * Every mismatch found, only covers the spans read back when the step failed
+ */
+BlankCheckStep::BlankCheckStep(PICData* deviceData, bool flash, bool eeprom) : ReadStep("BlankCheck", "Blank checking memory...", deviceData, flash, eeprom)
+{
+    this->deviceData = deviceData;
+    this->flash = flash;
+    this->eeprom = eeprom;
+}
+
+/*
+ * Same as Programmer::BlankCheckDevice(), every extent that is not erased
+ * ends up in mismatches()
+ */
+USB::ErrorCode BlankCheckStep::Resume(USB* comm, bool* done)
+{
+    USB::ErrorCode result;
+
+    result = ReadStep::Resume(comm, done);
+    if((result != USB::Success) || !*done)
+        return result;
+
+    diff.Clear();
+    diff.BlankCheck(deviceData, flash, eeprom);
+    foreach(QString line, diff.Describe())
+        LOG_WARNING("Not blank: %s", qPrintable(line));
+
+    return diff.isEmpty() ? USB::Success : USB::Fail;
+}
+
+const ImageDiff& BlankCheckStep::mismatches(void) const
+{
+    return diff;
+}
+
+const ImageDiff& WriteVerifyStep::mismatches(void) const
+{
+    return diff;
+}
+
+/*
+ * Starts programming the next span of the current region and sends its
+ * first packet
+ */
+USB::ErrorCode WriteVerifyStep::BeginSpan(USB* comm)
+{
+    const PICData::MemoryRange& range = regions.at(index);
+    uint32_t spanStart, spanEnd, spanBytes;
+    USB::ErrorCode result;
+
+    // Spans are read back in units of the plan, which are standard packets
+    // whatever size of packet the write uses
+    spanBytes = PIPELINE_SPAN_PACKETS * comm->payloadSize();
+    spanBytes -= spanBytes % Bootloader::bytesPerPacket;
+    spanEnd = writeAddress + spanBytes / BytesPerAddress(range);
+
+    // Flash spans end on an erase page boundary.  PROGRAM_COMPLETE makes the
+    // firmware write out the row it is holding padded with blank words, so a
+    // span ending inside a page would leave the next span programming the
+    // rest of that row a second time without an erase, and a resumed write
+    // would find a page the journal holds only half of.
+    if((range.type == PROGRAM_MEM) && (erasePageSize != 0) && (spanEnd < range.end))
+    {
+        spanEnd -= spanEnd % erasePageSize;
+        if(spanEnd <= writeAddress)
+            spanEnd += erasePageSize;
+    }
+    if(spanEnd > range.end)
+        spanEnd = range.end;
+
+    // Written before the write was cut short, only needs reading back
+    if((journal != NULL) && journal->Contains(range.type, writeAddress, spanEnd))
+    {
+        LOG_FLIGHT("Journaled", writeAddress, spanEnd);
+        spanStart = writeAddress;
+        writeAddress = spanEnd;
+        return SpanWritten(comm, spanStart, spanEnd);
+    }
+
+    result = comm->BeginProgram(&transfer, writeAddress, comm->payloadSize(), BytesPerAddress(range), BytesPerWord(range), spanEnd,
+                                range.pDataBuffer + (writeAddress - range.start) * BytesPerAddress(range));
+    if(result != USB::Success)
+        return result;
+
+    writeAddress = spanEnd;
+    started = true;
+    return comm->ProgramPacket(&transfer);
+}
+
+/*
+ * A span is flushed (or was already on the device), read back the one
+ * before it while the firmware writes this one
+ */
+USB::ErrorCode WriteVerifyStep::SpanWritten(USB* comm, uint32_t start, uint32_t end)
+{
+    USB::ErrorCode result = USB::Success;
+
+    if(pendingEnd > pendingStart)
+        result = BeginReadBack(comm);
+
+    pendingStart = start;
+    pendingEnd = end;
+    return result;
+}
+
+/*
+ * Queues the parts of the pending span the plan reads back and starts on
+ * the first one
+ */
+USB::ErrorCode WriteVerifyStep::BeginReadBack(USB* comm)
+{
+    const PICData::MemoryRange& deviceRange = deviceRanges.at(index);
+    PICData::MemoryRange range;
+    uint32_t planned = 0;
+
+    readStart = pendingStart;
+    readEnd = pendingEnd;
+    if(deviceRange.pDataBuffer == NULL)
+    {
+        SpanVerified();
+        return USB::Success;
+    }
+
+    readQueue = plan.Ranges(regions.at(index), deviceRange, pendingStart, pendingEnd);
+    foreach(range, readQueue)
+        planned += range.dataBufferLength;
+    diff.skippedBytes += (pendingEnd - pendingStart) * BytesPerAddress(deviceRange) - planned;
+
+    if(readQueue.isEmpty())
+    {
+        SpanVerified();
+        return USB::Success;
+    }
+
+    return NextRead(comm);
+}
+
+/*
+ * The span being read back matched (or had nothing to read), so a write
+ * cut short after this point does not need to program it again
+ */
+void WriteVerifyStep::SpanVerified(void)
+{
+    if((journal != NULL) && (readEnd > readStart))
+        journal->Record(regions.at(index).type, readStart, readEnd);
+}
+
+/*
+ * Starts reading the next queued range and reads its first packet
+ */
+USB::ErrorCode WriteVerifyStep::NextRead(USB* comm)
+{
+    USB::ErrorCode result;
+
+    currentRead = readQueue.takeFirst();
+    result = comm->BeginGetData(&readTransfer, currentRead.start, comm->payloadSize(), BytesPerAddress(currentRead), BytesPerWord(currentRead),
+                                currentRead.end, currentRead.pDataBuffer);
+    if(result != USB::Success)
+        return result;
+
+    reading = true;
+    return comm->GetDataPacket(&readTransfer);
+}
+
+/*
+ * Compares the range just read back against the image and logs what differs
+ */
+bool WriteVerifyStep::ReadMatches(void)
+{
+    const PICData::MemoryRange& range = regions.at(index);
+    uint32_t offset = (currentRead.start - range.start) * BytesPerAddress(range);
+
+    diff.Compare(range.type, currentRead.start, BytesPerAddress(range), range.pDataBuffer + offset, currentRead.pDataBuffer,
+                 currentRead.dataBufferLength);
+
+    foreach(QString line, diff.Describe())
+        LOG_WARNING("Failed to verify %s", qPrintable(line));
+
+    return diff.isEmpty();
+}
+
+SignStep::SignStep(ImageSnapshot hexData, const USB::FirmwareInfo& firmwareInfo) : AsyncStep("Sign")
+{
+    this->hexData = hexData;
+    this->firmwareInfo = firmwareInfo;
+    stage = 0;
+    startOfEraseBlock = 0;
+    memset((void*)&transfer, 0x00, sizeof(transfer));
+}
+
+/*
+ * Same as Programmer::SignDevice(): sends SIGN_FLASH, polls for the
+ * acknowledge, then reads the first erase page back a packet at a time and
+ * compares it against the image with the signature in place.  A mismatch
+ * runs an erase the same way EraseStep does before failing.
+ */
+USB::ErrorCode SignStep::Resume(USB* comm, bool* done)
+{
+    USB::WritePacket sendPacket;
+    USB::ErrorCode result;
+    bool received = false;
+    unsigned int i;
+
+    *done = false;
+    if(WaitMs() > 0)
+        return USB::Success;
+
+    switch(stage)
+    {
+        case 0:
+            if((firmwareInfo.erasePageSize == 0) || (firmwareInfo.erasePageSize > MAX_ERASE_BLOCK_SIZE))
+            {
+                LOG_WARNING("Unexpected erase page size %u.", firmwareInfo.erasePageSize);
+                return USB::Fail;
+            }
+
+            memset((void*)&sendPacket, 0x00, sizeof(sendPacket));
+            sendPacket.command = SIGN_FLASH;
+            stage++;
+            return comm->SendWithRetry(&sendPacket);
+
+        case 1:
+            memset((void*)&sendPacket, 0x00, sizeof(sendPacket));
+            sendPacket.command = FIRMWARE_INFO;
+
+            memset((void*)&acknowledge, 0x00, sizeof(acknowledge));
+            answer.Start();
+            stage++;
+            return comm->SendWithRetry(&sendPacket);
+
+        case 2:
+            result = answer.Poll(comm, (unsigned char*)&acknowledge, sizeof(acknowledge), &received);
+            if((result != USB::Success) || !received)
+                return result;
+
+            result = comm->FirmwareInfoAnswered(&acknowledge);
+            if(result != USB::Success)
+                return result;
+
+            startOfEraseBlock = Programmer::SignedEraseBlock(hexData.data(), firmwareInfo, expected);
+            comm->progressCounter()->BeginPhase(ProgressCounter::Verify, firmwareInfo.erasePageSize);
+            stage++;
+            return comm->BeginGetData(&transfer, startOfEraseBlock, comm->payloadSize(), Bootloader::bytesPerAddressFLASH, Bootloader::bytesPerWordFLASH,
+                                      startOfEraseBlock + firmwareInfo.erasePageSize, flashData);
+
+        case 3:
+            result = comm->GetDataPacket(&transfer);
+            if((result != USB::Success) || !transfer.done())
+                return result;
+            break;
+
+        default:
+            // Erase to remove the signature, which might be valid, so the
+            // device always stays in the bootloader
+            result = unsign.Resume(comm, done);
+            if(*done && (result == USB::Success))
+                result = USB::Fail;
+            return result;
+    }
+
+    i = ImageDiff::Mismatch(expected, flashData, firmwareInfo.erasePageSize);
+    if(i < firmwareInfo.erasePageSize)
+    {
+        LOG_WARNING("Post signing verify failure at address: 0x%x", startOfEraseBlock + i);
+        stage++;
+        return USB::Success;
+    }
+
+    *done = true;
+    return USB::Success;
+}
+
+int SignStep::WaitMs(void) const
+{
+    if(stage == 2)
+        return answer.WaitMs();
+    if(stage > 3)
+        return unsign.WaitMs();
+
+    return 0;
+}
+
+/*
+ * comm is not owned, it must stay open until Finished
+ */
+AsyncOperation::AsyncOperation(USB* comm, QObject* parent) : QObject(parent)
+{
+    this->comm = comm;
+    current = 0;
+    stepStarted = false;
+    deadline = 0;
+
+    connect(this, SIGNAL(Finished(QString,USB::ErrorCode)), this, SLOT(deleteLater()));
+}
+
+AsyncOperation::~AsyncOperation()
+{
+    qDeleteAll(steps);
+}
+
+/*
+ * Appends a step to the chain and takes ownership of it
+ */
+AsyncOperation* AsyncOperation::Then(AsyncStep* step)
+{
+    steps.append(step);
+    return this;
+}
+
+/*
+ * Fails the operation with a timeout when it has not finished msecs after
+ * it started running
+ */
+void AsyncOperation::setDeadline(int msecs)
+{
+    deadline = msecs;
+}
+
+CancelToken AsyncOperation::token(void) const
+{
+    return cancel;
+}
+
+/*
+ * Runs the next packet of the current step.  Called by the executor, returns
+ * true once the operation has finished.
+ */
+bool AsyncOperation::Resume(void)
+{
+    AsyncStep* step;
+    USB::ErrorCode result;
+    bool done = false;
+
+    if(!runTimer.isValid())
+        runTimer.start();
+
+    if(current >= steps.count())
+        return Complete(NULL, USB::Success);
+
+    step = steps.at(current);
+
+    if(cancel.isCancelled())
+        return Complete(step, USB::Cancelled);
+
+    if((deadline > 0) && (runTimer.elapsed() > deadline))
+    {
+        LOG_WARNING("%s passed its deadline of %dms.", qPrintable(step->name()), deadline);
+        return Complete(step, USB::Timeout);
+    }
+
+    if(!stepStarted)
+    {
+        stepStarted = true;
+        stepTimer.start();
+        if(!step->startMessage().isEmpty())
+            emit StepStarted(step->startMessage());
+    }
+
+    {
+        TRACE_SCOPE_ADDRESS(trace, "Resume", current);
+
+        if(comm->isConnected() || step->opensDevice())
+            result = step->Resume(comm, &done);
+        else
+            result = USB::NotConnected;
+    }
+
+    if(result != USB::Success)
+        return Complete(step, result);
+
+    if(done)
+    {
+        emit StepCompleted(step->name(), USB::Success, ((double)stepTimer.elapsed()) / 1000);
+        stepStarted = false;
+        current++;
+    }
+
+    if(current >= steps.count())
+    {
+        comm->progressCounter()->Finish();
+        return Complete(step, USB::Success);
+    }
+
+    return false;
+}
+
+/*
+ * Milliseconds until the current step has anything to do, 0 when it is
+ * ready or the operation is about to end
+ */
+int AsyncOperation::WaitMs(void) const
+{
+    int wait;
+
+    if((current >= steps.count()) || cancel.isCancelled())
+        return 0;
+
+    wait = steps.at(current)->WaitMs();
+    if((deadline > 0) && runTimer.isValid())
+        wait = qMin(wait, (int)qMax(deadline - runTimer.elapsed(), (qint64)0));
+
+    return wait;
+}
+
+/*
+ * Ends the operation, reporting the step that was running when it failed
+ */
+bool AsyncOperation::Complete(AsyncStep* step, USB::ErrorCode result)
+{
+    QString name;
+
+    if(step != NULL)
+        name = step->name();
+
+    if((result != USB::Success) && stepStarted)
+        emit StepCompleted(name, result, ((double)stepTimer.elapsed()) / 1000);
+    if((result != USB::Success) && (result != USB::Cancelled))
+        Log::DumpFlight(qPrintable(name));
+
+    emit Finished(name, result);
+    return true;
+}
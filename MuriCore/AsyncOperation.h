@@ -0,0 +1,375 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASYNCOPERATION_H
+#define ASYNCOPERATION_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QList>
+#include <QSharedPointer>
+#include "USB.h"
+#include "PICData.h"
+#include "ImageDiff.h"
+#include "VerifyPlan.h"
+#include "ProgressJournal.h"
+
+// Packets programmed before the firmware is told to flush and the span is
+// read back by WriteVerifyStep.  Keeps spans aligned to whole packets.
+#define PIPELINE_SPAN_PACKETS 16
+
+// Wait for the answer to a command before the step times out.  Longer than
+// PACKET_REPLY_TIMEOUT_MS, FIRMWARE_INFO after SIGN_FLASH is only answered
+// once the signature is written.
+#define STEP_REPLY_TIMEOUT_MS 5000
+// Interval between polls for an answer, other operations run meanwhile
+#define STEP_REPLY_POLL_MS 1
+
+/*!
+ * Lets any thread cancel an operation running on the I/O executor.  Copies
+ * share the same flag, cancellation is seen before the next packet.
+ */
+class CancelToken
+{
+public:
+    CancelToken();
+
+    void Cancel(void);
+    bool isCancelled(void) const;
+
+private:
+    QSharedPointer<QAtomicInt> flag;
+};
+
+/*!
+ * Waits for the answer to a command across Resume() calls.  Poll() looks
+ * for it without blocking, WaitMs() tells the step's WaitMs() how long
+ * until the next look.
+ */
+class ReplyWait
+{
+public:
+    ReplyWait();
+
+    void Start(void);
+    USB::ErrorCode Poll(USB* comm, unsigned char* reply, int size, bool* received);
+    int WaitMs(void) const;
+
+protected:
+    QElapsedTimer elapsed;
+    qint64 nextPoll;            // Milliseconds after Start() of the next look
+    bool waiting;
+};
+
+/*!
+ * One awaitable step of an operation.  Resume() does at most one packet
+ * transaction and sets done once the step is over, so the executor can
+ * interleave the steps of many devices on a single thread.  A step waiting
+ * on the device reports how long through WaitMs(), the executor sleeps
+ * when every operation is waiting.
+ */
+class AsyncStep
+{
+public:
+    AsyncStep(QString name, QString startMessage = QString());
+    virtual ~AsyncStep();
+
+    QString name(void) const;
+    QString startMessage(void) const;
+
+    virtual USB::ErrorCode Resume(USB* comm, bool* done) = 0;
+    virtual int WaitMs(void) const;
+    virtual bool opensDevice(void) const;
+
+protected:
+    QString stepName;
+    QString message;
+};
+
+// Sends one command packet, and receives its answer when reply is given
+class PacketStep : public AsyncStep
+{
+public:
+    PacketStep(QString name, unsigned char command, USB::ReadPacket* reply = 0);
+
+    USB::ErrorCode Resume(USB* comm, bool* done);
+    int WaitMs(void) const;
+
+protected:
+    unsigned char command;
+    USB::ReadPacket* reply;
+    bool sent;
+    ReplyWait answer;
+};
+
+// Reads the firmware information, also how the device acknowledges erase and sign
+class FirmwareInfoStep : public AsyncStep
+{
+public:
+    FirmwareInfoStep(USB::FirmwareInfo* firmwareInfo);
+
+    USB::ErrorCode Resume(USB* comm, bool* done);
+    int WaitMs(void) const;
+
+protected:
+    USB::FirmwareInfo* firmwareInfo;
+    bool sent;
+    ReplyWait answer;
+};
+
+// Opens a bootloader (the first one found when path is empty), switches it
+// into bootloader mode and reads its firmware information
+class OpenStep : public AsyncStep
+{
+public:
+    OpenStep(QString path, USB::FirmwareInfo* firmwareInfo);
+
+    USB::ErrorCode Resume(USB* comm, bool* done);
+    int WaitMs(void) const;
+    bool opensDevice(void) const;
+
+protected:
+    QString path;
+    bool opened;
+    FirmwareInfoStep info;
+};
+
+// Erases the device and waits for it to answer again, sleeping through
+// most of the erase time learned by EraseHistory
+class EraseStep : public AsyncStep
+{
+public:
+    EraseStep();
+
+    USB::ErrorCode Resume(USB* comm, bool* done);
+    int WaitMs(void) const;
+
+protected:
+    int stage;
+    USB::FirmwareInfo acknowledge;
+    QElapsedTimer elapsed;
+    int limit;                  // Milliseconds before the erase counts as hung
+    int poll;                   // Current polling interval
+    qint64 nextPoll;            // Milliseconds into the erase of the next poll
+};
+
+// Transfers the selected regions of an image, a packet per Resume()
+class RegionStep : public AsyncStep
+{
+public:
+    RegionStep(QString name, QString startMessage, ProgressCounter::Phase phase, const PICData* data, bool flash, bool eeprom);
+
+protected:
+	// Members
+    QList<PICData::MemoryRange> regions;
+    int index;
+    bool started;
+    USB::Transfer transfer;
+    ProgressCounter::Phase phase;
+    uint32_t bytesTotal;
+
+	// Methods
+    static unsigned char BytesPerAddress(const PICData::MemoryRange& range);
+    static unsigned char BytesPerWord(const PICData::MemoryRange& range);
+    USB::ErrorCode Advance(USB* comm, bool* done, bool program);
+};
+
+// Programs an erased device with an image
+class ProgramStep : public RegionStep
+{
+public:
+    ProgramStep(ImageSnapshot hexData, bool flash, bool eeprom);
+
+    USB::ErrorCode Resume(USB* comm, bool* done);
+
+protected:
+    ImageSnapshot image;        // Owns the buffers of regions
+};
+
+// Reads the device into deviceData, which must have the device layout
+class ReadStep : public RegionStep
+{
+public:
+    ReadStep(PICData* deviceData, bool flash, bool eeprom);
+
+    USB::ErrorCode Resume(USB* comm, bool* done);
+
+protected:
+    ReadStep(QString name, QString startMessage, PICData* deviceData, bool flash, bool eeprom);
+};
+
+// Reads the parts of the device the plan picks into deviceData and compares
+// them against the image
+class VerifyStep : public ReadStep
+{
+public:
+    VerifyStep(PICData* deviceData, ImageSnapshot hexData, bool flash, bool eeprom, const VerifyPlan& plan = VerifyPlan());
+
+    USB::ErrorCode Resume(USB* comm, bool* done);
+    const ImageDiff& mismatches(void) const;
+
+protected:
+    PICData* deviceData;
+    ImageSnapshot hexData;
+    VerifyPlan plan;
+    uint32_t selectedBytes;
+    ImageDiff diff;
+
+    bool Matches(void);
+};
+
+// Reads the selected regions into deviceData and checks they are erased
+class BlankCheckStep : public ReadStep
+{
+public:
+    BlankCheckStep(PICData* deviceData, bool flash, bool eeprom);
+
+    USB::ErrorCode Resume(USB* comm, bool* done);
+    const ImageDiff& mismatches(void) const;
+
+protected:
+    PICData* deviceData;
+    bool flash;
+    bool eeprom;
+    ImageDiff diff;
+};
+
+/*!
+ * Programs an erased device and verifies it in the same pass.  The image
+ * goes out in spans of about PIPELINE_SPAN_PACKETS packets, ending on an erase
+ * page boundary in flash, each one ended with PROGRAM_COMPLETE so the
+ * firmware flushes it.  Every span is read back
+ * into deviceData and compared right after the next span has been sent,
+ * while the firmware writes that one, and the step fails at the first span
+ * that does not match.  The plan picks which parts of each span are read.
+ *
+ * Spans that verified are recorded in the journal, if there is one.  Spans
+ * the journal already holds are not programmed again, only read back, which
+ * lets a write cut short carry on without an erase.
+ */
+class WriteVerifyStep : public RegionStep
+{
+public:
+    WriteVerifyStep(PICData* deviceData, ImageSnapshot hexData, bool flash, bool eeprom, uint32_t erasePageSize,
+                    const VerifyPlan& plan = VerifyPlan(), ProgressJournal* journal = NULL);
+
+    USB::ErrorCode Resume(USB* comm, bool* done);
+    const ImageDiff& mismatches(void) const;
+
+protected:
+	// Members
+    ImageSnapshot image;                        // Owns the buffers of regions
+    uint32_t erasePageSize;                     // Flash spans end on a multiple of it, in addresses
+    VerifyPlan plan;
+    QList<PICData::MemoryRange> deviceRanges;   // Device region of each region, no buffer when the device has none
+    QList<PICData::MemoryRange> readQueue;      // Parts of the span being read back still to go
+    PICData::MemoryRange currentRead;
+    USB::Transfer readTransfer;
+    uint32_t plannedBytes;
+    bool phaseStarted;
+    bool reading;
+    uint32_t writeAddress;              // Start of the next span to program
+    uint32_t pendingStart;              // Span programmed but not read back yet
+    uint32_t pendingEnd;
+    uint32_t readStart;                 // Span being read back
+    uint32_t readEnd;
+    ImageDiff diff;
+    ProgressJournal* journal;
+
+	// Methods
+    USB::ErrorCode BeginSpan(USB* comm);
+    USB::ErrorCode SpanWritten(USB* comm, uint32_t start, uint32_t end);
+    void SpanVerified(void);
+    USB::ErrorCode BeginReadBack(USB* comm);
+    USB::ErrorCode NextRead(USB* comm);
+    bool ReadMatches(void);
+};
+
+// Signs a verified image and checks the signed erase page, erasing the
+// device again when it does not match
+class SignStep : public AsyncStep
+{
+public:
+    SignStep(ImageSnapshot hexData, const USB::FirmwareInfo& firmwareInfo);
+
+    USB::ErrorCode Resume(USB* comm, bool* done);
+    int WaitMs(void) const;
+
+protected:
+    ImageSnapshot hexData;
+    USB::FirmwareInfo firmwareInfo;     // Copied, the session may publish a new one meanwhile
+    int stage;
+    USB::FirmwareInfo acknowledge;
+    ReplyWait answer;
+    EraseStep unsign;           // Run after a failed check
+    USB::Transfer transfer;
+    uint32_t startOfEraseBlock;
+    unsigned char flashData[MAX_ERASE_BLOCK_SIZE];
+    unsigned char expected[MAX_ERASE_BLOCK_SIZE];
+};
+
+/*!
+ * A chain of steps run against one device by an IoExecutor or the
+ * device's DeviceSession, the asynchronous counterpart of the Programmer
+ * calls:
+ *
+ *   operation->Then(new EraseStep())->Then(new ProgramStep(...));
+ *   executor->Post(operation);
+ *
+ * The first failing step ends the chain.  The operation deletes itself
+ * once Finished has been delivered, keep token() to cancel it.  Signals
+ * are emitted from the executor thread, progress is published in the
+ * ProgressCounter of comm.
+ */
+class AsyncOperation : public QObject
+{
+    Q_OBJECT
+
+public:
+	// Constructor/Destructor
+    explicit AsyncOperation(USB* comm, QObject* parent = 0);
+    ~AsyncOperation();
+
+	// Methods
+    AsyncOperation* Then(AsyncStep* step);
+    void setDeadline(int msecs);
+    CancelToken token(void) const;
+    bool Resume(void);
+    int WaitMs(void) const;
+
+signals:
+    void StepStarted(QString msg);
+    void StepCompleted(QString name, USB::ErrorCode result, double time);
+    void Finished(QString step, USB::ErrorCode result);   // step is the one that failed, or the last
+
+protected:
+	// Members
+    USB* comm;
+    QList<AsyncStep*> steps;
+    int current;
+    bool stepStarted;
+    int deadline;               // Milliseconds from the first Resume(), 0 for none
+    CancelToken cancel;
+    QElapsedTimer runTimer;
+    QElapsedTimer stepTimer;
+
+	// Methods
+    bool Complete(AsyncStep* step, USB::ErrorCode result);
+};
+
+#endif // ASYNCOPERATION_H
@@ -0,0 +1,485 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "AsyncSession.h"
+#include "FirmwareCache.h"
+#include "Log.h"
+
+/*
+ * The session takes ownership of comm, executor is shared and must outlive
+ * it
+ */
+AsyncSession::AsyncSession(IoExecutor* executor, USB* comm, QObject* parent) : QObject(parent)
+{
+    this->executor = executor;
+    this->comm = comm;
+    deviceData = new PICData();
+    hexData = new PICData();
+    loaded = false;
+    wasResumed = false;
+    call = NoCall;
+    retryBase = 0;
+    resyncBase = 0;
+    savedBase = 0;
+    verifyStep = NULL;
+    writeVerifyStep = NULL;
+    blankCheckStep = NULL;
+    running = false;
+    writeFlash = true;
+    writeEeprom = false;
+    pipelined = true;
+    resume = false;
+    memset((void*)&info, 0x00, sizeof(info));
+}
+
+/*
+ * Cancels the running call and waits for the executor to let go of it
+ */
+AsyncSession::~AsyncSession()
+{
+    cancel.Cancel();
+
+    mutex.lock();
+    while(running)
+        idle.wait(&mutex);
+    mutex.unlock();
+
+    Close();
+    delete deviceData;
+    delete hexData;
+    delete comm;
+}
+
+/*
+ * Same as Session::Open()
+ */
+void AsyncSession::Open(QString path)
+{
+    AsyncOperation* operation;
+
+    if(!Begin(OpenCall, false, false))
+        return;
+
+    operation = new AsyncOperation(comm);
+    operation->Then(new OpenStep(path, &info));
+    Run(operation);
+}
+
+/*
+ * Closes the device, only between calls
+ */
+void AsyncSession::Close(void)
+{
+    if(comm->isConnected())
+        comm->close();
+}
+
+/*
+ * Same as Session::LoadImage(), answered right away since it does not talk
+ * to the device
+ */
+SessionResult AsyncSession::LoadImage(const PICData* image)
+{
+    SessionResult result;
+    SessionPhase phase;
+    QElapsedTimer elapsed;
+    PICData::MemoryRange from;
+    int i;
+
+    elapsed.start();
+    loaded = true;
+    for(i = 0; i < hexData->ranges.count(); i++)
+    {
+        PICData::MemoryRange& to = hexData->ranges[i];
+        bool found = false;
+
+        foreach(from, image->ranges)
+        {
+            if((from.type == to.type) && (from.start == to.start) && (from.dataBufferLength == to.dataBufferLength))
+            {
+                memcpy(to.pDataBuffer, from.pDataBuffer, to.dataBufferLength);
+                found = true;
+                break;
+            }
+        }
+        loaded = loaded && found;
+    }
+
+    phase.name = "load";
+    phase.result = loaded ? USB::Success : USB::Fail;
+    phase.seconds = ((double)elapsed.nsecsElapsed()) / 1000000000;
+    result.result = phase.result;
+    result.seconds = phase.seconds;
+    result.phases.append(phase);
+    if(!loaded)
+        result.message = "image built for another device";
+    result.retries = 0;
+    result.resyncs = 0;
+    result.reportsSaved = 0;
+
+    return result;
+}
+
+void AsyncSession::Erase(void)
+{
+    if(!Begin(EraseCall, true, false))
+        return;
+
+    Run((new AsyncOperation(comm))->Then(new EraseStep()));
+}
+
+/*
+ * Compares the device against the image.  Does not change the device.
+ */
+void AsyncSession::Verify(void)
+{
+    VerifyStep* step;
+
+    if(!Begin(VerifyCall, true, true))
+        return;
+
+    step = new VerifyStep(deviceData, PICData::Borrow(hexData), writeFlash, writeEeprom, verifyPlan);
+    verifyStep = step;
+    Run((new AsyncOperation(comm))->Then(step));
+}
+
+void AsyncSession::BlankCheck(void)
+{
+    BlankCheckStep* step;
+
+    if(!Begin(BlankCheckCall, true, false))
+        return;
+
+    step = new BlankCheckStep(deviceData, writeFlash, writeEeprom);
+    blankCheckStep = step;
+    Run((new AsyncOperation(comm))->Then(step));
+}
+
+/*
+ * Same as Session::Write(): erase, program, verify and sign, or carry on
+ * from the journal with resume set
+ */
+void AsyncSession::Write(void)
+{
+    AsyncOperation* operation;
+    WriteVerifyStep* step;
+    bool journaled;
+
+    if(!Begin(WriteCall, true, true))
+        return;
+
+    operation = new AsyncOperation(comm);
+    journaled = journal.Open(comm->serialNumber(), ProgressJournal::ImageHash(hexData, writeFlash, writeEeprom));
+    if(resume && pipelined && journaled)
+    {
+        LOG_INFO("Resuming the interrupted write, %d spans were already written.", journal.spans());
+        call = ResumeCall;
+        step = new WriteVerifyStep(deviceData, PICData::Borrow(hexData), writeFlash, writeEeprom, info.erasePageSize, verifyPlan, &journal);
+        writeVerifyStep = step;
+        operation->Then(step)->Then(new SignStep(PICData::Borrow(hexData), info));
+    }
+    else
+        StartWrite(operation);
+
+    Run(operation);
+}
+
+/*
+ * Reads the device into deviceData, which must have the device layout and
+ * stay until Finished()
+ */
+void AsyncSession::ReadBack(PICData* deviceData)
+{
+    if(!Begin(ReadCall, true, false))
+        return;
+
+    Run((new AsyncOperation(comm))->Then(new ReadStep(deviceData, writeFlash, writeEeprom)));
+}
+
+/*
+ * Leaves the bootloader and starts the application, the session is closed
+ * afterwards
+ */
+void AsyncSession::Reset(void)
+{
+    if(!Begin(ResetCall, true, false))
+        return;
+
+    Run((new AsyncOperation(comm))->Then(new PacketStep("Reset", RESET_DEVICE)));
+}
+
+bool AsyncSession::isOpen(void) const
+{
+    return comm->isConnected();
+}
+
+bool AsyncSession::isBusy(void) const
+{
+    return call != NoCall;
+}
+
+QString AsyncSession::devicePath(void) const
+{
+    return comm->path();
+}
+
+QString AsyncSession::serialNumber(void) const
+{
+    return comm->serialNumber();
+}
+
+/*
+ * Read by the last Open(), valid between calls
+ */
+USB::FirmwareInfo AsyncSession::firmwareInfo(void) const
+{
+    return info;
+}
+
+const ProgressCounter* AsyncSession::progress(void) const
+{
+    return comm->progressCounter();
+}
+
+/*
+ * Every mismatch found by the last Write(), Verify() or BlankCheck()
+ */
+const ImageDiff& AsyncSession::diff(void) const
+{
+    return mismatches;
+}
+
+bool AsyncSession::resumed(void) const
+{
+    return wasResumed;
+}
+
+/*
+ * Executor thread, while the call runs nothing else touches current
+ */
+void AsyncSession::StepCompleted(QString name, USB::ErrorCode result, double seconds)
+{
+    SessionPhase phase;
+
+    phase.name = name.toLower();
+    phase.result = result;
+    phase.seconds = seconds;
+    current.phases.append(phase);
+}
+
+/*
+ * Executor thread, right before the operation lets go of its steps.  Keeps
+ * what Complete() needs from them and hands over to the session thread.
+ */
+void AsyncSession::OperationFinished(QString step, USB::ErrorCode result)
+{
+    Q_UNUSED(step);
+
+    if(writeVerifyStep != NULL)
+        mismatches = writeVerifyStep->mismatches();
+    else if(verifyStep != NULL)
+        mismatches = verifyStep->mismatches();
+    else if(blankCheckStep != NULL)
+        mismatches = blankCheckStep->mismatches();
+    verifyStep = NULL;
+    writeVerifyStep = NULL;
+    blankCheckStep = NULL;
+
+    // Keep what verified even when the robot was just unplugged
+    if((call == WriteCall) || (call == ResumeCall))
+        journal.Flush();
+
+    current.result = result;
+    QMetaObject::invokeMethod(this, "Complete", Qt::QueuedConnection);
+
+    mutex.lock();
+    running = false;
+    idle.wakeAll();
+    mutex.unlock();
+}
+
+/*
+ * Session thread, finishes the call the way Session::Finish() does
+ */
+void AsyncSession::Complete(void)
+{
+    USB::ErrorCode error = current.result;
+    SessionResult result;
+    AsyncOperation* operation;
+
+    // A call that never ran already has its message
+    switch(current.message.isEmpty() ? call : NoCall)
+    {
+        case OpenCall:
+            if(error == USB::NotConnected)
+                current.message = "no bootloader found";
+            else if(error != USB::Success)
+            {
+                Close();
+                current.message = "bootloader did not answer";
+            }
+            else
+                FirmwareCache::Store(comm->serialNumber(), &info);
+            break;
+
+        case VerifyCall:
+            if(error == USB::Fail)
+                current.message = "device does not match the image";
+            break;
+
+        case BlankCheckCall:
+            if(error == USB::Fail)
+                current.message = "device is not blank";
+            break;
+
+        case ResumeCall:
+            if((error == USB::Fail) && !mismatches.isEmpty())
+            {
+                LOG_INFO("The device changed since the write was interrupted, writing it again.");
+                mismatches.Clear();
+                call = WriteCall;
+                operation = new AsyncOperation(comm);
+                StartWrite(operation);
+                Run(operation);
+                return;
+            }
+            wasResumed = (error == USB::Success);
+            // Fall through
+        case WriteCall:
+            if(error == USB::Success)
+                journal.Remove();
+            break;
+
+        case ResetCall:
+            Close();
+            break;
+
+        default:
+            break;
+    }
+
+    current.seconds = ((double)callTimer.nsecsElapsed()) / 1000000000;
+    current.retries = progress()->retries() - retryBase;
+    current.resyncs = progress()->resyncs() - resyncBase;
+    current.reportsSaved = progress()->savedReports() - savedBase;
+    result = current;
+    call = NoCall;
+
+    emit Finished(result);
+}
+
+/*
+ * Starts collecting a call, or finishes it right away when the session is
+ * not ready for it.  Returns whether the call should go on.
+ */
+bool AsyncSession::Begin(Call call, bool needsDevice, bool needsImage)
+{
+    if(this->call != NoCall)
+    {
+        LOG_WARNING("Another call is still running.");
+        return false;
+    }
+
+    this->call = call;
+    cancel = CancelToken();
+    current = SessionResult();
+    current.result = USB::Success;
+    current.seconds = 0;
+    current.retries = 0;
+    current.resyncs = 0;
+    current.reportsSaved = 0;
+    callTimer.start();
+    retryBase = progress()->retries();
+    resyncBase = progress()->resyncs();
+    savedBase = progress()->savedReports();
+    if((call == WriteCall) || (call == VerifyCall) || (call == BlankCheckCall))
+        mismatches.Clear();
+    if(call == WriteCall)
+        wasResumed = false;
+
+    if(needsDevice && !comm->isConnected())
+    {
+        Fail(USB::NotConnected, "no device open");
+        return false;
+    }
+    if(needsImage && !loaded)
+    {
+        Fail(USB::Fail, "no image loaded");
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Posts the operation of the call.  Its steps report from the executor
+ * thread, directly, so their results are taken before the operation is
+ * gone.
+ */
+void AsyncSession::Run(AsyncOperation* operation)
+{
+    connect(operation, SIGNAL(StepCompleted(QString,USB::ErrorCode,double)), this, SLOT(StepCompleted(QString,USB::ErrorCode,double)),
+            Qt::DirectConnection);
+    connect(operation, SIGNAL(Finished(QString,USB::ErrorCode)), this, SLOT(OperationFinished(QString,USB::ErrorCode)),
+            Qt::DirectConnection);
+
+    mutex.lock();
+    running = true;
+    cancel = operation->token();
+    mutex.unlock();
+
+    executor->Post(operation);
+}
+
+/*
+ * Ends the call without posting anything
+ */
+void AsyncSession::Fail(USB::ErrorCode error, QString message)
+{
+    current.result = error;
+    current.message = message;
+    QMetaObject::invokeMethod(this, "Complete", Qt::QueuedConnection);
+}
+
+/*
+ * Fills operation with a write from scratch, dropping any journal left
+ */
+void AsyncSession::StartWrite(AsyncOperation* operation)
+{
+    WriteVerifyStep* step;
+    VerifyStep* verify;
+    ImageSnapshot image = PICData::Borrow(hexData);
+    bool journaled;
+
+    journaled = pipelined && journal.Start();
+
+    operation->Then(new EraseStep());
+    if(pipelined)
+    {
+        step = new WriteVerifyStep(deviceData, image, writeFlash, writeEeprom, info.erasePageSize, verifyPlan, journaled ? &journal : NULL);
+        writeVerifyStep = step;
+        operation->Then(step);
+    }
+    else
+    {
+        verify = new VerifyStep(deviceData, image, writeFlash, writeEeprom, verifyPlan);
+        verifyStep = verify;
+        operation->Then(new ProgramStep(image, writeFlash, writeEeprom))->Then(verify);
+    }
+    operation->Then(new SignStep(image, info));
+}
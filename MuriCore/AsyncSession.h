@@ -0,0 +1,129 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ASYNCSESSION_H
+#define ASYNCSESSION_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QWaitCondition>
+#include "Session.h"
+#include "IoExecutor.h"
+#include "ProgressJournal.h"
+
+/*!
+ * The calls of Session, run as operations on a shared IoExecutor.
+ *
+ * Each call returns right away, Finished() then brings the SessionResult
+ * the same Session call would have returned, on the thread the session
+ * belongs to.  Only one call runs at a time.  Every AsyncSession posting to
+ * the same executor is driven by its single I/O thread, a packet per device
+ * in turn, so a gang or a daemon does not need a thread per device.
+ */
+class AsyncSession : public QObject
+{
+    Q_OBJECT
+
+public:
+	// Constructor/Destructor
+    AsyncSession(IoExecutor* executor, USB* comm, QObject* parent = 0);
+    ~AsyncSession();
+
+	// Members
+    bool writeFlash;            // Same as in Session
+    bool writeEeprom;
+    bool pipelined;
+    bool resume;
+    VerifyPlan verifyPlan;
+
+	// Methods
+    void Open(QString path = QString());
+    void Close(void);
+    SessionResult LoadImage(const PICData* image);
+    void Erase(void);
+    void Verify(void);
+    void BlankCheck(void);
+    void Write(void);
+    void ReadBack(PICData* deviceData);
+    void Reset(void);
+
+    bool isOpen(void) const;
+    bool isBusy(void) const;
+    QString devicePath(void) const;
+    QString serialNumber(void) const;
+    USB::FirmwareInfo firmwareInfo(void) const;
+    const ProgressCounter* progress(void) const;
+    const ImageDiff& diff(void) const;
+    bool resumed(void) const;
+
+signals:
+    void Finished(const SessionResult& result);
+
+private slots:
+    void StepCompleted(QString name, USB::ErrorCode result, double seconds);
+    void OperationFinished(QString step, USB::ErrorCode result);
+    void Complete(void);
+
+protected:
+	// The call in progress
+	enum Call
+	{
+		NoCall = 0,
+		OpenCall,
+		EraseCall,
+		VerifyCall,
+		BlankCheckCall,
+		WriteCall,
+		ResumeCall,         // Write() carrying on from the journal, starts over when the device changed
+		ReadCall,
+		ResetCall
+	};
+
+	// Members
+    IoExecutor* executor;
+    USB* comm;
+    PICData* deviceData;        // Device layout, receives what verify and blank check read
+    PICData* hexData;           // Image in the device layout, see LoadImage()
+    bool loaded;
+    USB::FirmwareInfo info;
+    ProgressJournal journal;
+    ImageDiff mismatches;
+    bool wasResumed;
+    Call call;
+    SessionResult current;
+    QElapsedTimer callTimer;
+    int retryBase;
+    int resyncBase;
+    int savedBase;
+    const VerifyStep* verifyStep;               // Steps of the running operation whose mismatches are kept
+    const WriteVerifyStep* writeVerifyStep;
+    const BlankCheckStep* blankCheckStep;
+    CancelToken cancel;                         // Of the running operation
+    QMutex mutex;
+    QWaitCondition idle;
+    bool running;                               // An operation is posted and not finished
+
+	// Methods
+    bool Begin(Call call, bool needsDevice, bool needsImage);
+    void Run(AsyncOperation* operation);
+    void Fail(USB::ErrorCode error, QString message);
+    void StartWrite(AsyncOperation* operation);
+};
+
+#endif // ASYNCSESSION_H
@@ -33,7 +33,7 @@ public:
     Bootloader(PICData* data);
 	
 	// Members	
-    static const unsigned int bytesPerPacket = 58;
+    static const unsigned int bytesPerPacket = 58;     // Payload of a standard 64 byte report, USB::payloadSize() is the one in use
     static const unsigned int bytesPerWordFLASH = 2;
     static const unsigned int bytesPerWordEEPROM = 1;
     static const unsigned int bytesPerAddressFLASH = 1;
@@ -0,0 +1,54 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DAEMONPROTOCOL_H
+#define DAEMONPROTOCOL_H
+
+/*
+ * muriprogd listens on a local socket (a Unix domain socket, a named pipe on
+ * Windows).  Both directions carry one compact JSON object per line.
+ *
+ * A client submits jobs, any number of them on one connection:
+ *   {"command": "write", "file": "/abs/path.hex", "image": "", "device": "",
+ *    "eeprom": false, "verify": "full", "sample": 5, "seed": 1234,
+ *    "twoPass": false, "resume": false}
+ * command is one of list, load, erase, write, verify, blankcheck, readback
+ * and reset, the rest is optional and means the same as the muriprog-cli
+ * option of that name.  Paths must be absolute, the daemon has its own
+ * working directory.  A client sending a line longer than DAEMON_MAX_LINE
+ * is disconnected.
+ *
+ * For every job the daemon answers with events tagged with its job number:
+ *   {"event": "queued", "job": 3, "device": "...", "position": 1}
+ *   {"event": "started", "job": 3, "device": "..."}
+ *   {"event": "progress", "job": 3, "percent": 40}
+ *   {"event": "result", "job": 3, ...}
+ * The result carries the same fields muriprog-cli prints for the command.
+ */
+
+// Name the daemon listens on unless DAEMON_NAME_ENV gives another one
+#define DAEMON_NAME "muriprogd"
+#define DAEMON_NAME_ENV "MURIPROG_DAEMON"
+// Milliseconds between the progress events of a running job
+#define DAEMON_PROGRESS_MS 250
+// Milliseconds a client waits for the daemon to accept the connection
+#define DAEMON_CONNECT_TIMEOUT_MS 2000
+// Longest request line the daemon buffers, in bytes with the newline
+#define DAEMON_MAX_LINE 65536
+
+#endif // DAEMONPROTOCOL_H
@@ -0,0 +1,325 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QStringList>
+#include <QTimer>
+
+#include "DeviceMonitor.h"
+#include "Trace.h"
+#include "Log.h"
+
+// Used only where the operating system has no device notifications
+#define DEVICE_POLL_INTERVAL_MS 1000
+
+#if defined(Q_OS_LINUX)
+#include <QSocketNotifier>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <unistd.h>
+#include <string.h>
+
+// Multicast group udevd re-broadcasts kernel events on, once its rules
+// (and so the device node permissions) have been applied
+#define UDEV_MONITOR_GROUP 2
+#define UEVENT_BUFFER_SIZE 8192
+
+/*
+ * Listens for hidraw add/remove events on the udev netlink socket.
+ */
+class UdevEventSource : public DeviceEventSource
+{
+public:
+    UdevEventSource(int fd, QObject* parent) : DeviceEventSource(parent)
+    {
+        this->fd = fd;
+        notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+        connect(notifier, SIGNAL(activated(int)), this, SLOT(ReadEvents()));
+    }
+
+    ~UdevEventSource()
+    {
+        delete notifier;
+        ::close(fd);
+    }
+
+    static UdevEventSource* Create(QObject* parent)
+    {
+        struct sockaddr_nl address;
+        int fd;
+
+        fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+        if(fd < 0)
+            return NULL;
+
+        memset(&address, 0x00, sizeof(address));
+        address.nl_family = AF_NETLINK;
+        address.nl_groups = UDEV_MONITOR_GROUP;
+        if(bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0)
+        {
+            ::close(fd);
+            return NULL;
+        }
+
+        return new UdevEventSource(fd, parent);
+    }
+
+protected:
+    int fd;
+    QSocketNotifier* notifier;
+
+    /*
+     * Drains the socket and reports a change if any of the events was for a
+     * hidraw node.  Events for other subsystems are ignored.
+     */
+    void ReadEvents(void)
+    {
+        char buffer[UEVENT_BUFFER_SIZE];
+        const char* property;
+        const char* end;
+        unsigned int offset;
+        ssize_t length;
+        bool changed = false;
+
+        while((length = recv(fd, buffer, sizeof(buffer) - 1, MSG_DONTWAIT)) > 0)
+        {
+            buffer[length] = '\0';
+            property = buffer;
+            end = buffer + length;
+
+            //udevd puts a binary header in front of the properties, its
+            //properties_off field says where they start
+            if((length >= 24) && (memcmp(buffer, "libudev", 8) == 0))
+            {
+                memcpy(&offset, buffer + 16, sizeof(offset));
+                if(offset >= (unsigned int)length)
+                    continue;
+                property = buffer + offset;
+            }
+
+            //NUL separated KEY=value pairs
+            for(; property < end; property += strlen(property) + 1)
+            {
+                if(strcmp(property, "SUBSYSTEM=hidraw") == 0)
+                    changed = true;
+            }
+        }
+
+        if(changed)
+            emit Changed();
+    }
+};
+
+#elif defined(Q_OS_WIN)
+#include <QAbstractNativeEventFilter>
+#include <QCoreApplication>
+#include <windows.h>
+#include <dbt.h>
+
+/*
+ * Windows broadcasts DBT_DEVNODES_CHANGED to every top level window whenever
+ * a device is added or removed, no registration needed.
+ */
+class WinEventSource : public DeviceEventSource, public QAbstractNativeEventFilter
+{
+public:
+    explicit WinEventSource(QObject* parent) : DeviceEventSource(parent)
+    {
+        QCoreApplication::instance()->installNativeEventFilter(this);
+    }
+
+    ~WinEventSource()
+    {
+        QCoreApplication::instance()->removeNativeEventFilter(this);
+    }
+
+    bool nativeEventFilter(const QByteArray& eventType, void* message, long* result)
+    {
+        MSG* msg = (MSG*)message;
+
+        Q_UNUSED(result);
+        if((eventType == "windows_generic_MSG") && (msg->message == WM_DEVICECHANGE) && (msg->wParam == DBT_DEVNODES_CHANGED))
+            emit Changed();
+
+        return false;
+    }
+};
+#endif
+
+/*
+ * Fallback for platforms without device notifications, enumerates on a timer
+ */
+class PollingEventSource : public DeviceEventSource
+{
+public:
+    explicit PollingEventSource(QObject* parent) : DeviceEventSource(parent)
+    {
+        timer = new QTimer(this);
+        connect(timer, SIGNAL(timeout()), this, SLOT(ReadEvents()));
+        timer->start(DEVICE_POLL_INTERVAL_MS);
+    }
+
+protected:
+    QTimer* timer;
+
+    void ReadEvents(void)
+    {
+        emit Changed();
+    }
+};
+
+DeviceEventSource::DeviceEventSource(QObject* parent) : QObject(parent)
+{
+}
+
+DeviceEventSource::~DeviceEventSource()
+{
+}
+
+QList<USB::DeviceInfo> DeviceEventSource::Enumerate(void)
+{
+    return USB::Enumerate();
+}
+
+void DeviceEventSource::ReadEvents(void)
+{
+}
+
+DeviceEventSource* DeviceEventSource::Create(QObject* parent)
+{
+    DeviceEventSource* source = NULL;
+
+#if defined(Q_OS_LINUX)
+    source = UdevEventSource::Create(parent);
+    if(source == NULL)
+        LOG_WARNING("Unable to listen for udev events, polling for devices instead.");
+#elif defined(Q_OS_WIN)
+    source = new WinEventSource(parent);
+#endif
+
+    if(source == NULL)
+        source = new PollingEventSource(parent);
+
+    return source;
+}
+
+EmulatedEventSource::EmulatedEventSource(QObject* parent) : DeviceEventSource(parent)
+{
+}
+
+void EmulatedEventSource::Attach(QString path)
+{
+    USB::DeviceInfo info;
+
+    info.path = path;
+    info.serialNumber = path;
+    attached.append(info);
+
+    emit Changed();
+}
+
+void EmulatedEventSource::Detach(QString path)
+{
+    int i;
+
+    for(i = attached.count() - 1; i >= 0; i--)
+    {
+        if(attached[i].path == path)
+            attached.removeAt(i);
+    }
+
+    emit Changed();
+}
+
+QList<USB::DeviceInfo> EmulatedEventSource::Enumerate(void)
+{
+    return attached;
+}
+
+/*
+ * Takes ownership of source.  Without one, the platform default is used.
+ * Nothing is enumerated until Scan() is called.
+ */
+DeviceMonitor::DeviceMonitor(DeviceEventSource* source, QObject* parent) : QObject(parent)
+{
+    if(source == NULL)
+        source = DeviceEventSource::Create();
+
+    this->source = source;
+    source->setParent(this);
+    scanPending = false;
+
+    connect(source, SIGNAL(Changed()), this, SLOT(SourceChanged()));
+}
+
+DeviceMonitor::~DeviceMonitor()
+{
+}
+
+/*
+ * Enumerates the attached devices and reports the differences with the
+ * previous enumeration.
+ */
+void DeviceMonitor::Scan(void)
+{
+    QList<USB::DeviceInfo> current;
+    QStringList before, after;
+    USB::DeviceInfo info;
+    QString path;
+    TRACE_SCOPE("DeviceScan");
+
+    current = source->Enumerate();
+    foreach(info, known)
+        before.append(info.path);
+    foreach(info, current)
+        after.append(info.path);
+    known = current;
+
+    foreach(path, before)
+    {
+        if(!after.contains(path))
+            emit Detached(path);
+    }
+    foreach(path, after)
+    {
+        if(!before.contains(path))
+            emit Attached(path);
+    }
+}
+
+QList<USB::DeviceInfo> DeviceMonitor::devices(void) const
+{
+    return known;
+}
+
+/*
+ * A single plug in usually produces a burst of events (one per interface or
+ * device node), they are folded into one enumeration.
+ */
+void DeviceMonitor::SourceChanged(void)
+{
+    if(scanPending)
+        return;
+
+    scanPending = true;
+    QTimer::singleShot(0, this, SLOT(PendingScan()));
+}
+
+void DeviceMonitor::PendingScan(void)
+{
+    scanPending = false;
+    Scan();
+}
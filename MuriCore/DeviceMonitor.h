@@ -0,0 +1,109 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEVICEMONITOR_H
+#define DEVICEMONITOR_H
+
+#include <QObject>
+#include <QList>
+#include <QString>
+#include "USB.h"
+
+/*!
+ * Tells the DeviceMonitor when the set of attached devices may have changed.
+ *
+ * The default source listens to the operating system (udev on Linux,
+ * WM_DEVICECHANGE on Windows) and falls back to polling where neither is
+ * available.  Other sources can be injected into the monitor, see
+ * EmulatedEventSource.
+ */
+class DeviceEventSource : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DeviceEventSource(QObject* parent = 0);
+    virtual ~DeviceEventSource();
+
+    // Lists the devices currently attached, by default the bootloaders on the USB bus
+    virtual QList<USB::DeviceInfo> Enumerate(void);
+
+    // Creates the best source available on this platform
+    static DeviceEventSource* Create(QObject* parent = 0);
+
+signals:
+    // Something was attached or detached, the monitor should enumerate again
+    void Changed(void);
+
+protected slots:
+    // Called when the underlying notification handle has data to read
+    virtual void ReadEvents(void);
+};
+
+/*!
+ * Event source for tests and emulation.  Devices come and go only when
+ * Attach() and Detach() are called.
+ */
+class EmulatedEventSource : public DeviceEventSource
+{
+public:
+    explicit EmulatedEventSource(QObject* parent = 0);
+
+    void Attach(QString path);
+    void Detach(QString path);
+    QList<USB::DeviceInfo> Enumerate(void);
+
+protected:
+    QList<USB::DeviceInfo> attached;
+};
+
+/*!
+ * Keeps the list of attached bootloaders up to date.
+ *
+ * Devices are only enumerated by Scan() and when the event source reports a
+ * change, never on a timer.  Attached() and Detached() are emitted for every
+ * path that appeared or disappeared since the previous enumeration.
+ */
+class DeviceMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+	// Constructor/Destructor
+    explicit DeviceMonitor(DeviceEventSource* source = 0, QObject* parent = 0);
+    ~DeviceMonitor();
+
+	// Methods
+    void Scan(void);
+    QList<USB::DeviceInfo> devices(void) const;
+
+signals:
+    void Attached(QString path);
+    void Detached(QString path);
+
+private slots:
+    void SourceChanged(void);
+    void PendingScan(void);
+
+protected:
+	// Members
+    DeviceEventSource* source;
+    QList<USB::DeviceInfo> known;
+    bool scanPending;
+};
+
+#endif // DEVICEMONITOR_H
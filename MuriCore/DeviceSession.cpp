@@ -0,0 +1,484 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QElapsedTimer>
+
+#include "DeviceSession.h"
+#include "FirmwareCache.h"
+#include "RealtimeIo.h"
+#include "Trace.h"
+#include "Log.h"
+
+/*
+ * The session takes ownership of comm, without one it talks to real
+ * hardware.  The thread starts with the first command.
+ */
+DeviceSession::DeviceSession(USB* comm, QObject* parent) : QThread(parent)
+{
+    USB::FirmwareInfo none;
+
+    if(comm == NULL)
+        comm = new USB();
+
+    this->comm = comm;
+    memset((void*)&none, 0x00, sizeof(none));
+    info = QSharedPointer<const USB::FirmwareInfo>(new USB::FirmwareInfo(none));
+    currentState.store(Disconnected);
+    stopping = false;
+}
+
+/*
+ * Cancels whatever is still running, closes the device and waits for the
+ * thread to finish
+ */
+DeviceSession::~DeviceSession()
+{
+    Cancel();
+
+    mutex.lock();
+    stopping = true;
+    wake.wakeOne();
+    mutex.unlock();
+
+    wait();
+
+    if(comm->isConnected())
+        comm->close();
+    delete comm;
+}
+
+/*
+ * Opens the bootloader at path, switches it into bootloader mode and reads
+ * its firmware information.  CommandFinished("Open") tells how it went,
+ * for a Muribot in the FirmwareCache that is before the information has
+ * been read again, CommandFinished("Refresh") follows if it changed or
+ * could not be read.
+ */
+void DeviceSession::Open(QString path)
+{
+    Command command;
+
+    command.type = Command::Open;
+    command.path = path;
+    command.operation = NULL;
+
+    mutex.lock();
+    devicePath = path;
+    mutex.unlock();
+
+    Queue(command);
+}
+
+/*
+ * Closes the device once the queue gets there, operations still waiting
+ * or running are cancelled first
+ */
+void DeviceSession::Close(void)
+{
+    Command command;
+
+    command.type = Command::Close;
+    command.operation = NULL;
+
+    Cancel();
+
+    mutex.lock();
+    devicePath.clear();
+    serial.clear();
+    mutex.unlock();
+
+    Queue(command);
+}
+
+/*
+ * Restarts the Muribot into its application
+ */
+void DeviceSession::Reset(void)
+{
+    Command command;
+
+    command.type = Command::Reset;
+    command.operation = NULL;
+
+    Queue(command);
+}
+
+/*
+ * Queues an operation built with NewOperation().  It runs once everything
+ * queued before it is done, and reports through its own signals.
+ */
+void DeviceSession::Post(AsyncOperation* operation)
+{
+    Command command;
+
+    command.type = Command::Run;
+    command.operation = operation;
+
+    Queue(command);
+}
+
+/*
+ * Cancels every queued operation and the one running, each finishes with
+ * USB::Cancelled before its next packet
+ */
+void DeviceSession::Cancel(void)
+{
+    QMutexLocker lock(&mutex);
+    Command command;
+
+    foreach(command, queued)
+    {
+        if(command.type == Command::Run)
+            command.operation->token().Cancel();
+    }
+    running.Cancel();
+    wake.wakeOne();
+}
+
+void DeviceSession::Queue(Command command)
+{
+    QMutexLocker lock(&mutex);
+
+    queued.append(command);
+    if(!isRunning())
+        start();
+    wake.wakeOne();
+}
+
+/*
+ * An operation against this session's device, for Post()
+ */
+AsyncOperation* DeviceSession::NewOperation(void) const
+{
+    return new AsyncOperation(comm);
+}
+
+DeviceSession::State DeviceSession::state(void) const
+{
+    return (State)currentState.load();
+}
+
+bool DeviceSession::isConnected(void) const
+{
+    return (state() == Connected) || (state() == Busy);
+}
+
+/*
+ * Device the session was last asked to open, empty once closed or when
+ * opening it failed
+ */
+QString DeviceSession::path(void) const
+{
+    QMutexLocker lock(&mutex);
+
+    return devicePath;
+}
+
+/*
+ * USB serial number of the opened device, empty until it is connected or
+ * when it has none
+ */
+QString DeviceSession::serialNumber(void) const
+{
+    QMutexLocker lock(&mutex);
+
+    return serial;
+}
+
+/*
+ * Firmware information of the opened device, cached or read, valid after
+ * CommandFinished("Open") or ("Refresh").  The session thread publishes a
+ * new copy when it changes, one already handed out stays as it was.
+ */
+QSharedPointer<const USB::FirmwareInfo> DeviceSession::firmwareInfo(void) const
+{
+    QMutexLocker lock(&mutex);
+
+    return info;
+}
+
+/*
+ * Progress of the device, can be sampled from any thread
+ */
+ProgressCounter* DeviceSession::progressCounter(void) const
+{
+    return comm->progressCounter();
+}
+
+void DeviceSession::setState(State state)
+{
+    if(currentState.fetchAndStoreOrdered(state) != state)
+        emit StateChanged(state);
+}
+
+/*
+ * Session thread side of Open().  A Muribot seen before is reported ready
+ * with its cached firmware information, and a Refresh queued ahead of
+ * anything else reads it again.  Otherwise it is read here.
+ */
+void DeviceSession::Connect(QString path)
+{
+    QElapsedTimer elapsed;
+    USB::ErrorCode result;
+    USB::FirmwareInfo cachedInfo;
+    Command command;
+    bool cached;
+    TRACE_SCOPE("Open");
+
+    elapsed.start();
+    setState(Connecting);
+    if(comm->isConnected())
+        comm->close();
+
+    result = comm->open(path);
+    cached = false;
+    if(result == USB::Success)
+    {
+        comm->EngageBootloader();
+        cached = FirmwareCache::Find(comm->serialNumber(), &cachedInfo);
+
+        mutex.lock();
+        serial = comm->serialNumber();
+        mutex.unlock();
+    }
+
+    if(result != USB::Success)
+    {
+        Disconnect(path);
+        emit CommandFinished("Open", result, ((double)elapsed.elapsed()) / 1000);
+        return;
+    }
+    if(!cached)
+    {
+        Refresh(path, false);
+        return;
+    }
+
+    LOG_INFO("Using the cached firmware information of %s.", qPrintable(comm->serialNumber()));
+    Publish(cachedInfo);
+    setState(Connected);
+
+    command.type = Command::Refresh;
+    command.path = path;
+    command.operation = NULL;
+    mutex.lock();
+    queued.prepend(command);
+    mutex.unlock();
+
+    emit CommandFinished("Open", USB::Success, ((double)elapsed.elapsed()) / 1000);
+}
+
+/*
+ * Reads the firmware information of the device just opened at path and
+ * stores it in the FirmwareCache.  After a cached open only news is
+ * reported, a failure or a change, as CommandFinished("Refresh"), and a
+ * Cancel() leaves the cached copy in place.
+ */
+void DeviceSession::Refresh(QString path, bool cached)
+{
+    QElapsedTimer elapsed;
+    USB::ErrorCode result = USB::NotConnected;
+    USB::FirmwareInfo fresh;
+    bool changed = false;
+
+    elapsed.start();
+    if(comm->isConnected())
+        result = ReadFirmwareInfo(&fresh);
+    if(cached && (result == USB::Cancelled))
+        return;
+
+    if(result == USB::Success)
+    {
+        changed = FirmwareCache::Store(comm->serialNumber(), &fresh);
+        if(changed && cached)
+            LOG_WARNING("Firmware information of %s changed since it was cached.", qPrintable(comm->serialNumber()));
+        if(changed || !cached)
+            Publish(fresh);
+        setState(Connected);
+    }
+    else
+        Disconnect(path);
+
+    if(!cached)
+        emit CommandFinished("Open", result, ((double)elapsed.elapsed()) / 1000);
+    else if((result != USB::Success) || changed)
+        emit CommandFinished("Refresh", result, ((double)elapsed.elapsed()) / 1000);
+}
+
+/*
+ * Gives up on the device at path after it could not be opened or read
+ */
+void DeviceSession::Disconnect(QString path)
+{
+    LOG_WARNING("Could not connect to %s.", qPrintable(path));
+    if(comm->isConnected())
+        comm->close();
+
+    // Let the next attach try again
+    mutex.lock();
+    if(devicePath == path)
+        devicePath.clear();
+    serial.clear();
+    mutex.unlock();
+    setState(Disconnected);
+}
+
+/*
+ * Replaces the firmware information other threads see
+ */
+void DeviceSession::Publish(const USB::FirmwareInfo& firmwareInfo)
+{
+    QSharedPointer<const USB::FirmwareInfo> published(new USB::FirmwareInfo(firmwareInfo));
+
+    mutex.lock();
+    info = published;
+    mutex.unlock();
+}
+
+/*
+ * Same as USB::ReadFirmwareInfo(), but polled for like an operation so
+ * Cancel() and the destructor do not have to wait for the answer
+ */
+USB::ErrorCode DeviceSession::ReadFirmwareInfo(USB::FirmwareInfo* firmwareInfo)
+{
+    FirmwareInfoStep step(firmwareInfo);
+    CancelToken token;
+    USB::ErrorCode result;
+    bool done = false;
+    int wait;
+
+    mutex.lock();
+    running = token;
+    mutex.unlock();
+
+    forever
+    {
+        result = step.Resume(comm, &done);
+        if((result != USB::Success) || done)
+            break;
+        if(token.isCancelled())
+        {
+            result = USB::Cancelled;
+            break;
+        }
+
+        wait = step.WaitMs();
+        if(wait > 0)
+        {
+            mutex.lock();
+            if(!token.isCancelled() && !stopping)
+                wake.wait(&mutex, (unsigned long)wait);
+            mutex.unlock();
+        }
+    }
+
+    mutex.lock();
+    running = CancelToken();
+    mutex.unlock();
+
+    return result;
+}
+
+/*
+ * Runs an operation to its end, sleeping while it waits on the device.
+ * Cancel() wakes the thread early.
+ */
+void DeviceSession::Drive(AsyncOperation* operation)
+{
+    int wait;
+
+    mutex.lock();
+    running = operation->token();
+    mutex.unlock();
+
+    setState(Busy);
+    while(!operation->Resume())
+    {
+        wait = operation->WaitMs();
+        if(wait > 0)
+        {
+            mutex.lock();
+            if(!running.isCancelled() && !stopping)
+                wake.wait(&mutex, (unsigned long)wait);
+            mutex.unlock();
+        }
+    }
+
+    mutex.lock();
+    running = CancelToken();
+    mutex.unlock();
+
+    setState(comm->isConnected() ? Connected : Disconnected);
+}
+
+void DeviceSession::run()
+{
+    Command command;
+    QElapsedTimer elapsed;
+
+    // Every transfer of the session runs on this thread
+    RealtimeIo::Apply();
+
+    forever
+    {
+        mutex.lock();
+        while(queued.isEmpty() && !stopping)
+            wake.wait(&mutex);
+
+        if(queued.isEmpty())
+        {
+            mutex.unlock();
+            return;
+        }
+        command = queued.takeFirst();
+        mutex.unlock();
+
+        elapsed.start();
+        switch(command.type)
+        {
+            case Command::Open:
+                Connect(command.path);
+                break;
+
+            case Command::Refresh:
+                Refresh(command.path, true);
+                break;
+
+            case Command::Close:
+                if(comm->isConnected())
+                    comm->close();
+                setState(Disconnected);
+                emit CommandFinished("Close", USB::Success, ((double)elapsed.elapsed()) / 1000);
+                break;
+
+            case Command::Reset:
+                if(comm->isConnected())
+                {
+                    comm->Reset();
+                    emit CommandFinished("Reset", USB::Success, ((double)elapsed.elapsed()) / 1000);
+                }
+                else
+                    emit CommandFinished("Reset", USB::NotConnected, 0);
+                break;
+
+            case Command::Run:
+                Drive(command.operation);
+                break;
+        }
+    }
+}
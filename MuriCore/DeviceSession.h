@@ -0,0 +1,112 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DEVICESESSION_H
+#define DEVICESESSION_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <QList>
+#include <QString>
+#include "USB.h"
+#include "AsyncOperation.h"
+
+/*!
+ * One Muribot owned by its own I/O thread.
+ *
+ * Everything that talks to the device is queued here as a command and run
+ * on the session thread in the order it was queued, so USB access is never
+ * shared with another thread and the caller never waits on the device.
+ * Results come back as signals, which reach a receiver on another thread as
+ * queued events.  The non-blocking counterpart of Session, for programs with
+ * an event loop to keep responsive.
+ */
+class DeviceSession : public QThread
+{
+    Q_OBJECT
+
+public:
+	// Connection state, published by the session thread
+	enum State
+	{
+		Disconnected = 0,
+		Connecting,         // Opening, engaging the bootloader and reading its information
+		Connected,          // Idle, ready for the next command
+		Busy                // Running an operation
+	};
+
+	// Constructor/Destructor
+    explicit DeviceSession(USB* comm = 0, QObject* parent = 0);
+    ~DeviceSession();
+
+	// Methods (any thread)
+    void Open(QString path);
+    void Close(void);
+    void Reset(void);
+    void Post(AsyncOperation* operation);
+    void Cancel(void);
+
+    AsyncOperation* NewOperation(void) const;
+    State state(void) const;
+    bool isConnected(void) const;
+    QString path(void) const;
+    QString serialNumber(void) const;
+    QSharedPointer<const USB::FirmwareInfo> firmwareInfo(void) const;
+    ProgressCounter* progressCounter(void) const;
+
+signals:
+    void StateChanged(int state);
+    void CommandFinished(QString command, USB::ErrorCode result, double time);    // "Open", "Refresh", "Close" or "Reset"
+
+protected:
+	// A queued command, operation is only set for Run
+    struct Command
+    {
+        enum Type { Open, Refresh, Close, Reset, Run } type;
+        QString path;
+        AsyncOperation* operation;
+    };
+
+	// Members
+    USB* comm;                  // Only ever used on the session thread
+    QSharedPointer<const USB::FirmwareInfo> info;   // Replaced, never changed, by the session thread
+    QString devicePath;         // Opened or being opened, empty when closed
+    QString serial;             // USB serial number of the opened device
+    QAtomicInt currentState;
+    mutable QMutex mutex;
+    QWaitCondition wake;
+    QList<Command> queued;
+    CancelToken running;        // Of the operation on the session thread
+    bool stopping;
+
+	// Methods
+    void Queue(Command command);
+    void setState(State state);
+    void Connect(QString path);
+    void Refresh(QString path, bool cached);
+    void Disconnect(QString path);
+    void Publish(const USB::FirmwareInfo& firmwareInfo);
+    USB::ErrorCode ReadFirmwareInfo(USB::FirmwareInfo* firmwareInfo);
+    void Drive(AsyncOperation* operation);
+    void run();
+};
+
+#endif // DEVICESESSION_H
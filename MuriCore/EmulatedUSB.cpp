@@ -0,0 +1,277 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "EmulatedUSB.h"
+#include "PayloadCodec.h"
+
+EmulatedUSB::EmulatedUSB(QString name)
+{
+    this->name = name;
+    packetTimeUs = 1000;
+    eraseTimeMs = 2000;
+    offeredPacketSize = USB_PACKET_SIZE;
+    offerCompression = false;
+    packetsSent = 0;
+    packetsReceived = 0;
+    dropEvery = 0;
+    packetsDropped = 0;
+    packetsRejected = 0;
+    unplugAfter = 0;
+    responsePending = false;
+    busyTimeMs = 0;
+    memset(flash, 0xFF, sizeof(flash));
+}
+
+/*
+ * An emulated device is always attached.
+ */
+void EmulatedUSB::PollUSB(void)
+{
+    connected = true;
+}
+
+USB::ErrorCode EmulatedUSB::open(void)
+{
+    return open(name);
+}
+
+USB::ErrorCode EmulatedUSB::open(QString path)
+{
+    devicePath = path;
+    serial = path;
+    connected = true;
+    responsePending = false;
+    packetBytes = USB_PACKET_SIZE;
+    return Success;
+}
+
+void EmulatedUSB::close(void)
+{
+    connected = false;
+    packetBytes = USB_PACKET_SIZE;
+}
+
+/*
+ * Blocks for the time one report takes on the bus, and for whatever is
+ * left of an erase that is still running on the device.
+ */
+void EmulatedUSB::WaitPacketTime(void)
+{
+    if(busyTimeMs > 0)
+    {
+        qint64 remaining = busyTimeMs - busyTimer.elapsed();
+        if(remaining > 0)
+            QThread::msleep((unsigned long)remaining);
+        busyTimeMs = 0;
+    }
+
+    if(packetTimeUs > 0)
+        QThread::usleep(packetTimeUs);
+}
+
+/*
+ * Handles one command the same way the Muribot bootloader firmware does.
+ */
+USB::ErrorCode EmulatedUSB::SendPacket(unsigned char *data, int size, int msecs)
+{
+    WritePacket* packet = (WritePacket*)data;
+    ReadPacket* reply = (ReadPacket*)response;
+    FirmwareInfo* info = (FirmwareInfo*)response;
+    unsigned char decoded[COMPRESSED_MAX_SPAN];
+    const unsigned char* coded;
+    uint32_t address;
+    unsigned int i, payload, length;
+    int decodedSize;
+
+    // Takes every report at once, msecs never runs out
+    Q_UNUSED(msecs);
+    if(!connected)
+        return NotConnected;
+
+    //Takes standard reports and the larger ones it offers, the payload ends
+    //where the report does
+    if((size != USB_PACKET_SIZE_WITH_REPORT_ID) && (size != (int)offeredPacketSize + 1))
+        return Fail;
+    payload = size - 1 - USB_PACKET_HEADER;
+    if(packet->bytesPerPacket > payload)
+        return Fail;
+
+    WaitPacketTime();
+
+    if((dropEvery > 0) && (((packetsSent + packetsDropped + 1) % dropEvery) == 0))
+    {
+        packetsDropped++;
+        return Timeout;
+    }
+
+    if((unplugAfter > 0) && (packetsSent >= unplugAfter))
+    {
+        unplugAfter = 0;
+        close();
+        return Fail;
+    }
+    packetsSent++;
+
+    switch(packet->command)
+    {
+        case ERASE_DEVICE:
+            //Erase the application area, the bootloader itself lives below it and is never touched
+            memset(&flash[0x1000], 0xFF, EMULATED_FLASH_SIZE - 0x1000);
+            busyTimer.start();
+            busyTimeMs = eraseTimeMs;
+            break;
+
+        case PROGRAM_DEVICE:
+            //The payload is right justified in the data field.  Programming can
+            //only clear bits, same as real flash, so writing over memory that is
+            //not erased shows up when it is verified.
+            address = packet->address;
+            for(i = 0; i < packet->bytesPerPacket; i++)
+            {
+                if((address + i) < EMULATED_FLASH_SIZE)
+                    flash[address + i] &= packet->data[payload - packet->bytesPerPacket + i];
+            }
+            break;
+
+        case PROGRAM_COMPRESSED:
+            //Decoded into a buffer first, like the firmware, and only
+            //programmed when it comes out at the length the payload states
+            coded = &packet->data[payload - packet->bytesPerPacket];
+            decodedSize = -1;
+            length = 0;
+            if(packet->bytesPerPacket >= COMPRESSED_HEADER)
+            {
+                length = coded[0] | (coded[1] << 8);
+                decodedSize = PayloadCodec::Decode(coded + COMPRESSED_HEADER, packet->bytesPerPacket - COMPRESSED_HEADER, decoded, sizeof(decoded));
+            }
+            if((decodedSize < 0) || ((unsigned int)decodedSize != length))
+            {
+                packetsRejected++;
+                break;
+            }
+            address = packet->address;
+            for(i = 0; i < length; i++)
+            {
+                if((address + i) < EMULATED_FLASH_SIZE)
+                    flash[address + i] &= decoded[i];
+            }
+            break;
+
+        case GET_DATA:
+            memset(response, 0x00, sizeof(response));
+            reply->command = GET_DATA;
+            reply->address = packet->address;
+            reply->bytesPerPacket = packet->bytesPerPacket;
+            address = packet->address;
+            for(i = 0; i < packet->bytesPerPacket; i++)
+            {
+                if((address + i) < EMULATED_FLASH_SIZE)
+                    reply->data[payload - packet->bytesPerPacket + i] = flash[address + i];
+            }
+            responsePending = true;
+            break;
+
+        case SIGN_FLASH:
+            flash[EMULATED_SIGNATURE_ADDRESS] = (unsigned char)EMULATED_SIGNATURE_VALUE;
+            flash[EMULATED_SIGNATURE_ADDRESS + 1] = (unsigned char)(EMULATED_SIGNATURE_VALUE >> 8);
+            break;
+
+        case FIRMWARE_INFO:
+            memset(response, 0x00, sizeof(response));
+            info->command = FIRMWARE_INFO;
+            info->bootloaderVersion = 0x0102;
+            info->applicationVersion = 0x0100;
+            info->signatureAddress = EMULATED_SIGNATURE_ADDRESS;
+            info->signatureValue = EMULATED_SIGNATURE_VALUE;
+            info->erasePageSize = EMULATED_ERASE_PAGE_SIZE;
+            if(offeredPacketSize > USB_PACKET_SIZE)
+            {
+                info->capabilities |= CAPABILITY_PACKET_SIZE;
+                info->packetSize = (uint16_t)offeredPacketSize;
+            }
+            if(offerCompression)
+                info->capabilities |= CAPABILITY_COMPRESSED;
+            responsePending = true;
+            break;
+
+        case PROGRAM_COMPLETE:
+        case RESET_DEVICE:
+        case ENGAGE_BOOTLOADER:
+        default:
+            break;
+    }
+
+    return Success;
+}
+
+/*
+ * Returns the response to the last command that produced one.  Commands
+ * without a response read back nothing, which the real hardware reports
+ * as a timeout.
+ */
+USB::ErrorCode EmulatedUSB::ReceivePacket(unsigned char *data, int size)
+{
+    if(!connected)
+        return NotConnected;
+
+    WaitPacketTime();
+
+    if(!responsePending)
+        return Timeout;
+
+    memcpy(data, response, qMin(size, (int)sizeof(response)));
+    responsePending = false;
+    packetsReceived++;
+
+    return Success;
+}
+
+/*
+ * Same as ReceivePacket(), but nothing has arrived yet while an erase is
+ * still running or when the last command has no response
+ */
+USB::ErrorCode EmulatedUSB::TryReceivePacket(unsigned char *data, int size, bool* received)
+{
+    ErrorCode result;
+
+    *received = false;
+    if(!connected)
+        return NotConnected;
+
+    if((busyTimeMs > 0) && (busyTimer.elapsed() < busyTimeMs))
+        return Success;
+
+    result = ReceivePacket(data, size);
+    if(result == Timeout)
+        return Success;
+
+    *received = (result == Success);
+    return result;
+}
+
+/*
+ * Answers are there as soon as their request was handled, only a busy
+ * emulated bootloader (an erase) makes this wait, a millisecond at a time.
+ */
+USB::ErrorCode EmulatedUSB::WaitReceivePacket(unsigned char *data, int size, int msecs, bool* received)
+{
+    ErrorCode result = TryReceivePacket(data, size, received);
+
+    if((result == Success) && !*received && (msecs > 0))
+        QThread::msleep(1);
+    return result;
+}
@@ -0,0 +1,98 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EMULATEDUSB_H
+#define EMULATEDUSB_H
+
+#include <QElapsedTimer>
+#include "USB.h"
+
+// Size of the emulated PIC18F46J50 address space
+#define EMULATED_FLASH_SIZE 0x10000
+
+// Signature the emulated bootloader writes on SIGN_FLASH (same as the Muribot firmware)
+#define EMULATED_SIGNATURE_ADDRESS 0x1006
+#define EMULATED_SIGNATURE_VALUE 0x600D
+#define EMULATED_ERASE_PAGE_SIZE 1024
+// Reports a pipelined write of the whole emulated flash takes, the range a
+// random unplug point is picked from
+#define EMULATED_UNPLUG_RANGE 2200
+
+/*!
+ * A software stand-in for the Muribot HID bootloader.
+ *
+ * Answers the same commands as the real firmware from an in-memory flash
+ * image, and waits out a configurable time per USB report and per erase so
+ * that timings behave like the hardware.  Used to exercise gang programming
+ * and the rest of the programming engine without robots attached.
+ */
+class EmulatedUSB : public USB
+{
+public:
+    explicit EmulatedUSB(QString name = QString());
+
+    // Time spent on each report, 1ms matches the full speed HID polling interval
+    int packetTimeUs;
+    // Time the device stays busy after ERASE_DEVICE
+    int eraseTimeMs;
+    // Largest report offered in FIRMWARE_INFO, USB_PACKET_SIZE emulates a
+    // bootloader that predates packet size negotiation
+    unsigned int offeredPacketSize;
+    // Offers PROGRAM_COMPRESSED in FIRMWARE_INFO
+    bool offerCompression;
+
+    // The emulated flash contents
+    unsigned char flash[EMULATED_FLASH_SIZE];
+
+    // Number of reports exchanged since the device was created
+    unsigned int packetsSent;
+    unsigned int packetsReceived;
+
+    // Loses every dropEvery-th report sent, the send times out without the
+    // command reaching the firmware.  0 loses none.
+    unsigned int dropEvery;
+    unsigned int packetsDropped;
+    // PROGRAM_COMPRESSED packets whose payload did not decode to its length,
+    // nothing of them is programmed
+    unsigned int packetsRejected;
+    // Unplugs the robot once this many reports were sent, open() plugs it
+    // back in with the flash as it was.  0 never unplugs.
+    unsigned int unplugAfter;
+
+    // USB overrides
+    void PollUSB(void);
+    ErrorCode open(void);
+    ErrorCode open(QString path);
+    void close(void);
+    ErrorCode SendPacket(unsigned char *data, int size, int msecs);
+    ErrorCode ReceivePacket(unsigned char *data, int size);
+    ErrorCode TryReceivePacket(unsigned char *data, int size, bool* received);
+    ErrorCode WaitReceivePacket(unsigned char *data, int size, int msecs, bool* received);
+
+protected:
+    QString name;
+    // Response waiting to be read by ReceivePacket()
+    unsigned char response[USB_MAX_PACKET_SIZE + 1];
+    bool responsePending;
+    // Set while an erase is "running" on the device
+    QElapsedTimer busyTimer;
+    int busyTimeMs;
+
+    void WaitPacketTime(void);
+};
+
+#endif // EMULATEDUSB_H
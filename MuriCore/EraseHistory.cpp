@@ -0,0 +1,124 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <math.h>
+#include <string.h>
+#include <QMutexLocker>
+#include <QSettings>
+#include <QStringList>
+
+#include "EraseHistory.h"
+
+QMap<QString, EraseHistory::Stats> EraseHistory::history;
+bool EraseHistory::loaded = false;
+QMutex EraseHistory::lock(QMutex::Recursive);
+
+/*
+ * Milliseconds an erase of type usually takes, 0 while unknown
+ */
+int EraseHistory::Expected(QString type)
+{
+    Stats stats = Find(type);
+
+    if(stats.count < ERASE_MIN_SAMPLES)
+        return 0;
+
+    return (int)stats.mean;
+}
+
+/*
+ * Milliseconds after which an erase of type is considered hung
+ */
+int EraseHistory::Limit(QString type)
+{
+    Stats stats = Find(type);
+    double deviation;
+    int limit;
+
+    if(stats.count < ERASE_MIN_SAMPLES)
+        return ERASE_DEFAULT_LIMIT_MS;
+
+    deviation = sqrt(stats.m2 / (stats.count - 1));
+    limit = (int)(stats.mean + ERASE_LIMIT_SIGMAS * deviation);
+
+    return qMax(limit, stats.slowest + ERASE_LIMIT_MARGIN_MS);
+}
+
+/*
+ * Adds a completed erase of type that took msecs
+ */
+void EraseHistory::Record(QString type, int msecs)
+{
+    QMutexLocker locker(&lock);
+    QSettings settings;
+    Stats stats;
+    double delta;
+
+    stats = Find(type);
+
+    // Welford's update, with the count capped so old erases fade out
+    if(stats.count < ERASE_MAX_SAMPLES)
+        stats.count++;
+    else
+        stats.m2 = stats.m2 * (stats.count - 1) / stats.count;
+    delta = msecs - stats.mean;
+    stats.mean += delta / stats.count;
+    stats.m2 += delta * (msecs - stats.mean);
+    stats.slowest = qMax(stats.slowest, msecs);
+    history.insert(type, stats);
+
+    settings.beginGroup("EraseHistory");
+    settings.setValue(type, QStringList() << QString::number(stats.count) << QString::number(stats.mean)
+                                          << QString::number(stats.m2) << QString::number(stats.slowest));
+    settings.endGroup();
+}
+
+/*
+ * History of type, loading the saved one on first use.  lock is recursive
+ * for Record().
+ */
+EraseHistory::Stats EraseHistory::Find(QString type)
+{
+    QMutexLocker locker(&lock);
+    Stats stats;
+
+    if(!loaded)
+    {
+        QSettings settings;
+        QStringList values;
+
+        settings.beginGroup("EraseHistory");
+        foreach(QString key, settings.childKeys())
+        {
+            values = settings.value(key).toStringList();
+            if(values.count() != 4)
+                continue;
+
+            stats.count = values.at(0).toInt();
+            stats.mean = values.at(1).toDouble();
+            stats.m2 = values.at(2).toDouble();
+            stats.slowest = values.at(3).toInt();
+            history.insert(key, stats);
+        }
+        settings.endGroup();
+        loaded = true;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    return history.value(type, stats);
+}
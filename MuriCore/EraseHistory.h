@@ -0,0 +1,79 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ERASEHISTORY_H
+#define ERASEHISTORY_H
+
+#include <QMap>
+#include <QMutex>
+#include <QString>
+
+// Longest wait for an erase until enough erases of the device type were timed
+#define ERASE_DEFAULT_LIMIT_MS  15000
+// Erases timed before the history is trusted
+#define ERASE_MIN_SAMPLES       3
+// Newer erases count as much as this many old ones, so the history follows
+// a device that slows down with wear
+#define ERASE_MAX_SAMPLES       32
+// Part of the expected time slept before polling for the answer
+#define ERASE_SLEEP_PERCENT     80
+// Polling interval, doubled after every empty poll
+#define ERASE_POLL_MIN_MS       2
+#define ERASE_POLL_MAX_MS       50
+// An erase fails once it takes this many standard deviations over the mean,
+// and at least ERASE_LIMIT_MARGIN_MS longer than the slowest erase seen
+#define ERASE_LIMIT_SIGMAS      6
+#define ERASE_LIMIT_MARGIN_MS   1000
+
+/*!
+ * How long erases take, per device type (see USB::deviceType()).
+ *
+ * Every completed erase is recorded, the erase wait then sleeps through
+ * most of the expected time instead of spinning on the device, and gives
+ * up once an erase is clearly slower than any seen before instead of after
+ * the generic receive timeout.  The history is kept in QSettings, so it
+ * survives restarts.  Can be used from any thread.
+ */
+class EraseHistory
+{
+public:
+	// Methods
+    static int Expected(QString type);
+    static int Limit(QString type);
+    static void Record(QString type, int msecs);
+
+private:
+	// Running mean and variance (Welford) of one device type
+	struct Stats
+	{
+		int count;
+		double mean;
+		double m2;
+		int slowest;
+	};
+
+	// Members
+    static QMap<QString, Stats> history;
+    static bool loaded;
+    static QMutex lock;
+
+	// Methods
+    static Stats Find(QString type);
+};
+
+#endif // ERASEHISTORY_H
@@ -0,0 +1,125 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include <QMutexLocker>
+#include <QSettings>
+#include <QStringList>
+
+#include "FirmwareCache.h"
+
+QMap<QString, USB::FirmwareInfo> FirmwareCache::cache;
+bool FirmwareCache::loaded = false;
+QMutex FirmwareCache::lock;
+
+/*
+ * Copies the information last read from the Muribot with serial into
+ * firmwareInfo, returns false when it has not been seen yet
+ */
+bool FirmwareCache::Find(QString serial, USB::FirmwareInfo* firmwareInfo)
+{
+    QMutexLocker locker(&lock);
+
+    if(serial.isEmpty())
+        return false;
+
+    Load();
+    if(!cache.contains(serial))
+        return false;
+
+    *firmwareInfo = cache.value(serial);
+    return true;
+}
+
+/*
+ * Remembers the information just read from the Muribot with serial.
+ * Returns true when it differs from what was cached.
+ */
+bool FirmwareCache::Store(QString serial, const USB::FirmwareInfo* firmwareInfo)
+{
+    QMutexLocker locker(&lock);
+    QSettings settings;
+    USB::FirmwareInfo info;
+
+    if(serial.isEmpty())
+        return false;
+
+    Load();
+    if(cache.contains(serial))
+    {
+        info = cache.value(serial);
+        if(Same(&info, firmwareInfo))
+            return false;
+    }
+
+    memset((void*)&info, 0x00, sizeof(info));
+    info.command = FIRMWARE_INFO;
+    info.bootloaderVersion = firmwareInfo->bootloaderVersion;
+    info.applicationVersion = firmwareInfo->applicationVersion;
+    info.signatureAddress = firmwareInfo->signatureAddress;
+    info.signatureValue = firmwareInfo->signatureValue;
+    info.erasePageSize = firmwareInfo->erasePageSize;
+    cache.insert(serial, info);
+
+    settings.beginGroup("FirmwareCache");
+    settings.setValue(serial, QStringList() << QString::number(info.bootloaderVersion) << QString::number(info.applicationVersion)
+                                            << QString::number(info.signatureAddress) << QString::number(info.signatureValue)
+                                            << QString::number(info.erasePageSize));
+    settings.endGroup();
+
+    return true;
+}
+
+/*
+ * Reads the saved cache on first use, lock must be held
+ */
+void FirmwareCache::Load(void)
+{
+    QSettings settings;
+    QStringList values;
+    USB::FirmwareInfo info;
+
+    if(loaded)
+        return;
+
+    settings.beginGroup("FirmwareCache");
+    foreach(QString key, settings.childKeys())
+    {
+        values = settings.value(key).toStringList();
+        if(values.count() != 5)
+            continue;
+
+        memset((void*)&info, 0x00, sizeof(info));
+        info.command = FIRMWARE_INFO;
+        info.bootloaderVersion = (uint16_t)values.at(0).toUInt();
+        info.applicationVersion = (uint16_t)values.at(1).toUInt();
+        info.signatureAddress = values.at(2).toUInt();
+        info.signatureValue = (uint16_t)values.at(3).toUInt();
+        info.erasePageSize = values.at(4).toUInt();
+        cache.insert(key, info);
+    }
+    settings.endGroup();
+    loaded = true;
+}
+
+bool FirmwareCache::Same(const USB::FirmwareInfo* a, const USB::FirmwareInfo* b)
+{
+    return (a->bootloaderVersion == b->bootloaderVersion) && (a->applicationVersion == b->applicationVersion) &&
+           (a->signatureAddress == b->signatureAddress) && (a->signatureValue == b->signatureValue) &&
+           (a->erasePageSize == b->erasePageSize);
+}
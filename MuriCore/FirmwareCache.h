@@ -0,0 +1,54 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FIRMWARECACHE_H
+#define FIRMWARECACHE_H
+
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include "USB.h"
+
+/*!
+ * Firmware information of every Muribot seen, by USB serial number.
+ *
+ * Holds the bootloader and application versions along with the signature
+ * address and erase page size, which is all of the device layout that is
+ * not fixed.  A session reconnecting a known robot can be ready before its
+ * FIRMWARE_INFO round trip and refresh the information afterwards.  Kept in
+ * QSettings so it survives restarts.  Can be used from any thread.
+ */
+class FirmwareCache
+{
+public:
+	// Methods
+    static bool Find(QString serial, USB::FirmwareInfo* firmwareInfo);
+    static bool Store(QString serial, const USB::FirmwareInfo* firmwareInfo);
+
+private:
+	// Members
+    static QMap<QString, USB::FirmwareInfo> cache;
+    static bool loaded;
+    static QMutex lock;
+
+	// Methods
+    static void Load(void);
+    static bool Same(const USB::FirmwareInfo* a, const USB::FirmwareInfo* b);
+};
+
+#endif // FIRMWARECACHE_H
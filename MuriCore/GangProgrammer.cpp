@@ -0,0 +1,186 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "GangProgrammer.h"
+#include "EmulatedUSB.h"
+#include "Log.h"
+
+/*
+ * The session takes ownership of comm
+ */
+GangSession::GangSession(GangProgrammer* gang, int index, IoExecutor* executor, USB* comm, QString path) : QObject(gang)
+{
+    this->gang = gang;
+    this->index = index;
+    this->path = path;
+    writing = false;
+    session = new AsyncSession(executor, comm, this);
+    session->writeFlash = gang->writeFlash;
+    session->writeEeprom = gang->writeEeprom;
+    session->verifyPlan = gang->verifyPlan;
+
+    connect(session, SIGNAL(Finished(SessionResult)), this, SLOT(CallFinished(SessionResult)));
+}
+
+/*
+ * Runs the whole programming cycle against this session's device, the
+ * packets go out on the gang's executor
+ */
+void GangSession::Start(void)
+{
+    SessionResult result;
+
+    elapsed.start();
+
+    result = session->LoadImage(gang->image());
+    if(!result.ok())
+    {
+        LOG_WARNING("%s: %s", qPrintable(path), qPrintable(result.message));
+        emit Finished(index, result.result, ((double)elapsed.elapsed()) / 1000);
+        return;
+    }
+
+    session->Open(path);
+}
+
+/*
+ * The write follows the open, the device is closed after either failed
+ */
+void GangSession::CallFinished(const SessionResult& result)
+{
+    if(result.ok() && !writing)
+    {
+        writing = true;
+        session->Write();
+        return;
+    }
+
+    session->Close();
+    emit Finished(index, result.result, ((double)elapsed.elapsed()) / 1000);
+}
+
+GangProgrammer::GangProgrammer(QObject* parent) : QObject(parent)
+{
+    writeFlash = true;
+    writeEeprom = false;
+    remaining = 0;
+}
+
+/*
+ * Cancels the devices still programming, their sessions go before the
+ * executor they run on
+ */
+GangProgrammer::~GangProgrammer()
+{
+    qDeleteAll(findChildren<GangSession*>());
+    qDeleteAll(counters);
+}
+
+/*
+ * Starts programming hexData into every attached bootloader and returns the
+ * number of devices found.  DeviceFinished() is emitted once per device and
+ * Finished() once all of them are done.  Every device gets the same snapshot,
+ * the next image can be loaded meanwhile.
+ */
+int GangProgrammer::Start(ImageSnapshot hexData)
+{
+    QList<USB*> devices;
+    QList<QString> paths;
+    int emulated = qgetenv(GANG_EMULATE_ENV).toInt();
+    int i;
+
+    if(isRunning())
+        return 0;
+
+    this->hexData = hexData;
+    names.clear();
+    qDeleteAll(counters);
+    counters.clear();
+
+    if(emulated > 0)
+    {
+        for(i = 0; i < emulated; i++)
+        {
+            QString name = QString("emulated:%1").arg(i);
+            devices.append(new EmulatedUSB(name));
+            paths.append(name);
+            names.append(name);
+        }
+    }
+    else
+    {
+        foreach(USB::DeviceInfo info, USB::Enumerate())
+        {
+            devices.append(new USB());
+            paths.append(info.path);
+            names.append(info.serialNumber.isEmpty() ? info.path : info.serialNumber);
+        }
+    }
+
+    if(devices.isEmpty())
+        return 0;
+
+    remaining = devices.count();
+
+    for(i = 0; i < devices.count(); i++)
+    {
+        counters.append(new ProgressCounter());
+        devices[i]->setProgressCounter(counters[i]);
+
+        GangSession* session = new GangSession(this, i, &executor, devices[i], paths[i]);
+        connect(session, SIGNAL(Finished(int,USB::ErrorCode,double)), this, SLOT(SessionFinished(int,USB::ErrorCode,double)));
+        connect(session, SIGNAL(Finished(int,USB::ErrorCode,double)), session, SLOT(deleteLater()));
+        session->Start();
+    }
+
+    return devices.count();
+}
+
+bool GangProgrammer::isRunning(void) const
+{
+    return remaining > 0;
+}
+
+/*
+ * Serial number of the device (or its path when it reports none)
+ */
+QString GangProgrammer::DeviceName(int index) const
+{
+    return names.value(index);
+}
+
+/*
+ * Progress of a device, valid until the next Start()
+ */
+const ProgressCounter* GangProgrammer::Progress(int index) const
+{
+    return counters.value(index);
+}
+
+const PICData* GangProgrammer::image(void) const
+{
+    return hexData.data();
+}
+
+void GangProgrammer::SessionFinished(int index, USB::ErrorCode result, double time)
+{
+    emit DeviceFinished(index, result, time);
+
+    remaining--;
+    if(remaining == 0)
+        emit Finished();
+}
@@ -0,0 +1,112 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GANGPROGRAMMER_H
+#define GANGPROGRAMMER_H
+
+#include <QObject>
+#include <QList>
+#include <QElapsedTimer>
+#include "USB.h"
+#include "PICData.h"
+#include "Progress.h"
+#include "IoExecutor.h"
+#include "AsyncSession.h"
+
+// Environment variable that replaces the attached bootloaders with N emulated ones
+#define GANG_EMULATE_ENV "MURIPROG_EMULATE"
+
+class GangProgrammer;
+
+/*!
+ * Programs one device of a gang: opens it, then writes the image.  Owns its
+ * USB connection through its AsyncSession, so it shares nothing with the
+ * other sessions except the read only image and the executor.
+ */
+class GangSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    GangSession(GangProgrammer* gang, int index, IoExecutor* executor, USB* comm, QString path);
+
+    void Start(void);
+
+signals:
+    void Finished(int index, USB::ErrorCode result, double time);
+
+private slots:
+    void CallFinished(const SessionResult& result);
+
+protected:
+	// Members
+    GangProgrammer* gang;
+    int index;
+    QString path;
+    AsyncSession* session;
+    bool writing;               // Opened, the write is running
+    QElapsedTimer elapsed;
+};
+
+/*!
+ * Erases, writes, verifies and signs every attached bootloader at the same time.
+ *
+ * Each device runs in its own session, all of them on one IoExecutor: its I/O
+ * thread gives every device a packet in turn, so a slow or failing robot only
+ * holds up itself by a packet.  The progress of each device
+ * is published in a ProgressCounter, sample them with a ProgressModel.
+ * Setting MURIPROG_EMULATE=N programs N emulated bootloaders instead of the
+ * attached hardware.
+ */
+class GangProgrammer : public QObject
+{
+    Q_OBJECT
+
+public:
+	// Constructor/Destructor
+    explicit GangProgrammer(QObject* parent = 0);
+    ~GangProgrammer();
+
+	// Members
+    bool writeFlash;
+    bool writeEeprom;
+    VerifyPlan verifyPlan;
+
+	// Methods
+    int Start(ImageSnapshot hexData);
+    bool isRunning(void) const;
+    QString DeviceName(int index) const;
+    const ProgressCounter* Progress(int index) const;
+    const PICData* image(void) const;
+
+signals:
+    void DeviceFinished(int index, USB::ErrorCode result, double time);
+    void Finished(void);
+
+private slots:
+    void SessionFinished(int index, USB::ErrorCode result, double time);
+
+protected:
+	// Members
+    IoExecutor executor;
+    QList<QString> names;
+    QList<ProgressCounter*> counters;       // Kept until the next Start(), after the sessions are gone
+    ImageSnapshot hexData;
+    int remaining;
+};
+
+#endif // GANGPROGRAMMER_H
@@ -18,6 +18,7 @@
 #include <QFile>
 #include "HexLoader.h"
 #include "Bootloader.h"
+#include "Log.h"
 
 
 HexLoader::HexLoader(void)
@@ -174,7 +175,7 @@ HexLoader::ErrorCode HexLoader::ImportHexFile(QString fileName, PICData* pData,
                     //Print debug output text to debug window
                     if(i == 0)
                     {
-                        qDebug(QString("Importing .hex file line with device address: 0x" + QString::number(deviceAddress, 16)).toLatin1());
+                        LOG_DEBUG("Importing .hex file line with device address: 0x%x", deviceAddress);
                     }
 
                     //Fetch ASCII encoded payload byte from .hex file and save the byte to our temporary RAM buffer.
@@ -205,7 +206,7 @@ HexLoader::ErrorCode HexLoader::ImportHexFile(QString fileName, PICData* pData,
     //Check if we imported any data from the .hex file.
     if(importedAtLeastOneByte == true)
     {
-        qDebug(QString("Hex File imported successfully.").toLatin1());
+        LOG_INFO("Hex File imported successfully.");
         return Success;
     }
     else
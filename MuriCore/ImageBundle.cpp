@@ -0,0 +1,397 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QThreadPool>
+
+#include "ImageBundle.h"
+#include "HexLoader.h"
+#include "Bootloader.h"
+
+/*
+ * Parses one hex file of a bundle being built, on the pool
+ */
+class BundleImport : public QRunnable
+{
+public:
+    BundleImport(QString fileName)
+    {
+        this->fileName = fileName;
+        data = new PICData();
+        result = HexLoader::CouldNotOpenFile;
+        setAutoDelete(false);
+    }
+
+    ~BundleImport()
+    {
+        PICData::MemoryRange range;
+
+        foreach(range, data->ranges)
+            delete[] range.pDataBuffer;
+        delete data;
+    }
+
+    void run(void)
+    {
+        HexLoader import;
+        Bootloader device(data);
+
+        result = import.ImportHexFile(fileName, data, &device);
+    }
+
+    QString fileName;
+    PICData* data;
+    HexLoader::ErrorCode result;
+};
+
+ImageBundle::ImageBundle()
+{
+    base = NULL;
+    header = NULL;
+    index = NULL;
+}
+
+ImageBundle::~ImageBundle()
+{
+    Close();
+}
+
+/*
+ * Maps a bundle and checks its index.  Nothing is read beyond the header
+ * and the index until an image is selected.
+ */
+ImageBundle::ErrorCode ImageBundle::Open(QString fileName)
+{
+    const Header* candidate;
+    const Entry* entry;
+    const Range* range;
+    qint64 size;
+    uint32_t i, j;
+
+    Close();
+    file.setFileName(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+        return CouldNotOpenFile;
+
+    size = file.size();
+    if(size < (qint64)sizeof(Header))
+    {
+        Close();
+        return BadFormat;
+    }
+
+    base = file.map(0, size);
+    if(base == NULL)
+    {
+        Close();
+        return CouldNotOpenFile;
+    }
+
+    candidate = (const Header*)base;
+    if((memcmp(candidate->magic, BUNDLE_MAGIC, sizeof(candidate->magic)) != 0) || (candidate->version != BUNDLE_VERSION))
+    {
+        Close();
+        return BadFormat;
+    }
+
+    // The index must lie within the file and hash to what the header says
+    if((candidate->fileSize != size) || (candidate->imageCount > BUNDLE_MAX_IMAGES) || (candidate->indexOffset > size) ||
+       ((size - candidate->indexOffset) < (qint64)(candidate->imageCount * sizeof(Entry))) ||
+       (QCryptographicHash::hash(QByteArray::fromRawData((const char*)base + candidate->indexOffset, candidate->imageCount * sizeof(Entry)),
+                                 QCryptographicHash::Sha1) != QByteArray::fromRawData((const char*)candidate->indexHash, BUNDLE_HASH_BYTES)))
+    {
+        Close();
+        return BadIndex;
+    }
+
+    // So must every image's pages
+    entry = (const Entry*)(base + candidate->indexOffset);
+    for(i = 0; i < candidate->imageCount; i++, entry++)
+    {
+        if((entry->name[BUNDLE_NAME_LENGTH - 1] != '\0') || (entry->rangeCount > BUNDLE_MAX_RANGES))
+        {
+            Close();
+            return BadIndex;
+        }
+
+        for(j = 0; j < entry->rangeCount; j++)
+        {
+            range = &entry->ranges[j];
+            if((range->end <= range->start) || (range->pagesOffset > size) ||
+               (range->pageCount > (size - range->pagesOffset) / sizeof(Page)))
+            {
+                Close();
+                return BadIndex;
+            }
+        }
+    }
+
+    header = candidate;
+    index = (const Entry*)(base + header->indexOffset);
+    return Success;
+}
+
+void ImageBundle::Close(void)
+{
+    if(base != NULL)
+        file.unmap((uchar*)base);
+    file.close();
+    base = NULL;
+    header = NULL;
+    index = NULL;
+}
+
+bool ImageBundle::isOpen(void) const
+{
+    return header != NULL;
+}
+
+QString ImageBundle::fileName(void) const
+{
+    return isOpen() ? file.fileName() : QString();
+}
+
+int ImageBundle::count(void) const
+{
+    return isOpen() ? (int)header->imageCount : 0;
+}
+
+QString ImageBundle::name(int index) const
+{
+    if((index < 0) || (index >= count()))
+        return QString();
+
+    return QString::fromUtf8(this->index[index].name);
+}
+
+/*
+ * SHA-1 of the image, see Fingerprint()
+ */
+QByteArray ImageBundle::fingerprint(int index) const
+{
+    if((index < 0) || (index >= count()))
+        return QByteArray();
+
+    return QByteArray((const char*)this->index[index].fingerprint, BUNDLE_HASH_BYTES);
+}
+
+/*
+ * Index of the image called name, -1 when there is none
+ */
+int ImageBundle::Find(QString name) const
+{
+    int i;
+
+    for(i = 0; i < count(); i++)
+    {
+        if(this->name(i) == name)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Copies an image into hexData, which must have the memory layout the
+ * image was built for (ex: a freshly constructed PICData).  Addresses the
+ * image does not program are set to 0xFF, same as after a hex import.
+ */
+ImageBundle::ErrorCode ImageBundle::Select(int index, PICData* hexData) const
+{
+    const Entry* entry;
+    const Range* range;
+    const Page* page;
+    PICData::MemoryRange target;
+    unsigned char* buffers[BUNDLE_MAX_RANGES];
+    uint32_t lengths[BUNDLE_MAX_RANGES];
+    uint32_t i, j;
+
+    if((index < 0) || (index >= count()))
+        return NotFound;
+
+    entry = &this->index[index];
+    for(i = 0; i < entry->rangeCount; i++)
+    {
+        range = &entry->ranges[i];
+        buffers[i] = NULL;
+        foreach(target, hexData->ranges)
+        {
+            if((target.type == range->type) && (target.start == range->start) && (target.end == range->end))
+            {
+                buffers[i] = target.pDataBuffer;
+                lengths[i] = target.dataBufferLength;
+            }
+        }
+        if(buffers[i] == NULL)
+            return LayoutMismatch;
+    }
+
+    foreach(target, hexData->ranges)
+        memset(target.pDataBuffer, 0xFF, target.dataBufferLength);
+
+    for(i = 0; i < entry->rangeCount; i++)
+    {
+        range = &entry->ranges[i];
+        page = (const Page*)(base + range->pagesOffset);
+        for(j = 0; j < range->pageCount; j++, page++)
+        {
+            if(page->offset >= lengths[i])
+                return BadIndex;
+
+            memcpy(buffers[i] + page->offset, page->data, qMin((uint32_t)BUNDLE_PAGE_BYTES, lengths[i] - page->offset));
+        }
+    }
+
+    return Success;
+}
+
+/*
+ * Whether fileName starts like a bundle
+ */
+bool ImageBundle::IsBundle(QString fileName)
+{
+    QFile in(fileName);
+
+    if(!in.open(QIODevice::ReadOnly))
+        return false;
+
+    return in.read(sizeof(BUNDLE_MAGIC) - 1) == QByteArray(BUNDLE_MAGIC);
+}
+
+/*
+ * SHA-1 over the layout and contents of every range of an image
+ */
+QByteArray ImageBundle::Fingerprint(const PICData* data)
+{
+    QCryptographicHash sha(QCryptographicHash::Sha1);
+    PICData::MemoryRange range;
+
+    foreach(range, data->ranges)
+    {
+        sha.addData((const char*)&range.type, sizeof(range.type));
+        sha.addData((const char*)&range.start, sizeof(range.start));
+        sha.addData((const char*)&range.end, sizeof(range.end));
+        sha.addData((const char*)range.pDataBuffer, range.dataBufferLength);
+    }
+    return sha.result();
+}
+
+/*
+ * Parses hexFiles on a thread pool and writes them to fileName as one
+ * bundle, each image named after its file.  When a file does not parse the
+ * bundle is not written and failed lists the files at fault.
+ */
+ImageBundle::ErrorCode ImageBundle::Build(QString fileName, QStringList hexFiles, QStringList* failed)
+{
+    QThreadPool pool;
+    QList<BundleImport*> imports;
+    BundleImport* import;
+    QSaveFile out(fileName);
+    Header header;
+    Entry entry;
+    Range* descriptor;
+    Page page;
+    PICData::MemoryRange range;
+    QByteArray indexData, pageData, imageName;
+    uint32_t dataOffset, offset, chunk, i;
+    ErrorCode result = Success;
+
+    failed->clear();
+    if(hexFiles.isEmpty() || (hexFiles.count() > BUNDLE_MAX_IMAGES))
+        return BadIndex;
+
+    foreach(QString hexFile, hexFiles)
+    {
+        import = new BundleImport(hexFile);
+        imports.append(import);
+        pool.start(import);
+    }
+    pool.waitForDone();
+
+    // Pages go right after the index, in the order of the images
+    dataOffset = sizeof(Header) + imports.count() * sizeof(Entry);
+    foreach(import, imports)
+    {
+        if(import->result != HexLoader::Success)
+        {
+            failed->append(import->fileName);
+            result = HexFileError;
+            continue;
+        }
+
+        memset((void*)&entry, 0x00, sizeof(entry));
+        imageName = QFileInfo(import->fileName).completeBaseName().toUtf8().left(BUNDLE_NAME_LENGTH - 1);
+        memcpy(entry.name, imageName.constData(), imageName.size());
+        memcpy(entry.fingerprint, Fingerprint(import->data).constData(), BUNDLE_HASH_BYTES);
+
+        foreach(range, import->data->ranges)
+        {
+            if(entry.rangeCount >= BUNDLE_MAX_RANGES)
+                break;
+
+            descriptor = &entry.ranges[entry.rangeCount++];
+            descriptor->type = range.type;
+            descriptor->start = range.start;
+            descriptor->end = range.end;
+            descriptor->pagesOffset = dataOffset + pageData.size();
+
+            // Only the pages that are not blank
+            for(offset = 0; offset < range.dataBufferLength; offset += BUNDLE_PAGE_BYTES)
+            {
+                chunk = qMin((uint32_t)BUNDLE_PAGE_BYTES, range.dataBufferLength - offset);
+                for(i = 0; (i < chunk) && (range.pDataBuffer[offset + i] == 0xFF); i++)
+                    ;
+                if(i == chunk)
+                    continue;
+
+                page.offset = offset;
+                memset(page.data, 0xFF, sizeof(page.data));
+                memcpy(page.data, range.pDataBuffer + offset, chunk);
+                pageData.append((const char*)&page, sizeof(page));
+                descriptor->pageCount++;
+            }
+        }
+        indexData.append((const char*)&entry, sizeof(entry));
+    }
+
+    qDeleteAll(imports);
+    if(result != Success)
+        return result;
+
+    memset((void*)&header, 0x00, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+    header.version = BUNDLE_VERSION;
+    header.imageCount = hexFiles.count();
+    header.indexOffset = sizeof(Header);
+    header.fileSize = dataOffset + pageData.size();
+    memcpy(header.indexHash, QCryptographicHash::hash(indexData, QCryptographicHash::Sha1).constData(), BUNDLE_HASH_BYTES);
+
+    if(!out.open(QIODevice::WriteOnly))
+        return CouldNotWriteFile;
+
+    out.write((const char*)&header, sizeof(header));
+    out.write(indexData);
+    out.write(pageData);
+    if(!out.commit())
+        return CouldNotWriteFile;
+
+    return Success;
+}
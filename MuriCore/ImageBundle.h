@@ -0,0 +1,138 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef IMAGEBUNDLE_H
+#define IMAGEBUNDLE_H
+
+#include <stdint.h>
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include "PICData.h"
+
+// Bundle file identification
+#define BUNDLE_MAGIC            "MURIBNDL"
+#define BUNDLE_VERSION          1
+// Usual extension of a bundle
+#define BUNDLE_SUFFIX           "mbundle"
+// Blank (all 0xFF) pages of this size are left out of a bundle
+#define BUNDLE_PAGE_BYTES       64
+// Longest image name, including the terminating NUL
+#define BUNDLE_NAME_LENGTH      64
+// Memory ranges per image and images per bundle
+#define BUNDLE_MAX_RANGES       4
+#define BUNDLE_MAX_IMAGES       4096
+// Size of the SHA-1 of the index and of each image
+#define BUNDLE_HASH_BYTES       20
+
+/*!
+ * Several parsed hex images in one file, for stations that switch between
+ * the lessons of a course.
+ *
+ * A bundle holds a header, an index with the name, memory layout and
+ * fingerprint of every image, and the non blank pages of each image already
+ * in device layout.  Open() maps the whole file once and checks the index
+ * against the hash in the header; Select() then copies an image into a
+ * PICData without parsing anything.  Build() parses a list of hex files on
+ * a thread pool and writes them out as a bundle.
+ */
+class ImageBundle
+{
+public:
+	// Error codes, HexLoader's for the hex files a bundle is built from
+    enum ErrorCode
+    {
+        Success = 0,
+        CouldNotOpenFile,
+        BadFormat,              // Not a bundle, or a version this build does not read
+        BadIndex,               // Index or page data does not match the header
+        NotFound,               // No image by that name
+        LayoutMismatch,         // Image built for another memory layout
+        HexFileError,
+        CouldNotWriteFile
+    };
+
+	// Constructor/Destructor
+    ImageBundle();
+    ~ImageBundle();
+
+	// Methods
+    ErrorCode Open(QString fileName);
+    void Close(void);
+    bool isOpen(void) const;
+    QString fileName(void) const;
+    int count(void) const;
+    QString name(int index) const;
+    QByteArray fingerprint(int index) const;
+    int Find(QString name) const;
+    ErrorCode Select(int index, PICData* hexData) const;
+
+    static bool IsBundle(QString fileName);
+    static QByteArray Fingerprint(const PICData* data);
+    static ErrorCode Build(QString fileName, QStringList hexFiles, QStringList* failed);
+
+protected:
+    #pragma pack(1)
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t imageCount;
+        uint32_t indexOffset;               // From the start of the file
+        uint32_t fileSize;
+        unsigned char indexHash[BUNDLE_HASH_BYTES];
+        uint32_t reserved;
+    };
+
+    struct Range
+    {
+        unsigned char type;
+        unsigned char reserved[3];
+        uint32_t start;
+        uint32_t end;
+        uint32_t pageCount;
+        uint32_t pagesOffset;               // From the start of the file
+    };
+
+    struct Entry
+    {
+        char name[BUNDLE_NAME_LENGTH];
+        unsigned char fingerprint[BUNDLE_HASH_BYTES];
+        uint32_t rangeCount;
+        Range ranges[BUNDLE_MAX_RANGES];
+    };
+
+    struct Page
+    {
+        uint32_t offset;                    // Bytes into the range
+        unsigned char data[BUNDLE_PAGE_BYTES];
+    };
+    #pragma pack()
+
+	// Members
+    QFile file;
+    const uchar* base;                      // The mapped file
+    const Header* header;
+    const Entry* index;
+
+	// Methods
+    static int PageCount(const PICData::MemoryRange& range);
+};
+
+#endif // IMAGEBUNDLE_H
@@ -0,0 +1,291 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include <QString>
+
+#include "ImageDiff.h"
+#include "Bootloader.h"
+
+// SSE2 is always there on x64, on 32 bit MSVC only with /arch:SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define IMAGE_DIFF_SSE2
+#endif
+
+ImageDiff::ImageDiff()
+{
+    Clear();
+}
+
+void ImageDiff::Clear(void)
+{
+    extents.clear();
+    extentCount = 0;
+    mismatchedBytes = 0;
+    comparedBytes = 0;
+    skippedBytes = 0;
+}
+
+bool ImageDiff::isEmpty(void) const
+{
+    return extentCount == 0;
+}
+
+/*
+ * Offset of the first byte where the buffers differ, length when they match
+ */
+uint32_t ImageDiff::Mismatch(const unsigned char* expected, const unsigned char* actual, uint32_t length)
+{
+    uint32_t i = 0;
+
+#ifdef IMAGE_DIFF_SSE2
+    for(; (i + 16) <= length; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(expected + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(actual + i));
+
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF)
+            break;
+    }
+#else
+    uint64_t a, b;
+
+    for(; (i + 8) <= length; i += 8)
+    {
+        memcpy(&a, expected + i, 8);
+        memcpy(&b, actual + i, 8);
+        if(a != b)
+            break;
+    }
+#endif
+
+    // The block that differs, and the tail
+    while((i < length) && (expected[i] == actual[i]))
+        i++;
+
+    return i;
+}
+
+/*
+ * Offset of the first byte of actual that is not expected, length when all
+ * of them are
+ */
+uint32_t ImageDiff::Mismatch(unsigned char expected, const unsigned char* actual, uint32_t length)
+{
+    uint32_t i = 0;
+
+#ifdef IMAGE_DIFF_SSE2
+    __m128i fill = _mm_set1_epi8((char)expected);
+
+    for(; (i + 16) <= length; i += 16)
+    {
+        __m128i b = _mm_loadu_si128((const __m128i*)(actual + i));
+
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(fill, b)) != 0xFFFF)
+            break;
+    }
+#else
+    uint64_t fill = expected * 0x0101010101010101ULL;
+    uint64_t b;
+
+    for(; (i + 8) <= length; i += 8)
+    {
+        memcpy(&b, actual + i, 8);
+        if(b != fill)
+            break;
+    }
+#endif
+
+    while((i < length) && (actual[i] == expected))
+        i++;
+
+    return i;
+}
+
+/*
+ * Records every run of bytes where actual differs from expected.  address is
+ * the device address of the first byte, each address holds bytesPerAddress
+ * bytes.
+ */
+void ImageDiff::Compare(unsigned char type, uint32_t address, unsigned int bytesPerAddress,
+                        const unsigned char* expected, const unsigned char* actual, uint32_t length)
+{
+    uint32_t offset = 0;
+    uint32_t run;
+
+    while(offset < length)
+    {
+        offset += Mismatch(expected + offset, actual + offset, length - offset);
+        if(offset >= length)
+            break;
+
+        run = offset;
+        while((offset < length) && (expected[offset] != actual[offset]))
+            offset++;
+
+        Add(type, address + (run / bytesPerAddress), expected + run, 0, actual + run, offset - run);
+    }
+
+    comparedBytes += length;
+}
+
+/*
+ * Compares each selected region of actual against the region of expected
+ * starting at the same address
+ */
+void ImageDiff::CompareImages(const PICData* expected, const PICData* actual, bool flash, bool eeprom)
+{
+    PICData::MemoryRange actualRange, expectedRange;
+    unsigned int bytesPerAddress;
+    uint32_t length;
+
+    foreach(actualRange, actual->ranges)
+    {
+        if(!((flash && (actualRange.type == PROGRAM_MEM)) || (eeprom && (actualRange.type == EEPROM_MEM))))
+            continue;
+
+        bytesPerAddress = BytesPerAddress(actualRange.type);
+        foreach(expectedRange, expected->ranges)
+        {
+            if(expectedRange.start != actualRange.start)
+                continue;
+
+            length = (qMin(actualRange.end, expectedRange.end) - actualRange.start) * bytesPerAddress;
+            Compare(actualRange.type, actualRange.start, bytesPerAddress, expectedRange.pDataBuffer, actualRange.pDataBuffer, length);
+        }
+    }
+}
+
+/*
+ * Compares a part of a region read back against the image region that
+ * contains it
+ */
+void ImageDiff::CompareRange(const PICData* expected, const PICData::MemoryRange& actual)
+{
+    PICData::MemoryRange expectedRange;
+    unsigned int bytesPerAddress = BytesPerAddress(actual.type);
+
+    foreach(expectedRange, expected->ranges)
+    {
+        if((expectedRange.type != actual.type) || (actual.start < expectedRange.start) || (actual.start >= expectedRange.end))
+            continue;
+
+        Compare(actual.type, actual.start, bytesPerAddress, expectedRange.pDataBuffer + (actual.start - expectedRange.start) * bytesPerAddress,
+                actual.pDataBuffer, (qMin(actual.end, expectedRange.end) - actual.start) * bytesPerAddress);
+        return;
+    }
+}
+
+/*
+ * Records every run of bytes in the selected regions of actual that are not
+ * erased
+ */
+void ImageDiff::BlankCheck(const PICData* actual, bool flash, bool eeprom)
+{
+    PICData::MemoryRange range;
+    unsigned int bytesPerAddress;
+    uint32_t length, offset, run;
+
+    foreach(range, actual->ranges)
+    {
+        if(!((flash && (range.type == PROGRAM_MEM)) || (eeprom && (range.type == EEPROM_MEM))))
+            continue;
+
+        bytesPerAddress = BytesPerAddress(range.type);
+        length = (range.end - range.start) * bytesPerAddress;
+        offset = 0;
+        while(offset < length)
+        {
+            offset += Mismatch((unsigned char)IMAGE_DIFF_BLANK, range.pDataBuffer + offset, length - offset);
+            if(offset >= length)
+                break;
+
+            run = offset;
+            while((offset < length) && (range.pDataBuffer[offset] != IMAGE_DIFF_BLANK))
+                offset++;
+
+            Add(range.type, range.start + (run / bytesPerAddress), NULL, IMAGE_DIFF_BLANK, range.pDataBuffer + run, offset - run);
+        }
+
+        comparedBytes += length;
+    }
+}
+
+/*
+ * One line per extent, at most maxExtents of them, followed by a summary
+ * when there are more
+ */
+QStringList ImageDiff::Describe(int maxExtents) const
+{
+    QStringList lines;
+    int i;
+
+    for(i = 0; (i < extents.count()) && (i < maxExtents); i++)
+    {
+        const Extent& extent = extents.at(i);
+        QString more = (extent.length > (uint32_t)extent.actual.size()) ? "..." : "";
+
+        lines << QString("%1 at 0x%2: %3 byte(s) differ, expected %4%5 read %6%5")
+                 .arg((extent.type == EEPROM_MEM) ? "EEPROM" : "Program Memory")
+                 .arg(extent.address, 0, 16)
+                 .arg(extent.length)
+                 .arg(QString(extent.expected.toHex()))
+                 .arg(more)
+                 .arg(QString(extent.actual.toHex()));
+    }
+
+    if(extentCount > (uint32_t)i)
+        lines << QString("%1 more mismatching extent(s), %2 of %3 bytes differ in total")
+                 .arg(extentCount - i).arg(mismatchedBytes).arg(comparedBytes);
+
+    return lines;
+}
+
+/*
+ * Counts a run of mismatching bytes and keeps its start.  expected is NULL
+ * when every byte was expected to be fill.
+ */
+void ImageDiff::Add(unsigned char type, uint32_t address, const unsigned char* expected, unsigned char fill, const unsigned char* actual, uint32_t length)
+{
+    Extent extent;
+    int kept = (int)qMin(length, (uint32_t)IMAGE_DIFF_MAX_BYTES);
+
+    extentCount++;
+    mismatchedBytes += length;
+    if(extents.count() >= IMAGE_DIFF_MAX_EXTENTS)
+        return;
+
+    extent.type = type;
+    extent.address = address;
+    extent.length = length;
+    if(expected == NULL)
+        extent.expected = QByteArray(kept, (char)fill);
+    else
+        extent.expected = QByteArray((const char*)expected, kept);
+    extent.actual = QByteArray((const char*)actual, kept);
+    extents.append(extent);
+}
+
+unsigned int ImageDiff::BytesPerAddress(unsigned char type)
+{
+    if(type == EEPROM_MEM)
+        return Bootloader::bytesPerAddressEEPROM;
+
+    return Bootloader::bytesPerAddressFLASH;
+}
@@ -0,0 +1,86 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef IMAGEDIFF_H
+#define IMAGEDIFF_H
+
+#include <stdint.h>
+#include <QByteArray>
+#include <QList>
+#include <QStringList>
+#include "PICData.h"
+
+// Extents kept with their contents, any further ones are only counted
+#define IMAGE_DIFF_MAX_EXTENTS  256
+// Bytes of each extent kept for the report
+#define IMAGE_DIFF_MAX_BYTES    16
+// Value of erased memory
+#define IMAGE_DIFF_BLANK        0xFF
+
+/*!
+ * Compares memory images and records every run of mismatching bytes.
+ *
+ * The buffers are scanned 16 bytes at a time with SSE2 (8 bytes at a time
+ * elsewhere), so matching memory costs about as much as a memcmp() and only
+ * the mismatches are looked at byte by byte.  Nothing stops at the first bad
+ * address: the result is the whole mismatch map of the image, needed for
+ * failure analysis of production parts.
+ */
+class ImageDiff
+{
+public:
+	// A run of consecutive mismatching bytes
+	struct Extent
+	{
+		unsigned char type;         // PROGRAM_MEM or EEPROM_MEM
+		uint32_t address;           // Device address of the first bad byte
+		uint32_t length;            // Bytes in the run
+		QByteArray expected;        // First IMAGE_DIFF_MAX_BYTES of the run
+		QByteArray actual;
+	};
+
+	// Constructor
+    ImageDiff();
+
+	// Members
+    QList<Extent> extents;          // The first IMAGE_DIFF_MAX_EXTENTS runs, in address order
+    uint32_t extentCount;           // All runs found, including the ones not kept
+    uint32_t mismatchedBytes;
+    uint32_t comparedBytes;
+    uint32_t skippedBytes;          // Left out by the verify policy
+
+	// Methods
+    void Clear(void);
+    bool isEmpty(void) const;
+    void Compare(unsigned char type, uint32_t address, unsigned int bytesPerAddress,
+                 const unsigned char* expected, const unsigned char* actual, uint32_t length);
+    void CompareImages(const PICData* expected, const PICData* actual, bool flash, bool eeprom);
+    void CompareRange(const PICData* expected, const PICData::MemoryRange& actual);
+    void BlankCheck(const PICData* actual, bool flash, bool eeprom);
+    QStringList Describe(int maxExtents = 8) const;
+
+    static uint32_t Mismatch(const unsigned char* expected, const unsigned char* actual, uint32_t length);
+    static uint32_t Mismatch(unsigned char expected, const unsigned char* actual, uint32_t length);
+    static unsigned int BytesPerAddress(unsigned char type);
+
+protected:
+	// Methods
+    void Add(unsigned char type, uint32_t address, const unsigned char* expected, unsigned char fill, const unsigned char* actual, uint32_t length);
+};
+
+#endif // IMAGEDIFF_H
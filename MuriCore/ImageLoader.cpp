@@ -0,0 +1,143 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QTime>
+
+#include "ImageLoader.h"
+#include "HexLoader.h"
+#include "Bootloader.h"
+#include "Trace.h"
+
+ImageLoad::ImageLoad(int id, QString fileName)
+{
+    this->id = id;
+    this->fileName = fileName;
+    data = new PICData();
+
+    // The pool must not delete the load, its image is taken once Finished() arrives
+    setAutoDelete(false);
+}
+
+ImageLoad::~ImageLoad()
+{
+    if(data != NULL)
+        PICData::Free(data);
+}
+
+/*
+ * Parses the file, on the loader's thread
+ */
+void ImageLoad::run(void)
+{
+    QTime elapsed;
+    Bootloader device(data);
+    HexLoader import;
+    HexLoader::ErrorCode result;
+    TRACE_SCOPE("ImageLoad");
+
+    elapsed.start();
+    result = import.ImportHexFile(fileName, data, &device);
+
+    emit Finished(id, result, ((double)elapsed.elapsed()) / 1000);
+}
+
+/*
+ * Hands the parsed image over to the caller, once run() is over
+ */
+PICData* ImageLoad::Take(void)
+{
+    PICData* image = data;
+
+    data = NULL;
+    return image;
+}
+
+ImageLoader::ImageLoader(QObject* parent) : QObject(parent)
+{
+    current = 0;
+    loading = false;
+
+    // Files are parsed one at a time, in the order they were opened
+    pool.setMaxThreadCount(1);
+}
+
+ImageLoader::~ImageLoader()
+{
+    pool.waitForDone();
+}
+
+/*
+ * Starts loading fileName, Loaded() tells how it went
+ */
+void ImageLoader::Start(QString fileName)
+{
+    ImageLoad* load;
+
+    current++;
+    loading = true;
+    name = fileName;
+
+    load = new ImageLoad(current, fileName);
+    connect(load, SIGNAL(Finished(int,int,double)), this, SLOT(LoadFinished(int,int,double)));
+    connect(load, SIGNAL(Finished(int,int,double)), load, SLOT(deleteLater()));
+    pool.start(load);
+}
+
+/*
+ * Drops the result of the load still running, image() stays as it is
+ */
+void ImageLoader::Cancel(void)
+{
+    current++;
+    loading = false;
+}
+
+bool ImageLoader::isLoading(void) const
+{
+    return loading;
+}
+
+/*
+ * The file being loaded, or the last one loaded
+ */
+QString ImageLoader::fileName(void) const
+{
+    return name;
+}
+
+/*
+ * The last file loaded, null before the first one
+ */
+ImageSnapshot ImageLoader::image(void) const
+{
+    return snapshot;
+}
+
+void ImageLoader::LoadFinished(int id, int result, double time)
+{
+    ImageLoad* load = qobject_cast<ImageLoad*>(sender());
+
+    if((id != current) || (load == NULL))
+        return;
+
+    loading = false;
+    if(result == HexLoader::Success)
+        snapshot = PICData::Freeze(load->Take());
+
+    emit Loaded(name, result, time);
+}
@@ -0,0 +1,97 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+#include <QObject>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QString>
+#include "PICData.h"
+
+/*!
+ * Parses one hex file into a PICData of its own, on the loader's thread.
+ */
+class ImageLoad : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+	// Constructor/Destructor
+    ImageLoad(int id, QString fileName);
+    ~ImageLoad();
+
+	// Methods
+    void run(void);
+    PICData* Take(void);
+
+signals:
+    void Finished(int id, int result, double time);
+
+protected:
+	// Members
+    int id;
+    QString fileName;
+    PICData* data;
+};
+
+/*!
+ * Loads hex files off the GUI thread.
+ *
+ * Start() returns at once, the file is parsed on a thread of the loader and
+ * published as a new snapshot on the thread that started it, right before
+ * Loaded() is emitted.  Nothing is copied and snapshots handed out earlier
+ * stay as they were, so a write can go on with the image it started with
+ * while the next one loads.  image() keeps the last good snapshot when a
+ * file cannot be loaded.  Starting another load drops the result of the one
+ * still running.
+ */
+class ImageLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+	// Constructor/Destructor
+    explicit ImageLoader(QObject* parent = 0);
+    ~ImageLoader();
+
+	// Methods
+    void Start(QString fileName);
+    void Cancel(void);
+    bool isLoading(void) const;
+    QString fileName(void) const;
+    ImageSnapshot image(void) const;
+
+signals:
+    // result is a HexLoader::ErrorCode
+    void Loaded(QString fileName, int result, double time);
+
+private slots:
+    void LoadFinished(int id, int result, double time);
+
+protected:
+	// Members
+    QThreadPool pool;
+    int current;                // Id of the latest load, older ones are ignored
+    bool loading;
+    QString name;
+    ImageSnapshot snapshot;     // Last file loaded
+};
+
+#endif // IMAGELOADER_H
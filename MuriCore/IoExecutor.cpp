@@ -0,0 +1,124 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+
+#include "IoExecutor.h"
+#include "RealtimeIo.h"
+
+IoExecutor::IoExecutor(QObject* parent) : QThread(parent)
+{
+    cancelRequested = false;
+    stopping = false;
+}
+
+/*
+ * Cancels whatever is still running and waits for the thread to finish
+ */
+IoExecutor::~IoExecutor()
+{
+    CancelAll();
+
+    mutex.lock();
+    stopping = true;
+    wake.wakeOne();
+    mutex.unlock();
+
+    wait();
+}
+
+/*
+ * Queues an operation, it starts on the next pass of the I/O thread.  Can
+ * be called from any thread.
+ */
+void IoExecutor::Post(AsyncOperation* operation)
+{
+    QMutexLocker lock(&mutex);
+
+    queued.append(operation);
+    if(!isRunning())
+        start();
+    wake.wakeOne();
+}
+
+/*
+ * Cancels every queued and running operation, each finishes with
+ * USB::Cancelled before its next packet.
+ */
+void IoExecutor::CancelAll(void)
+{
+    QMutexLocker lock(&mutex);
+    AsyncOperation* operation;
+
+    foreach(operation, queued)
+        operation->token().Cancel();
+    cancelRequested = true;
+    wake.wakeOne();
+}
+
+void IoExecutor::run()
+{
+    QList<AsyncOperation*> active;
+    AsyncOperation* operation;
+    int i, wait;
+
+    RealtimeIo::Apply();
+
+    forever
+    {
+        mutex.lock();
+        while(queued.isEmpty() && active.isEmpty() && !stopping)
+            wake.wait(&mutex);
+
+        active.append(queued);
+        queued.clear();
+        if(cancelRequested)
+        {
+            foreach(operation, active)
+                operation->token().Cancel();
+            cancelRequested = false;
+        }
+        mutex.unlock();
+
+        if(active.isEmpty())
+            return;
+
+        // One packet for every running operation, dropping the finished
+        // ones (they delete themselves once Finished is delivered)
+        for(i = 0; i < active.count(); )
+        {
+            if(active.at(i)->Resume())
+                active.removeAt(i);
+            else
+                i++;
+        }
+
+        // Sleep while every operation is waiting on its device (an erase),
+        // a Post() or a cancel still wakes the thread
+        wait = active.isEmpty() ? 0 : INT_MAX;
+        foreach(operation, active)
+            wait = qMin(wait, operation->WaitMs());
+
+        if(wait > 0)
+        {
+            mutex.lock();
+            if(queued.isEmpty() && !cancelRequested && !stopping)
+                wake.wait(&mutex, (unsigned long)wait);
+            mutex.unlock();
+        }
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IOEXECUTOR_H
+#define IOEXECUTOR_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QList>
+#include "AsyncOperation.h"
+
+/*!
+ * Single I/O thread that drives any number of AsyncOperations.
+ *
+ * Every pass gives each running operation one packet in turn, so one thread
+ * keeps several devices busy without a thread per device and a slow device
+ * only delays the others by a packet.  An operation must be the only one
+ * using its USB while it runs.
+ */
+class IoExecutor : public QThread
+{
+    Q_OBJECT
+
+public:
+	// Constructor/Destructor
+    explicit IoExecutor(QObject* parent = 0);
+    ~IoExecutor();
+
+	// Methods
+    void Post(AsyncOperation* operation);
+    void CancelAll(void);
+
+protected:
+	// Members
+    QMutex mutex;
+    QWaitCondition wake;
+    QList<AsyncOperation*> queued;      // Posted, not yet picked up by the thread
+    bool cancelRequested;
+    bool stopping;
+
+	// Methods
+    void run();
+};
+
+#endif // IOEXECUTOR_H
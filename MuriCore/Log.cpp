@@ -0,0 +1,132 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include "Log.h"
+
+#ifdef QT_NO_DEBUG
+QAtomicInt Log::level(Log::Warning);
+#else
+QAtomicInt Log::level(Log::Info);
+#endif
+
+static Log::Record flight[LOG_FLIGHT_RECORDS];
+static QAtomicInt flightCount;          // total records ever written, the ring index is flightCount % LOG_FLIGHT_RECORDS
+static unsigned int flightDumped = 0;   // records already shown by a previous dump
+static QElapsedTimer flightClock;
+static QMutex dumpLock;
+
+/*
+ * Reads the level from MURIPROG_LOG and starts the flight recorder clock.
+ * Call once at startup, before any other thread logs.
+ */
+void Log::Init(void)
+{
+    QByteArray name = qgetenv(LOG_LEVEL_ENV).toLower();
+
+    flightClock.start();
+
+    if(name == "off")
+        level.store(Off);
+    else if(name == "error")
+        level.store(Error);
+    else if(name == "warning")
+        level.store(Warning);
+    else if(name == "info")
+        level.store(Info);
+    else if(name == "debug")
+        level.store(Debug);
+}
+
+void Log::SetLevel(Level newLevel)
+{
+    level.store(newLevel);
+}
+
+/*
+ * Adds a record to the ring.  Any thread can record, claiming a slot is the
+ * only synchronization.  The slot's sequence is cleared while the fields are
+ * written and then published, so a concurrent dump can tell a finished
+ * record from one that is half written or has been lapped.
+ */
+void Log::Flight(const char* what, uint32_t address, uint32_t value)
+{
+    unsigned int index = (unsigned int)flightCount.fetchAndAddRelaxed(1);
+    Record& record = flight[index % LOG_FLIGHT_RECORDS];
+
+    record.sequence.fetchAndStoreAcquire(0);
+    record.timestamp = flightClock.isValid() ? flightClock.nsecsElapsed() / 1000 : 0;
+    record.what = what;
+    record.address = address;
+    record.value = value;
+    record.sequence.storeRelease((int)(index + 1));
+}
+
+/*
+ * Writes the records made since the previous dump (as many as the ring still
+ * holds) to the log, oldest first.  Called when an operation has failed.
+ * Slots another thread is still writing, or has overwritten since the count
+ * was taken, are skipped.
+ */
+void Log::DumpFlight(const char* reason)
+{
+    QMutexLocker locker(&dumpLock);
+    unsigned int count = (unsigned int)flightCount.load();
+    unsigned int skipped = 0;
+    unsigned int i;
+    Record copy;
+
+    if(level.load() < Error)
+        return;
+
+    i = flightDumped;
+    if((count - i) > LOG_FLIGHT_RECORDS)
+        i = count - LOG_FLIGHT_RECORDS;
+
+    qWarning("Flight recorder (%s), last %u events:", reason, count - i);
+    for(; i < count; i++)
+    {
+        Record& record = flight[i % LOG_FLIGHT_RECORDS];
+
+        if((unsigned int)record.sequence.loadAcquire() != (i + 1))
+        {
+            skipped++;
+            continue;
+        }
+        copy.timestamp = record.timestamp;
+        copy.what = record.what;
+        copy.address = record.address;
+        copy.value = record.value;
+        // Ordered so the copy above is complete before the sequence is checked again
+        if((unsigned int)record.sequence.fetchAndAddOrdered(0) != (i + 1))
+        {
+            skipped++;
+            continue;
+        }
+
+        qWarning("  %10lld us  %-16s 0x%08x  %u", (long long)copy.timestamp, copy.what, copy.address, copy.value);
+    }
+    if(skipped)
+        qWarning("  (%u events still being written or overwritten)", skipped);
+
+    flightDumped = count;
+}
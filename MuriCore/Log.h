@@ -0,0 +1,87 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <QAtomicInt>
+#include <QtGlobal>
+
+// Records kept by the flight recorder before the oldest are overwritten
+#define LOG_FLIGHT_RECORDS 4096
+
+// Environment variable selecting the log level: off, error, warning, info or debug
+#define LOG_LEVEL_ENV "MURIPROG_LOG"
+
+/*!
+ * Leveled logging and a flight recorder for the hot paths.
+ *
+ * A disabled LOG_* statement costs a single relaxed load of Log::level, its
+ * arguments are not even evaluated.  The packet and hex import paths log at
+ * Debug, which is off by default, and instead leave a fixed-size binary
+ * record in the flight recorder (a timestamp, a literal and two numbers).
+ * Nothing is formatted until DumpFlight() is called after a failure.
+ */
+class Log
+{
+public:
+	enum Level
+	{
+		Off = 0,
+		Error,
+		Warning,
+		Info,
+		Debug
+	};
+
+	// One flight recorder entry.  what must be a string literal, only the pointer is stored.
+	struct Record
+	{
+		QAtomicInt sequence;    // index of the record plus one once complete, 0 while it is being written
+		int64_t timestamp;      // microseconds since the first record
+		const char* what;
+		uint32_t address;
+		uint32_t value;
+	};
+
+	// Checked by every LOG_* statement, may be changed at any time from any thread
+	static QAtomicInt level;
+
+	// Methods
+	static void Init(void);
+	static void SetLevel(Level newLevel);
+	static void Flight(const char* what, uint32_t address, uint32_t value);
+	static void DumpFlight(const char* reason);
+};
+
+#ifdef MURIPROG_NO_LOG
+	#define LOG_ERROR(...)
+	#define LOG_WARNING(...)
+	#define LOG_INFO(...)
+	#define LOG_DEBUG(...)
+	#define LOG_FLIGHT(what, address, value)
+#else
+	#define LOG_ERROR(...) do { if(Log::level.load() >= Log::Error) qWarning(__VA_ARGS__); } while(0)
+	#define LOG_WARNING(...) do { if(Log::level.load() >= Log::Warning) qWarning(__VA_ARGS__); } while(0)
+	#define LOG_INFO(...) do { if(Log::level.load() >= Log::Info) qDebug(__VA_ARGS__); } while(0)
+	#define LOG_DEBUG(...) do { if(Log::level.load() >= Log::Debug) qDebug(__VA_ARGS__); } while(0)
+	// Always recorded, dumped by Log::DumpFlight()
+	#define LOG_FLIGHT(what, address, value) Log::Flight(what, address, value)
+#endif
+
+#endif // LOG_H
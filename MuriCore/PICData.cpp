@@ -27,7 +27,6 @@ PICData::PICData() {
 // Simple way to add an item to the ranges array
 void PICData::QuickAdd(unsigned char type, unsigned int size, unsigned int startAddress)
 {
-	unsigned int i;
 	PICData::MemoryRange tmp;
 	tmp.type = type;
 	tmp.dataBufferLength = size * Bootloader::bytesPerAddressFLASH;
@@ -36,9 +35,40 @@ void PICData::QuickAdd(unsigned char type, unsigned int size, unsigned int start
 	tmp.start = startAddress;
 	tmp.end = tmp.start + tmp.dataBufferLength;
 
-	for(i = 0; i < tmp.dataBufferLength; i++)
-		tmp.pDataBuffer[i] = 0xFF;
-
 	ranges.append(tmp);
 }
 PICData::~PICData() {}
+
+/*
+ * Hands data over as a snapshot, its buffers are freed along with the last
+ * reference.  data must not be written afterwards.
+ */
+ImageSnapshot PICData::Freeze(PICData* data)
+{
+	return ImageSnapshot(data, Free);
+}
+
+/*
+ * A snapshot that leaves data to its owner, for callers that outlive every
+ * use of it (ex: a step run to completion on the caller's thread)
+ */
+ImageSnapshot PICData::Borrow(const PICData* data)
+{
+	return ImageSnapshot(data, Keep);
+}
+
+/*
+ * PICData leaves its buffers to the owner
+ */
+void PICData::Free(const PICData* data)
+{
+	PICData::MemoryRange range;
+
+	foreach(range, data->ranges)
+		delete[] range.pDataBuffer;
+	delete data;
+}
+
+void PICData::Keep(const PICData* data)
+{
+}
@@ -19,6 +19,7 @@
 #define PICDEVICE_H
 
 #include <QVector>
+#include <QSharedPointer>
 
 // Types of PIC memory regions
 #define PROGRAM_MEM			0x01
@@ -27,6 +28,12 @@
 #define USERID_MEM       0x04
 #define END_OF_TYPES_LIST   0xFF
 
+class PICData;
+
+// An image published to other threads.  Never written once shared, so any
+// number of jobs can read it while a newer one is being loaded.
+typedef QSharedPointer<const PICData> ImageSnapshot;
+
 // Provides a representation of microcontroller device memory contents.
 class PICData
 {
@@ -45,7 +52,14 @@ class PICData
 
         QList<PICData::MemoryRange> ranges;
 
-		void PICData::QuickAdd(unsigned char type, unsigned int size, unsigned int startAddress);
+		void QuickAdd(unsigned char type, unsigned int size, unsigned int startAddress);
+
+        static ImageSnapshot Freeze(PICData* data);
+        static ImageSnapshot Borrow(const PICData* data);
+        static void Free(const PICData* data);
+
+    protected:
+        static void Keep(const PICData* data);
 };
 
 #endif // end PICDATA_H
@@ -0,0 +1,107 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+#include "PayloadCodec.h"
+
+/*
+ * Encodes as much of source as fits into room bytes of out.  Returns the
+ * encoded size, consumed is set to the source bytes it covers.
+ */
+uint32_t PayloadCodec::Encode(const unsigned char* source, uint32_t length, unsigned char* out, uint32_t room, uint32_t* consumed)
+{
+    uint32_t position = 0, used = 0, run, literal;
+
+    while(position < length)
+    {
+        run = Run(source + position, length - position);
+        if(run >= PAYLOAD_MIN_RUN)
+        {
+            if((used + 2) > room)
+                break;
+            out[used++] = (unsigned char)(0x80 + run - PAYLOAD_MIN_RUN);
+            out[used++] = source[position];
+            position += run;
+            continue;
+        }
+
+        // Literals up to the next run worth coding
+        literal = 1;
+        while(((position + literal) < length) && (literal < PAYLOAD_MAX_LITERAL) &&
+              (Run(source + position + literal, length - position - literal) < PAYLOAD_MIN_RUN))
+            literal++;
+
+        if((used + 1) >= room)
+            break;
+        if((used + 1 + literal) > room)
+            literal = room - used - 1;
+
+        out[used++] = (unsigned char)(literal - 1);
+        memcpy(out + used, source + position, literal);
+        used += literal;
+        position += literal;
+    }
+
+    *consumed = position;
+    return used;
+}
+
+/*
+ * Decodes a payload into out.  Returns the decoded size, or -1 when the
+ * stream is cut short or would not fit into room bytes.
+ */
+int PayloadCodec::Decode(const unsigned char* in, uint32_t length, unsigned char* out, uint32_t room)
+{
+    uint32_t position = 0, written = 0, count;
+    unsigned char token;
+
+    while(position < length)
+    {
+        token = in[position++];
+        if(token >= 0x80)
+        {
+            count = token - 0x80 + PAYLOAD_MIN_RUN;
+            if((position >= length) || ((written + count) > room))
+                return -1;
+            memset(out + written, in[position++], count);
+        }
+        else
+        {
+            count = token + 1;
+            if(((position + count) > length) || ((written + count) > room))
+                return -1;
+            memcpy(out + written, in + position, count);
+            position += count;
+        }
+        written += count;
+    }
+
+    return (int)written;
+}
+
+/*
+ * Length of the run of equal bytes source starts with, at most one token
+ */
+uint32_t PayloadCodec::Run(const unsigned char* source, uint32_t length)
+{
+    uint32_t run = 1;
+
+    while((run < length) && (run < PAYLOAD_MAX_RUN) && (source[run] == source[0]))
+        run++;
+    return run;
+}
@@ -0,0 +1,50 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PAYLOADCODEC_H
+#define PAYLOADCODEC_H
+
+#include <stdint.h>
+
+// A repeated byte shorter than this is cheaper as literals
+#define PAYLOAD_MIN_RUN         3
+// Longest run and longest literal stretch of a single token
+#define PAYLOAD_MAX_RUN         (0x7F + PAYLOAD_MIN_RUN)
+#define PAYLOAD_MAX_LITERAL     0x80
+
+/*!
+ * Run length coding of PROGRAM_COMPRESSED payloads.
+ *
+ * The stream is a series of tokens.  A token byte below 0x80 is followed by
+ * token + 1 literal bytes, one of 0x80 or above by a single byte repeated
+ * (token - 0x80) + PAYLOAD_MIN_RUN times.  Decoding needs no state beyond
+ * the output position, so the firmware can decode straight into its write
+ * buffer.
+ */
+class PayloadCodec
+{
+public:
+	// Methods
+    static uint32_t Encode(const unsigned char* source, uint32_t length, unsigned char* out, uint32_t room, uint32_t* consumed);
+    static int Decode(const unsigned char* in, uint32_t length, unsigned char* out, uint32_t room);
+
+protected:
+    static uint32_t Run(const unsigned char* source, uint32_t length);
+};
+
+#endif // PAYLOADCODEC_H
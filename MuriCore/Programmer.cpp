@@ -0,0 +1,562 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QTime>
+
+#include "Programmer.h"
+#include "AsyncOperation.h"
+#include "Trace.h"
+#include "Log.h"
+
+Programmer::Programmer(USB* comm)
+{
+    this->comm = comm;
+    picData = new PICData();
+    writeFlash = true;
+    writeEeprom = false;
+    pipelined = true;
+    resume = false;
+    resumed = false;
+    memset((void*)&firmwareInfo, 0x00, sizeof(firmwareInfo));
+}
+
+Programmer::~Programmer()
+{
+    delete picData;
+}
+
+/*
+ * Fetches the signature and erase page layout of the connected firmware,
+ * needed by the post signing verify.
+ */
+USB::ErrorCode Programmer::ReadFirmwareInfo(void)
+{
+    return comm->ReadFirmwareInfo(&firmwareInfo);
+}
+
+/*
+ * Send an Erase command
+ */
+USB::ErrorCode Programmer::EraseDevice(void)
+{
+    QTime elapsed;
+    USB::ErrorCode result;    
+    TRACE_SCOPE("Erase");
+
+    emit IoWithDeviceStarted("Erasing memory... (no status update until complete, may take several seconds)");
+    comm->progressCounter()->BeginPhase(ProgressCounter::Erase, 0);
+    elapsed.start();
+
+    result = comm->Erase();
+    if(result != USB::Success)
+    {
+        emit IoWithDeviceCompleted("Erase", result, ((double)elapsed.elapsed()) / 1000);
+        return result;
+    }    
+
+    emit IoWithDeviceCompleted("Erase", result, ((double)elapsed.elapsed()) / 1000);
+    return result;
+}
+
+/*
+ * Erases the Muribot, writes the parsed file memory ranges contained in
+ * hexData->ranges to it, then verifies and signs them.
+ *
+ * A pipelined write journals every span that verified.  With resume set and
+ * a journal of the same image left by a write that was cut short, the erase
+ * is skipped: the journaled spans are read back and only the rest written.
+ * Should the journaled spans no longer match, the write starts over.
+ */
+USB::ErrorCode Programmer::WriteDevice(const PICData* hexData)
+{
+    USB::ErrorCode result = USB::Fail;
+    bool journaled;
+    TRACE_SCOPE("WriteDevice");
+
+    diff.Clear();
+    resumed = false;
+    journaled = journal.Open(comm->serialNumber(), ProgressJournal::ImageHash(hexData, writeFlash, writeEeprom));
+
+    if(resume && pipelined && journaled)
+    {
+        emit AppendString(QString("Resuming the interrupted write, %1 spans were already written.").arg(journal.spans()));
+        result = WriteVerify(hexData, &journal, false);
+        resumed = (result == USB::Success);
+
+        if((result == USB::Fail) && !diff.isEmpty())
+        {
+            emit AppendString("The device changed since the write was interrupted, writing it again.");
+            diff.Clear();
+        }
+        else if(result != USB::Success)
+            return result;
+    }
+
+    if(!resumed)
+    {
+        journaled = pipelined && journal.Start();
+
+        //First erase the entire device.
+        result = EraseDevice();
+
+        //Now being re-programming each section based on the info we obtained when
+        //we parsed the user's .hex file.
+        if(pipelined)
+        {
+            if(result == USB::Success)
+                result = WriteVerify(hexData, journaled ? &journal : NULL, true);
+        }
+        else
+        {
+            if(result == USB::Success)
+                result = ProgramDevice(hexData);
+            if(result == USB::Success)
+                result = VerifyDevice(hexData);
+        }
+    }
+    if(result == USB::Success)
+        result = SignDevice(hexData);
+
+    if(result == USB::Success)
+    {
+        journal.Remove();
+        comm->progressCounter()->Finish();
+    }
+
+    return result;
+}
+
+/*
+ * Writes the parsed file memory ranges contained in hexData->ranges to an
+ * already erased Muribot.
+ */
+USB::ErrorCode Programmer::ProgramDevice(const PICData* hexData)
+{
+    QTime elapsed;
+    USB::ErrorCode result = USB::Success;
+    PICData::MemoryRange hexRange;
+    TRACE_SCOPE("ProgramDevice");
+
+    emit IoWithDeviceStarted("Writing memory...");
+    comm->progressCounter()->BeginPhase(ProgressCounter::Program, SelectedBytes(hexData));
+    elapsed.start();
+    foreach(hexRange, hexData->ranges)
+    {
+        if(writeFlash && (hexRange.type == PROGRAM_MEM))
+        {
+            TRACE_SCOPE_ADDRESS(trace, "Program", hexRange.start);
+
+            result = comm->Program(hexRange.start,
+                                   comm->payloadSize(),
+                                   Bootloader::bytesPerAddressFLASH,
+                                   Bootloader::bytesPerWordFLASH,
+                                   hexRange.end,
+                                   hexRange.pDataBuffer);
+        }
+        else if(writeEeprom && (hexRange.type ==  EEPROM_MEM))
+        {
+                TRACE_SCOPE_ADDRESS(trace, "Program", hexRange.start);
+
+                result = comm->Program(hexRange.start,
+                                       comm->payloadSize(),
+                                       Bootloader::bytesPerAddressEEPROM,
+                                       Bootloader::bytesPerWordEEPROM,
+                                       hexRange.end,
+                                       hexRange.pDataBuffer);
+        }
+		else continue;
+
+        if(result != USB::Success)
+        {
+            LOG_WARNING("Programming failed");
+            break;
+        }
+    }
+
+    emit IoWithDeviceCompleted("Write", result, ((double)elapsed.elapsed()) / 1000);
+
+    return result;
+}
+
+
+/*
+ * Routine that verifies the contents memory regions after programming.
+ * This function requests the memory contents of the device, then
+ * compares it against the parsed .hex file data to make sure the
+ * locations that got programmed properly match.  Every mismatching
+ * extent is collected in diff, not only the first one.  verifyPlan picks
+ * the parts of the device read back.
+ */
+USB::ErrorCode Programmer::VerifyDevice(const PICData* hexData)
+{
+    USB::ErrorCode result;
+    QList<PICData::MemoryRange> ranges;
+    PICData::MemoryRange range;
+    QTime elapsed;
+    TRACE_SCOPE("Verify");
+
+    emit IoWithDeviceStarted("Verifying memory...");
+    elapsed.start();
+
+    diff.Clear();
+    ranges = verifyPlan.Ranges(picData, hexData, writeFlash, writeEeprom);
+    result = ReadRanges(ranges);
+    if(result == USB::Success)
+    {
+        //Compare all of the programmable memory read back with the parsed .hex file data
+        //at the same addresses.
+        foreach(range, ranges)
+            diff.CompareRange(hexData, range);
+        diff.skippedBytes = SelectedBytes(picData) - diff.comparedBytes;
+        LOG_DEBUG("Verify policy %s: %u bytes compared, %u skipped", qPrintable(verifyPlan.name()), diff.comparedBytes, diff.skippedBytes);
+
+        foreach(QString line, diff.Describe())
+            LOG_WARNING("Failed to verify %s", qPrintable(line));
+
+        if(!diff.isEmpty())
+            result = USB::Fail;
+    }
+
+    if(result != USB::Success)
+        VerifyFailed();
+
+    emit IoWithDeviceCompleted("Verify", result, ((double)elapsed.elapsed()) / 1000);
+    return result;
+}
+
+/*
+ * Programs an erased device and verifies it in the same pass, each span is
+ * read back while the firmware flushes the next one.  Stops at the first
+ * span that does not match, with its extents in diff.  See WriteVerifyStep.
+ */
+USB::ErrorCode Programmer::WriteVerifyDevice(const PICData* hexData)
+{
+    return WriteVerify(hexData, NULL, true);
+}
+
+/*
+ * Runs a WriteVerifyStep, recording the spans that verified in journal and
+ * skipping the ones it already holds.  The verify failed message is left
+ * out unless reportFailure, a resume that fails starts over instead.
+ */
+USB::ErrorCode Programmer::WriteVerify(const PICData* hexData, ProgressJournal* journal, bool reportFailure)
+{
+    WriteVerifyStep step(picData, PICData::Borrow(hexData), writeFlash, writeEeprom, firmwareInfo.erasePageSize, verifyPlan, journal);
+    USB::ErrorCode result;
+    QTime elapsed;
+    bool done = false;
+    TRACE_SCOPE("WriteVerify");
+
+    emit IoWithDeviceStarted(step.startMessage());
+    elapsed.start();
+
+    do
+    {
+        result = step.Resume(comm, &done);
+    } while((result == USB::Success) && !done);
+
+    // Keep what verified even when the robot was just unplugged
+    if(journal != NULL)
+        journal->Flush();
+
+    diff = step.mismatches();
+    if(!diff.isEmpty() && reportFailure)
+        VerifyFailed();
+
+    emit IoWithDeviceCompleted("WriteVerify", result, ((double)elapsed.elapsed()) / 1000);
+    return result;
+}
+
+/*
+ * Checks that the selected regions of the device are erased.  Every extent
+ * that is not is collected in diff.
+ */
+USB::ErrorCode Programmer::BlankCheckDevice(void)
+{
+    USB::ErrorCode result;
+    QTime elapsed;
+    TRACE_SCOPE("BlankCheck");
+
+    emit IoWithDeviceStarted("Blank checking memory...");
+    elapsed.start();
+
+    diff.Clear();
+    result = ReadSelected(picData);
+    if(result == USB::Success)
+    {
+        diff.BlankCheck(picData, writeFlash, writeEeprom);
+        foreach(QString line, diff.Describe())
+            LOG_WARNING("Not blank: %s", qPrintable(line));
+
+        if(!diff.isEmpty())
+            result = USB::Fail;
+    }
+
+    emit IoWithDeviceCompleted("BlankCheck", result, ((double)elapsed.elapsed()) / 1000);
+    return result;
+}
+
+/*
+ * Signs a freshly verified image so the bootloader will start it.
+ */
+USB::ErrorCode Programmer::SignDevice(const PICData* hexData)
+{
+    USB::ErrorCode result;
+    QTime elapsed;
+    unsigned int i;
+    bool failureDetected = false;
+    unsigned char flashData[MAX_ERASE_BLOCK_SIZE];
+    unsigned char hexEraseBlockData[MAX_ERASE_BLOCK_SIZE];
+    uint32_t startOfEraseBlock;
+    uint32_t errorAddress = 0;
+    uint16_t expectedResult = 0;
+    uint16_t actualResult = 0;
+    TRACE_SCOPE("Sign");
+
+    elapsed.start();
+
+    //Successfully verified all regions without error.
+    //If this is a v1.01 or later device, we now need to issue the SIGN_FLASH
+    //command, and then re-verify the first erase page worth of flash memory
+    //(but with the exclusion of the signature WORD address from the verify,
+    //since the bootloader firmware will have changed it to the new/magic
+    //value (probably 0x600D, or "good" in leet speak).        
+    comm->SignFlash();
+
+    LOG_DEBUG("Expected Signature Address: 0x%x", firmwareInfo.signatureAddress);
+    LOG_DEBUG("Expected Signature Value: 0x%x", firmwareInfo.signatureValue);
+
+    //Now re-verify the first erase page of flash memory.
+    comm->progressCounter()->BeginPhase(ProgressCounter::Verify, firmwareInfo.erasePageSize);
+    startOfEraseBlock = SignedEraseBlock(hexData, firmwareInfo, hexEraseBlockData);
+    result = comm->GetData(startOfEraseBlock, comm->payloadSize(), Bootloader::bytesPerAddressFLASH, Bootloader::bytesPerWordFLASH, (startOfEraseBlock + firmwareInfo.erasePageSize), &flashData[0]);
+    if(result != USB::Success)
+    {
+        failureDetected = true;
+        LOG_WARNING("Error reading, post signing, flash data block.");
+    }
+
+    //We now have both the hex data and the post signing flash erase block data
+    //in two RAM buffers.  Compare them to each other to perform post-signing
+    //verify.
+    i = ImageDiff::Mismatch(hexEraseBlockData, flashData, firmwareInfo.erasePageSize);
+    if(i < firmwareInfo.erasePageSize)
+    {
+        failureDetected = true;
+        LOG_WARNING("Post signing verify failure.");
+        EraseDevice();  //Send an erase command, to forcibly
+        //remove the signature (which might be valid), since
+        //there was a verify error and we can't trust the application
+        //firmware image integrity.  This ensures the device jumps
+        //back into bootloader mode always.
+
+        errorAddress = startOfEraseBlock + i;
+        expectedResult = hexEraseBlockData[i] + ((uint32_t)hexEraseBlockData[i+1] << 8);
+        actualResult = flashData[i] + ((uint32_t)flashData[i+1] << 8);
+    }
+
+    if(failureDetected == true)
+    {
+        LOG_DEBUG("Verify failed at address: 0x%x", errorAddress);
+        LOG_DEBUG("Expected result: 0x%x", expectedResult);
+        LOG_DEBUG("Actual result: 0x%x", actualResult);
+        VerifyFailed();
+
+        emit IoWithDeviceCompleted("Sign", USB::Fail, ((double)elapsed.elapsed()) / 1000);
+    }
+    else
+    {
+        emit IoWithDeviceCompleted("Sign", USB::Success, ((double)elapsed.elapsed()) / 1000);
+        emit AppendString("Programming completed successfully!");
+        emit AppendString("You may now turn off and unplug the Muribot.");
+    }
+
+    return failureDetected ? USB::Fail : USB::Success;
+}
+
+/*
+ * Size in bytes of the regions of data selected by writeFlash and writeEeprom
+ */
+uint32_t Programmer::SelectedBytes(const PICData* data) const
+{
+    PICData::MemoryRange range;
+    uint32_t bytes = 0;
+
+    foreach(range, data->ranges)
+    {
+        if(writeFlash && (range.type == PROGRAM_MEM))
+            bytes += (range.end - range.start) * Bootloader::bytesPerAddressFLASH;
+        else if(writeEeprom && (range.type == EEPROM_MEM))
+            bytes += (range.end - range.start) * Bootloader::bytesPerAddressEEPROM;
+    }
+
+    return bytes;
+}
+
+/*
+ * Builds the contents the first erase page should have once signed: the
+ * image, 0xFF where the image has no data, and the signature value at the
+ * signature address.  block must hold MAX_ERASE_BLOCK_SIZE bytes.  Returns
+ * the address of the erase page.
+ */
+uint32_t Programmer::SignedEraseBlock(const PICData* hexData, const USB::FirmwareInfo& firmwareInfo, unsigned char* block)
+{
+    PICData::MemoryRange hexRange;
+    uint32_t startOfEraseBlock;
+    unsigned int i;
+
+    //Initialize an erase block sized buffer with 0xFF.
+    memset(block, 0xFF, MAX_ERASE_BLOCK_SIZE);
+
+    startOfEraseBlock = firmwareInfo.signatureAddress - (firmwareInfo.signatureAddress % firmwareInfo.erasePageSize);
+
+    //Search through all of the programmable memory regions from the parsed .hex file data.
+    //For each of the programmable memory regions found, if the region also overlaps a region
+    //that is part of the erase block, copy out bytes into the block buffer,
+    //for re-verification.
+    foreach(hexRange, hexData->ranges)
+    {
+        //Check if any portion of the range is within the erase block of interest in the device.
+        if((hexRange.start <= startOfEraseBlock) && (hexRange.end > startOfEraseBlock))
+        {
+            unsigned int rangeSize = hexRange.end - hexRange.start;
+            unsigned int address = hexRange.start;
+            unsigned int k = 0;
+
+            //Check every byte in the hex file range, to see if it is inside the erase block of interest
+            for(i = 0; i < rangeSize; i++)
+            {
+                //Check if the current byte we are looking at is inside the erase block of interst
+                if(((address+i) >= startOfEraseBlock) && ((address+i) < (startOfEraseBlock + firmwareInfo.erasePageSize)))
+                {
+                    //The byte is in the erase block of interst.  Copy it out into a new buffer.
+                    block[k] = *(hexRange.pDataBuffer + i);
+                    //Check if this is a signature byte.  If so, replace the value in the buffer
+                    //with the post-signing expected signature value, since this is now the expected
+                    //value from the device, rather than the value from the hex file...
+                    if((address+i) == firmwareInfo.signatureAddress)
+                    {
+                        block[k] = (unsigned char)firmwareInfo.signatureValue;    //Write LSB of signature into buffer
+                    }
+                    if((address+i) == (firmwareInfo.signatureAddress + 1))
+                    {
+                        block[k] = (unsigned char)(firmwareInfo.signatureValue >> 8); //Write MSB into buffer
+                    }
+                    k++;
+                }
+                if((k >= firmwareInfo.erasePageSize) || (k >= MAX_ERASE_BLOCK_SIZE))
+                    break;
+            }
+        }
+    }
+
+    return startOfEraseBlock;
+}
+
+/*
+ * What to tell the user after the image failed to verify
+ */
+QStringList Programmer::VerifyFailedMessage(void)
+{
+    QStringList lines;
+
+    lines << "Operation aborted due to error encountered during verify stage."
+          << "Please try programming the Muribot again."
+          << "If repeated failures are encountered, this may indicate the flash"
+          << "memory has worn out, that the firmware has been damaged, or that"
+          << "there is some other unidentified problem."
+          << ""
+          << "If you continue to experience problems, please contact Mid-Ohio Area Robotics";
+
+    return lines;
+}
+
+void Programmer::VerifyFailed(void)
+{
+    foreach(QString line, VerifyFailedMessage())
+        emit AppendString(line);
+}
+
+/*
+ * Reads the selected memory regions of the Muribot into deviceData, which
+ * must have the same layout as the device (ex: a freshly constructed PICData).
+ */
+USB::ErrorCode Programmer::ReadDevice(PICData* deviceData)
+{
+    USB::ErrorCode result;
+    QTime elapsed;
+    TRACE_SCOPE("ReadDevice");
+
+    emit IoWithDeviceStarted("Reading memory...");
+    elapsed.start();
+
+    result = ReadSelected(deviceData);
+
+    emit IoWithDeviceCompleted("Read", result, ((double)elapsed.elapsed()) / 1000);
+
+    return result;
+}
+
+/*
+ * Reads the regions selected by writeFlash and writeEeprom into deviceData,
+ * as part of the Verify phase
+ */
+USB::ErrorCode Programmer::ReadSelected(PICData* deviceData)
+{
+    QList<PICData::MemoryRange> ranges;
+    PICData::MemoryRange deviceRange;
+
+    foreach(deviceRange, deviceData->ranges)
+    {
+        if((writeFlash && (deviceRange.type == PROGRAM_MEM)) || (writeEeprom && (deviceRange.type == EEPROM_MEM)))
+            ranges.append(deviceRange);
+    }
+
+    return ReadRanges(ranges);
+}
+
+/*
+ * Reads each range into its buffer, as the Verify phase
+ */
+USB::ErrorCode Programmer::ReadRanges(const QList<PICData::MemoryRange>& ranges)
+{
+    USB::ErrorCode result = USB::Success;
+    PICData::MemoryRange range;
+    uint32_t bytes = 0;
+
+    foreach(range, ranges)
+        bytes += range.dataBufferLength;
+
+    comm->progressCounter()->BeginPhase(ProgressCounter::Verify, bytes);
+    foreach(range, ranges)
+    {
+        TRACE_SCOPE_ADDRESS(trace, "ReadRegion", range.start);
+
+        if(range.type == EEPROM_MEM)
+            result = comm->GetData(range.start, comm->payloadSize(), Bootloader::bytesPerAddressEEPROM, Bootloader::bytesPerWordEEPROM, range.end, range.pDataBuffer);
+        else
+            result = comm->GetData(range.start, comm->payloadSize(), Bootloader::bytesPerAddressFLASH, Bootloader::bytesPerWordFLASH, range.end, range.pDataBuffer);
+
+        if(result != USB::Success)
+        {
+            LOG_WARNING("Error reading memory.");
+            break;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,90 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROGRAMMER_H
+#define PROGRAMMER_H
+
+#include <QObject>
+#include <QStringList>
+#include "USB.h"
+#include "PICData.h"
+#include "ImageDiff.h"
+#include "VerifyPlan.h"
+#include "Bootloader.h"
+#include "ProgressJournal.h"
+
+/*!
+ * Runs the erase/program/verify/sign cycle against one bootloader.
+ * WriteDevice() does the whole cycle, the other steps can also be run alone.
+ *
+ * Every device being programmed gets its own Programmer, so several can run
+ * at once on different threads.  The parsed image is only ever read, which
+ * lets all of them share the same PICData.
+ */
+class Programmer : public QObject
+{
+	// Qt Macro
+    Q_OBJECT
+
+signals:
+    void IoWithDeviceCompleted(QString msg, USB::ErrorCode, double time);
+    void IoWithDeviceStarted(QString msg);
+    void AppendString(QString msg);
+
+public:
+	// Constructor/Destructor
+    Programmer(USB* comm);
+    ~Programmer();
+
+	// Members
+    USB::FirmwareInfo firmwareInfo;     // Information about the firmware on the connected Muribot
+    bool writeFlash;
+    bool writeEeprom;
+    bool pipelined;                     // WriteDevice() verifies each span while writing the next
+    VerifyPlan verifyPlan;              // What verify reads back
+    ImageDiff diff;                     // Every mismatch found by the last verify or blank check
+    bool resume;                        // WriteDevice() carries on from an interrupted write of the same image
+    bool resumed;                       // The last WriteDevice() did
+
+	// Methods
+    USB::ErrorCode ReadFirmwareInfo(void);
+    USB::ErrorCode EraseDevice(void);
+    USB::ErrorCode WriteDevice(const PICData* hexData);
+    USB::ErrorCode ProgramDevice(const PICData* hexData);
+    USB::ErrorCode VerifyDevice(const PICData* hexData);
+    USB::ErrorCode WriteVerifyDevice(const PICData* hexData);
+    USB::ErrorCode BlankCheckDevice(void);
+    USB::ErrorCode SignDevice(const PICData* hexData);
+    USB::ErrorCode ReadDevice(PICData* deviceData);
+    static uint32_t SignedEraseBlock(const PICData* hexData, const USB::FirmwareInfo& firmwareInfo, unsigned char* block);
+    static QStringList VerifyFailedMessage(void);
+
+protected:
+	// Members
+    USB* comm;
+    PICData* picData;       // Device memory layout, also receives the read back contents during verify
+    ProgressJournal journal;    // Spans of the current write already verified, see WriteDevice()
+
+	// Methods
+    void VerifyFailed(void);
+    USB::ErrorCode WriteVerify(const PICData* hexData, ProgressJournal* journal, bool reportFailure);
+    USB::ErrorCode ReadSelected(PICData* deviceData);
+    USB::ErrorCode ReadRanges(const QList<PICData::MemoryRange>& ranges);
+    uint32_t SelectedBytes(const PICData* data) const;
+};
+
+#endif // PROGRAMMER_H
@@ -0,0 +1,294 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Progress.h"
+
+ProgressCounter::ProgressCounter()
+{
+    Reset();
+}
+
+/*
+ * Starts a phase of total bytes.  Release ordering so a reader seeing the
+ * new phase also sees its total.
+ */
+void ProgressCounter::BeginPhase(Phase phase, uint32_t total)
+{
+    regionBase = 0;
+    this->total.store((int)total);
+    done.store(0);
+    currentPhase.storeRelease(phase);
+}
+
+/*
+ * Keeps what the previous regions of the phase transferred, Update() then
+ * counts from the start of the next one
+ */
+void ProgressCounter::BeginRegion(void)
+{
+    regionBase = (uint32_t)done.load();
+}
+
+void ProgressCounter::Finish(void)
+{
+    currentPhase.storeRelease(Done);
+}
+
+void ProgressCounter::Reset(void)
+{
+    int i;
+
+    regionBase = 0;
+    total.store(0);
+    done.store(0);
+    retryCount.store(0);
+    resyncCount.store(0);
+    savedCount.store(0);
+    for(i = 0; i < LATENCY_BUCKETS; i++)
+        latencyCount[i].store(0);
+    currentPhase.storeRelease(Idle);
+}
+
+/*
+ * Counts a packet that had to be sent again.  Retries are rare, so these
+ * are full atomic increments.
+ */
+void ProgressCounter::AddRetry(void)
+{
+    retryCount.ref();
+}
+
+void ProgressCounter::AddResync(void)
+{
+    resyncCount.ref();
+}
+
+/*
+ * Counts the reports a compressed packet stood in for, besides itself
+ */
+void ProgressCounter::AddSavedReports(int count)
+{
+    savedCount.fetchAndAddRelaxed(count);
+}
+
+/*
+ * Counts a packet (a program packet sent, or a read request and its
+ * answer) that took us microseconds.  A single relaxed add, the worker
+ * is the only writer.
+ */
+void ProgressCounter::AddLatency(qint64 us)
+{
+    int bucket = 0;
+
+    while((bucket < (LATENCY_BUCKETS - 1)) && (us >= LatencyBound(bucket)))
+        bucket++;
+
+    latencyCount[bucket].fetchAndAddRelaxed(1);
+}
+
+ProgressCounter::Phase ProgressCounter::phase(void) const
+{
+    return (Phase)currentPhase.loadAcquire();
+}
+
+int ProgressCounter::retries(void) const
+{
+    return retryCount.load();
+}
+
+int ProgressCounter::resyncs(void) const
+{
+    return resyncCount.load();
+}
+
+int ProgressCounter::savedReports(void) const
+{
+    return savedCount.load();
+}
+
+int ProgressCounter::latency(int bucket) const
+{
+    if((bucket < 0) || (bucket >= LATENCY_BUCKETS))
+        return 0;
+
+    return latencyCount[bucket].load();
+}
+
+/*
+ * Microseconds within which permille of the packets so far were done, to
+ * the bucket (ex: 990 for the 99th percentile).  0 before the first packet.
+ */
+qint64 ProgressCounter::LatencyPercentile(int permille) const
+{
+    qint64 packets = 0, seen = 0;
+    int i;
+
+    for(i = 0; i < LATENCY_BUCKETS; i++)
+        packets += latency(i);
+    if(packets == 0)
+        return 0;
+
+    for(i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += latency(i);
+        if((seen * 1000) >= (packets * permille))
+            return LatencyBound(i);
+    }
+    return LatencyBound(LATENCY_BUCKETS - 1);
+}
+
+/*
+ * Upper bound of a bucket in microseconds
+ */
+qint64 ProgressCounter::LatencyBound(int bucket)
+{
+    return ((qint64)1) << bucket;
+}
+
+/*
+ * Overall percentage, the position within the current phase scaled into
+ * that phase's band
+ */
+int ProgressCounter::Percent(void) const
+{
+    int first, width;
+    uint32_t phaseTotal, phaseDone;
+
+    switch(phase())
+    {
+        case Erase:
+            first = 0;
+            width = 33;
+            break;
+        case Program:
+            first = 33;
+            width = 34;
+            break;
+        case Verify:
+            first = 67;
+            width = 33;
+            break;
+        case Done:
+            return 100;
+        case Idle:
+        default:
+            return 0;
+    }
+
+    phaseTotal = (uint32_t)total.load();
+    phaseDone = (uint32_t)done.load();
+    if(phaseTotal == 0)
+        return first;
+    if(phaseDone > phaseTotal)
+        phaseDone = phaseTotal;
+
+    return first + (int)(((uint64_t)phaseDone * width) / phaseTotal);
+}
+
+ProgressModel::ProgressModel(QObject* parent) : QObject(parent)
+{
+    lastTotal = -1;
+    timer.setInterval(PROGRESS_SAMPLE_MS);
+    connect(&timer, SIGNAL(timeout()), this, SLOT(Sample()));
+}
+
+/*
+ * Adds a device and returns its index in Changed()
+ */
+int ProgressModel::Add(const ProgressCounter* counter)
+{
+    counters.append(counter);
+    last.append(-1);
+    return counters.count() - 1;
+}
+
+void ProgressModel::Clear(void)
+{
+    timer.stop();
+    counters.clear();
+    last.clear();
+    lastTotal = -1;
+}
+
+void ProgressModel::Start(void)
+{
+    Sample();
+    timer.start();
+}
+
+/*
+ * Stops sampling, after reporting the final values
+ */
+void ProgressModel::Stop(void)
+{
+    timer.stop();
+    Sample();
+}
+
+int ProgressModel::count(void) const
+{
+    return counters.count();
+}
+
+int ProgressModel::Percent(int index) const
+{
+    if((index < 0) || (index >= counters.count()))
+        return 0;
+
+    return counters.at(index)->Percent();
+}
+
+int ProgressModel::Total(void) const
+{
+    int sum = 0;
+    int i;
+
+    if(counters.isEmpty())
+        return 0;
+
+    for(i = 0; i < counters.count(); i++)
+        sum += counters.at(i)->Percent();
+
+    return sum / counters.count();
+}
+
+void ProgressModel::Sample(void)
+{
+    int percent, sum = 0;
+    int i;
+
+    if(counters.isEmpty())
+        return;
+
+    for(i = 0; i < counters.count(); i++)
+    {
+        percent = counters.at(i)->Percent();
+        sum += percent;
+        if(percent != last.at(i))
+        {
+            last[i] = percent;
+            emit Changed(i, percent);
+        }
+    }
+
+    percent = sum / counters.count();
+    if(percent != lastTotal)
+    {
+        lastTotal = percent;
+        emit TotalChanged(percent);
+    }
+}
@@ -0,0 +1,135 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdint.h>
+#include <QObject>
+#include <QAtomicInt>
+#include <QList>
+#include <QTimer>
+
+// How often a ProgressModel samples its counters, which bounds the rate of
+// progress updates reaching the UI
+#define PROGRESS_SAMPLE_MS 50
+
+// Buckets of the packet latency histogram.  Bucket i counts packets that
+// took less than 2^i microseconds (and at least half that), the last one
+// everything slower.
+#define LATENCY_BUCKETS 24
+
+/*!
+ * Progress of one device, published by the thread talking to it and read by
+ * any other thread.
+ *
+ * The worker announces each phase with its size in bytes, after that every
+ * packet costs a single relaxed store of the bytes done.  Nothing is
+ * signalled, a ProgressModel samples the counters at its own pace.
+ */
+class ProgressCounter
+{
+public:
+	// Phases, each one owns a band of the overall percentage
+	enum Phase
+	{
+		Idle = 0,       // 0%
+		Erase,          // 0% - 32%
+		Program,        // 33% - 66%
+		Verify,         // 67% - 100%, also read back and the post sign check
+		Done            // 100%
+	};
+
+	// Constructor
+    ProgressCounter();
+
+	// Methods (worker thread)
+    void BeginPhase(Phase phase, uint32_t total);
+    void BeginRegion(void);
+    void Finish(void);
+    void Reset(void);
+    void AddRetry(void);
+    void AddResync(void);
+    void AddSavedReports(int count);
+    void AddLatency(qint64 us);
+
+    // Bytes done in the current region, the only call made per packet
+    inline void Update(uint32_t regionDone)
+    {
+        done.store((int)(regionBase + regionDone));
+    }
+
+	// Methods (any thread)
+    Phase phase(void) const;
+    int Percent(void) const;
+    int retries(void) const;
+    int resyncs(void) const;
+    int savedReports(void) const;
+    int latency(int bucket) const;
+    qint64 LatencyPercentile(int permille) const;
+    static qint64 LatencyBound(int bucket);
+
+private:
+	// Members
+    QAtomicInt currentPhase;
+    QAtomicInt total;
+    QAtomicInt done;
+    QAtomicInt retryCount;      // Packets sent again after a failed attempt
+    QAtomicInt resyncCount;     // Transfers re-synced with the firmware
+    QAtomicInt savedCount;      // Reports compressed packets made unnecessary
+    QAtomicInt latencyCount[LATENCY_BUCKETS];   // Packets by how long they took, see AddLatency()
+    uint32_t regionBase;        // Bytes of the phase done before the current region, worker thread only
+};
+
+/*!
+ * Samples the progress of one or more devices on a timer in the thread it
+ * lives in (normally the GUI thread) and signals only the values that
+ * changed, at most once per PROGRESS_SAMPLE_MS.
+ */
+class ProgressModel : public QObject
+{
+    Q_OBJECT
+
+public:
+	// Constructor
+    explicit ProgressModel(QObject* parent = 0);
+
+	// Methods
+    int Add(const ProgressCounter* counter);
+    void Clear(void);
+    void Start(void);
+    void Stop(void);
+    int count(void) const;
+    int Percent(int index) const;
+    int Total(void) const;
+
+signals:
+    void Changed(int index, int percent);
+    void TotalChanged(int percent);       // Average over all devices
+
+private slots:
+    void Sample(void);
+
+private:
+	// Members
+    QTimer timer;
+    QList<const ProgressCounter*> counters;     // Not owned, must outlive Clear()
+    QList<int> last;
+    int lastTotal;
+};
+
+#endif // PROGRESS_H
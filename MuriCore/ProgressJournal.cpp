@@ -0,0 +1,289 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QRegExp>
+#include <QStandardPaths>
+
+#if defined(Q_OS_WIN)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "ProgressJournal.h"
+#include "Log.h"
+
+ProgressJournal::ProgressJournal()
+{
+    pendingSpans = 0;
+}
+
+ProgressJournal::~ProgressJournal()
+{
+    Flush();
+    file.close();
+}
+
+/*
+ * Picks the journal of the Muribot with serial.  Spans a previous write of
+ * the same image left behind are loaded and further spans appended to them,
+ * returns false when there is no journal to resume.
+ */
+bool ProgressJournal::Open(QString serial, QByteArray imageHash)
+{
+    Flush();
+    file.close();
+    done.clear();
+    hash = imageHash;
+
+    // Without a serial there is no journal, Start() must not reuse the
+    // previous device's
+    if(serial.isEmpty())
+    {
+        file.setFileName(QString());
+        return false;
+    }
+
+    file.setFileName(FileName(serial));
+    if(!Load(file.fileName(), hash, &done) || done.isEmpty())
+        return false;
+
+    return file.open(QIODevice::WriteOnly | QIODevice::Append);
+}
+
+/*
+ * Starts a new journal for a write from scratch, dropping the old one
+ */
+bool ProgressJournal::Start(void)
+{
+    Flush();
+    file.close();
+    done.clear();
+
+    if(file.fileName().isEmpty())
+        return false;
+
+    QDir().mkpath(QFileInfo(file.fileName()).absolutePath());
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        LOG_WARNING("Cannot write journal %s", qPrintable(file.fileName()));
+        return false;
+    }
+
+    file.write(Header(hash) + '\n');
+    file.flush();
+    Sync();
+    return true;
+}
+
+/*
+ * Notes a span written and verified.  It reaches the disk with the rest of
+ * its batch.
+ */
+void ProgressJournal::Record(unsigned char type, uint32_t start, uint32_t end)
+{
+    Span span;
+
+    if(Contains(type, start, end))
+        return;
+
+    span.type = type;
+    span.start = start;
+    span.end = end;
+    done.append(span);
+
+    if(pendingSpans == 0)
+        sinceSync.start();
+    pending += QString("%1 %2 %3\n").arg(type).arg(start, 0, 16).arg(end, 0, 16).toLatin1();
+    pendingSpans++;
+
+    if((pendingSpans >= JOURNAL_BATCH_SPANS) || (sinceSync.elapsed() >= JOURNAL_SYNC_MS))
+        Flush();
+}
+
+/*
+ * Writes out and syncs the spans recorded since the last batch
+ */
+void ProgressJournal::Flush(void)
+{
+    if(pendingSpans == 0)
+        return;
+
+    if(file.isOpen())
+    {
+        file.write(pending);
+        file.flush();
+        Sync();
+    }
+    pending.clear();
+    pendingSpans = 0;
+}
+
+/*
+ * Deletes the journal once the write it covers is complete
+ */
+void ProgressJournal::Remove(void)
+{
+    pending.clear();
+    pendingSpans = 0;
+    done.clear();
+    file.close();
+    if(!file.fileName().isEmpty())
+        file.remove();
+}
+
+bool ProgressJournal::Contains(unsigned char type, uint32_t start, uint32_t end) const
+{
+    Span span;
+
+    foreach(span, done)
+    {
+        if((span.type == type) && (span.start <= start) && (span.end >= end))
+            return true;
+    }
+    return false;
+}
+
+bool ProgressJournal::isOpen(void) const
+{
+    return file.isOpen();
+}
+
+int ProgressJournal::spans(void) const
+{
+    return done.count();
+}
+
+/*
+ * Hash of the parts of an image a write programs, a journal only applies to
+ * the image it was written for
+ */
+QByteArray ProgressJournal::ImageHash(const PICData* data, bool flash, bool eeprom)
+{
+    QCryptographicHash sha(QCryptographicHash::Sha1);
+    PICData::MemoryRange range;
+
+    foreach(range, data->ranges)
+    {
+        if((flash && (range.type == PROGRAM_MEM)) || (eeprom && (range.type == EEPROM_MEM)))
+        {
+            sha.addData(QString("%1 %2 %3\n").arg(range.type).arg(range.start, 0, 16).arg(range.end, 0, 16).toLatin1());
+            sha.addData((const char*)range.pDataBuffer, range.dataBufferLength);
+        }
+    }
+    return sha.result().toHex();
+}
+
+/*
+ * Whether the Muribot with serial has an unfinished write of the image
+ */
+bool ProgressJournal::Exists(QString serial, QByteArray imageHash)
+{
+    QList<Span> spans;
+
+    if(serial.isEmpty())
+        return false;
+
+    return Load(FileName(serial), imageHash, &spans) && !spans.isEmpty();
+}
+
+/*
+ * Whether the Muribot with serial has an unfinished write of any image, for
+ * when the image is not known yet
+ */
+bool ProgressJournal::Pending(QString serial)
+{
+    QFile in(FileName(serial));
+
+    if(serial.isEmpty() || !in.open(QIODevice::ReadOnly))
+        return false;
+
+    return in.readLine().startsWith(JOURNAL_MAGIC " ");
+}
+
+QString ProgressJournal::FileName(QString serial)
+{
+    QString name = serial;
+
+    name.replace(QRegExp("[^A-Za-z0-9_-]"), "_");
+    return QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/journal/" + name + ".journal";
+}
+
+QByteArray ProgressJournal::Header(QByteArray imageHash)
+{
+    QByteArray header(JOURNAL_MAGIC);
+
+    header.append(' ');
+    header.append(imageHash);
+    return header;
+}
+
+/*
+ * Reads the spans of a journal, false when there is none for imageHash.
+ * Stops at the first line that is not complete.
+ */
+bool ProgressJournal::Load(QString fileName, QByteArray imageHash, QList<Span>* spans)
+{
+    QFile in(fileName);
+    QByteArray line;
+    QList<QByteArray> fields;
+    Span span;
+    bool ok[3];
+
+    spans->clear();
+    if(!in.open(QIODevice::ReadOnly))
+        return false;
+
+    if(in.readLine().trimmed() != Header(imageHash))
+        return false;
+
+    while(!in.atEnd())
+    {
+        line = in.readLine();
+        if(!line.endsWith('\n'))
+            break;
+
+        fields = line.trimmed().split(' ');
+        if(fields.count() != 3)
+            break;
+
+        span.type = (unsigned char)fields.at(0).toUInt(&ok[0]);
+        span.start = fields.at(1).toUInt(&ok[1], 16);
+        span.end = fields.at(2).toUInt(&ok[2], 16);
+        if(!ok[0] || !ok[1] || !ok[2] || (span.end <= span.start))
+            break;
+
+        spans->append(span);
+    }
+    return true;
+}
+
+/*
+ * Makes what was written so far survive a crash or power loss
+ */
+void ProgressJournal::Sync(void)
+{
+#if defined(Q_OS_WIN)
+    _commit(file.handle());
+#else
+    fsync(file.handle());
+#endif
+}
@@ -0,0 +1,92 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PROGRESSJOURNAL_H
+#define PROGRESSJOURNAL_H
+
+#include <stdint.h>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QString>
+#include "PICData.h"
+
+// Spans recorded before the journal is written out and synced to disk
+#define JOURNAL_BATCH_SPANS     8
+// Longest a recorded span waits in memory for the rest of its batch
+#define JOURNAL_SYNC_MS         500
+// First line of a journal, followed by the image hash
+#define JOURNAL_MAGIC           "MuriProg journal 1"
+
+/*!
+ * Record of the spans of an image already written and verified on one
+ * Muribot, so a write cut short by an unplugged robot or a crash can carry
+ * on where it stopped instead of starting over.
+ *
+ * There is one journal per USB serial number, in the application data
+ * directory.  Its first line holds the hash of the image being written, a
+ * journal of another image does not count.  Spans are appended as text
+ * lines in batches of JOURNAL_BATCH_SPANS, with a single sync per batch;
+ * losing the last batch only means those spans are written again.  A torn
+ * last line is ignored.  Used from the thread doing the write.
+ */
+class ProgressJournal
+{
+public:
+	// Constructor/Destructor
+    ProgressJournal();
+    ~ProgressJournal();
+
+	// Methods
+    bool Open(QString serial, QByteArray imageHash);
+    bool Start(void);
+    void Record(unsigned char type, uint32_t start, uint32_t end);
+    void Flush(void);
+    void Remove(void);
+    bool Contains(unsigned char type, uint32_t start, uint32_t end) const;
+    bool isOpen(void) const;
+    int spans(void) const;
+    static QByteArray ImageHash(const PICData* data, bool flash, bool eeprom);
+    static bool Exists(QString serial, QByteArray imageHash);
+    static bool Pending(QString serial);
+
+protected:
+    struct Span
+    {
+        unsigned char type;
+        uint32_t start;
+        uint32_t end;
+    };
+
+	// Members
+    QFile file;
+    QByteArray hash;
+    QList<Span> done;           // Spans written and verified, recorded or not
+    QByteArray pending;         // Lines not written to the file yet
+    int pendingSpans;
+    QElapsedTimer sinceSync;
+
+	// Methods
+    static QString FileName(QString serial);
+    static QByteArray Header(QByteArray imageHash);
+    static bool Load(QString fileName, QByteArray imageHash, QList<Span>* spans);
+    void Sync(void);
+};
+
+#endif // PROGRESSJOURNAL_H
@@ -0,0 +1,192 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QStringList>
+#include <string.h>
+
+#if defined(Q_OS_LINUX)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#elif defined(Q_OS_WIN)
+#include <windows.h>
+#endif
+
+#include "RealtimeIo.h"
+#include "Log.h"
+
+RealtimeIo::Settings RealtimeIo::current = RealtimeIo::Defaults();
+
+/*
+ * Low jitter mode off, with the values it uses once turned on
+ */
+RealtimeIo::Settings RealtimeIo::Defaults(void)
+{
+    Settings settings;
+
+    settings.enabled = false;
+    settings.priority = REALTIME_DEFAULT_PRIORITY;
+    settings.cpu = -1;
+    settings.pollUs = REALTIME_DEFAULT_POLL_US;
+    return settings;
+}
+
+/*
+ * Reads settings like "on" or "cpu=2,priority=60,poll=100".  Any of them
+ * turns the mode on, the ones left out keep their defaults; "off" or
+ * nothing turns it off.  Returns false, leaving settings alone, when text
+ * does not parse.
+ */
+bool RealtimeIo::Parse(QString text, Settings* settings)
+{
+    Settings parsed = Defaults();
+    QString item, key;
+    int value;
+    bool ok;
+
+    text = text.trimmed();
+    if(text.isEmpty() || (text == "off"))
+    {
+        *settings = parsed;
+        return true;
+    }
+
+    parsed.enabled = true;
+    if(text != "on")
+    {
+        foreach(item, text.split(','))
+        {
+            key = item.section('=', 0, 0).trimmed();
+            value = item.section('=', 1).trimmed().toInt(&ok);
+            if(!ok)
+                return false;
+
+            if((key == "priority") && (value >= 1) && (value <= 99))
+                parsed.priority = value;
+            else if((key == "cpu") && (value >= 0))
+                parsed.cpu = value;
+            else if((key == "poll") && (value >= 0))
+                parsed.pollUs = value;
+            else
+                return false;
+        }
+    }
+
+    *settings = parsed;
+    return true;
+}
+
+/*
+ * Settings for the I/O threads started from now on
+ */
+void RealtimeIo::Configure(const Settings& settings)
+{
+    current = settings;
+}
+
+bool RealtimeIo::isEnabled(void)
+{
+    return current.enabled;
+}
+
+int RealtimeIo::pollUs(void)
+{
+    return current.pollUs;
+}
+
+/*
+ * Applies the settings to the calling thread, with the mode on.  Returns what
+ * it got (ex: "fifo 40, cpu 2, stack locked"), empty when the mode is off or
+ * none of it was permitted.
+ */
+QString RealtimeIo::Apply(void)
+{
+    QStringList applied;
+
+    if(!current.enabled)
+        return QString();
+
+#if defined(Q_OS_LINUX)
+    struct sched_param param;
+    cpu_set_t cpus;
+    int error;
+
+    memset(&param, 0x00, sizeof(param));
+    param.sched_priority = current.priority;
+    error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if(error == 0)
+        applied.append(QString("fifo %1").arg(current.priority));
+    else
+        LOG_WARNING("Real-time priority not permitted (%s), the I/O thread keeps its priority.", strerror(error));
+
+    if(current.cpu >= 0)
+    {
+        CPU_ZERO(&cpus);
+        CPU_SET(current.cpu, &cpus);
+        error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if(error == 0)
+            applied.append(QString("cpu %1").arg(current.cpu));
+        else
+            LOG_WARNING("Could not pin the I/O thread to CPU %d (%s).", current.cpu, strerror(error));
+    }
+#elif defined(Q_OS_WIN)
+    if(SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+        applied.append("time critical");
+    else
+        LOG_WARNING("Time critical priority not permitted (error %lu), the I/O thread keeps its priority.", GetLastError());
+
+    if(current.cpu >= 0)
+    {
+        if((current.cpu < (int)(sizeof(DWORD_PTR) * 8)) && (SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR)1) << current.cpu) != 0))
+            applied.append(QString("cpu %1").arg(current.cpu));
+        else
+            LOG_WARNING("Could not pin the I/O thread to CPU %d.", current.cpu);
+    }
+#endif
+
+    if(LockStack())
+        applied.append("stack locked");
+
+    LOG_INFO("Low jitter I/O: %s.", applied.isEmpty() ? "nothing permitted" : qPrintable(applied.join(", ")));
+    return applied.join(", ");
+}
+
+/*
+ * Touches REALTIME_STACK_LOCK bytes of stack below the caller and locks them,
+ * so the frames of a transfer never page fault.  The pages stay locked once
+ * this returns.
+ */
+bool RealtimeIo::LockStack(void)
+{
+    unsigned char stack[REALTIME_STACK_LOCK];
+
+    memset(stack, 0x00, sizeof(stack));
+
+#if defined(Q_OS_LINUX)
+    if(mlock(stack, sizeof(stack)) == 0)
+        return true;
+
+    LOG_WARNING("Could not lock the I/O thread's stack, raise the memlock limit (ulimit -l) to allow it.");
+#elif defined(Q_OS_WIN)
+    if(VirtualLock(stack, sizeof(stack)))
+        return true;
+
+    LOG_WARNING("Could not lock the I/O thread's stack (error %lu).", GetLastError());
+#endif
+    return false;
+}
@@ -0,0 +1,76 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef REALTIMEIO_H
+#define REALTIMEIO_H
+
+#include <QString>
+
+// Environment variable the GUI, the command line tool and the daemon read
+// their low jitter settings from, see RealtimeIo::Parse()
+#define REALTIME_ENV "MURIPROG_REALTIME"
+// SCHED_FIFO priority of the I/O threads, above every normal thread but
+// below the kernel's interrupt threads (50), which the USB stack needs
+#define REALTIME_DEFAULT_PRIORITY 40
+// Reply busy-poll before blocking on the device, in microseconds.  About
+// two USB frames, most replies arrive within it.
+#define REALTIME_DEFAULT_POLL_US 250
+// Stack prefaulted and locked by Apply(), room for the packet buffers and
+// everything a transfer calls
+#define REALTIME_STACK_LOCK (64 * 1024)
+
+/*!
+ * Opt-in low jitter mode for the threads that talk to the devices.
+ *
+ * Configure() is called once at startup, before the first I/O thread
+ * starts.  Every I/O thread then calls Apply() on itself: it asks for
+ * SCHED_FIFO (time critical priority on Windows), pins itself to the chosen
+ * CPU and prefaults and locks a stretch of its stack, where the packets of
+ * every transfer are built.  Whatever the process is not allowed to do is
+ * skipped with a warning and the thread carries on as before.  Replies are
+ * busy-polled for pollUs before the thread blocks on the device, see
+ * USB::ReceiveReply().
+ */
+class RealtimeIo
+{
+public:
+    struct Settings
+    {
+        bool enabled;
+        int priority;           // SCHED_FIFO priority, 1 - 99
+        int cpu;                // CPU the I/O threads are pinned to, -1 for any
+        int pollUs;             // Busy-poll for a reply this long before blocking, 0 blocks at once
+    };
+
+	// Methods
+    static Settings Defaults(void);
+    static bool Parse(QString text, Settings* settings);
+    static void Configure(const Settings& settings);
+    static bool isEnabled(void);
+    static int pollUs(void);
+    static QString Apply(void);
+
+private:
+	// Members
+    static Settings current;
+
+	// Methods
+    static bool LockStack(void);
+};
+
+#endif // REALTIMEIO_H
@@ -0,0 +1,497 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Session.h"
+#include "Bootloader.h"
+#include "FirmwareCache.h"
+#include "Trace.h"
+#include "Log.h"
+
+/*
+ * The session takes ownership of comm.  Without one it talks to real
+ * hardware, pass an EmulatedUSB to run without a Muribot attached.
+ */
+Session::Session(USB* comm, QObject* parent) : QObject(parent)
+{
+    if(comm == NULL)
+        comm = new USB();
+
+    this->comm = comm;
+    programmer = new Programmer(comm);
+    hexData = new PICData();
+    loaded = false;
+    current = NULL;
+    retryBase = 0;
+    resyncBase = 0;
+    writeFlash = true;
+    writeEeprom = false;
+    pipelined = true;
+    resume = false;
+
+    connect(programmer, SIGNAL(IoWithDeviceCompleted(QString,USB::ErrorCode,double)), this, SLOT(PhaseCompleted(QString,USB::ErrorCode,double)));
+}
+
+Session::~Session()
+{
+    Close();
+    delete programmer;
+    delete hexData;
+    delete comm;
+}
+
+/*
+ * Lists the attached bootloaders, any of their paths can be given to Open()
+ */
+QList<USB::DeviceInfo> Session::Devices(void)
+{
+    return USB::Enumerate();
+}
+
+/*
+ * Opens a bootloader (the first one found when path is empty), switches it
+ * into bootloader mode and reads its firmware information.
+ */
+SessionResult Session::Open(QString path)
+{
+    SessionResult result;
+    QElapsedTimer elapsed;
+    USB::ErrorCode error;
+    TRACE_SCOPE("Open");
+
+    Close();
+    Begin(&result);
+    elapsed.start();
+
+    if(path.isEmpty())
+        error = comm->open();
+    else
+        error = comm->open(path);
+
+    if(error == USB::Success)
+    {
+        comm->EngageBootloader();
+        error = programmer->ReadFirmwareInfo();
+    }
+
+    PhaseCompleted("Open", error, ((double)elapsed.nsecsElapsed()) / 1000000000);
+
+    if(error == USB::NotConnected)
+        return Finish(&result, error, "no bootloader found");
+    if(error != USB::Success)
+    {
+        comm->close();
+        return Finish(&result, error, "bootloader did not answer");
+    }
+    FirmwareCache::Store(comm->serialNumber(), &programmer->firmwareInfo);
+
+    return Finish(&result, error);
+}
+
+void Session::Close(void)
+{
+    if(comm->isConnected())
+        comm->close();
+}
+
+/*
+ * Parses a hex file into the session image.  Addresses the file does not
+ * cover are programmed as 0xFF, the erased value.
+ */
+SessionResult Session::Load(QString fileName)
+{
+    SessionResult result;
+    QElapsedTimer elapsed;
+    HexLoader import;
+    HexLoader::ErrorCode error;
+    Bootloader device(hexData);
+    PICData::MemoryRange range;
+    TRACE_SCOPE("Load");
+
+    Begin(&result);
+    elapsed.start();
+
+    foreach(range, hexData->ranges)
+        memset(range.pDataBuffer, 0xFF, range.dataBufferLength);
+
+    error = import.ImportHexFile(fileName, hexData, &device);
+    loaded = (error == HexLoader::Success);
+
+    PhaseCompleted("Load", loaded ? USB::Success : USB::Fail, ((double)elapsed.nsecsElapsed()) / 1000000000);
+
+    switch(error)
+    {
+        case HexLoader::Success:
+            return Finish(&result, USB::Success);
+        case HexLoader::CouldNotOpenFile:
+            return Finish(&result, USB::Fail, "could not open file");
+        case HexLoader::NoneInRange:
+            return Finish(&result, USB::Fail, "no address within the device range");
+        case HexLoader::ErrorInHexFile:
+            return Finish(&result, USB::Fail, "error in hex file");
+        case HexLoader::InsufficientMemory:
+        default:
+            return Finish(&result, USB::Fail, "memory allocation failed");
+    }
+}
+
+/*
+ * Selects an image of a bundle as the session image.  The bundle stays
+ * mapped, loading another image of the same bundle does not read the file
+ * again.
+ */
+SessionResult Session::LoadBundle(QString fileName, QString image)
+{
+    SessionResult result;
+    QElapsedTimer elapsed;
+    ImageBundle::ErrorCode error = ImageBundle::Success;
+    TRACE_SCOPE("Load");
+
+    Begin(&result);
+    elapsed.start();
+
+    loaded = false;
+    if(!bundle.isOpen() || (bundle.fileName() != fileName))
+        error = bundle.Open(fileName);
+    if(error == ImageBundle::Success)
+        error = bundle.Select(bundle.Find(image), hexData);
+    loaded = (error == ImageBundle::Success);
+
+    PhaseCompleted("Load", loaded ? USB::Success : USB::Fail, ((double)elapsed.nsecsElapsed()) / 1000000000);
+
+    switch(error)
+    {
+        case ImageBundle::Success:
+            return Finish(&result, USB::Success);
+        case ImageBundle::CouldNotOpenFile:
+            return Finish(&result, USB::Fail, "could not open file");
+        case ImageBundle::NotFound:
+            return Finish(&result, USB::Fail, "no image by that name in the bundle");
+        case ImageBundle::LayoutMismatch:
+            return Finish(&result, USB::Fail, "image built for another device");
+        case ImageBundle::BadFormat:
+        case ImageBundle::BadIndex:
+        default:
+            return Finish(&result, USB::Fail, "bundle is damaged or not a bundle");
+    }
+}
+
+/*
+ * Copies an image parsed elsewhere into the session image, for programs
+ * that keep images in memory and hand the same one to many sessions.  Only
+ * the ranges of the session layout are taken.
+ */
+SessionResult Session::LoadImage(const PICData* image)
+{
+    SessionResult result;
+    QElapsedTimer elapsed;
+    PICData::MemoryRange from;
+    int i;
+    TRACE_SCOPE("Load");
+
+    Begin(&result);
+    elapsed.start();
+
+    loaded = true;
+    for(i = 0; i < hexData->ranges.count(); i++)
+    {
+        PICData::MemoryRange& to = hexData->ranges[i];
+        bool found = false;
+
+        foreach(from, image->ranges)
+        {
+            if((from.type == to.type) && (from.start == to.start) && (from.dataBufferLength == to.dataBufferLength))
+            {
+                memcpy(to.pDataBuffer, from.pDataBuffer, to.dataBufferLength);
+                found = true;
+                break;
+            }
+        }
+        loaded = loaded && found;
+    }
+
+    PhaseCompleted("Load", loaded ? USB::Success : USB::Fail, ((double)elapsed.nsecsElapsed()) / 1000000000);
+
+    if(!loaded)
+        return Finish(&result, USB::Fail, "image built for another device");
+    return Finish(&result, USB::Success);
+}
+
+SessionResult Session::Erase(void)
+{
+    SessionResult result;
+
+    Begin(&result);
+    if(!Ready(&result, false))
+        return result;
+
+    return Finish(&result, programmer->EraseDevice());
+}
+
+/*
+ * Writes the image to an erased device, without verifying or signing it
+ */
+SessionResult Session::Program(void)
+{
+    SessionResult result;
+
+    Begin(&result);
+    if(!Ready(&result, true))
+        return result;
+
+    return Finish(&result, programmer->ProgramDevice(hexData));
+}
+
+/*
+ * Compares the device against the image.  Does not change the device.
+ */
+SessionResult Session::Verify(void)
+{
+    SessionResult result;
+    USB::ErrorCode error;
+
+    Begin(&result);
+    if(!Ready(&result, true))
+        return result;
+
+    error = programmer->VerifyDevice(hexData);
+    return Finish(&result, error, (error == USB::Fail) ? "device does not match the image" : "");
+}
+
+/*
+ * Checks that the selected regions of the device are erased
+ */
+SessionResult Session::BlankCheck(void)
+{
+    SessionResult result;
+    USB::ErrorCode error;
+
+    Begin(&result);
+    if(!Ready(&result, false))
+        return result;
+
+    error = programmer->BlankCheckDevice();
+    return Finish(&result, error, (error == USB::Fail) ? "device is not blank" : "");
+}
+
+/*
+ * Signs a verified image so the bootloader starts it on the next reset
+ */
+SessionResult Session::Sign(void)
+{
+    SessionResult result;
+    USB::ErrorCode error;
+
+    Begin(&result);
+    if(!Ready(&result, true))
+        return result;
+
+    error = programmer->SignDevice(hexData);
+    return Finish(&result, error, (error == USB::Fail) ? "signature did not verify" : "");
+}
+
+/*
+ * The complete cycle: erase, program, verify and sign.  Programming and
+ * verify overlap unless pipelined is cleared.
+ */
+SessionResult Session::Write(void)
+{
+    SessionResult result;
+
+    Begin(&result);
+    if(!Ready(&result, true))
+        return result;
+
+    return Finish(&result, programmer->WriteDevice(hexData));
+}
+
+/*
+ * Reads the device into deviceData, which must have the device layout (a
+ * freshly constructed PICData).
+ */
+SessionResult Session::ReadBack(PICData* deviceData)
+{
+    SessionResult result;
+
+    Begin(&result);
+    if(!Ready(&result, false))
+        return result;
+
+    return Finish(&result, programmer->ReadDevice(deviceData));
+}
+
+/*
+ * Leaves the bootloader and starts the application.  The device detaches,
+ * so the session is closed afterwards.
+ */
+SessionResult Session::Reset(void)
+{
+    SessionResult result;
+    QElapsedTimer elapsed;
+
+    Begin(&result);
+    if(!Ready(&result, false))
+        return result;
+
+    elapsed.start();
+    comm->Reset();
+    PhaseCompleted("Reset", USB::Success, ((double)elapsed.nsecsElapsed()) / 1000000000);
+    Close();
+
+    return Finish(&result, USB::Success);
+}
+
+bool Session::isOpen(void) const
+{
+    return comm->isConnected();
+}
+
+bool Session::isLoaded(void) const
+{
+    return loaded;
+}
+
+QString Session::devicePath(void) const
+{
+    return comm->path();
+}
+
+USB::FirmwareInfo Session::firmwareInfo(void) const
+{
+    return programmer->firmwareInfo;
+}
+
+const PICData* Session::image(void) const
+{
+    return hexData;
+}
+
+/*
+ * Progress of the running call, safe to read from any thread
+ */
+const ProgressCounter* Session::progress(void) const
+{
+    return comm->progressCounter();
+}
+
+/*
+ * The bundle LoadBundle() last opened, not open before that
+ */
+const ImageBundle* Session::openBundle(void) const
+{
+    return &bundle;
+}
+
+/*
+ * Every mismatch found by the last Write(), Verify() or BlankCheck()
+ */
+const ImageDiff& Session::diff(void) const
+{
+    return programmer->diff;
+}
+
+/*
+ * Whether the open device has a write of the loaded image that was cut
+ * short, which Write() can finish when resume is set
+ */
+bool Session::canResume(void) const
+{
+    if(!isOpen() || !loaded)
+        return false;
+
+    return ProgressJournal::Exists(comm->serialNumber(), ProgressJournal::ImageHash(hexData, writeFlash, writeEeprom));
+}
+
+/*
+ * Whether the last Write() finished an interrupted write instead of
+ * starting over
+ */
+bool Session::resumed(void) const
+{
+    return programmer->resumed;
+}
+
+void Session::PhaseCompleted(QString name, USB::ErrorCode result, double seconds)
+{
+    SessionPhase phase;
+
+    if(current == NULL)
+        return;
+
+    phase.name = name.toLower();
+    phase.result = result;
+    phase.seconds = seconds;
+    current->phases.append(phase);
+}
+
+/*
+ * Starts collecting the phases of a call into result
+ */
+void Session::Begin(SessionResult* result)
+{
+    result->result = USB::Success;
+    result->seconds = 0;
+    result->retries = 0;
+    result->resyncs = 0;
+    result->reportsSaved = 0;
+    current = result;
+    callTimer.start();
+    retryBase = progress()->retries();
+    resyncBase = progress()->resyncs();
+    savedBase = progress()->savedReports();
+
+    programmer->writeFlash = writeFlash;
+    programmer->writeEeprom = writeEeprom;
+    programmer->pipelined = pipelined;
+    programmer->resume = resume;
+    programmer->verifyPlan = verifyPlan;
+}
+
+SessionResult Session::Finish(SessionResult* result, USB::ErrorCode error, QString message)
+{
+    result->result = error;
+    result->seconds = ((double)callTimer.nsecsElapsed()) / 1000000000;
+    result->message = message;
+    result->retries = progress()->retries() - retryBase;
+    result->resyncs = progress()->resyncs() - resyncBase;
+    result->reportsSaved = progress()->savedReports() - savedBase;
+    current = NULL;
+
+    if((error != USB::Success) && !result->phases.isEmpty())
+        Log::DumpFlight(qPrintable(result->phases.last().name));
+
+    return *result;
+}
+
+/*
+ * Checks a device is open (and an image loaded when needsImage), finishing
+ * result with the reason when not.
+ */
+bool Session::Ready(SessionResult* result, bool needsImage)
+{
+    if(!comm->isConnected())
+    {
+        Finish(result, USB::NotConnected, "no device open");
+        return false;
+    }
+    if(needsImage && !loaded)
+    {
+        Finish(result, USB::Fail, "no image loaded");
+        return false;
+    }
+
+    return true;
+}
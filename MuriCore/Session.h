@@ -0,0 +1,128 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QList>
+#include <QString>
+#include "USB.h"
+#include "PICData.h"
+#include "HexLoader.h"
+#include "Programmer.h"
+#include "ImageBundle.h"
+
+// One step of a session call, as it ran on the device
+struct SessionPhase
+{
+    QString name;               // "open", "load", "erase", "write", "writeverify", "verify", "blankcheck", "sign", "read", "reset"
+    USB::ErrorCode result;
+    double seconds;
+};
+
+// Outcome of a session call
+struct SessionResult
+{
+    USB::ErrorCode result;      // Success, or the error of the phase that failed
+    double seconds;             // Wall time of the whole call
+    QList<SessionPhase> phases; // Every phase that ran, in order
+    QString message;            // Why the call failed, empty on success
+    int retries;                // Packets that had to be sent again
+    int resyncs;                // Times a transfer re-synced with the firmware
+    int reportsSaved;           // Reports compressed payloads made unnecessary
+
+    bool ok(void) const { return result == USB::Success; }
+};
+
+/*!
+ * Programming API for embedding MuriProg in other programs.
+ *
+ * A session talks to a single bootloader and holds the image that gets
+ * programmed into it.  Every call blocks until the device is done and
+ * returns what happened along with how long each phase took.  Only needs
+ * QtCore, a session can be used from any one thread at a time while other
+ * threads sample progress().
+ */
+class Session : public QObject
+{
+    Q_OBJECT
+
+public:
+	// Constructor/Destructor
+    explicit Session(USB* comm = 0, QObject* parent = 0);
+    ~Session();
+
+	// Members
+    bool writeFlash;            // Regions included in program, verify and read back
+    bool writeEeprom;
+    bool pipelined;             // Write() verifies while programming instead of in a second pass
+    bool resume;                // Write() carries on from an interrupted write of the same image
+    VerifyPlan verifyPlan;      // What Write() and Verify() read back
+
+	// Methods
+    static QList<USB::DeviceInfo> Devices(void);
+
+    SessionResult Open(QString path = QString());
+    void Close(void);
+    SessionResult Load(QString fileName);
+    SessionResult LoadBundle(QString fileName, QString image);
+    SessionResult LoadImage(const PICData* image);
+    SessionResult Erase(void);
+    SessionResult Program(void);
+    SessionResult Verify(void);
+    SessionResult BlankCheck(void);
+    SessionResult Sign(void);
+    SessionResult Write(void);
+    SessionResult ReadBack(PICData* deviceData);
+    SessionResult Reset(void);
+
+    bool isOpen(void) const;
+    bool isLoaded(void) const;
+    QString devicePath(void) const;
+    USB::FirmwareInfo firmwareInfo(void) const;
+    const PICData* image(void) const;
+    const ImageBundle* openBundle(void) const;
+    const ProgressCounter* progress(void) const;
+    const ImageDiff& diff(void) const;
+    bool canResume(void) const;
+    bool resumed(void) const;
+
+private slots:
+    void PhaseCompleted(QString name, USB::ErrorCode result, double seconds);
+
+protected:
+	// Members
+    USB* comm;
+    Programmer* programmer;
+    PICData* hexData;
+    bool loaded;
+    ImageBundle bundle;         // Kept mapped, so switching between its images costs a copy
+    SessionResult* current;     // Collects the phases of the call in progress
+    QElapsedTimer callTimer;
+    int retryBase;              // Progress counts when the call began
+    int resyncBase;
+    int savedBase;
+
+	// Methods
+    void Begin(SessionResult* result);
+    SessionResult Finish(SessionResult* result, USB::ErrorCode error, QString message = QString());
+    bool Ready(SessionResult* result, bool needsImage);
+};
+
+#endif // SESSION_H
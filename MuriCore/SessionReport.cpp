@@ -0,0 +1,241 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QFile>
+
+#include "SessionReport.h"
+
+ExitCode SessionReport::ExitCodeFor(USB::ErrorCode result)
+{
+    switch(result)
+    {
+        case USB::Success:
+            return ExitSuccess;
+        case USB::NotConnected:
+            return ExitNotConnected;
+        case USB::IncorrectCommand:
+            return ExitIncorrectCommand;
+        case USB::Timeout:
+            return ExitTimeout;
+        case USB::Fail:
+        default:
+            return ExitFail;
+    }
+}
+
+QString SessionReport::Hex(unsigned int value)
+{
+    return "0x" + QString::number(value, 16);
+}
+
+QString SessionReport::ResultName(USB::ErrorCode result)
+{
+    switch(result)
+    {
+        case USB::Success:
+            return "success";
+        case USB::NotConnected:
+            return "not-connected";
+        case USB::Fail:
+            return "fail";
+        case USB::IncorrectCommand:
+            return "incorrect-command";
+        case USB::Timeout:
+            return "timeout";
+        case USB::Cancelled:
+            return "cancelled";
+        default:
+            return "other";
+    }
+}
+
+/*
+ * Adds the phases of a session call to the report and returns its exit code
+ */
+ExitCode SessionReport::Record(const SessionResult& result, QJsonArray& phases, QJsonObject& report)
+{
+    foreach(SessionPhase phase, result.phases)
+    {
+        QJsonObject item;
+        item["name"] = phase.name;
+        item["result"] = ResultName(phase.result);
+        item["seconds"] = phase.seconds;
+        phases.append(item);
+    }
+
+    if(!result.ok())
+        report["error"] = result.message;
+
+    // Summed over the calls of the command, so a recovered flaky link shows up
+    report["retries"] = report.value("retries").toInt() + result.retries;
+    report["resyncs"] = report.value("resyncs").toInt() + result.resyncs;
+    report["reportsSaved"] = report.value("reportsSaved").toInt() + result.reportsSaved;
+
+    return ExitCodeFor(result.result);
+}
+
+QJsonObject SessionReport::Firmware(const USB::FirmwareInfo& info)
+{
+    QJsonObject firmware;
+
+    firmware["bootloaderVersion"] = Hex(info.bootloaderVersion);
+    firmware["applicationVersion"] = Hex(info.applicationVersion);
+    firmware["packetSize"] = (int)USB::NegotiatedPacketSize(&info);
+    firmware["compression"] = (info.capabilities & CAPABILITY_COMPRESSED) != 0;
+    return firmware;
+}
+
+/*
+ * Packet latency so far: percentiles (to the histogram bucket) and every
+ * bucket that counted a packet, in microseconds
+ */
+QJsonObject SessionReport::Latency(const ProgressCounter* progress)
+{
+    QJsonObject latency;
+    QJsonArray histogram;
+    int i;
+
+    latency["p50"] = (double)progress->LatencyPercentile(500);
+    latency["p99"] = (double)progress->LatencyPercentile(990);
+    latency["p999"] = (double)progress->LatencyPercentile(999);
+    latency["max"] = (double)progress->LatencyPercentile(1000);
+
+    for(i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        if(progress->latency(i) == 0)
+            continue;
+
+        QJsonObject bucket;
+        bucket["under"] = (double)ProgressCounter::LatencyBound(i);
+        bucket["packets"] = progress->latency(i);
+        histogram.append(bucket);
+    }
+    latency["histogram"] = histogram;
+
+    return latency;
+}
+
+QJsonArray SessionReport::Ranges(const PICData* data)
+{
+    PICData::MemoryRange range;
+    QJsonArray ranges;
+
+    foreach(range, data->ranges)
+    {
+        QJsonObject item;
+        item["type"] = (int)range.type;
+        item["start"] = Hex(range.start);
+        item["end"] = Hex(range.end);
+        ranges.append(item);
+    }
+
+    return ranges;
+}
+
+/*
+ * Lists the extents that differ, with the bytes expected and read
+ */
+QJsonObject SessionReport::Mismatches(const ImageDiff& diff)
+{
+    QJsonObject result;
+    QJsonArray extents;
+
+    foreach(ImageDiff::Extent extent, diff.extents)
+    {
+        QJsonObject item;
+        item["type"] = (int)extent.type;
+        item["address"] = Hex(extent.address);
+        item["length"] = (int)extent.length;
+        item["expected"] = QString(extent.expected.toHex());
+        item["actual"] = QString(extent.actual.toHex());
+        extents.append(item);
+    }
+
+    result["extents"] = extents;
+    result["extentCount"] = (int)diff.extentCount;
+    result["bytes"] = (int)diff.mismatchedBytes;
+    return result;
+}
+
+/*
+ * Which verify policy ran and how much of the device it left out.  The seed
+ * lets a sampled verify be repeated with --seed.
+ */
+QJsonObject SessionReport::Verify(const VerifyPlan& plan, const ImageDiff& diff)
+{
+    QJsonObject result;
+
+    result["policy"] = plan.name();
+    result["samplePercent"] = plan.samplePercent;
+    result["seed"] = (double)plan.seed;
+    result["comparedBytes"] = (int)diff.comparedBytes;
+    result["skippedBytes"] = (int)diff.skippedBytes;
+    return result;
+}
+
+/*
+ * Writes the read back memory regions one after the other into a raw binary
+ * file.  Where each region landed in the file is listed in the report.
+ */
+ExitCode SessionReport::SaveReadback(QString fileName, PICData* deviceData, bool eeprom, QJsonObject& report)
+{
+    QFile file(fileName);
+    PICData::MemoryRange range;
+    QJsonArray ranges;
+    qint64 offset = 0;
+
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        report["error"] = QString("could not open file");
+        return ExitFileError;
+    }
+
+    foreach(range, deviceData->ranges)
+    {
+        if((range.type != PROGRAM_MEM) && !(eeprom && (range.type == EEPROM_MEM)))
+            continue;
+
+        if(file.write((const char*)range.pDataBuffer, range.dataBufferLength) != range.dataBufferLength)
+        {
+            report["error"] = QString("could not write file");
+            return ExitFileError;
+        }
+
+        QJsonObject item;
+        item["type"] = (int)range.type;
+        item["start"] = Hex(range.start);
+        item["end"] = Hex(range.end);
+        item["offset"] = offset;
+        ranges.append(item);
+        offset += range.dataBufferLength;
+    }
+    report["ranges"] = ranges;
+
+    return ExitSuccess;
+}
+
+/*
+ * Adds the fields every report ends with
+ */
+void SessionReport::Finish(QJsonObject& report, ExitCode code, const QJsonArray& phases, double seconds)
+{
+    report["exitCode"] = (int)code;
+    report["success"] = (code == ExitSuccess);
+    report["phases"] = phases;
+    report["seconds"] = seconds;
+}
@@ -0,0 +1,63 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SESSIONREPORT_H
+#define SESSIONREPORT_H
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QString>
+#include "Session.h"
+
+// Process exit codes of muriprog-cli, also the "exitCode" of every report.
+// Test fixtures depend on these, only ever add to the list.
+enum ExitCode
+{
+    ExitSuccess = 0,
+    ExitUsage = 1,
+    ExitFileError = 2,
+    ExitNotConnected = 3,
+    ExitFail = 4,
+    ExitIncorrectCommand = 5,
+    ExitTimeout = 6
+};
+
+/*!
+ * Turns session results into the JSON report printed by muriprog-cli.
+ *
+ * Shared by the command line and muriprogd, so a job run by the daemon
+ * reports exactly what the same command run on its own would have.
+ */
+class SessionReport
+{
+public:
+	// Methods
+    static ExitCode ExitCodeFor(USB::ErrorCode result);
+    static QString Hex(unsigned int value);
+    static QString ResultName(USB::ErrorCode result);
+    static ExitCode Record(const SessionResult& result, QJsonArray& phases, QJsonObject& report);
+    static QJsonObject Firmware(const USB::FirmwareInfo& info);
+    static QJsonArray Ranges(const PICData* data);
+    static QJsonObject Latency(const ProgressCounter* progress);
+    static QJsonObject Mismatches(const ImageDiff& diff);
+    static QJsonObject Verify(const VerifyPlan& plan, const ImageDiff& diff);
+    static ExitCode SaveReadback(QString fileName, PICData* deviceData, bool eeprom, QJsonObject& report);
+    static void Finish(QJsonObject& report, ExitCode code, const QJsonArray& phases, double seconds);
+};
+
+#endif // SESSIONREPORT_H
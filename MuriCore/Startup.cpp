@@ -0,0 +1,118 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Startup.h"
+#include "Trace.h"
+#include "Log.h"
+
+QElapsedTimer Startup::clock;
+const char* Startup::current = NULL;
+qint64 Startup::currentStart = 0;
+bool Startup::currentTraced = false;
+QList<Startup::Mark> Startup::phases;
+QList<Startup::Mark> Startup::milestones;
+
+/*
+ * Starts the clock every phase and milestone is measured against
+ */
+void Startup::Begin(void)
+{
+	clock.start();
+}
+
+/*
+ * Ends the phase running and starts name
+ */
+void Startup::Phase(const char* name)
+{
+	End();
+
+	current = name;
+	currentStart = clock.nsecsElapsed();
+	currentTraced = Trace::enabled;
+	if(currentTraced)
+		Trace::Record(Trace::Begin, name);
+}
+
+void Startup::End(void)
+{
+	Mark mark;
+
+	if(current == NULL)
+		return;
+
+	if(currentTraced)
+		Trace::Record(Trace::End, current);
+
+	mark.name = current;
+	mark.nsecs = clock.nsecsElapsed() - currentStart;
+	if(phases.count() < STARTUP_MAX_MARKS)
+		phases.append(mark);
+	current = NULL;
+}
+
+/*
+ * Notes that name happened now, only the first time.  Returns false when it
+ * was already noted.
+ */
+bool Startup::Milestone(const char* name)
+{
+	Mark mark;
+
+	if(Reached(name) || (milestones.count() >= STARTUP_MAX_MARKS))
+		return false;
+
+	if(Trace::enabled)
+		Trace::Record(Trace::Instant, name);
+
+	mark.name = name;
+	mark.nsecs = clock.nsecsElapsed();
+	milestones.append(mark);
+
+	LOG_INFO("Startup: %s after %.1f ms.", name, ((double)mark.nsecs) / 1000000);
+	return true;
+}
+
+bool Startup::Reached(const char* name)
+{
+	Mark mark;
+
+	foreach(mark, milestones)
+	{
+		if(qstrcmp(mark.name, name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * The phases with their durations followed by the milestones, in ms
+ */
+QString Startup::Report(void)
+{
+	QStringList items;
+	Mark mark;
+
+	foreach(mark, phases)
+		items.append(QString("%1 %2 ms").arg(mark.name).arg(((double)mark.nsecs) / 1000000, 0, 'f', 1));
+	foreach(mark, milestones)
+		items.append(QString("%1 at %2 ms").arg(mark.name).arg(((double)mark.nsecs) / 1000000, 0, 'f', 1));
+
+	return items.join(", ");
+}
@@ -0,0 +1,68 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+// Phases and milestones kept, later ones are not recorded
+#define STARTUP_MAX_MARKS 32
+
+/*!
+ * Times how an application starts up.
+ *
+ * Begin() is called first thing in main().  Each Phase() closes the phase
+ * before it and opens the next one, End() closes the last one, and every
+ * phase is also a span in the trace.  Milestone() notes how long after
+ * Begin() something happened that the user waits for, such as the first
+ * paint of the window or the Muribot becoming ready.  Report() lists the
+ * lot in one line.  GUI thread only.
+ */
+class Startup
+{
+public:
+	// A phase with its duration, or a milestone with its time since Begin()
+	struct Mark
+	{
+		const char* name;       // String literal, only the pointer is stored
+		qint64 nsecs;
+	};
+
+	// Methods
+	static void Begin(void);
+	static void Phase(const char* name);
+	static void End(void);
+	static bool Milestone(const char* name);
+	static bool Reached(const char* name);
+	static QString Report(void);
+
+private:
+	// Members
+	static QElapsedTimer clock;
+	static const char* current;     // Phase running, NULL once ended
+	static qint64 currentStart;
+	static bool currentTraced;      // Its Begin event went to the trace
+	static QList<Mark> phases;
+	static QList<Mark> milestones;
+};
+
+#endif // STARTUP_H
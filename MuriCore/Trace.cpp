@@ -0,0 +1,195 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadStorage>
+
+#include "Trace.h"
+#include "Log.h"
+
+// Deepest span nesting tracked when looking for idle gaps
+#define TRACE_MAX_DEPTH 32
+
+// Ring buffer owned by a single recording thread
+struct TraceBuffer
+{
+	Trace::Event events[TRACE_EVENTS_PER_THREAD];
+	unsigned int count;     // total events ever written, the ring index is count % TRACE_EVENTS_PER_THREAD
+	int threadId;
+	QString threadName;
+};
+
+bool Trace::enabled = false;
+
+static QElapsedTimer traceClock;
+static QMutex bufferLock;
+static QList<TraceBuffer*> buffers;
+
+// The calling thread's buffer.  Wrapped so QThreadStorage does not delete the
+// buffer when the thread exits, its events are still needed for the export.
+struct TraceBufferRef
+{
+	TraceBuffer* buffer;
+};
+static QThreadStorage<TraceBufferRef> threadBuffer;
+
+/*
+ * Returns the ring buffer of the calling thread, creating it the first time
+ * the thread records something.  Only this first call takes the lock.
+ */
+static TraceBuffer* CurrentBuffer(void)
+{
+	TraceBufferRef& ref = threadBuffer.localData();
+	if(ref.buffer != NULL)
+		return ref.buffer;
+
+	TraceBuffer* buffer = new TraceBuffer;
+	buffer->count = 0;
+
+	QMutexLocker locker(&bufferLock);
+	buffer->threadId = buffers.count() + 1;
+	if(QCoreApplication::instance() && (QThread::currentThread() == QCoreApplication::instance()->thread()))
+		buffer->threadName = "GUI thread";
+	else
+		buffer->threadName = QString("Worker thread %1").arg(buffer->threadId);
+	buffers.append(buffer);
+	ref.buffer = buffer;
+
+	return buffer;
+}
+
+/*
+ * Starts recording.  Timestamps in the exported trace are relative to this call.
+ */
+void Trace::Enable(void)
+{
+	traceClock.start();
+	enabled = true;
+}
+
+void Trace::Record(Phase phase, const char* name)
+{
+	TraceBuffer* buffer = CurrentBuffer();
+	Event& event = buffer->events[buffer->count % TRACE_EVENTS_PER_THREAD];
+
+	event.timestamp = traceClock.nsecsElapsed() / 1000;
+	event.name = name;
+	event.address = 0;
+	event.phase = (unsigned char)phase;
+	event.hasAddress = false;
+	buffer->count++;
+}
+
+void Trace::Record(Phase phase, const char* name, uint32_t address)
+{
+	TraceBuffer* buffer = CurrentBuffer();
+	Event& event = buffer->events[buffer->count % TRACE_EVENTS_PER_THREAD];
+
+	event.timestamp = traceClock.nsecsElapsed() / 1000;
+	event.name = name;
+	event.address = address;
+	event.phase = (unsigned char)phase;
+	event.hasAddress = true;
+	buffer->count++;
+}
+
+/*
+ * Converts everything recorded so far into a Chrome trace-event JSON file.
+ * Besides the recorded spans, every gap of at least TRACE_MIN_IDLE_US between
+ * two neighbouring spans on a thread is written out as an "Idle" span, so the
+ * dead time shows up directly in the viewer.  Call this once the threads being
+ * traced have gone quiet, the ring buffers are read without synchronization.
+ */
+bool Trace::WriteJson(QString fileName)
+{
+	QFile file(fileName);
+	int64_t lastEnd[TRACE_MAX_DEPTH + 1];
+	bool first = true;
+	unsigned int i;
+	int depth;
+
+	if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+	{
+		LOG_WARNING("Unable to open trace file %s", qPrintable(fileName));
+		return false;
+	}
+
+	QTextStream out(&file);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+	QMutexLocker locker(&bufferLock);
+	foreach(TraceBuffer* buffer, buffers)
+	{
+		//Name the thread row in the viewer
+		if(!first)
+			out << ",\n";
+		first = false;
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadId
+			<< ",\"args\":{\"name\":\"" << buffer->threadName << "\"}}";
+
+		for(depth = 0; depth <= TRACE_MAX_DEPTH; depth++)
+			lastEnd[depth] = -1;
+		depth = 0;
+
+		//If the ring has wrapped, start at the oldest event still held
+		i = (buffer->count > TRACE_EVENTS_PER_THREAD) ? (buffer->count - TRACE_EVENTS_PER_THREAD) : 0;
+		for(; i < buffer->count; i++)
+		{
+			const Event& event = buffer->events[i % TRACE_EVENTS_PER_THREAD];
+
+			if(event.phase == Begin)
+			{
+				//Time since the previous sibling finished (or the parent started) is idle time
+				if((depth <= TRACE_MAX_DEPTH) && (lastEnd[depth] >= 0) && ((event.timestamp - lastEnd[depth]) >= TRACE_MIN_IDLE_US))
+				{
+					out << ",\n{\"name\":\"Idle\",\"cat\":\"idle\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId
+						<< ",\"ts\":" << (qint64)lastEnd[depth] << ",\"dur\":" << (qint64)(event.timestamp - lastEnd[depth]) << "}";
+				}
+				depth++;
+				if(depth <= TRACE_MAX_DEPTH)
+					lastEnd[depth] = event.timestamp;
+			}
+			else if(event.phase == End)
+			{
+				if(depth > 0)
+					depth--;
+				if(depth <= TRACE_MAX_DEPTH)
+					lastEnd[depth] = event.timestamp;
+			}
+
+			out << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"" << (char)event.phase
+				<< "\",\"pid\":1,\"tid\":" << buffer->threadId << ",\"ts\":" << (qint64)event.timestamp;
+			if(event.phase == Instant)
+				out << ",\"s\":\"t\"";
+			if(event.hasAddress)
+				out << ",\"args\":{\"address\":\"0x" << QString::number(event.address, 16) << "\"}";
+			out << "}";
+		}
+	}
+
+	out << "\n]}\n";
+	file.close();
+
+	return true;
+}
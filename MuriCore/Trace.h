@@ -0,0 +1,136 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <stdint.h>
+
+// Number of events kept per thread before the oldest ones are overwritten
+#define TRACE_EVENTS_PER_THREAD 65536
+
+// Gaps between two spans on the same thread shorter than this (in microseconds)
+// are not reported as idle time in the exported trace.
+#define TRACE_MIN_IDLE_US 50
+
+/*!
+ * Timeline recorder for programming sessions.
+ *
+ * Each thread writes fixed-size binary events into its own ring buffer, so
+ * recording never takes a lock.  WriteJson() converts everything recorded so far
+ * into the Chrome trace-event format (chrome://tracing, Perfetto).  While the
+ * recorder is disabled every trace point costs a single branch, and defining
+ * MURIPROG_NO_TRACE removes the trace points from the build entirely.
+ */
+class Trace
+{
+public:
+	// Event types, the values are the trace-event "ph" characters
+	enum Phase
+	{
+		Begin = 'B',
+		End = 'E',
+		Instant = 'i'
+	};
+
+	// One recorded event.  Names must be string literals, only the pointer is stored.
+	struct Event
+	{
+		int64_t timestamp;      // microseconds since Enable()
+		const char* name;
+		uint32_t address;
+		unsigned char phase;
+		unsigned char hasAddress;
+	};
+
+	// Set once by Enable(), checked by every trace point
+	static bool enabled;
+
+	// Methods
+	static void Enable(void);
+	static void Record(Phase phase, const char* name);
+	static void Record(Phase phase, const char* name, uint32_t address);
+	static bool WriteJson(QString fileName);
+};
+
+// Records a Begin event on construction and the matching End event when it goes out of scope.
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name)
+	{
+		this->name = name;
+		hasAddress = false;
+		if(Trace::enabled)
+			Trace::Record(Trace::Begin, name);
+	}
+
+	TraceScope(const char* name, uint32_t address)
+	{
+		this->name = name;
+		this->address = address;
+		hasAddress = true;
+		if(Trace::enabled)
+			Trace::Record(Trace::Begin, name, address);
+	}
+
+	~TraceScope()
+	{
+		if(Trace::enabled)
+		{
+			if(hasAddress)
+				Trace::Record(Trace::End, name, address);
+			else
+				Trace::Record(Trace::End, name);
+		}
+	}
+
+	// Attach an address that is only known once the span has finished (ex: a received packet)
+	void SetAddress(uint32_t address)
+	{
+		this->address = address;
+		hasAddress = true;
+	}
+
+private:
+	const char* name;
+	uint32_t address;
+	bool hasAddress;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef MURIPROG_NO_TRACE
+	#define TRACE_SCOPE(name)
+	#define TRACE_SCOPE_ADDRESS(var, name, address)
+	#define TRACE_SET_ADDRESS(var, address)
+	#define TRACE_INSTANT(name)
+#else
+	// Trace the rest of the enclosing block
+	#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+	// Trace the rest of the enclosing block, tagged with a packet address.  The scope
+	// is named so the address can be updated later with TRACE_SET_ADDRESS().  The
+	// address is only evaluated while the recorder is enabled.
+	#define TRACE_SCOPE_ADDRESS(var, name, address) TraceScope var(name, Trace::enabled ? (uint32_t)(address) : 0)
+	#define TRACE_SET_ADDRESS(var, address) do { if(Trace::enabled) var.SetAddress(address); } while(0)
+	// A single point in time
+	#define TRACE_INSTANT(name) do { if(Trace::enabled) Trace::Record(Trace::Instant, name); } while(0)
+#endif
+
+#endif // TRACE_H
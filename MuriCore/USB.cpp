@@ -0,0 +1,1222 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "USB.h"
+#include "EraseHistory.h"
+#include "ImageDiff.h"
+#include "PayloadCodec.h"
+#include "RealtimeIo.h"
+#include "Trace.h"
+#include "Log.h"
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTime>
+
+const int USB::SyncWaitTime = 40000;
+
+/*
+ * Bootloader version and erase page size, which is what decides how long
+ * an erase takes
+ */
+static QString DeviceType(const USB::FirmwareInfo* firmwareInfo)
+{
+    return QString("%1-%2").arg(firmwareInfo->bootloaderVersion, 4, 16, QChar('0')).arg(firmwareInfo->erasePageSize);
+}
+
+/**
+ *
+ */
+USB::USB()
+{
+    connected = false;
+    usb_device = NULL;
+    progress = &ownProgress;
+    type = "unknown";
+    packetBytes = USB_PACKET_SIZE;
+    compress = false;
+}
+
+/**
+ *
+ */
+USB::~USB()
+{
+    usb_device = NULL;
+}
+
+/**
+ *
+ */
+void USB::PollUSB()
+{
+    hid_device_info *dev;
+
+    dev = hid_enumerate(VID, PID);
+
+    connected = (dev != NULL);
+    hid_free_enumeration(dev);
+}
+
+/**
+ * Lists every attached bootloader, so several can be opened at once with open(path).
+ */
+QList<USB::DeviceInfo> USB::Enumerate(void)
+{
+    QList<DeviceInfo> devices;
+    hid_device_info *list, *dev;
+    DeviceInfo info;
+
+    list = hid_enumerate(VID, PID);
+    for(dev = list; dev != NULL; dev = dev->next)
+    {
+        info.path = QString::fromLatin1(dev->path);
+        if(dev->serial_number != NULL)
+            info.serialNumber = QString::fromWCharArray(dev->serial_number);
+        else
+            info.serialNumber.clear();
+        devices.append(info);
+    }
+    hid_free_enumeration(list);
+
+    return devices;
+}
+
+/**
+ *
+ */
+bool USB::isConnected(void)
+{
+    return connected;
+}
+
+/**
+ * Path of the opened device
+ */
+QString USB::path(void) const
+{
+    return devicePath;
+}
+
+/**
+ * Kind of bootloader connected, known once its firmware information has
+ * been read.  Erase times are learned per type.
+ */
+QString USB::deviceType(void) const
+{
+    return type;
+}
+
+/**
+ * USB serial number of the opened bootloader, empty when it reports none
+ */
+QString USB::serialNumber(void) const
+{
+    return serial;
+}
+
+/**
+ * Report size in use without the report ID, USB_PACKET_SIZE until the
+ * firmware information offers a larger one
+ */
+unsigned int USB::packetSize(void) const
+{
+    return packetBytes;
+}
+
+/**
+ * Most payload bytes a packet carries, what transfers are split into
+ */
+unsigned int USB::payloadSize(void) const
+{
+    return packetBytes - USB_PACKET_HEADER;
+}
+
+/**
+ * Whether programming sends compressed payloads, which the bootloader offers
+ * in its firmware information
+ */
+bool USB::compression(void) const
+{
+    return compress;
+}
+
+/**
+ * First byte of the payload of a packet.  The payload is right justified,
+ * it ends where the report does whatever its length.
+ */
+unsigned char* USB::Payload(WritePacket* packet) const
+{
+    return packet->data + payloadSize() - packet->bytesPerPacket;
+}
+
+const unsigned char* USB::Payload(const ReadPacket* packet) const
+{
+    return packet->data + payloadSize() - packet->bytesPerPacket;
+}
+
+/**
+ * Report size to use with a bootloader, the standard one unless its firmware
+ * information offers a larger one
+ */
+unsigned int USB::NegotiatedPacketSize(const FirmwareInfo* firmwareInfo)
+{
+    if(!(firmwareInfo->capabilities & CAPABILITY_PACKET_SIZE) || (firmwareInfo->packetSize <= USB_PACKET_SIZE))
+        return USB_PACKET_SIZE;
+
+    return qMin((unsigned int)firmwareInfo->packetSize, (unsigned int)USB_MAX_PACKET_SIZE);
+}
+
+/**
+ * Where the packets programmed and read are counted
+ */
+ProgressCounter* USB::progressCounter(void) const
+{
+    return progress;
+}
+
+/**
+ * Counts into an outside counter (which must outlive this USB), so progress
+ * can still be read once the connection is gone.  NULL returns to the own one.
+ */
+void USB::setProgressCounter(ProgressCounter* counter)
+{
+    progress = (counter != NULL) ? counter : &ownProgress;
+}
+
+/**
+ * Opens the first bootloader found
+ */
+USB::ErrorCode USB::open(void)
+{
+    QList<DeviceInfo> devices = Enumerate();
+
+    if(devices.isEmpty())
+    {
+        LOG_WARNING("Unable to open device.");
+        return NotConnected;
+    }
+
+    return open(devices.first().path);
+}
+
+/**
+ * Opens a specific bootloader, by a path returned from Enumerate()
+ */
+USB::ErrorCode USB::open(QString path)
+{
+    wchar_t serialString[MAX_SERIAL_LENGTH];
+
+    usb_device = hid_open_path(path.toLatin1().constData());
+    devicePath = path;
+    serial.clear();
+    packetBytes = USB_PACKET_SIZE;
+    compress = false;
+    if(usb_device)
+    {
+        connected = true;
+        hid_set_nonblocking(usb_device, true);
+        if(hid_get_serial_number_string(usb_device, serialString, MAX_SERIAL_LENGTH) == 0)
+            serial = QString::fromWCharArray(serialString);
+        LOG_WARNING("Bootloader %s successfully connected to.", qPrintable(path));
+        return Success;
+    }
+
+    LOG_WARNING("Unable to open device %s.", qPrintable(path));
+    return NotConnected;
+}
+
+/**
+ *
+ */
+void USB::close(void)
+{
+    hid_close(usb_device);
+    usb_device = NULL;
+    connected = false;
+    type = "unknown";
+    serial.clear();
+    packetBytes = USB_PACKET_SIZE;
+    compress = false;
+}
+
+/**
+ *
+ */
+void USB::Reset(void)
+{
+    unsigned char sendPacket[USB_MAX_PACKET_SIZE + 1];
+    QTime elapsed;
+    ErrorCode status;
+
+    if(connected) {
+        memset((void*)&sendPacket, 0x00, sizeof(sendPacket));
+        sendPacket[1] = RESET_DEVICE;
+
+        LOG_INFO("Sending Reset Command...");
+        LOG_FLIGHT("Reset", 0, 0);
+        elapsed.start();
+
+        status = SendPacket(sendPacket, packetBytes + 1, PACKET_SEND_TIMEOUT_MS);
+
+        if(status == USB::Success)
+            LOG_INFO("Successfully sent reset command (%fs)", (double)elapsed.elapsed() / 1000);
+        else
+            LOG_WARNING("Sending reset command failed.");
+    }
+}
+
+USB::ErrorCode USB::EngageBootloader(void)
+{
+	unsigned char sendPacket[USB_MAX_PACKET_SIZE + 1];
+	ErrorCode status;
+	if(connected) {
+		memset((void*)&sendPacket, 0x00, sizeof(sendPacket));
+		sendPacket[1] = ENGAGE_BOOTLOADER;
+		status = SendPacket(sendPacket, packetBytes + 1, PACKET_SEND_TIMEOUT_MS);
+
+		if(status == USB::Success)
+			LOG_INFO("Successfully sent engage bootloader command");
+		else
+			LOG_INFO("Sending engage bootloader command failed.");
+		return status;
+	}	
+}
+
+/**
+ *
+ */
+USB::ErrorCode USB::Program(uint32_t address, unsigned char bytesPerPacket,
+                              unsigned char bytesPerAddress, unsigned char bytesPerWord,
+                              uint32_t endAddress, const unsigned char *pData)
+{
+    Transfer transfer;
+    ErrorCode result;
+
+    result = BeginProgram(&transfer, address, bytesPerPacket, bytesPerAddress, bytesPerWord, endAddress, pData);
+    if(result != Success)
+        return result;
+
+    //Loop through the entire data set/region, but break it into individual packets before sending it
+    //to the device.
+    while(!transfer.done())
+    {
+        result = ProgramPacket(&transfer);
+        if(result != Success)
+            return result;
+    }
+
+    return result;
+}
+
+/**
+ * Sets up transfer for programming a region with ProgramPacket()
+ */
+USB::ErrorCode USB::BeginProgram(Transfer* transfer, uint32_t address, unsigned char bytesPerPacket,
+                                   unsigned char bytesPerAddress, unsigned char bytesPerWord,
+                                   uint32_t endAddress, const unsigned char *pData)
+{
+    //Error check input parameters before using them
+    if((pData == NULL) || (bytesPerAddress == 0) || (address > endAddress) || (bytesPerWord == 0))
+    {
+        LOG_WARNING("Bad parameters specified when calling Program() function.");
+        return Fail;
+    }
+
+    //A packet carries no more than the report in use has room for.
+    if(bytesPerPacket > payloadSize())
+        bytesPerPacket = payloadSize();
+
+    //Error check to make sure the requested maximum data payload size is an exact multiple of the bytesPerAddress.
+    //If not, shrink the number of bytes we actually send, so that it is always an exact multiple of the
+    //programmable media bytesPerAddress.  This ensures that we don't "half" program any memory address (ex: if each
+    //flash address is a 16-bit word address, we don't want to only program one byte of the address, we want to program
+    //both bytes.
+    while((bytesPerPacket % bytesPerWord) != 0)
+    {
+        bytesPerPacket--;
+    }
+
+    memset((void*)transfer, 0x00, sizeof(Transfer));
+    transfer->start = address;
+    transfer->address = address;
+    transfer->endAddress = endAddress;
+    transfer->bytesPerPacket = bytesPerPacket;
+    transfer->bytesPerAddress = bytesPerAddress;
+    transfer->bytesPerWord = bytesPerWord;
+    transfer->source = pData;
+    transfer->firstAllFFPacketFound = false;
+    transfer->lastCommandSent = PROGRAM_DEVICE;
+    progress->BeginRegion();
+
+    return Success;
+}
+
+/**
+ * Programs the next packet of a region set up by BeginProgram(), the region
+ * is complete once transfer->done().
+ */
+USB::ErrorCode USB::ProgramPacket(Transfer* transfer)
+{
+    WritePacket writePacket;
+    ErrorCode result = Success;
+    uint32_t i;
+    bool allPayloadBytesFF;
+    uint32_t bytesToSend;
+    uint32_t bytesCovered;
+    uint32_t startOfDataPayloadIndex;
+    unsigned char bytesPerPacket = transfer->bytesPerPacket;
+    unsigned char bytesPerAddress = transfer->bytesPerAddress;
+    unsigned char bytesPerWord = transfer->bytesPerWord;
+    uint32_t address = transfer->address;
+    uint32_t endAddress = transfer->endAddress;
+
+    //Make sure the device is still connected before we start trying to communicate with it.
+    if(!connected)
+        return NotConnected;
+
+    if(transfer->done())
+        return Success;
+
+    //Prepare the packet to send to the device.
+    memset((void*)&writePacket, 0x00, sizeof(writePacket)); //initialize all bytes clear, so unused pad bytes are = 0x00.
+    writePacket.command = PROGRAM_DEVICE;
+    writePacket.address = address;
+
+    //Check if we are near the end of the programmable region, and need to send a "short packet" (with less than the maximum
+    //allowed program data payload bytes).  In this case we need to notify the device by using the PROGRAM_COMPLETE command instead
+    //of the normal PROGRAM_DEVICE command.  This lets the bootloader firmware in the device know it should flush any internal
+    //buffers it may be using, by programming all of the bufferred data to NVM memory.
+    if(((endAddress - address) * bytesPerAddress) < bytesPerPacket)
+    {
+        writePacket.bytesPerPacket = (endAddress - address) * bytesPerAddress;
+        //Copy the packet data to the actual outgoing buffer and then send it over USB to the device.
+        memcpy(Payload(&writePacket), transfer->source, writePacket.bytesPerPacket);
+        //Check to make sure we are completely programming all bytes of the destination address.  If not,
+        //increase the data size and set the extra byte(s) to 0xFF (the default/blank value).
+        while((writePacket.bytesPerPacket % bytesPerWord) != 0)
+        {
+            if(writePacket.bytesPerPacket >= bytesPerPacket)
+            {
+                break; //should never hit this break, due to while((bytesPerPacket % bytesPerWord) != 0) check in BeginProgram()
+            }
+
+            //Shift all the data payload bytes in the packet to the left one (lower address),
+            //so we can insert a new 0xFF byte at the end of the payload.
+            memmove(Payload(&writePacket) - 1, Payload(&writePacket), writePacket.bytesPerPacket);
+            writePacket.data[payloadSize() - 1] = 0xFF;
+            writePacket.bytesPerPacket++;
+
+        }
+        bytesToSend = writePacket.bytesPerPacket;
+        LOG_DEBUG("Preparing short packet of final program data with payload: 0x%x", (uint32_t)writePacket.bytesPerPacket);
+    }
+    else
+    {
+        //Else we are planning on sending a full length packet with the full size payload.
+        writePacket.bytesPerPacket = bytesPerPacket;
+        bytesToSend = bytesPerPacket;
+        //Copy the packet data to the actual outgoing buffer and then prepare to send it.
+        memcpy(Payload(&writePacket), transfer->source, writePacket.bytesPerPacket);
+    }
+
+
+    //Check if all bytes of the data payload section of the packet are == 0xFF.  If so, we can save programming
+    //time by skipping the packet by not sending it to the device.  The default/erased value is already = 0xFF, so
+    //the contents of the flash memory will be correct (although if we want to be certain we should make sure
+    //the 0xFF regions are still getting checked during the verify step, in case the erase procedure failed to set
+    //all bytes = 0xFF).
+    allPayloadBytesFF = true;   //assume true until we do the actual check below
+    //Loop for all of the bytes in the data payload portion of the writePacket.  The data payload is little endian but is stored
+    //"right justified" in the packet.  Therefore, writePacket.data[0] isn't necessarily the LSB data byte in the packet.
+    startOfDataPayloadIndex = payloadSize() - writePacket.bytesPerPacket;
+    for(i = startOfDataPayloadIndex; i < (startOfDataPayloadIndex + writePacket.bytesPerPacket); i++)
+    {
+        if(writePacket.data[i] != 0xFF)
+        {
+            //Special check for PIC24, where every 4th byte from the .hex file is == 0x00,
+            //which is the "phantom byte" (the upper byte of each odd address 16-bit word
+            //is unimplemented, and is probably 0x00 in the .hex file).
+/*            if((((i - startOfDataPayloadIndex) % bytesPerWord) == 3) && (deviceFamily == Bootloader::PIC24))
+            {
+                //We can ignore this "phantom byte", since it is unimplemented and effectively a "don't care" byte.
+            }
+            else*/
+            {
+                //We found a non 0xFF (or blank value) byte.  We need to send and program the
+                //packet of useful data into the device.
+                allPayloadBytesFF = false;
+                break;
+            }
+        }
+    }
+
+    //Check if we need to send a normal packet of data to the device, if the packet was all 0xFF and
+    //we need to send a PROGRAM_COMPLETE packet, or if it was all 0xFF and we can simply skip it without
+    //doing anything.
+    bytesCovered = bytesPerPacket;
+    if(allPayloadBytesFF == false)
+    {
+        //A compressed packet may cover several plain ones.
+        if(compress)
+        {
+            bytesCovered = CompressPacket(transfer, &writePacket, bytesToSend);
+            if(bytesCovered > 0)
+                bytesToSend = bytesCovered;
+            else
+                bytesCovered = bytesPerPacket;
+        }
+
+        LOG_DEBUG("Sending program data packet with address: 0x%x", (uint32_t)writePacket.address);
+        LOG_FLIGHT((writePacket.command == PROGRAM_COMPRESSED) ? "ProgramCompressed" : "Program", writePacket.address, bytesToSend);
+
+        //We need to send a normal PROGRAM_DEVICE packet worth of data to program.
+        result = SendWithRetry(&writePacket);
+        //Verify the data was successfully received by the USB device, if not
+        //re-sync and send it again on the next call.
+        if(result != Success)
+        {
+            LOG_WARNING("Error during program sending packet with address: 0x%x", (uint32_t)writePacket.address);
+            return Resync(transfer, result);
+        }
+        transfer->firstAllFFPacketFound = true; //reset flag so it will be true the next time a pure 0xFF packet is found
+        transfer->lastCommandSent = writePacket.command;
+        if(writePacket.command == PROGRAM_COMPRESSED)
+            progress->AddSavedReports((bytesCovered + bytesPerPacket - 1) / bytesPerPacket - 1);
+
+    }
+    else if((allPayloadBytesFF == true) && (transfer->firstAllFFPacketFound == true))
+    {
+        //In this case we need to send a PROGRAM_COMPLETE command to let the firmware know it should flush
+        //its buffer by programming all of it to flash, since we are about to skip to a new address range.
+        writePacket.command = PROGRAM_COMPLETE;
+        writePacket.bytesPerPacket = 0;
+        transfer->firstAllFFPacketFound = false;
+        LOG_DEBUG("Sending program complete data packet to skip a packet with address: 0x%x", (uint32_t)writePacket.address);
+        LOG_FLIGHT("ProgramComplete", writePacket.address, 0);
+        result = SendWithRetry(&writePacket);
+        //Verify the data was successfully received by the USB device.
+        if(result != Success)
+        {
+            LOG_WARNING("Error during program sending packet with address: 0x%x", (uint32_t)writePacket.address);
+            return Resync(transfer, result);
+        }
+        transfer->lastCommandSent = PROGRAM_COMPLETE;
+    }
+    else
+    {
+        //If we get to here, this means that (allPayloadBytesFF == true) && (firstAllFFPacketFound == false).
+        //In this case, the last packet that we processed was all 0xFF, and all bytes of this packet are
+        //also all 0xFF.  In this case, we don't need to send any packet data to the device.  All we need
+        //to do is advance our pointers and keep checking for a new non-0xFF section.
+        LOG_DEBUG("Skipping data packet with all 0xFF with address: 0x%x", (uint32_t)writePacket.address);
+        LOG_FLIGHT("Skip", writePacket.address, 0);
+    }
+
+    //Increment pointers now that we successfully programmed (or deliberately skipped) a packet worth of data
+    transfer->address += bytesCovered / bytesPerAddress;
+    transfer->source += bytesToSend;
+    progress->Update((transfer->address - transfer->start) * bytesPerAddress);
+
+    //Check if we just now exactly finished programming the memory region (in which case address will be exactly == endAddress)
+    //region. (ex: we sent a PROGRAM_DEVICE instead of PROGRAM_COMPLETE for the last packet sent).
+    //In this case, we still need to send the PROGRAM_COMPLETE command to let the firmware know that it is done,
+    //and will not be receiving any subsequent program packets for this memory region.
+    //Check if we still need to send a PROGRAM_COMPLETE command (we don't need to send one if
+    //the last command we sent was a PRORAM_COMPLETE already).
+    if(transfer->done() && (transfer->lastCommandSent != PROGRAM_COMPLETE))
+    {
+        memset((void*)&writePacket, 0x00, sizeof(writePacket));
+        writePacket.command = PROGRAM_COMPLETE;
+        writePacket.bytesPerPacket = 0;
+        LOG_DEBUG("Sending final program complete command for this region.");
+        LOG_FLIGHT("ProgramComplete", transfer->address, 0);
+
+        result = SendWithRetry(&writePacket);
+        if(result != Success)
+            return Resync(transfer, result);
+    }
+
+    return result;
+}
+
+/**
+ *
+ */
+USB::ErrorCode USB::GetData(uint32_t address, unsigned char bytesPerPacket,
+                              unsigned char bytesPerAddress, unsigned char bytesPerWord,
+                              uint32_t endAddress, unsigned char *pData)
+{
+    Transfer transfer;
+    ErrorCode result;
+
+    // If not connected, return not connected
+    if(!connected)
+        return NotConnected;
+
+    result = BeginGetData(&transfer, address, bytesPerPacket, bytesPerAddress, bytesPerWord, endAddress, pData);
+    if(result != Success)
+        return result;
+
+    // Continue reading from device until the entire programmable region has been read
+    while(!transfer.done())
+    {
+        // If it wasn't successful, then return with error
+        result = GetDataPacket(&transfer);
+        if(result != Success)
+            return result;
+    }
+
+    // if successfully received entire region, return success
+    return Success;
+}
+
+/**
+ * Sets up transfer for reading a region with GetDataPacket()
+ */
+USB::ErrorCode USB::BeginGetData(Transfer* transfer, uint32_t address, unsigned char bytesPerPacket,
+                                   unsigned char bytesPerAddress, unsigned char bytesPerWord,
+                                   uint32_t endAddress, unsigned char *pData)
+{
+    //First error check the input parameters before using them
+    if((pData == NULL) || (endAddress < address) || (bytesPerPacket == 0) || (bytesPerAddress == 0))
+    {
+        LOG_WARNING("Error, bad parameters provided to call of GetData()");
+        return Fail;
+    }
+
+    if(bytesPerPacket > payloadSize())
+        bytesPerPacket = payloadSize();
+
+    memset((void*)transfer, 0x00, sizeof(Transfer));
+    transfer->start = address;
+    transfer->address = address;
+    transfer->endAddress = endAddress;
+    transfer->bytesPerPacket = bytesPerPacket;
+    transfer->bytesPerAddress = bytesPerAddress;
+    transfer->bytesPerWord = bytesPerWord;
+    transfer->destination = pData;
+    progress->BeginRegion();
+
+    return Success;
+}
+
+/**
+ * Reads the next packet of a region set up by BeginGetData(), the region
+ * is complete once transfer->done().
+ */
+USB::ErrorCode USB::GetDataPacket(Transfer* transfer)
+{
+    ReadPacket readPacket;
+    WritePacket writePacket;
+    QElapsedTimer elapsed;
+    ErrorCode result;
+    uint32_t address = transfer->address;
+    uint32_t endAddress = transfer->endAddress;
+    int attempt;
+
+    if(!connected)
+        return NotConnected;
+
+    if(transfer->done())
+        return Success;
+
+    // Set up the buffer packet with the appropriate address and with the get data command
+    memset((void*)&writePacket, 0x00, sizeof(writePacket));
+    writePacket.command = GET_DATA;
+    writePacket.address = address;
+
+    //Debug output info.
+    LOG_DEBUG("Fetching packet with address: 0x%x", (uint32_t)writePacket.address);
+
+    // Calculate to see if the entire buffer can be filled with data, or just partially
+    if(((endAddress - address) * transfer->bytesPerAddress) < transfer->bytesPerPacket)
+        // If the amount of bytes left over between current address and end address is less than
+        //  the max amount of bytes per packet, then make sure the bytesPerPacket info is updated
+        writePacket.bytesPerPacket = (endAddress - address) * transfer->bytesPerAddress;
+    else
+        // Otherwise keep it at its maximum
+        writePacket.bytesPerPacket = transfer->bytesPerPacket;
+    LOG_FLIGHT("GetData", writePacket.address, writePacket.bytesPerPacket);
+
+    // Send the request and read back its answer, asking again when the
+    // request or the answer got lost
+    elapsed.start();
+    for(attempt = 1; ; attempt++)
+    {
+        result = SendPacket((unsigned char*)&writePacket, packetBytes + 1, PACKET_REPLY_TIMEOUT_MS);
+        if(result == Success)
+        {
+            memset((void*)&readPacket, 0x00, sizeof(readPacket));
+            result = ReceiveReply(&writePacket, (unsigned char*)&readPacket, sizeof(readPacket));
+        }
+
+        if((result == Success) || !connected || (attempt >= PACKET_ATTEMPTS))
+            break;
+
+        LOG_FLIGHT("GetDataRetry", writePacket.address, attempt);
+        progress->AddRetry();
+        QThread::msleep(PACKET_RETRY_DELAY_MS);
+    }
+
+    // If it still wasn't successful, re-sync and ask again on the next call
+    if(result != Success)
+    {
+        LOG_WARNING("Error reading packet with address: 0x%x", (uint32_t)writePacket.address);
+        return Resync(transfer, result);
+    }
+    progress->AddLatency(elapsed.nsecsElapsed() / 1000);
+
+    // Copy contents from packet to data pointer
+    if(readPacket.bytesPerPacket > payloadSize())
+    {
+        LOG_WARNING("Packet with address 0x%x claims %u payload bytes.", (uint32_t)readPacket.address, (uint32_t)readPacket.bytesPerPacket);
+        return Resync(transfer, IncorrectCommand);
+    }
+    memcpy(transfer->destination, Payload(&readPacket), readPacket.bytesPerPacket);
+
+    // Increment data pointer
+    transfer->destination += readPacket.bytesPerPacket;
+
+    // Increment address by however many bytes were received divided by how many bytes per address
+    transfer->address += readPacket.bytesPerPacket / transfer->bytesPerAddress;
+    progress->Update((transfer->address - transfer->start) * transfer->bytesPerAddress);
+
+    return Success;
+}
+
+/**
+ *
+ */
+USB::ErrorCode USB::Erase(void) {
+    WritePacket sendPacket;
+    QElapsedTimer elapsed;
+    ErrorCode status;
+	FirmwareInfo QueryInfoBuffer;
+    QString eraseType = type;
+    int expected, limit, poll;
+    bool received = false;
+
+    if(connected) {
+        memset((void*)&sendPacket, 0x00, sizeof(sendPacket));
+        sendPacket.command = ERASE_DEVICE;
+
+        LOG_INFO("Sending Erase Command...");
+        LOG_FLIGHT("Erase", 0, 0);
+
+        elapsed.start();
+
+        status = SendWithRetry(&sendPacket);
+
+        if(status == USB::Success)
+            LOG_INFO("Successfully sent erase command (%fs)", (double)elapsed.elapsed() / 1000);
+        else
+        {
+            LOG_INFO("Erasing Bootloader Failed");
+            return status;
+        }
+
+        //Sleep through most of the time an erase of this device usually takes, the
+        //device cannot answer before it is done anyway.
+        expected = EraseHistory::Expected(eraseType);
+        limit = EraseHistory::Limit(eraseType);
+        if(expected > 0)
+            QThread::msleep((unsigned long)(expected * ERASE_SLEEP_PERCENT / 100));
+
+		//Now issue a FIRMWARE_INFO command, so as to "poll" for the completion of
+        //the prior request (which doesn't by itself generate a respone packet).
+        memset((void*)&sendPacket, 0x00, sizeof(sendPacket));
+        sendPacket.command = FIRMWARE_INFO;
+        LOG_FLIGHT("FirmwareInfo", 0, 0);
+
+        status = SendWithRetry(&sendPacket);
+        if(status != Success)
+        {
+            if(status == Fail)
+                close();
+            return status;
+        }
+
+        //Poll with a growing interval until it answers, and give up once the erase
+        //takes clearly longer than any erase of this device type so far.
+        memset((void*)&QueryInfoBuffer, 0x00, sizeof(QueryInfoBuffer));
+        poll = ERASE_POLL_MIN_MS;
+        forever
+        {
+            status = TryReceivePacket((unsigned char*)&QueryInfoBuffer, sizeof(QueryInfoBuffer), &received);
+            if((status != Success) || received)
+                break;
+
+            if(elapsed.elapsed() > limit)
+            {
+                LOG_WARNING("Erase did not finish within %dms.", limit);
+                LOG_FLIGHT("EraseTimeout", 0, limit);
+                return Timeout;
+            }
+
+            QThread::msleep(poll);
+            poll = qMin(poll * 2, ERASE_POLL_MAX_MS);
+        }
+
+        if(status != Success)
+            return status;
+
+        return EraseAnswered(&QueryInfoBuffer, (int)elapsed.elapsed());
+    }
+
+    LOG_INFO("Bootloader not connected");
+    return NotConnected;
+}
+
+/**
+ * Checks the FIRMWARE_INFO answer that ends an erase and adds the time the
+ * erase took to the history of the device type.
+ */
+USB::ErrorCode USB::EraseAnswered(FirmwareInfo* firmwareInfo, int msecs)
+{
+    if(firmwareInfo->command != FIRMWARE_INFO)
+    {
+        LOG_WARNING("Received incorrect command.");
+        LOG_FLIGHT("IncorrectCommand", 0, firmwareInfo->command);
+        return IncorrectCommand;
+    }
+
+    type = DeviceType(firmwareInfo);
+    EraseHistory::Record(type, msecs);
+    LOG_INFO("Erase complete (%fs)", (double)msecs / 1000);
+
+    return Success;
+}
+
+
+USB::ErrorCode USB::ReadFirmwareInfo(FirmwareInfo* firmwareInfo)
+{
+    QTime elapsed;
+    WritePacket sendPacket;
+    ErrorCode status;
+
+    LOG_INFO("Getting Extended Query Info packet...");
+    LOG_FLIGHT("FirmwareInfo", 0, 0);
+
+    if(connected)
+    {
+        memset((void*)&sendPacket, 0x00, sizeof(sendPacket));
+        sendPacket.command = FIRMWARE_INFO;
+
+        elapsed.start();
+
+        status = SendWithRetry(&sendPacket);
+
+        switch(status)
+        {
+            case Fail:
+                close();
+            case Timeout:
+                return status;
+            default:
+                break;
+        }
+
+        LOG_INFO("Successfully sent FIRMWARE_INFO command (%fs)", (double)elapsed.elapsed() / 1000);
+        memset((void*)firmwareInfo, 0x00, sizeof(FirmwareInfo));
+
+        elapsed.start();
+
+        status = ReceivePacket((unsigned char*)firmwareInfo, sizeof(FirmwareInfo));
+
+
+        if(firmwareInfo->command != FIRMWARE_INFO)
+        {
+            LOG_WARNING("Received incorrect command.");
+            LOG_FLIGHT("IncorrectCommand", 0, firmwareInfo->command);
+            return IncorrectCommand;
+        }
+
+        switch(status)
+        {
+            case Fail:
+                close();
+            case Timeout:
+                return status;
+            default:
+                break;
+        }
+
+        LOG_INFO("Successfully received FIRMWARE_INFO response packet (%fs)", (double)elapsed.elapsed() / 1000);
+        return FirmwareInfoAnswered(firmwareInfo);
+    }
+
+    return NotConnected;
+}
+
+/**
+ * Takes in the answer to FIRMWARE_INFO, however it was waited for: the
+ * device type, and what the bootloader offers beyond the basic packet.
+ */
+USB::ErrorCode USB::FirmwareInfoAnswered(FirmwareInfo* firmwareInfo)
+{
+    if(firmwareInfo->command != FIRMWARE_INFO)
+    {
+        LOG_WARNING("Received incorrect command.");
+        LOG_FLIGHT("IncorrectCommand", 0, firmwareInfo->command);
+        return IncorrectCommand;
+    }
+
+    type = DeviceType(firmwareInfo);
+    compress = (firmwareInfo->capabilities & CAPABILITY_COMPRESSED) != 0;
+
+    // Larger reports carry more payload per USB transaction
+    if(NegotiatedPacketSize(firmwareInfo) != packetBytes)
+    {
+        packetBytes = NegotiatedPacketSize(firmwareInfo);
+        LOG_INFO("Using %u byte reports, %u bytes of payload each.", packetBytes, payloadSize());
+    }
+    return Success;
+}
+
+
+USB::ErrorCode USB::SignFlash(void)
+{
+    QTime elapsed;
+    WritePacket sendPacket;
+    ErrorCode status;
+    uint32_t i;
+    uint32_t bytesRead = 0;
+    FirmwareInfo QueryInfoBuffer;
+
+    LOG_INFO("Sending SIGN_FLASH command...");
+    LOG_FLIGHT("Sign", 0, 0);
+
+    if(connected)
+    {
+        memset((void*)&sendPacket, 0x00, sizeof(sendPacket));
+        sendPacket.command = SIGN_FLASH;
+
+        elapsed.start();
+
+        status = SendWithRetry(&sendPacket);
+
+        switch(status)
+        {
+            case Fail:
+                close();
+            case Timeout:
+                return status;
+            default:
+                break;
+        }
+
+        //Now issue a ReadFirmwareInfo command, so as to "poll" for the completion of
+        //the prior request (which doesn't by itself generate a respone packet).
+		status = ReadFirmwareInfo(&QueryInfoBuffer);
+        switch(status)
+        {
+            case Fail:
+                close();
+            case Timeout:
+                return status;
+            default:
+                break;
+        }
+        LOG_INFO("Successfully sent SIGN_FLASH command (%fs)", (double)elapsed.elapsed() / 1000);
+
+        return Success;
+    }//if(connected)
+
+    return NotConnected;
+}
+
+
+/**
+ * Writes a report, offering it again for up to msecs while the device does
+ * not take it.
+ */
+USB::ErrorCode USB::SendPacket(unsigned char *pData, int size, int msecs)
+{
+    QElapsedTimer timeoutTimer;
+    int res = 0, failures = 0;
+    TRACE_SCOPE_ADDRESS(trace, "SendPacket", ((WritePacket*)pData)->address);
+
+    timeoutTimer.start();
+
+    while(res < 1)
+    {
+        res = hid_write(usb_device, pData, size);
+
+        // If timed out, or return error then close device and return failure
+        if((res < 1) && (timeoutTimer.elapsed() > msecs))
+        {
+            LOG_WARNING("Timed out waiting for query command acknowledgement.");
+            LOG_FLIGHT("SendTimeout", ((WritePacket*)pData)->address, ((WritePacket*)pData)->command);
+            return Timeout;
+        }
+
+        // A write error on a noisy hub is often gone a moment later, only
+        // give up on the device when it keeps failing
+        if((res == -1) && (++failures < PACKET_ATTEMPTS))
+        {
+            LOG_FLIGHT("SendRetry", ((WritePacket*)pData)->address, failures);
+            progress->AddRetry();
+            QThread::msleep(PACKET_RETRY_DELAY_MS);
+            res = 0;
+            continue;
+        }
+
+        if(res == -1)
+        {
+            LOG_WARNING("Write failed.");
+            LOG_FLIGHT("SendFailed", ((WritePacket*)pData)->address, ((WritePacket*)pData)->command);
+            close();
+            return Fail;
+        }
+    }
+    return Success;
+}
+
+
+USB::ErrorCode USB::ReceivePacket(unsigned char *data, int size)
+{
+    QTime timeoutTimer;
+    int res = 0, timeout = 3;
+    TRACE_SCOPE_ADDRESS(trace, "ReceivePacket", 0);
+
+    timeoutTimer.start();
+
+    while(res < 1)
+    {
+        res = hid_read(usb_device, data, size);
+
+        if(timeoutTimer.elapsed() > SyncWaitTime)
+        {
+            timeoutTimer.start();
+            timeout--;
+        }
+
+        // If timed out twice, or return error then close device and return failure
+        if(timeout == 0)
+        {
+            LOG_WARNING("Timeout.");
+            LOG_FLIGHT("ReceiveTimeout", 0, 0);
+            return Timeout;
+        }
+
+        if(res == -1)
+        {
+            LOG_WARNING("Read failed.");
+            LOG_FLIGHT("ReceiveFailed", 0, 0);
+            close();
+            return Fail;
+        }
+    }
+    TRACE_SET_ADDRESS(trace, ((ReadPacket*)data)->address);
+    return Success;
+}
+
+/**
+ * Reads a report if one has arrived, without waiting for it.
+ */
+USB::ErrorCode USB::TryReceivePacket(unsigned char *data, int size, bool* received)
+{
+    int res;
+
+    *received = false;
+    if(!connected)
+        return NotConnected;
+
+    res = hid_read(usb_device, data, size);
+    if(res == -1)
+    {
+        LOG_WARNING("Read failed.");
+        LOG_FLIGHT("ReceiveFailed", 0, 0);
+        close();
+        return Fail;
+    }
+
+    *received = (res > 0);
+    return Success;
+}
+
+/**
+ * Waits up to msecs for a report, asleep in the driver rather than polling.
+ */
+USB::ErrorCode USB::WaitReceivePacket(unsigned char *data, int size, int msecs, bool* received)
+{
+    int res;
+
+    *received = false;
+    if(!connected)
+        return NotConnected;
+
+    res = hid_read_timeout(usb_device, data, size, msecs);
+    if(res == -1)
+    {
+        LOG_WARNING("Read failed.");
+        LOG_FLIGHT("ReceiveFailed", 0, 0);
+        close();
+        return Fail;
+    }
+
+    *received = (res > 0);
+    return Success;
+}
+
+/**
+ * Sends a packet, sending it again when the device did not take it within
+ * PACKET_REPLY_TIMEOUT_MS while it is still there.
+ */
+USB::ErrorCode USB::SendWithRetry(WritePacket* packet)
+{
+    QElapsedTimer elapsed;
+    ErrorCode result;
+    int attempt;
+
+    elapsed.start();
+    for(attempt = 1; ; attempt++)
+    {
+        result = SendPacket((unsigned char*)packet, packetBytes + 1, PACKET_REPLY_TIMEOUT_MS);
+        if(result == Success)
+            progress->AddLatency(elapsed.nsecsElapsed() / 1000);
+        if((result != Timeout) || !connected || (attempt >= PACKET_ATTEMPTS))
+            return result;
+
+        LOG_FLIGHT("SendRetry", packet->address, attempt);
+        progress->AddRetry();
+        QThread::msleep(PACKET_RETRY_DELAY_MS);
+    }
+}
+
+/**
+ * Packs the data ahead of transfer into a PROGRAM_COMPRESSED packet.  It
+ * covers up to COMPRESSED_MAX_SPAN bytes, stopping short of the next blank
+ * packet so blank stretches are still skipped.  Returns the bytes covered,
+ * or 0 when that is no more than the plainBytes a plain packet carries and
+ * packet is left as it was.
+ */
+uint32_t USB::CompressPacket(const Transfer* transfer, WritePacket* packet, uint32_t plainBytes)
+{
+    unsigned char encoded[USB_MAX_PAYLOAD];
+    unsigned char* payload;
+    uint32_t remaining, span, chunk, consumed, size;
+
+    remaining = (transfer->endAddress - transfer->address) * transfer->bytesPerAddress;
+    span = 0;
+    while((span < remaining) && (span < COMPRESSED_MAX_SPAN))
+    {
+        chunk = qMin((uint32_t)transfer->bytesPerPacket, remaining - span);
+        if((span > 0) && (ImageDiff::Mismatch((unsigned char)IMAGE_DIFF_BLANK, transfer->source + span, chunk) == chunk))
+            break;
+        span += chunk;
+    }
+    span = qMin(span, (uint32_t)COMPRESSED_MAX_SPAN);
+
+    //Whole words only, then code again what is left so the stream ends there
+    PayloadCodec::Encode(transfer->source, span, encoded, payloadSize() - COMPRESSED_HEADER, &consumed);
+    consumed -= consumed % transfer->bytesPerWord;
+    if(consumed <= plainBytes)
+        return 0;
+    size = PayloadCodec::Encode(transfer->source, consumed, encoded, payloadSize() - COMPRESSED_HEADER, &consumed);
+
+    memset(packet->data, 0x00, sizeof(packet->data));
+    packet->command = PROGRAM_COMPRESSED;
+    packet->bytesPerPacket = (unsigned char)(size + COMPRESSED_HEADER);
+    payload = Payload(packet);
+    payload[0] = (unsigned char)consumed;
+    payload[1] = (unsigned char)(consumed >> 8);
+    memcpy(payload + COMPRESSED_HEADER, encoded, size);
+
+    return consumed;
+}
+
+/**
+ * Waits for the answer to a request.  Answers to earlier requests that are
+ * still queued (the request was sent again, but the first answer arrived
+ * after all) are dropped.  The wait sleeps in the driver, up to
+ * PACKET_REPLY_POLL_MS at a time, so the thread does not spin on the CPU.
+ * In low jitter mode it polls for RealtimeIo::pollUs() first, then blocks
+ * for the rest of the timeout.
+ */
+USB::ErrorCode USB::ReceiveReply(const WritePacket* request, unsigned char* reply, int size)
+{
+    QElapsedTimer timer;
+    ErrorCode result;
+    bool received;
+    ReadPacket* packet = (ReadPacket*)reply;
+
+    timer.start();
+    while(timer.elapsed() < PACKET_REPLY_TIMEOUT_MS)
+    {
+        if(!RealtimeIo::isEnabled())
+            result = WaitReceivePacket(reply, size, PACKET_REPLY_POLL_MS, &received);
+        else if(timer.nsecsElapsed() >= ((qint64)RealtimeIo::pollUs() * 1000))
+            result = WaitReceivePacket(reply, size, qMax(1, PACKET_REPLY_TIMEOUT_MS - (int)timer.elapsed()), &received);
+        else
+            result = TryReceivePacket(reply, size, &received);
+        if(result != Success)
+            return result;
+        if(!received)
+            continue;
+
+        if((packet->command == request->command) &&
+           ((request->command != GET_DATA) || (packet->address == request->address)))
+            return Success;
+
+        LOG_FLIGHT("StaleReply", packet->address, packet->command);
+    }
+
+    LOG_FLIGHT("ReceiveTimeout", request->address, request->command);
+    return Timeout;
+}
+
+/**
+ * Brings the firmware back to a known state after a packet kept failing: any
+ * buffered program data is flushed and the firmware must answer a query.  The
+ * transfer is left at its last good address, so the next packet call carries
+ * on from there.  Gives up (returning the original error) once the device is
+ * gone or the transfer has re-synced too often.
+ */
+USB::ErrorCode USB::Resync(Transfer* transfer, ErrorCode error)
+{
+    WritePacket writePacket;
+    FirmwareInfo firmwareInfo;
+    ErrorCode result;
+
+    if(!connected || (transfer->resyncs >= TRANSFER_RESYNCS))
+        return error;
+
+    transfer->resyncs++;
+    LOG_WARNING("Re-syncing at address 0x%x", transfer->address);
+    LOG_FLIGHT("Resync", transfer->address, transfer->resyncs);
+
+    memset((void*)&writePacket, 0x00, sizeof(writePacket));
+    writePacket.command = PROGRAM_COMPLETE;
+    result = SendWithRetry(&writePacket);
+    if(result != Success)
+        return result;
+
+    memset((void*)&writePacket, 0x00, sizeof(writePacket));
+    writePacket.command = FIRMWARE_INFO;
+    result = SendWithRetry(&writePacket);
+    if(result == Success)
+        result = ReceiveReply(&writePacket, (unsigned char*)&firmwareInfo, sizeof(firmwareInfo));
+    if(result != Success)
+        return result;
+
+    transfer->lastCommandSent = PROGRAM_COMPLETE;
+    transfer->firstAllFFPacketFound = false;
+    progress->AddResync();
+    return Success;
+}
@@ -0,0 +1,242 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef USB_H
+#define USB_H
+
+#include <stdint.h>
+#include <QList>
+#include <QThread>
+#include <QTimer>
+#include "../HidApi/hidapi.h"
+#include "Bootloader.h"
+#include "Progress.h"
+
+// Bootloader Vendor and Product IDs
+#define VID 0x04d8
+#define PID 0x003C
+
+// Report size every bootloader takes, used until a larger one is negotiated
+#define USB_PACKET_SIZE 64
+#define USB_PACKET_SIZE_WITH_REPORT_ID (USB_PACKET_SIZE + 1)
+// Largest report used with a bootloader that offers bigger ones.  The payload
+// length of a packet travels in a single byte, larger reports gain nothing.
+#define USB_MAX_PACKET_SIZE 256
+// Command, address and payload length ahead of the payload of a packet
+#define USB_PACKET_HEADER 6
+// Payload room of the largest packet
+#define USB_MAX_PAYLOAD (USB_MAX_PACKET_SIZE - USB_PACKET_HEADER)
+
+// Packet commands
+#define UNLOCK_CONFIG       0x03
+#define ERASE_DEVICE        0x04
+#define PROGRAM_DEVICE      0x05
+#define PROGRAM_COMPLETE    0x06
+#define GET_DATA            0x07
+#define RESET_DEVICE        0x08
+#define SIGN_FLASH			0x09	//The host PC application should send this command after the verify operation has completed successfully.  If checksums are used instead of a true verify (due to ALLOW_GET_DATA_COMMAND being commented), then the host PC application should send SIGN_FLASH command after is has verified the checksums are as exected. The firmware will then program the SIGNATURE_WORD into flash at the SIGNATURE_ADDRESS.
+#define ENGAGE_BOOTLOADER	0x0A
+#define FIRMWARE_INFO		0x0C    //Used by host PC app to get additional info about the device, beyond the basic NVM layout provided by the query device command
+#define PROGRAM_COMPRESSED  0x0D    //Same as PROGRAM_DEVICE, with a run length coded payload (see PayloadCodec) that starts with the decoded length
+
+// Capability bits of FIRMWARE_INFO, bootloaders that predate them leave the byte 0
+#define CAPABILITY_PACKET_SIZE  0x01    // packetSize holds the largest report the bootloader takes
+#define CAPABILITY_COMPRESSED   0x02    // PROGRAM_COMPRESSED is understood
+
+// Bytes ahead of the coded data in a PROGRAM_COMPRESSED payload, the decoded length
+#define COMPRESSED_HEADER       2
+// Longest stretch one PROGRAM_COMPRESSED packet decodes to, the firmware buffers it whole
+#define COMPRESSED_MAX_SPAN     512
+
+// Maximum number of memory regions that can be bootloaded
+#define MAX_DATA_REGIONS    0x02
+#define MAX_ERASE_BLOCK_SIZE 8196   //Increase this in the future if any microcontrollers with bigger than 8196 byte erase block is implemented
+
+// Longest USB serial number read, in characters
+#define MAX_SERIAL_LENGTH   128
+
+// Attempts at one packet before the transfer re-syncs with the firmware
+#define PACKET_ATTEMPTS         3
+// Pause before a packet is sent again
+#define PACKET_RETRY_DELAY_MS   2
+// Wait for the answer to a data request before it is asked for again, and
+// for the device to take a packet that is sent again when it does not
+#define PACKET_REPLY_TIMEOUT_MS 1000
+// Longest a reply wait sleeps in the driver before it checks the time
+#define PACKET_REPLY_POLL_MS    1
+// Wait for the device to take a command that is only sent once
+#define PACKET_SEND_TIMEOUT_MS  200000
+// Re-syncs a transfer may do before it fails
+#define TRANSFER_RESYNCS        4
+
+// Provides low level HID bootloader communication.
+class USB : public QObject
+{
+	// Qt Macro
+    Q_OBJECT
+
+protected:
+    hid_device *usb_device;
+    bool connected;
+    QString devicePath;
+    ProgressCounter ownProgress;
+    ProgressCounter* progress;      // Updated with every packet programmed or read
+    QString type;                   // See deviceType()
+    QString serial;                 // USB serial number of the opened device, empty when it has none
+    unsigned int packetBytes;       // Report size in use, see packetSize()
+    bool compress;                  // The bootloader takes PROGRAM_COMPRESSED
+
+public:
+
+    explicit USB();
+    ~USB();
+
+	// Members
+    static const int SyncWaitTime;
+
+	// Enums and structs
+    enum ErrorCode
+    {
+        Success = 0, NotConnected, Fail, IncorrectCommand, Timeout, Cancelled, Other = 0xFF
+    };
+
+    QString ErrorString(ErrorCode errorCode) const;
+
+    // An attached bootloader, as found by Enumerate()
+    struct DeviceInfo
+    {
+        QString path;
+        QString serialNumber;
+    };
+
+	// http://stackoverflow.com/questions/3318410/pragma-pack-effect
+    #pragma pack(1)
+    struct MemoryRegion
+    {
+        unsigned char type;
+        uint32_t address;
+        uint32_t size;
+    };
+	
+    //Structure for the response to the GetFirmwareInfo command
+    union FirmwareInfo
+    {
+        struct
+        {
+            unsigned char command;
+            uint16_t bootloaderVersion;
+            uint16_t applicationVersion;
+            uint32_t signatureAddress;
+            uint16_t signatureValue;
+            uint32_t erasePageSize;
+            unsigned char capabilities;
+            uint16_t packetSize;
+            unsigned char pad[USB_PACKET_SIZE_WITH_REPORT_ID - 18];
+        };
+    };
+
+	// Packet written to the onboard MCU.  Only the first packetSize() + 1
+	// bytes are sent, the payload is right justified within them, see Payload().
+    struct WritePacket
+    {
+        unsigned char report;
+        unsigned char command;
+        union {
+            uint32_t address;
+            unsigned char LockedValue;
+        };
+        unsigned char bytesPerPacket;
+        unsigned char data[USB_MAX_PAYLOAD];
+    };
+
+	// Packet read from the onboard MCU, laid out like WritePacket without
+	// the report ID
+    struct ReadPacket
+    {
+        unsigned char command;
+        uint32_t address;
+        unsigned char bytesPerPacket;
+        unsigned char data[USB_MAX_PAYLOAD + 1];
+    };
+
+    #pragma pack()
+
+    // Progress through one memory region, advanced a packet at a time by
+    // ProgramPacket() or GetDataPacket() so a caller can interleave devices
+    struct Transfer
+    {
+        uint32_t start;
+        uint32_t address;                   // Next address to transfer
+        uint32_t endAddress;
+        unsigned char bytesPerPacket;
+        unsigned char bytesPerAddress;
+        unsigned char bytesPerWord;
+        const unsigned char* source;        // Program
+        unsigned char* destination;         // GetData
+        bool firstAllFFPacketFound;
+        unsigned char lastCommandSent;
+        unsigned char resyncs;              // Re-syncs so far, see Resync()
+
+        bool done(void) const { return address >= endAddress; }
+    };
+
+	// Methods
+    static QList<DeviceInfo> Enumerate(void);
+	ErrorCode EngageBootloader(void);
+    virtual void PollUSB(void);
+    virtual ErrorCode open(void);
+    virtual ErrorCode open(QString path);
+    virtual void close(void);
+    bool isConnected(void);
+    QString path(void) const;
+    QString deviceType(void) const;
+    QString serialNumber(void) const;
+    unsigned int packetSize(void) const;
+    unsigned int payloadSize(void) const;
+    bool compression(void) const;
+    unsigned char* Payload(WritePacket* packet) const;
+    const unsigned char* Payload(const ReadPacket* packet) const;
+    static unsigned int NegotiatedPacketSize(const FirmwareInfo* firmwareInfo);
+    ProgressCounter* progressCounter(void) const;
+    void setProgressCounter(ProgressCounter* counter);
+    void Reset(void);
+    ErrorCode GetData(uint32_t address, unsigned char bytesPerPacket, unsigned char bytesPerAddress, unsigned char bytesPerWord, uint32_t endAddress, unsigned char *data);
+    ErrorCode Program(uint32_t address, unsigned char bytesPerPacket, unsigned char bytesPerAddress, unsigned char bytesPerWord, uint32_t endAddress, const unsigned char *data);	
+    ErrorCode BeginProgram(Transfer* transfer, uint32_t address, unsigned char bytesPerPacket, unsigned char bytesPerAddress, unsigned char bytesPerWord, uint32_t endAddress, const unsigned char *data);
+    ErrorCode ProgramPacket(Transfer* transfer);
+    ErrorCode BeginGetData(Transfer* transfer, uint32_t address, unsigned char bytesPerPacket, unsigned char bytesPerAddress, unsigned char bytesPerWord, uint32_t endAddress, unsigned char *data);
+    ErrorCode GetDataPacket(Transfer* transfer);
+    ErrorCode Erase(void);
+    ErrorCode EraseAnswered(FirmwareInfo* firmwareInfo, int msecs);
+    ErrorCode FirmwareInfoAnswered(FirmwareInfo* firmwareInfo);
+    //ErrorCode LockUnlockConfig(bool lock);
+    ErrorCode ReadFirmwareInfo(FirmwareInfo* firmwareInfo);
+    ErrorCode SignFlash(void);
+    // Transport, overridden by EmulatedUSB to stand in for real hardware
+    virtual ErrorCode SendPacket(unsigned char *data, int size, int msecs);
+    virtual ErrorCode ReceivePacket(unsigned char *data, int size);
+    virtual ErrorCode TryReceivePacket(unsigned char *data, int size, bool* received);
+    virtual ErrorCode WaitReceivePacket(unsigned char *data, int size, int msecs, bool* received);
+    ErrorCode SendWithRetry(WritePacket* packet);
+
+protected:
+    ErrorCode ReceiveReply(const WritePacket* request, unsigned char* reply, int size);
+    uint32_t CompressPacket(const Transfer* transfer, WritePacket* packet, uint32_t plainBytes);
+    ErrorCode Resync(Transfer* transfer, ErrorCode error);
+};
+
+#endif // COMM_H
@@ -0,0 +1,187 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QDateTime>
+
+#include "VerifyPlan.h"
+#include "ImageDiff.h"
+#include "Bootloader.h"
+
+VerifyPlan::VerifyPlan(Policy policy)
+{
+    this->policy = policy;
+    samplePercent = DefaultSamplePercent(policy);
+    seed = (uint32_t)QDateTime::currentMSecsSinceEpoch();
+}
+
+/*
+ * The parts of deviceRange within [from, to) to read back, as ranges
+ * pointing into its buffer.  hexRange is the image region at the same
+ * address.  Unless the whole region is asked for, from must be a multiple
+ * of a packet from the region start.
+ */
+QList<PICData::MemoryRange> VerifyPlan::Ranges(const PICData::MemoryRange& hexRange, const PICData::MemoryRange& deviceRange, uint32_t from, uint32_t to) const
+{
+    QList<PICData::MemoryRange> ranges;
+    PICData::MemoryRange range;
+    unsigned int bytesPerAddress = ImageDiff::BytesPerAddress(deviceRange.type);
+    uint32_t unit, address, start, end, hexLength;
+    bool selected;
+
+    unit = Bootloader::bytesPerPacket / bytesPerAddress;
+    if(policy == Sampled)
+        unit *= VERIFY_PAGE_PACKETS;
+    if(to > deviceRange.end)
+        to = deviceRange.end;
+
+    for(address = deviceRange.start + ((from - deviceRange.start) / unit) * unit; address < to; address += unit)
+    {
+        switch(policy)
+        {
+            case Extents:
+                // Programmed when the image has anything but 0xFF in the packet
+                selected = Sample(address);
+                if(!selected && (address < hexRange.end))
+                {
+                    hexLength = (qMin(address + unit, hexRange.end) - address) * bytesPerAddress;
+                    selected = ImageDiff::Mismatch((unsigned char)IMAGE_DIFF_BLANK, hexRange.pDataBuffer + (address - hexRange.start) * bytesPerAddress, hexLength) < hexLength;
+                }
+                break;
+            case Sampled:
+                selected = Sample(address);
+                break;
+            case Full:
+            default:
+                selected = true;
+                break;
+        }
+
+        if(!selected)
+            continue;
+
+        start = qMax(address, from);
+        end = qMin(address + unit, to);
+        if(!ranges.isEmpty() && (ranges.last().end == start))
+        {
+            ranges.last().end = end;
+            ranges.last().dataBufferLength = (end - ranges.last().start) * bytesPerAddress;
+            continue;
+        }
+
+        range.type = deviceRange.type;
+        range.start = start;
+        range.end = end;
+        range.dataBufferLength = (end - start) * bytesPerAddress;
+        range.pDataBuffer = deviceRange.pDataBuffer + (start - deviceRange.start) * bytesPerAddress;
+        ranges.append(range);
+    }
+
+    return ranges;
+}
+
+/*
+ * The parts of the selected device regions to read back, for every region
+ * the image also has
+ */
+QList<PICData::MemoryRange> VerifyPlan::Ranges(const PICData* deviceData, const PICData* hexData, bool flash, bool eeprom) const
+{
+    QList<PICData::MemoryRange> ranges;
+    PICData::MemoryRange deviceRange, hexRange;
+
+    foreach(deviceRange, deviceData->ranges)
+    {
+        if(!((flash && (deviceRange.type == PROGRAM_MEM)) || (eeprom && (deviceRange.type == EEPROM_MEM))))
+            continue;
+
+        foreach(hexRange, hexData->ranges)
+        {
+            if(hexRange.start == deviceRange.start)
+                ranges += Ranges(hexRange, deviceRange, deviceRange.start, deviceRange.end);
+        }
+    }
+
+    return ranges;
+}
+
+QString VerifyPlan::name(void) const
+{
+    switch(policy)
+    {
+        case Extents:
+            return "extents";
+        case Sampled:
+            return "sampled";
+        case Full:
+        default:
+            return "full";
+    }
+}
+
+/*
+ * Policy from its name() ("full", "extents" or "sampled")
+ */
+bool VerifyPlan::Parse(QString name, Policy* policy)
+{
+    name = name.toLower();
+    if(name == "full")
+        *policy = Full;
+    else if(name == "extents")
+        *policy = Extents;
+    else if(name == "sampled")
+        *policy = Sampled;
+    else
+        return false;
+
+    return true;
+}
+
+int VerifyPlan::DefaultSamplePercent(Policy policy)
+{
+    switch(policy)
+    {
+        case Extents:
+            return VERIFY_BLANK_SAMPLE_PERCENT;
+        case Sampled:
+            return VERIFY_PAGE_SAMPLE_PERCENT;
+        case Full:
+        default:
+            return 100;
+    }
+}
+
+/*
+ * Whether the packet or page at address is one of the samplePercent picked
+ */
+bool VerifyPlan::Sample(uint32_t address) const
+{
+    uint32_t hash = address ^ seed;
+
+    if(samplePercent >= 100)
+        return true;
+    if(samplePercent <= 0)
+        return false;
+
+    // Integer hash finalizer, spreads neighbouring addresses evenly
+    hash ^= hash >> 16;
+    hash *= 0x7feb352dU;
+    hash ^= hash >> 15;
+    hash *= 0x846ca68bU;
+    hash ^= hash >> 16;
+
+    return (int)(hash % 100) < samplePercent;
+}
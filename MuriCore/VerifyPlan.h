@@ -0,0 +1,78 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef VERIFYPLAN_H
+#define VERIFYPLAN_H
+
+#include <stdint.h>
+#include <QList>
+#include <QString>
+#include "PICData.h"
+
+// Share of the blank packets read back by the Extents policy
+#define VERIFY_BLANK_SAMPLE_PERCENT 5
+// Share of the pages read back by the Sampled policy
+#define VERIFY_PAGE_SAMPLE_PERCENT  10
+// Packets in a page of the Sampled policy
+#define VERIFY_PAGE_PACKETS         16
+
+/*!
+ * Decides which parts of the device a verify reads back.
+ *
+ * Full reads every address of the selected regions.  Extents reads the
+ * packets the image actually programs, since the rest was only erased, plus
+ * samplePercent of the blank packets to catch an erase that did not take.
+ * Sampled reads samplePercent of the pages, for quick re-tests of parts
+ * already known to be good.
+ *
+ * Samples are picked by hashing the address with seed, so any part of a
+ * region always gets the same answer within a job and the pipelined verify
+ * can ask span by span.
+ */
+class VerifyPlan
+{
+public:
+	// Policies
+	enum Policy
+	{
+		Full = 0,
+		Extents,
+		Sampled
+	};
+
+	// Constructor
+    VerifyPlan(Policy policy = Full);
+
+	// Members
+    Policy policy;
+    int samplePercent;          // See the policies, 0 - 100
+    uint32_t seed;              // Picks the samples, random unless set, reported so a verify can be repeated
+
+	// Methods
+    QList<PICData::MemoryRange> Ranges(const PICData::MemoryRange& hexRange, const PICData::MemoryRange& deviceRange, uint32_t from, uint32_t to) const;
+    QList<PICData::MemoryRange> Ranges(const PICData* deviceData, const PICData* hexData, bool flash, bool eeprom) const;
+    QString name(void) const;
+    static bool Parse(QString name, Policy* policy);
+    static int DefaultSamplePercent(Policy policy);
+
+protected:
+	// Methods
+    bool Sample(uint32_t address) const;
+};
+
+#endif // VERIFYPLAN_H
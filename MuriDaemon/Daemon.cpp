@@ -0,0 +1,706 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QFileInfo>
+#include <QJsonDocument>
+
+#include "Daemon.h"
+#include "EmulatedUSB.h"
+#include "Trace.h"
+#include "Log.h"
+
+/*
+ * The device takes ownership of comm, its jobs run on executor
+ */
+DaemonDevice::DaemonDevice(IoExecutor* executor, USB* comm, QString path, QString name, QObject* parent) : QObject(parent)
+{
+    session = new AsyncSession(executor, comm, this);
+    devicePath = path;
+    deviceName = name.isEmpty() ? path : name;
+    turn = 0;
+    job = NULL;
+    opening = false;
+    readback = NULL;
+    stopping = false;
+
+    connect(session, SIGNAL(Finished(SessionResult)), this, SLOT(CallFinished(SessionResult)));
+}
+
+/*
+ * A running job is cancelled, the session waits for the executor to let go
+ * of it
+ */
+DaemonDevice::~DaemonDevice()
+{
+    delete session;
+    delete readback;
+}
+
+/*
+ * Queues a job and returns the number of jobs ahead of it.  It starts once
+ * the caller returned to the event loop, after it announced the job.
+ */
+int DaemonDevice::Post(DaemonJob* job)
+{
+    int ahead = load();
+
+    queued.append(job);
+    QMetaObject::invokeMethod(this, "Next", Qt::QueuedConnection);
+    return ahead;
+}
+
+/*
+ * Takes the queued jobs of a client that went away off the queue and
+ * returns their ids.  A job already running finishes.
+ */
+QList<int> DaemonDevice::Drop(int client)
+{
+    QList<int> dropped;
+    int i;
+
+    for(i = queued.count() - 1; i >= 0; i--)
+    {
+        if(queued[i]->client == client)
+            dropped.prepend(queued.takeAt(i)->id);
+    }
+    served.remove(client);
+
+    return dropped;
+}
+
+/*
+ * Emits Stopped once the running job is done, jobs still queued finish
+ * with NotConnected
+ */
+void DaemonDevice::Stop(void)
+{
+    stopping = true;
+    QMetaObject::invokeMethod(this, "Next", Qt::QueuedConnection);
+}
+
+QString DaemonDevice::path(void) const
+{
+    return devicePath;
+}
+
+QString DaemonDevice::name(void) const
+{
+    return deviceName;
+}
+
+/*
+ * Jobs queued or running
+ */
+int DaemonDevice::load(void) const
+{
+    return queued.count() + ((job != NULL) ? 1 : 0);
+}
+
+/*
+ * Id of the job running, 0 when idle
+ */
+int DaemonDevice::running(void) const
+{
+    return (job != NULL) ? job->id : 0;
+}
+
+/*
+ * Progress of the running job, sampled while the executor updates it
+ */
+const ProgressCounter* DaemonDevice::progress(void) const
+{
+    return session->progress();
+}
+
+/*
+ * Next job to run, the oldest one of the client served least recently
+ */
+DaemonJob* DaemonDevice::Take(void)
+{
+    DaemonJob* next;
+    int i, index = 0;
+
+    for(i = 1; i < queued.count(); i++)
+    {
+        if(served.value(queued[i]->client, -1) < served.value(queued[index]->client, -1))
+            index = i;
+    }
+
+    next = queued.takeAt(index);
+    served[next->client] = turn++;
+
+    return next;
+}
+
+/*
+ * Starts the next job when idle, the same sequence muriprog-cli runs for
+ * the command.  The calls go out on the executor and carry on in
+ * CallFinished().
+ */
+void DaemonDevice::Next(void)
+{
+    DaemonJob* failed;
+
+    if(job != NULL)
+        return;
+
+    if(stopping)
+    {
+        foreach(failed, queued)
+        {
+            failed->code = ExitNotConnected;
+            failed->report["error"] = QString("device detached");
+            emit JobFinished(failed->id);
+        }
+        queued.clear();
+        emit Stopped();
+        return;
+    }
+    if(queued.isEmpty())
+        return;
+
+    job = Take();
+    emit JobStarted(job->id);
+    TRACE_INSTANT("DaemonJob");
+
+    session->writeEeprom = job->eeprom;
+    session->pipelined = !job->twoPass;
+    session->resume = job->resume;
+    session->verifyPlan = job->verifyPlan;
+    job->code = ExitSuccess;
+
+    if(!job->image.isNull())
+    {
+        job->code = SessionReport::Record(session->LoadImage(job->image.data()), job->phases, job->report);
+        if(job->code != ExitSuccess)
+        {
+            job->code = ExitFileError;
+            Done();
+            return;
+        }
+    }
+
+    // Left open by the previous job unless that one lost the device
+    job->report["device"] = devicePath;
+    job->report["reusedSession"] = session->isOpen();
+    if(!session->isOpen())
+    {
+        opening = true;
+        session->Open(devicePath);
+        return;
+    }
+
+    Run();
+}
+
+/*
+ * Starts the command of the job on the open device
+ */
+void DaemonDevice::Run(void)
+{
+    job->report["firmware"] = SessionReport::Firmware(session->firmwareInfo());
+
+    if(job->command == "erase")
+        session->Erase();
+    else if(job->command == "write")
+        session->Write();
+    else if(job->command == "verify")
+        session->Verify();
+    else if(job->command == "blankcheck")
+        session->BlankCheck();
+    else if(job->command == "readback")
+    {
+        readback = new PICData();
+        session->ReadBack(readback);
+    }
+    else
+        session->Reset();
+}
+
+/*
+ * Records a finished call of the running job, then runs its command once
+ * the device opened or ends the job
+ */
+void DaemonDevice::CallFinished(const SessionResult& result)
+{
+    QJsonObject& report = job->report;
+
+    job->code = SessionReport::Record(result, job->phases, report);
+    if(opening)
+    {
+        opening = false;
+        if(job->code == ExitSuccess)
+            Run();
+        else
+            Done();
+        return;
+    }
+
+    if(job->command == "write")
+    {
+        report["resumed"] = session->resumed();
+        report["verify"] = SessionReport::Verify(session->verifyPlan, session->diff());
+        if(!session->diff().isEmpty())
+            report["mismatches"] = SessionReport::Mismatches(session->diff());
+    }
+    else if(job->command == "verify")
+    {
+        report["verify"] = SessionReport::Verify(session->verifyPlan, session->diff());
+        if(!session->diff().isEmpty())
+            report["mismatches"] = SessionReport::Mismatches(session->diff());
+    }
+    else if(job->command == "blankcheck")
+    {
+        if(!session->diff().isEmpty())
+            report["mismatches"] = SessionReport::Mismatches(session->diff());
+    }
+    else if((job->command == "readback") && (job->code == ExitSuccess))
+    {
+        job->code = SessionReport::SaveReadback(job->fileName, readback, session->writeEeprom, report);
+    }
+
+    Done();
+}
+
+/*
+ * Hands the finished job back and takes the next one
+ */
+void DaemonDevice::Done(void)
+{
+    int id = job->id;
+
+    // Opened again by the next job, which may find it back
+    if((job->code == ExitNotConnected) || (job->code == ExitTimeout))
+        session->Close();
+
+    delete readback;
+    readback = NULL;
+    job = NULL;
+
+    emit JobFinished(id);
+    Next();
+}
+/*
+ * With emulated set, emulated bootloaders stand in for the attached ones
+ */
+Daemon::Daemon(int emulated, QObject* parent) : QObject(parent)
+{
+    EmulatedEventSource* source = NULL;
+    int i;
+
+    this->emulated = (emulated > 0);
+    nextClient = 1;
+    nextJob = 1;
+
+    if(this->emulated)
+        source = new EmulatedEventSource();
+    monitor = new DeviceMonitor(source, this);
+    connect(monitor, SIGNAL(Attached(QString)), this, SLOT(DeviceAttached(QString)));
+    connect(monitor, SIGNAL(Detached(QString)), this, SLOT(DeviceDetached(QString)));
+    connect(&server, SIGNAL(newConnection()), this, SLOT(ClientConnected()));
+
+    progressTimer.setInterval(DAEMON_PROGRESS_MS);
+    connect(&progressTimer, SIGNAL(timeout()), this, SLOT(SampleProgress()));
+
+    for(i = 0; i < emulated; i++)
+        source->Attach(QString("emulated:%1").arg(i));
+    monitor->Scan();
+}
+
+Daemon::~Daemon()
+{
+    server.close();
+    qDeleteAll(devices);
+    qDeleteAll(jobs);
+}
+
+/*
+ * Starts accepting clients.  A socket left behind by a daemon that did not
+ * shut down cleanly is replaced, one still answering is not.
+ */
+bool Daemon::Listen(QString name)
+{
+    QLocalSocket probe;
+
+    if(server.listen(name))
+        return true;
+
+    probe.connectToServer(name);
+    if(probe.waitForConnected(DAEMON_CONNECT_TIMEOUT_MS))
+        return false;
+
+    QLocalServer::removeServer(name);
+    return server.listen(name);
+}
+
+QString Daemon::errorString(void) const
+{
+    return server.errorString();
+}
+
+void Daemon::ClientConnected(void)
+{
+    QLocalSocket* socket;
+
+    while((socket = server.nextPendingConnection()) != NULL)
+    {
+        socket->setProperty("client", nextClient);
+        clients[nextClient] = socket;
+        nextClient++;
+
+        connect(socket, SIGNAL(readyRead()), this, SLOT(ClientReadyRead()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(ClientDisconnected()));
+    }
+}
+
+/*
+ * Submits every complete line.  A client whose line runs past
+ * DAEMON_MAX_LINE is dropped rather than buffered without end.
+ */
+void Daemon::ClientReadyRead(void)
+{
+    QLocalSocket* socket = qobject_cast<QLocalSocket*>(sender());
+    QByteArray line;
+    bool tooLong = false;
+
+    while(socket->canReadLine())
+    {
+        line = socket->readLine(DAEMON_MAX_LINE);
+        if(!line.endsWith('\n'))
+        {
+            tooLong = true;
+            break;
+        }
+        Submit(socket->property("client").toInt(), line);
+    }
+
+    // No end of line within the limit, read or still arriving
+    if(tooLong || (socket->bytesAvailable() >= DAEMON_MAX_LINE))
+    {
+        LOG_WARNING("Dropping client %d, its request is longer than %d bytes.", socket->property("client").toInt(), DAEMON_MAX_LINE);
+        socket->abort();
+    }
+}
+
+/*
+ * Forgets the jobs of a client that went away.  Its running jobs finish,
+ * their results have nowhere to go.
+ */
+void Daemon::ClientDisconnected(void)
+{
+    QLocalSocket* socket = qobject_cast<QLocalSocket*>(sender());
+    int client = socket->property("client").toInt();
+
+    clients.remove(client);
+    foreach(DaemonDevice* device, devices)
+    {
+        foreach(int id, device->Drop(client))
+            delete jobs.take(id);
+    }
+
+    socket->deleteLater();
+}
+
+void Daemon::DeviceAttached(QString path)
+{
+    USB::DeviceInfo info;
+    QString serial;
+    DaemonDevice* device;
+
+    foreach(info, monitor->devices())
+    {
+        if(info.path == path)
+            serial = info.serialNumber;
+    }
+
+    device = new DaemonDevice(&executor, emulated ? new EmulatedUSB(path) : new USB(), path, serial, this);
+    connect(device, SIGNAL(JobStarted(int)), this, SLOT(JobStarted(int)));
+    connect(device, SIGNAL(JobFinished(int)), this, SLOT(JobFinished(int)));
+    devices.append(device);
+
+    LOG_INFO("Attached %s.", qPrintable(device->name()));
+}
+
+void Daemon::DeviceDetached(QString path)
+{
+    int i;
+
+    for(i = devices.count() - 1; i >= 0; i--)
+    {
+        if(devices[i]->path() != path)
+            continue;
+
+        LOG_INFO("Detached %s.", qPrintable(devices[i]->name()));
+        connect(devices[i], SIGNAL(Stopped()), devices[i], SLOT(deleteLater()));
+        devices.takeAt(i)->Stop();
+    }
+}
+
+void Daemon::JobStarted(int id)
+{
+    DaemonJob* job = jobs.value(id);
+    QJsonObject event;
+
+    if(job == NULL)
+        return;
+
+    event["event"] = QString("started");
+    event["job"] = id;
+    event["device"] = job->device;
+    Send(job->client, event);
+
+    if(!progressTimer.isActive())
+        progressTimer.start();
+}
+
+void Daemon::JobFinished(int id)
+{
+    DaemonJob* job = jobs.take(id);
+
+    if(job != NULL)
+        Complete(job);
+}
+
+/*
+ * Sends the progress of every running job that moved since the last sample
+ */
+void Daemon::SampleProgress(void)
+{
+    DaemonJob* job;
+    bool busy = false;
+    int percent;
+
+    foreach(DaemonDevice* device, devices)
+    {
+        job = jobs.value(device->running());
+        if(job == NULL)
+            continue;
+
+        busy = true;
+        percent = device->progress()->Percent();
+        if(percent == job->percent)
+            continue;
+        job->percent = percent;
+
+        QJsonObject event;
+        event["event"] = QString("progress");
+        event["job"] = job->id;
+        event["percent"] = percent;
+        Send(job->client, event);
+    }
+
+    if(!busy)
+        progressTimer.stop();
+}
+
+/*
+ * Parses a request line and queues the job, or answers it right away when
+ * it needs no device or cannot run
+ */
+void Daemon::Submit(int client, QByteArray line)
+{
+    QJsonObject request = QJsonDocument::fromJson(line).object();
+    DaemonJob* job = new DaemonJob();
+    DaemonDevice* device;
+    QJsonObject event;
+
+    job->id = nextJob++;
+    job->client = client;
+    job->command = request.value("command").toString();
+    job->code = ExitSuccess;
+    job->percent = -1;
+    job->elapsed.start();
+    job->report["command"] = job->command;
+
+    if(!Prepare(job, request))
+    {
+        Complete(job);
+        return;
+    }
+
+    device = Pick(request.value("device").toString());
+    if(device == NULL)
+    {
+        job->code = ExitNotConnected;
+        job->report["error"] = QString("no bootloader found");
+        Complete(job);
+        return;
+    }
+
+    job->device = device->path();
+    jobs[job->id] = job;
+
+    event["event"] = QString("queued");
+    event["job"] = job->id;
+    event["device"] = job->device;
+    event["position"] = device->Post(job);
+    Send(client, event);
+}
+
+/*
+ * Fills in a job from its request and loads its image from the cache.
+ * Returns whether it still has to run on a device.
+ */
+bool Daemon::Prepare(DaemonJob* job, const QJsonObject& request)
+{
+    QString command = job->command;
+    QString fileName = request.value("file").toString();
+    bool needsFile = (command == "load") || (command == "write") || (command == "verify") || (command == "readback");
+    bool needsImage = (command == "load") || (command == "write") || (command == "verify");
+    VerifyPlan::Policy policy = VerifyPlan::Full;
+    int samplePercent = request.value("sample").toInt();
+    double seed = request.value("seed").toDouble();
+    QJsonObject cache;
+    SessionResult result;
+    SessionPhase phase;
+    QElapsedTimer elapsed;
+    QString error;
+    bool cached;
+
+    if(!(needsFile || (command == "list") || (command == "erase") || (command == "blankcheck") || (command == "reset")) ||
+       (needsFile && (fileName.isEmpty() || QFileInfo(fileName).isRelative())) ||
+       (request.contains("verify") && !VerifyPlan::Parse(request.value("verify").toString(), &policy)) ||
+       (request.contains("sample") && ((samplePercent < 0) || (samplePercent > 100))) ||
+       (request.contains("seed") && ((seed < 0) || (seed > 0xFFFFFFFFU) || (seed != (uint32_t)seed))))
+    {
+        job->code = ExitUsage;
+        job->report["error"] = QString("bad request");
+        return false;
+    }
+
+    job->fileName = fileName;
+    job->eeprom = request.value("eeprom").toBool();
+    job->twoPass = request.value("twoPass").toBool();
+    job->resume = request.value("resume").toBool();
+    job->verifyPlan = VerifyPlan(policy);
+    if(request.contains("sample"))
+        job->verifyPlan.samplePercent = samplePercent;
+    if(request.contains("seed"))
+        job->verifyPlan.seed = (uint32_t)seed;
+
+    if(command == "list")
+    {
+        cache["count"] = images.count();
+        cache["hits"] = images.hits();
+        cache["misses"] = images.misses();
+        job->report["devices"] = List();
+        job->report["images"] = cache;
+        return false;
+    }
+
+    if(needsImage)
+    {
+        // Parsed here on the daemon thread, a hex file takes milliseconds
+        // and every later job of the same image skips it
+        elapsed.start();
+        job->image = images.Find(fileName, request.value("image").toString(), &error, &cached);
+
+        phase.name = "load";
+        phase.result = job->image.isNull() ? USB::Fail : USB::Success;
+        phase.seconds = ((double)elapsed.nsecsElapsed()) / 1000000000;
+        result.result = phase.result;
+        result.seconds = phase.seconds;
+        result.phases.append(phase);
+        result.message = error;
+        result.retries = 0;
+        result.resyncs = 0;
+        result.reportsSaved = 0;
+        SessionReport::Record(result, job->phases, job->report);
+
+        if(job->image.isNull())
+        {
+            job->code = ExitFileError;
+            return false;
+        }
+        job->report["ranges"] = SessionReport::Ranges(job->image.data());
+        job->report["cached"] = cached;
+    }
+
+    return command != "load";
+}
+
+/*
+ * The device asked for by path or serial number, or the one with the
+ * fewest jobs when device is empty
+ */
+DaemonDevice* Daemon::Pick(QString device) const
+{
+    DaemonDevice* best = NULL;
+
+    foreach(DaemonDevice* candidate, devices)
+    {
+        if(!device.isEmpty())
+        {
+            if((candidate->path() == device) || (candidate->name() == device))
+                return candidate;
+        }
+        else if((best == NULL) || (candidate->load() < best->load()))
+        {
+            best = candidate;
+        }
+    }
+
+    return best;
+}
+
+void Daemon::Send(int client, QJsonObject message)
+{
+    QLocalSocket* socket = clients.value(client);
+    QByteArray line;
+
+    if(socket == NULL)
+        return;
+
+    line = QJsonDocument(message).toJson(QJsonDocument::Compact);
+    line.append('\n');
+    socket->write(line);
+}
+
+/*
+ * Sends the result of a job and deletes it
+ */
+void Daemon::Complete(DaemonJob* job)
+{
+    QJsonObject result = job->report;
+
+    result["event"] = QString("result");
+    result["job"] = job->id;
+    SessionReport::Finish(result, job->code, job->phases, ((double)job->elapsed.nsecsElapsed()) / 1000000000);
+    Send(job->client, result);
+
+    delete job;
+}
+
+/*
+ * The devices with the number of jobs each has queued or running
+ */
+QJsonArray Daemon::List(void) const
+{
+    QJsonArray list;
+
+    foreach(DaemonDevice* device, devices)
+    {
+        QJsonObject item;
+        item["path"] = device->path();
+        item["serialNumber"] = device->name();
+        item["jobs"] = device->load();
+        list.append(item);
+    }
+
+    return list;
+}
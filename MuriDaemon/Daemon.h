@@ -0,0 +1,168 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QList>
+#include <QMap>
+#include <QTimer>
+#include "DaemonProtocol.h"
+#include "DeviceMonitor.h"
+#include "SessionReport.h"
+#include "AsyncSession.h"
+#include "IoExecutor.h"
+#include "ImageCache.h"
+
+// A job submitted by a client
+struct DaemonJob
+{
+    int id;
+    int client;
+    QString device;                 // Path of the device it was queued on
+    QString command;
+    QString fileName;               // Where readback saves to
+    ImageSnapshot image;            // From the cache, null for jobs that program nothing
+    bool eeprom;
+    bool twoPass;
+    bool resume;
+    VerifyPlan verifyPlan;
+    QJsonObject report;             // Begun by the daemon, completed by the device
+    QJsonArray phases;
+    ExitCode code;
+    QElapsedTimer elapsed;          // Since the job was submitted
+    int percent;                    // Last progress sent
+};
+
+/*!
+ * One bootloader owned by the daemon.
+ *
+ * Its session runs on the daemon's IoExecutor, shared with every other
+ * device, and stays open between jobs, so a job only pays for opening the
+ * device when the previous one lost it.  Jobs of different clients are
+ * taken in turns, a client queuing many jobs does not hold up the others.
+ * Lives on the daemon thread, like its jobs.
+ */
+class DaemonDevice : public QObject
+{
+    Q_OBJECT
+
+public:
+	// Constructor/Destructor
+    DaemonDevice(IoExecutor* executor, USB* comm, QString path, QString name, QObject* parent = 0);
+    ~DaemonDevice();
+
+	// Methods
+    int Post(DaemonJob* job);
+    QList<int> Drop(int client);
+    void Stop(void);
+    QString path(void) const;
+    QString name(void) const;
+    int load(void) const;
+    int running(void) const;
+    const ProgressCounter* progress(void) const;
+
+signals:
+    void JobStarted(int id);
+    void JobFinished(int id);
+    void Stopped(void);
+
+private slots:
+    void Next(void);
+    void CallFinished(const SessionResult& result);
+
+protected:
+	// Members
+    AsyncSession* session;
+    QString devicePath;
+    QString deviceName;             // Serial number, or the path when there is none
+    QList<DaemonJob*> queued;
+    QMap<int, qint64> served;       // Turn each client was last served in
+    qint64 turn;
+    DaemonJob* job;                 // Running, NULL when idle
+    bool opening;                   // The job is waiting for its device to open
+    PICData* readback;              // What a readback job read
+    bool stopping;
+
+	// Methods
+    DaemonJob* Take(void);
+    void Run(void);
+    void Done(void);
+};
+
+/*!
+ * The programming daemon.
+ *
+ * Owns every attached bootloader, keeps the images it was asked for parsed
+ * and runs the jobs its clients submit over a local socket (see
+ * DaemonProtocol.h).  A job names its device or goes to the one with the
+ * fewest jobs waiting, devices work in parallel.
+ */
+class Daemon : public QObject
+{
+    Q_OBJECT
+
+public:
+	// Constructor/Destructor
+    explicit Daemon(int emulated = 0, QObject* parent = 0);
+    ~Daemon();
+
+	// Methods
+    bool Listen(QString name);
+    QString errorString(void) const;
+
+private slots:
+    void ClientConnected(void);
+    void ClientReadyRead(void);
+    void ClientDisconnected(void);
+    void DeviceAttached(QString path);
+    void DeviceDetached(QString path);
+    void JobStarted(int id);
+    void JobFinished(int id);
+    void SampleProgress(void);
+
+protected:
+	// Members
+    QLocalServer server;
+    IoExecutor executor;            // Drives the jobs of every device
+    DeviceMonitor* monitor;
+    bool emulated;                  // Devices are EmulatedUSB, attached once at start
+    ImageCache images;
+    QList<DaemonDevice*> devices;
+    QMap<int, QLocalSocket*> clients;
+    QMap<int, DaemonJob*> jobs;     // Queued or running
+    QTimer progressTimer;
+    int nextClient;
+    int nextJob;
+
+	// Methods
+    void Submit(int client, QByteArray line);
+    bool Prepare(DaemonJob* job, const QJsonObject& request);
+    DaemonDevice* Pick(QString device) const;
+    void Send(int client, QJsonObject message);
+    void Complete(DaemonJob* job);
+    QJsonArray List(void) const;
+};
+
+#endif // DAEMON_H
@@ -0,0 +1,164 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QDateTime>
+#include <QFileInfo>
+
+#include "ImageCache.h"
+#include "HexLoader.h"
+#include "ImageBundle.h"
+#include "Bootloader.h"
+#include "Log.h"
+
+ImageCache::ImageCache()
+{
+    hitCount = 0;
+    missCount = 0;
+}
+
+/*
+ * The image in fileName (image picks one of a bundle), parsed now unless the
+ * file is unchanged since it was last parsed.  Returns a null pointer with
+ * the reason in error when it cannot be loaded.
+ */
+ImageSnapshot ImageCache::Find(QString fileName, QString image, QString* error, bool* cached)
+{
+    QFileInfo info(fileName);
+    QString key = image.isEmpty() ? fileName : fileName + "#" + image;
+    qint64 modified = info.lastModified().toMSecsSinceEpoch();
+    PICData* data;
+    Entry entry;
+    int i;
+
+    *cached = false;
+    for(i = 0; i < entries.count(); i++)
+    {
+        if(entries[i].key != key)
+            continue;
+
+        if((entries[i].modified == modified) && (entries[i].size == info.size()))
+        {
+            entries.move(i, 0);
+            hitCount++;
+            *cached = true;
+            return entries[0].data;
+        }
+
+        // Rebuilt since, parse it again
+        entries.removeAt(i);
+        break;
+    }
+
+    data = Parse(fileName, image, error);
+    if(data == NULL)
+        return ImageSnapshot();
+
+    missCount++;
+    entry.key = key;
+    entry.modified = modified;
+    entry.size = info.size();
+    entry.data = PICData::Freeze(data);
+    entries.prepend(entry);
+
+    while(entries.count() > IMAGE_CACHE_SIZE)
+        entries.removeLast();
+
+    return entry.data;
+}
+
+int ImageCache::count(void) const
+{
+    return entries.count();
+}
+
+int ImageCache::hits(void) const
+{
+    return hitCount;
+}
+
+int ImageCache::misses(void) const
+{
+    return missCount;
+}
+
+/*
+ * Parses a hex file, or selects an image of a bundle, into a new PICData
+ */
+PICData* ImageCache::Parse(QString fileName, QString image, QString* error)
+{
+    PICData* data = new PICData();
+    Bootloader device(data);
+    HexLoader import;
+    ImageBundle bundle;
+
+    if(ImageBundle::IsBundle(fileName))
+    {
+        switch(bundle.Open(fileName))
+        {
+            case ImageBundle::Success:
+                break;
+            case ImageBundle::CouldNotOpenFile:
+                *error = "could not open file";
+                PICData::Free(data);
+                return NULL;
+            default:
+                *error = "bundle is damaged or not a bundle";
+                PICData::Free(data);
+                return NULL;
+        }
+
+        switch(bundle.Select(bundle.Find(image), data))
+        {
+            case ImageBundle::Success:
+                return data;
+            case ImageBundle::NotFound:
+                *error = "no image by that name in the bundle";
+                break;
+            case ImageBundle::LayoutMismatch:
+                *error = "image built for another device";
+                break;
+            default:
+                *error = "bundle is damaged or not a bundle";
+                break;
+        }
+        PICData::Free(data);
+        return NULL;
+    }
+
+    switch(import.ImportHexFile(fileName, data, &device))
+    {
+        case HexLoader::Success:
+            LOG_INFO("Parsed %s.", qPrintable(fileName));
+            return data;
+        case HexLoader::CouldNotOpenFile:
+            *error = "could not open file";
+            break;
+        case HexLoader::NoneInRange:
+            *error = "no address within the device range";
+            break;
+        case HexLoader::ErrorInHexFile:
+            *error = "error in hex file";
+            break;
+        case HexLoader::InsufficientMemory:
+        default:
+            *error = "memory allocation failed";
+            break;
+    }
+    PICData::Free(data);
+    return NULL;
+}
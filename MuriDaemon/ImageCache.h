@@ -0,0 +1,67 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <QList>
+#include <QString>
+#include "PICData.h"
+
+// Images kept parsed, the least recently used one is dropped first
+#define IMAGE_CACHE_SIZE 32
+
+/*!
+ * Parsed images by file name (and image name, for bundles).
+ *
+ * A file is parsed the first time a job asks for it and again only once its
+ * size or modification time changed.  Images are handed out as snapshots,
+ * so devices can copy from one while the cache drops it.  Lives in the
+ * daemon thread.
+ */
+class ImageCache
+{
+public:
+	// Constructor
+    ImageCache();
+
+	// Methods
+    ImageSnapshot Find(QString fileName, QString image, QString* error, bool* cached);
+    int count(void) const;
+    int hits(void) const;
+    int misses(void) const;
+
+protected:
+    struct Entry
+    {
+        QString key;                // File name, "file#image" for an image of a bundle
+        qint64 modified;
+        qint64 size;
+        ImageSnapshot data;
+    };
+
+	// Members
+    QList<Entry> entries;           // Most recently used first
+    int hitCount;
+    int missCount;
+
+	// Methods
+    static PICData* Parse(QString fileName, QString image, QString* error);
+};
+
+#endif // IMAGECACHE_H
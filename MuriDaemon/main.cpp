@@ -0,0 +1,98 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <stdio.h>
+
+#include "Daemon.h"
+#include "Log.h"
+#include "RealtimeIo.h"
+#include "../version.h"
+
+static bool verbose = false;
+
+/*
+ * The programming log only goes to stderr with --verbose
+ */
+static void MessageHandler(QtMsgType type, const QMessageLogContext& context, const QString& msg)
+{
+    Q_UNUSED(context);
+
+    if(verbose || (type == QtCriticalMsg) || (type == QtFatalMsg))
+        fprintf(stderr, "%s\n", qPrintable(msg));
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setOrganizationName("Mid-Ohio Area Robotics");
+    QCoreApplication::setOrganizationDomain("moarobotics.com");
+    QCoreApplication::setApplicationName("muriprogd");
+    QCoreApplication::setApplicationVersion(VERSION);
+
+    QCommandLineParser parser;
+    QCommandLineOption nameOption("name", "Local socket to listen on (default: $" DAEMON_NAME_ENV " or " DAEMON_NAME ").", "name");
+    QCommandLineOption emulateOption("emulate", "Serve n emulated bootloaders instead of the hardware.", "n");
+    QCommandLineOption realtimeOption("realtime", "Low jitter I/O thread: \"on\" or any of cpu=<n>,priority=<n>,poll=<us>\n"
+                                      "(default: $" REALTIME_ENV ").", "settings");
+    QCommandLineOption verboseOption("verbose", "Print the programming log to stderr.");
+
+    parser.setApplicationDescription("Owns the attached Muribots and runs the jobs muriprog-cli --daemon submits,\n"
+                                     "keeping images parsed and devices open between jobs.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addOption(nameOption);
+    parser.addOption(emulateOption);
+    parser.addOption(realtimeOption);
+    parser.addOption(verboseOption);
+    parser.process(a);
+
+    verbose = parser.isSet(verboseOption);
+    qInstallMessageHandler(MessageHandler);
+
+    Log::Init();
+    if(!verbose)
+        Log::SetLevel(Log::Off);
+
+    bool emulateOk = true;
+    int emulated = parser.value(emulateOption).toInt(&emulateOk);
+    RealtimeIo::Settings realtime;
+    bool realtimeOk = RealtimeIo::Parse(parser.isSet(realtimeOption) ? parser.value(realtimeOption) : QString(qgetenv(REALTIME_ENV)), &realtime);
+    if((parser.isSet(emulateOption) && (!emulateOk || (emulated < 1))) || !realtimeOk)
+    {
+        fprintf(stderr, "%s\n", qPrintable(parser.helpText()));
+        return 1;
+    }
+    RealtimeIo::Configure(realtime);
+
+    QString name = parser.value(nameOption);
+    if(name.isEmpty())
+        name = qgetenv(DAEMON_NAME_ENV);
+    if(name.isEmpty())
+        name = DAEMON_NAME;
+
+    Daemon daemon(parser.isSet(emulateOption) ? emulated : 0);
+    if(!daemon.Listen(name))
+    {
+        fprintf(stderr, "Could not listen on %s: %s\n", qPrintable(name), qPrintable(daemon.errorString()));
+        return 1;
+    }
+
+    return a.exec();
+}
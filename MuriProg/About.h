@@ -18,7 +18,7 @@
 #ifndef ABOUT_H
 #define ABOUT_H
 
-#include <QtWidgets\QDialog>
+#include <QtWidgets/QDialog>
 
 // This dialog simply shows a window for the user to read
 // the MuriProg about information.
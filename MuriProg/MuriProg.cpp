@@ -31,9 +31,9 @@ NOTES -
 #include <QTime>
 #include <QtWidgets/QFileDialog>
 #include <QtWidgets/QMessageBox>
+#include <QtWidgets/QInputDialog>
 #include <QSettings>
 #include <QtWidgets/QDesktopWidget>
-#include <QtConcurrent/QtConcurrentRun>
 #include <sstream>
 
 #include "MuriProg.h"
@@ -41,6 +41,9 @@ NOTES -
 
 #include "Settings.h"
 #include "About.h"
+#include "Trace.h"
+#include "Startup.h"
+#include "Log.h"
 
 #include "../version.h"
 
@@ -48,22 +51,33 @@ NOTES -
 //Value used for error checking device reponse values.
 #define MAXIMUM_PROGRAMMABLE_MEMORY_SEGMENT_SIZE 0x0FFFFFFF
 
-// Information about the firmware on the Muribot
-USB::FirmwareInfo firmwareInfo;
-
 
 MuriProg::MuriProg(QWidget *parent) : QMainWindow(parent), ui(new Ui::MuriProg)
 {
     int i;
     hexOpen = false;
+    deviceBusy = false;
+    resuming = false;
+    writePending = false;
+    eraseAhead = NotErasing;
+    gangPending = false;
+    gangReopen = false;
     fileWatcher = NULL;
-    timer = new QTimer();
+    monitor = NULL;
+    picData = NULL;
+    device = NULL;
 
 	// Window setup
+    Startup::Phase("ui");
     ui->setupUi(this);
+    ui->Output->setMaximumBlockCount(OUTPUT_MAX_LINES);
+    outputTimer.setSingleShot(true);
+    outputTimer.setInterval(OUTPUT_FLUSH_MS);
+    connect(&outputTimer, SIGNAL(timeout()), this, SLOT(FlushOutput()));
     setWindowTitle(APPLICATION + QString(" v") + VERSION);
 
 	// Fetch the saved settings
+    Startup::Phase("settings");
     QSettings settings;
     settings.beginGroup("MuriProg");
     fileName = settings.value("fileName").toString();
@@ -80,23 +94,28 @@ MuriProg::MuriProg(QWidget *parent) : QMainWindow(parent), ui(new Ui::MuriProg)
     settings.beginGroup("WriteOptions");
     writeFlash = settings.value("writeFlash", true).toBool();
     writeEeprom = settings.value("writeEeprom", false).toBool();
+    if(!VerifyPlan::Parse(settings.value("verify", "full").toString(), &verifyPolicy))
+        verifyPolicy = VerifyPlan::Full;
+    autoProgram = settings.value("autoProgram", false).toBool();
     eraseDuringWrite = true;
     settings.endGroup();
 
-    comm = new USB();
-    picData = new PICData();
-    hexData = new PICData();
-    device = new Bootloader(picData);
+    // The image buffers wait for the first file, see CreateImages()
+    Startup::Phase("objects");
+    session = new DeviceSession();
+    gang = new GangProgrammer(this);
+    progress = new ProgressModel(this);
+    loader = new ImageLoader(this);
 
     qRegisterMetaType<USB::ErrorCode>("USB::ErrorCode");
 
 	// Connect signals to their methods
-	connect(timer, SIGNAL(timeout()), this, SLOT(Connection()));
     connect(this, SIGNAL(IoWithDeviceCompleted(QString,USB::ErrorCode,double)), this, SLOT(IoWithDeviceComplete(QString,USB::ErrorCode,double)));
     connect(this, SIGNAL(IoWithDeviceStarted(QString)), this, SLOT(IoWithDeviceStart(QString)));
     connect(this, SIGNAL(AppendString(QString)), this, SLOT(AppendStringToTextbox(QString)));
     connect(this, SIGNAL(SetProgressBar(int)), this, SLOT(UpdateProgressBar(int)));
-    connect(comm, SIGNAL(SetProgressBar(int)), this, SLOT(UpdateProgressBar(int)));
+    connect(session, SIGNAL(CommandFinished(QString,USB::ErrorCode,double)), this, SLOT(SessionCommandFinished(QString,USB::ErrorCode,double)));
+    connect(session, SIGNAL(StateChanged(int)), this, SLOT(SessionStateChanged(int)));
 	connect(ui->AboutAction, SIGNAL(triggered()), this, SLOT(About_Clicked()));
 	connect(ui->EraseAction, SIGNAL(triggered()), this, SLOT(Erase_Clicked()));
 	connect(ui->ExitAction, SIGNAL(triggered()), this, SLOT(Exit_Clicked()));
@@ -104,35 +123,22 @@ MuriProg::MuriProg(QWidget *parent) : QMainWindow(parent), ui(new Ui::MuriProg)
 	connect(ui->ResetAction, SIGNAL(triggered()), this, SLOT(Reset_Clicked()));
 	connect(ui->WriteAction, SIGNAL(triggered()), this, SLOT(Write_Clicked()));
 	connect(ui->SettingsAction, SIGNAL(triggered()), this, SLOT(Settings_Clicked()));
+	connect(ui->GangAction, SIGNAL(triggered()), this, SLOT(Gang_Clicked()));
+    connect(progress, SIGNAL(TotalChanged(int)), this, SLOT(UpdateProgressBar(int)));
+    connect(gang, SIGNAL(DeviceFinished(int,USB::ErrorCode,double)), this, SLOT(GangDeviceFinished(int,USB::ErrorCode,double)));
+    connect(gang, SIGNAL(Finished()), this, SLOT(GangFinished()));
+    connect(loader, SIGNAL(Loaded(QString,int,double)), this, SLOT(LoadFinished(QString,int,double)));
 
 	//Update the file list in the File-->[import files list] area, so the user can quickly re-load a previously used .hex file.
     UpdateRecentFileList();
 
     this->statusBar()->addPermanentWidget(&deviceLabel);
     deviceLabel.setText("Connecting...");
+    setBootloadEnabled(false);
 
-    // Make initial check to see if the USB device is attached
-    comm->PollUSB();
-    if(comm->isConnected())
-    {
-        qWarning("Attempting to open USB connection...");
-        comm->open();
-        ui->Output->setPlainText("Muribot detected!");
-        ui->Output->appendPlainText("Attempting to connect...");		
-		comm->EngageBootloader();
-        GetFirmwareInfo();
-    }
-    else
-    {
-        ui->Output->appendPlainText("Muribot not detected...");
-		ui->Output->appendPlainText("Verify that the USB cable is plugged in and the robot is turned on.");
-        deviceLabel.setText("Disconnected");
-        hexOpen = false;
-        setBootloadEnabled(false);
-        emit SetProgressBar(0);
-    }
-
-    timer->start(1000); //Check for future USB connection status changes every 1000 milliseconds.
+    // USB enumeration waits for the first paint, in case the window
+    // never gets painted it starts anyway after a while
+    QTimer::singleShot(STARTUP_DEVICES_DELAY_MS, this, SLOT(StartDevices()));
 }
 
 MuriProg::~MuriProg()
@@ -148,60 +154,136 @@ MuriProg::~MuriProg()
     settings.beginGroup("WriteOptions");
     settings.setValue("writeFlash", writeFlash);
     settings.setValue("writeEeprom", writeEeprom);
+    settings.setValue("verify", VerifyPlan(verifyPolicy).name());
+    settings.setValue("autoProgram", autoProgram);
     settings.endGroup();
 
-	// Close the device and disable UI elements
-    comm->close();
+	// Stop anything still talking to the device, then close it and disable UI elements
+    delete session;
     setBootloadEnabled(false);
 
 	// Free memory
-    delete timer;
     delete ui;
-    delete comm;
     delete picData;
-    delete hexData;
     delete device;
 }
 
 /*
- * Poll for changes in the connection state
+ * Starts watching for Muribots and connects to one already attached, once
+ * the window is up
+ */
+void MuriProg::StartDevices(void)
+{
+    TRACE_SCOPE("StartDevices");
+
+    if(monitor != NULL)
+        return;
+
+    monitor = new DeviceMonitor(NULL, this);
+
+    // Make initial check to see if the USB device is attached, after this
+    // the monitor reports changes as they happen
+    monitor->Scan();
+    if(!monitor->devices().isEmpty())
+        Connection();
+    else
+    {
+        Print("Muribot not detected...");
+		Print("Verify that the USB cable is plugged in and the robot is turned on.");
+        deviceLabel.setText("Disconnected");
+        hexOpen = false;
+        setBootloadEnabled(false);
+        emit SetProgressBar(0);
+        DeviceReady();
+    }
+
+    connect(monitor, SIGNAL(Attached(QString)), this, SLOT(Connection()));
+    connect(monitor, SIGNAL(Detached(QString)), this, SLOT(Connection()));
+}
+
+/*
+ * The first paint ends startup as the user sees it, the devices are
+ * looked for right after
+ */
+void MuriProg::paintEvent(QPaintEvent* event)
+{
+    QMainWindow::paintEvent(event);
+
+    if(Startup::Milestone("first paint"))
+        QTimer::singleShot(0, this, SLOT(StartDevices()));
+}
+
+/*
+ * Notes when the Muribot attached at launch was ready, or found missing,
+ * and logs how startup went
+ */
+void MuriProg::DeviceReady(void)
+{
+    if(Startup::Milestone("device ready"))
+        LOG_INFO("Startup: %s.", qPrintable(Startup::Report()));
+}
+
+/*
+ * Allocates the device layout and its read back buffers, on the first load
+ * rather than at startup
+ */
+void MuriProg::CreateImages(void)
+{
+    if(picData != NULL)
+        return;
+
+    picData = new PICData();
+    device = new Bootloader(picData);
+}
+
+/*
+ * Called by the device monitor when a Muribot is attached or detached
  */
 void MuriProg::Connection(void)
 {
-    bool currStatus = comm->isConnected();
-    USB::ErrorCode result;
+    QList<USB::DeviceInfo> devices = monitor->devices();
+    QString path = session->path();
+    bool attached = false;
+    USB::DeviceInfo info;
+
+    // While connected only the Muribot we opened counts, otherwise any will do
+    foreach(info, devices)
+    {
+        if(path.isEmpty() || (info.path == path))
+            attached = true;
+    }
 
-    comm->PollUSB();	
 	// If our state has changed...
-    if(currStatus != comm->isConnected())
+    if(attached != !path.isEmpty())
     {
-        UpdateRecentFileList();
 		// If we're connected, open that connection and notify the onboard bootloader
-		// We want to load a program
-        if(comm->isConnected())
+		// We want to load a program.  The session does both on its own thread and
+		// reports back through SessionCommandFinished().
+        if(attached)
         {
-            qWarning("Attempting to open USB connection...");
-            comm->open();
-            ui->Output->setPlainText("Muribot detected!");
-            ui->Output->appendPlainText("Attempting to connect...");
-			/* BUGFIX: 3/8/2015 - Added the engage bootloader sequence here
-				So this is why the bootloader wouldn't get engaged when we'd start the software
-				after turning on the Muribot!
-			*/
-			comm->EngageBootloader();
-            GetFirmwareInfo();
+            LOG_INFO("Attempting to open USB connection...");
+            session->Open(devices.first().path);
+            // Back from a gang write, its results stay on screen
+            if(!gangReopen)
+            {
+                ClearOutput();
+                Print("Muribot detected!");
+                Print("Attempting to connect...");
+            }
+            setBootloadEnabled(false);
         }
         else // Otherwise close the device
         {
-            qWarning("Closing device.");
-            comm->close();
-            deviceLabel.setText("Disconnected");
-            ui->Output->setPlainText("Muribot detached.");
+            LOG_INFO("Closing device.");
+            session->Close();
+            ClearOutput();
+            Print("Muribot detached.");
             hexOpen = false;
             setBootloadEnabled(false);
             emit SetProgressBar(0);
         }
     }
+    gangReopen = false;
 }
 
 /*
@@ -211,6 +293,7 @@ void MuriProg::setBootloadEnabled(bool enable)
 {
 	ui->SettingsAction->setEnabled(enable);    
     ui->WriteAction->setEnabled(enable && hexOpen);
+    ui->GangAction->setEnabled(enable && hexOpen);
     ui->ExitAction->setEnabled(enable);    
     ui->OpenAction->setEnabled(enable);    
     ui->ResetAction->setEnabled(enable);
@@ -223,21 +306,30 @@ void MuriProg::setBootloadEnabled(bool enable)
  */
 void MuriProg::setBootloadBusy(bool busy)
 {
+    deviceBusy = busy;
     if(busy)
     {
         QApplication::setOverrideCursor(Qt::BusyCursor);
-        timer->stop();
+        if(monitor != NULL)
+            monitor->blockSignals(true);
     }
     else
     {
         QApplication::restoreOverrideCursor();
-        timer->start(1000);
+        // Catch up on anything attached or detached while we were busy
+        if(monitor != NULL)
+        {
+            monitor->blockSignals(false);
+            Connection();
+        }
     }
 
     ui->SettingsAction->setEnabled(!busy);
     ui->WriteAction->setEnabled(!busy && hexOpen);
+    ui->GangAction->setEnabled(!busy && hexOpen);
     ui->ExitAction->setEnabled(!busy);    
-    ui->OpenAction->setEnabled(!busy);
+    // The next file can be opened meanwhile, a write keeps the image it started with
+    ui->OpenAction->setEnabled(true);
     ui->SettingsAction->setEnabled(!busy);    
     ui->ResetAction->setEnabled(!busy);
 	ui->EraseAction->setEnabled(!busy);
@@ -256,7 +348,8 @@ void MuriProg::Exit_Clicked()
  */ 
 void MuriProg::IoWithDeviceStart(QString msg)
 {
-    ui->Output->appendPlainText(msg);
+    TRACE_SCOPE("IoWithDeviceStart");
+    Print(msg);
     setBootloadBusy(true);
 }
 
@@ -265,7 +358,34 @@ void MuriProg::IoWithDeviceStart(QString msg)
  */
 void MuriProg::AppendStringToTextbox(QString msg)
 {
-    ui->Output->appendPlainText(msg);
+    TRACE_SCOPE("AppendStringToTextbox");
+    Print(msg);
+}
+
+/*
+ * Queues a line for the output window.  Lines are appended in one batch per
+ * OUTPUT_FLUSH_MS, so a burst of messages costs a single layout.
+ */
+void MuriProg::Print(QString msg)
+{
+    pendingOutput.append(msg);
+    if(!outputTimer.isActive())
+        outputTimer.start();
+}
+
+void MuriProg::FlushOutput(void)
+{
+    if(pendingOutput.isEmpty())
+        return;
+
+    ui->Output->appendPlainText(pendingOutput.join("\n"));
+    pendingOutput.clear();
+}
+
+void MuriProg::ClearOutput(void)
+{
+    pendingOutput.clear();
+    ui->Output->clear();
 }
 
 /*
@@ -273,6 +393,7 @@ void MuriProg::AppendStringToTextbox(QString msg)
  */
 void MuriProg::UpdateProgressBar(int newValue)
 {
+    TRACE_SCOPE("UpdateProgressBar");
     ui->ProgressBar->setValue(newValue);
 }
 
@@ -283,6 +404,7 @@ void MuriProg::UpdateProgressBar(int newValue)
 void MuriProg::IoWithDeviceComplete(QString msg, USB::ErrorCode result, double time)
 {
     QTextStream ss(&msg);
+    TRACE_SCOPE("IoWithDeviceComplete");
 
     switch(result)
     {
@@ -306,314 +428,290 @@ void MuriProg::IoWithDeviceComplete(QString msg, USB::ErrorCode result, double t
             ss << " Timed out waiting for response (" << time << "s)\n";
             setBootloadBusy(false);
             break;
+        case USB::Cancelled:
+            ss << " Cancelled.\n";
+            setBootloadBusy(false);
+            break;
         default:
             break;
     }
 
-    ui->Output->appendPlainText(msg);
+    Print(msg);
 }
 
 /*
- * Routine that verifies the contents memory regions after programming.
- * This function requests the memory contents of the device, then
- * compares it against the parsed .hex file data to make sure the
- * locations that got programmed properly match.
+ * Verifies the contents of the memory regions after programming, on the
+ * session thread.  See VerifyStep.
  */
 void MuriProg::VerifyDevice()
 {
-    USB::ErrorCode result;
-    PICData::MemoryRange deviceRange, hexRange;
-    QTime elapsed;
-    unsigned int i, j;
-    unsigned int arrayIndex;
-    bool failureDetected = false;
-    unsigned char flashData[MAX_ERASE_BLOCK_SIZE];
-    unsigned char hexEraseBlockData[MAX_ERASE_BLOCK_SIZE];
-    uint32_t startOfEraseBlock;
-    uint32_t errorAddress = 0;
-    uint16_t expectedResult = 0;
-    uint16_t actualResult = 0;
-
-    //Initialize an erase block sized buffer with 0xFF.
-    //Used later for post SIGN_FLASH verify operation.
-    memset(&hexEraseBlockData[0], 0xFF, MAX_ERASE_BLOCK_SIZE);
-
-    emit IoWithDeviceStarted("Verifying memory...");
-    foreach(deviceRange, picData->ranges)
-    {
-        if(writeFlash && (deviceRange.type == PROGRAM_MEM))
-        {
-            elapsed.start();
+    session->Post(NewOperation()->Then(new VerifyStep(picData, hexData, writeFlash, writeEeprom, VerifyPlan(verifyPolicy))));
+}
 
-            //result = comm->GetData(deviceRange.start, device->bytesPerPacket, device->bytesPerAddressFLASH, device->bytesPerWordFLASH, deviceRange.end, deviceRange.pDataBuffer);
-			result = comm->GetData(deviceRange.start, device->bytesPerPacket, 1, 2, deviceRange.end, deviceRange.pDataBuffer);
+/*
+ * Write the hexData to the device on the I/O thread.
+ */ 
+void MuriProg::Write_Clicked()
+{
+    TRACE_INSTANT("Write_Clicked");
+    if(writePending)
+        return;
 
-            if(result != USB::Success)
-            {
-                failureDetected = true;
-                qWarning("Error reading memory.");
-            }
+    ClearOutput();
+    Print("Attempting to program the Muribot");
+    Print("Do not unplug it or turn it off until the operation is fully complete.");
+    Print(" ");
 
-            //Search through all of the programmable memory regions from the parsed .hex file data.
-            //For each of the programmable memory regions found, if the region also overlaps a region
-            //that was included in the device programmed area (which just got read back with GetData()),
-            //then verify both the parsed hex contents and read back data match.
-            foreach(hexRange, hexData->ranges)
-            {
-                if(deviceRange.start == hexRange.start)
-                {
-                    //For this entire programmable memory address range, check to see if the data read from the device exactly
-                    //matches what was in the hex file.
-                    for(i = deviceRange.start; i < deviceRange.end; i++)
-                    {
-                        //For each byte of each device address (1 on PIC18, 2 on PIC24, since flash memory is 16-bit WORD array)
-                        for(j = 0; j < device->bytesPerAddressFLASH; j++)
-                        {
-                            //Check if the device response data matches the data we parsed from the original input .hex file.
-                            if(deviceRange.pDataBuffer[((i - deviceRange.start) * device->bytesPerAddressFLASH)+j] != hexRange.pDataBuffer[((i - deviceRange.start) * device->bytesPerAddressFLASH)+j])
-                            {
-                                failureDetected = true;
-                                qWarning("Memory: 0x%x Hex: 0x%x", deviceRange.pDataBuffer[((i - deviceRange.start) * device->bytesPerAddressFLASH)+j], hexRange.pDataBuffer[((i - deviceRange.start) * device->bytesPerAddressFLASH)+j]);
-                                qWarning("Failed to verify Program Memory at address 0x%x", i);
-                                emit IoWithDeviceCompleted("Verify", USB::Fail, ((double)elapsed.elapsed()) / 1000);
-                                return;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-		else if(writeEeprom && (deviceRange.type == EEPROM_MEM))
-        {
-            elapsed.start();
+    // The file is still being parsed, the Muribot is erased meanwhile
+    if(loader->isLoading())
+    {
+        writePending = true;
+        EraseDeviceAhead();
+        return;
+    }
 
-            result = comm->GetData(deviceRange.start, device->bytesPerPacket, device->bytesPerAddressEEPROM, device->bytesPerWordEEPROM, deviceRange.end, deviceRange.pDataBuffer);
+    WriteDevice();
+}
 
-            if(result != USB::Success)
-            {
-                failureDetected = true;
-                qWarning("Error reading memory.");
-            }
 
-            //Search through all of the programmable memory regions from the parsed .hex file data.
-            //For each of the programmable memory regions found, if the region also overlaps a region
-            //that was included in the device programmed area (which just got read back with GetData()),
-            //then verify both the parsed hex contents and read back data match.
-            foreach(hexRange, hexData->ranges)
-            {
-                if(deviceRange.start == hexRange.start)
-                {
-                    //For this entire programmable memory address range, check to see if the data read from the device exactly
-                    //matches what was in the hex file.
-                    for(i = deviceRange.start; i < deviceRange.end; i++)
-                    {
-                        //For each byte of each device address (only 1 for EEPROM byte arrays, presumably 2 for EEPROM WORD arrays)
-                        for(j = 0; j < device->bytesPerAddressEEPROM; j++)
-                        {
-                            //Check if the device response data matches the data we parsed from the original input .hex file.
-                            if(deviceRange.pDataBuffer[((i - deviceRange.start) * device->bytesPerAddressEEPROM)+j] != hexRange.pDataBuffer[((i - deviceRange.start) * device->bytesPerAddressEEPROM)+j])
-                            {
-                                //A mismatch was detected.
-                                failureDetected = true;
-                                qWarning("Device: 0x%x Hex: 0x%x", deviceRange.pDataBuffer[((i - deviceRange.start) * device->bytesPerAddressFLASH)+j], hexRange.pDataBuffer[((i - deviceRange.start) * device->bytesPerAddressFLASH)+j]);
-                                qWarning("Failed to verify EEPROM at address 0x%x", i);
-                                emit IoWithDeviceCompleted("Verify EEPROM Memory", USB::Fail, ((double)elapsed.elapsed()) / 1000);
-                                return;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        else continue;
+// Writes the parsed file memory ranges contained in hexData->ranges to the
+// Muribot: erase, program, verify and sign, queued on the session thread.
+// When the last write of the same file to this Muribot was cut short, offers
+// to carry on from where it stopped instead.  erased skips the erase, for a
+// Muribot erased ahead of the write.
+void MuriProg::WriteDevice(bool erased)
+{
+    AsyncOperation* operation = NewOperation();
+    QString serial = session->serialNumber();
+    QByteArray hash = ProgressJournal::ImageHash(hexData.data(), writeFlash, writeEeprom);
+    bool journaled;
+
+    resuming = false;
+    if(!erased && ProgressJournal::Exists(serial, hash))
+    {
+        resuming = (QMessageBox::question(this, "Resume Write",
+                                          "The last write of this file to the Muribot was interrupted.\n"
+                                          "Continue from where it stopped?  Choose No to erase and write it again.",
+                                          QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes) == QMessageBox::Yes);
     }
 
-    if(failureDetected == false)
+    journaled = journal.Open(serial, hash);
+    if(resuming && journaled)
+        Print(QString("Resuming the interrupted write, %1 spans were already written.").arg(journal.spans()));
+    else
     {
-        //Successfully verified all regions without error.
-        //If this is a v1.01 or later device, we now need to issue the SIGN_FLASH
-        //command, and then re-verify the first erase page worth of flash memory
-        //(but with the exclusion of the signature WORD address from the verify,
-        //since the bootloader firmware will have changed it to the new/magic
-        //value (probably 0x600D, or "good" in leet speak).        
-        comm->SignFlash();
+        resuming = false;
+        journaled = journal.Start();
+        if(!erased)
+            operation->Then(new EraseStep());
+    }
 
-        qDebug("Expected Signature Address: 0x%x", firmwareInfo.signatureAddress);
-        qDebug("Expected Signature Value: 0x%x", firmwareInfo.signatureValue);
+    operation->Then(new WriteVerifyStep(picData, hexData, writeFlash, writeEeprom, session->firmwareInfo()->erasePageSize, VerifyPlan(verifyPolicy), journaled ? &journal : NULL))
+             ->Then(new SignStep(hexData, *session->firmwareInfo()));
+    connect(operation, SIGNAL(Finished(QString,USB::ErrorCode)), this, SLOT(WriteFinished(QString,USB::ErrorCode)));
 
-		//Now re-verify the first erase page of flash memory.
-        startOfEraseBlock = firmwareInfo.signatureAddress - (firmwareInfo.signatureAddress % firmwareInfo.erasePageSize);
-        result = comm->GetData(startOfEraseBlock, device->bytesPerPacket, device->bytesPerAddressFLASH, device->bytesPerWordFLASH, (startOfEraseBlock + firmwareInfo.erasePageSize), &flashData[0]);
-        if(result != USB::Success)
-        {
-			failureDetected = true;
-            qWarning("Error reading, post signing, flash data block.");
-        }
+    session->Post(operation);
+}
 
-        //Search through all of the programmable memory regions from the parsed .hex file data.
-        //For each of the programmable memory regions found, if the region also overlaps a region
-        //that is part of the erase block, copy out bytes into the hexEraseBlockData[] buffer,
-        //for re-verification.
-        foreach(hexRange, hexData->ranges)
-        {
-            //Check if any portion of the range is within the erase block of interest in the device.
-            if((hexRange.start <= startOfEraseBlock) && (hexRange.end > startOfEraseBlock))
-            {
-                unsigned int rangeSize = hexRange.end - hexRange.start;
-                unsigned int address = hexRange.start;
-                unsigned int k = 0;
-
-                //Check every byte in the hex file range, to see if it is inside the erase block of interest
-                for(i = 0; i < rangeSize; i++)
-                {
-                    //Check if the current byte we are looking at is inside the erase block of interst
-                    if(((address+i) >= startOfEraseBlock) && ((address+i) < (startOfEraseBlock + firmwareInfo.erasePageSize)))
-                    {
-                        //The byte is in the erase block of interst.  Copy it out into a new buffer.
-                        hexEraseBlockData[k] = *(hexRange.pDataBuffer + i);
-                        //Check if this is a signature byte.  If so, replace the value in the buffer
-                        //with the post-signing expected signature value, since this is now the expected
-                        //value from the device, rather than the value from the hex file...
-                        if((address+i) == firmwareInfo.signatureAddress)
-                        {
-                            hexEraseBlockData[k] = (unsigned char)firmwareInfo.signatureValue;    //Write LSB of signature into buffer
-                        }
-                        if((address+i) == (firmwareInfo.signatureAddress + 1))
-                        {
-                            hexEraseBlockData[k] = (unsigned char)(firmwareInfo.signatureValue >> 8); //Write MSB into buffer
-                        }
-                        k++;
-                    }
-                    if((k >= firmwareInfo.erasePageSize) || (k >= sizeof(hexEraseBlockData)))
-                        break;
-                }
-            }
-        }
+/*
+ * Erases the Muribot while the file it is about to get is still being
+ * parsed, so a write takes the longer of the two instead of both.  A robot
+ * with an interrupted write is left alone, the write may resume it.
+ */
+void MuriProg::EraseDeviceAhead(void)
+{
+    AsyncOperation* operation;
 
-        //We now have both the hex data and the post signing flash erase block data
-        //in two RAM buffers.  Compare them to each other to perform post-signing
-        //verify.
-        for(i = 0; i < firmwareInfo.erasePageSize; i++)
-        {
-            if(flashData[i] != hexEraseBlockData[i])
-            {
-                failureDetected = true;
-                qWarning("Post signing verify failure.");
-                EraseDevice();  //Send an erase command, to forcibly
-                //remove the signature (which might be valid), since
-                //there was a verify error and we can't trust the application
-                //firmware image integrity.  This ensures the device jumps
-                //back into bootloader mode always.
-
-                errorAddress = startOfEraseBlock + i;
-                expectedResult = hexEraseBlockData[i] + ((uint32_t)hexEraseBlockData[i+1] << 8);
-                actualResult = flashData[i] + ((uint32_t)flashData[i+1] << 8);
-                break;
-            }
-        }
-    }
-    
+    // An erase already on its way serves this write too
+    if(eraseAhead == Erasing)
+        return;
 
-    if(failureDetected == true)
-    {
-        qDebug("Verify failed at address: 0x%x", errorAddress);
-        qDebug("Expected result: 0x%x", expectedResult);
-        qDebug("Actual result: 0x%x", actualResult);
-        emit AppendString("Operation aborted due to error encountered during verify stage.");
-        emit AppendString("Please try programming the Muribot again.");
-        emit AppendString("If repeated failures are encountered, this may indicate the flash");
-        emit AppendString("memory has worn out, that the firmware has been damaged, or that");
-        emit AppendString("there is some other unidentified problem.");
-		emit AppendString("");
-		emit AppendString("If you continue to experience problems, please contact Mid-Ohio Area Robotics");
+    eraseAhead = NotErasing;
+    if(!session->isConnected() || ProgressJournal::Pending(session->serialNumber()))
+        return;
 
-        emit IoWithDeviceCompleted("Verify", USB::Fail, ((double)elapsed.elapsed()) / 1000);
-    }
-    else
+    eraseAhead = Erasing;
+    operation = NewOperation()->Then(new EraseStep());
+    connect(operation, SIGNAL(Finished(QString,USB::ErrorCode)), this, SLOT(EraseAheadFinished(QString,USB::ErrorCode)));
+    session->Post(operation);
+}
+
+void MuriProg::EraseAheadFinished(QString step, USB::ErrorCode result)
+{
+    eraseAhead = (result == USB::Success) ? Erased : EraseFailed;
+    StartPendingWrite();
+}
+
+/*
+ * Writes the file waiting for its load once both the load and the erase
+ * sent ahead of it are done
+ */
+void MuriProg::StartPendingWrite(void)
+{
+    if(!writePending || loader->isLoading() || (eraseAhead == Erasing))
+        return;
+
+    writePending = false;
+    if(eraseAhead == EraseFailed)
     {
-        emit IoWithDeviceCompleted("Verify", USB::Success, ((double)elapsed.elapsed()) / 1000);
-        emit AppendString("Programming completed successfully!");
-        emit AppendString("You may now turn off and unplug the Muribot.");
+        eraseAhead = NotErasing;
+        Print("Nothing was written, the Muribot could not be erased.");
+        return;
     }
 
-    emit SetProgressBar(100);   //Set progress bar to 100%
+    WriteDevice(eraseAhead == Erased);
+    eraseAhead = NotErasing;
 }
 
+/*
+ * Tells the user how the write went, once the whole chain has finished
+ */
+void MuriProg::WriteFinished(QString step, USB::ErrorCode result)
+{
+    const ProgressCounter* counter = session->progressCounter();
+
+    // A robot unplugged mid-write can resume from every span verified so far
+    journal.Flush();
+
+    if((counter->retries() > 0) || (counter->resyncs() > 0))
+        Print(QString("Recovered from USB errors: %1 packets sent again, %2 re-syncs.").arg(counter->retries()).arg(counter->resyncs()));
+    if(counter->savedReports() > 0)
+        Print(QString("Compressed payloads saved %1 USB reports.").arg(counter->savedReports()));
+    if(counter->LatencyPercentile(1000) > 0)
+        LOG_INFO("Packet latency: p50 %lldus, p99 %lldus, max %lldus.", counter->LatencyPercentile(500), counter->LatencyPercentile(990), counter->LatencyPercentile(1000));
+
+    if(result == USB::Success)
+    {
+        journal.Remove();
+        Print("Programming completed successfully!");
+        Print("You may now turn off and unplug the Muribot.");
+    }
+    else if(resuming && (result == USB::Fail) && (step == "WriteVerify"))
+    {
+        // What was written before no longer reads back, only a full write helps
+        journal.Remove();
+        Print("The Muribot changed since the write was interrupted, write it again to start over.");
+    }
+    else if((result == USB::Fail) && ((step == "WriteVerify") || (step == "Verify") || (step == "Sign")))
+    {
+        foreach(QString line, Programmer::VerifyFailedMessage())
+            Print(line);
+    }
+}
 
 /*
- * Start a thread to write the hexData to the device.
- */ 
-void MuriProg::Write_Clicked()
+ * An operation against the connected Muribot reporting to this window.  The
+ * progress bar samples the device's counter until it finishes.
+ */
+AsyncOperation* MuriProg::NewOperation(void)
 {
-    future = QtConcurrent::run(this, &MuriProg::WriteDevice);
-    ui->Output->clear();
-    ui->Output->appendPlainText("Attempting to program the Muribot");
-    ui->Output->appendPlainText("Do not unplug it or turn it off until the operation is fully complete.");
-    ui->Output->appendPlainText(" ");
+    AsyncOperation* operation = session->NewOperation();
+
+    connect(operation, SIGNAL(StepStarted(QString)), this, SLOT(IoWithDeviceStart(QString)));
+    connect(operation, SIGNAL(StepCompleted(QString,USB::ErrorCode,double)), this, SLOT(IoWithDeviceComplete(QString,USB::ErrorCode,double)));
+    connect(operation, SIGNAL(Finished(QString,USB::ErrorCode)), this, SLOT(OperationFinished()));
+
+    session->progressCounter()->Reset();
+    progress->Clear();
+    progress->Add(session->progressCounter());
+    progress->Start();
+
+    return operation;
 }
 
+void MuriProg::OperationFinished(void)
+{
+    progress->Stop();
+}
 
-// Writes the parsed file memory ranges contained in hexData->ranges to the
-// Muribot.
-void MuriProg::WriteDevice(void)
+/*
+ * Programs the open file into every attached Muribot at once.  The gang
+ * opens each of them itself, so the session closes its Muribot first: a
+ * second handle on it would queue the gang's replies for the session too.
+ */
+void MuriProg::Gang_Clicked()
 {
-    QTime elapsed;
-    USB::ErrorCode result;
-    PICData::MemoryRange hexRange;
+    TRACE_INSTANT("Gang_Clicked");
+    gang->writeFlash = writeFlash;
+    gang->writeEeprom = writeEeprom;
+    gang->verifyPlan = VerifyPlan(verifyPolicy);
 
-    //Update the progress bar so the user knows things are happening.
-    emit SetProgressBar(3);
-    //First erase the entire device.
-    EraseDevice();
+    setBootloadBusy(true);
+    emit SetProgressBar(0);
+    ClearOutput();
+
+    // StartGang() once the close went through, see SessionCommandFinished()
+    gangPending = true;
+    gangReopen = true;
+    session->Close();
+}
 
-    //Now being re-programming each section based on the info we obtained when
-    //we parsed the user's .hex file.
+void MuriProg::StartGang(void)
+{
+    int count, i;
+
+    gangPending = false;
 
-    emit IoWithDeviceStarted("Writing memory...");
-    foreach(hexRange, hexData->ranges)
+    // The gang replaces its counters on Start()
+    progress->Clear();
+    count = gang->Start(hexData);
+    if(count == 0)
     {
-        if(writeFlash && (hexRange.type == PROGRAM_MEM))
-        {
-            elapsed.start();
-
-            result = comm->Program(hexRange.start,
-                                   device->bytesPerPacket,
-                                   device->bytesPerAddressFLASH,
-                                   device->bytesPerWordFLASH,
-                                   hexRange.end,
-                                   hexRange.pDataBuffer);
-        }
-        else if(writeEeprom && (hexRange.type ==  EEPROM_MEM))
-        {
-                elapsed.start();
-
-                result = comm->Program(hexRange.start,
-                                       device->bytesPerPacket,
-                                       device->bytesPerAddressEEPROM,
-                                       device->bytesPerWordEEPROM,
-                                       hexRange.end,
-                                       hexRange.pDataBuffer);
-        }
-		else continue;
+        Print("No Muribots detected.");
+        setBootloadBusy(false);
+        return;
+    }
 
-        if(result != USB::Success)
-        {
-            qWarning("Programming failed");
-            return;
-        }
+    for(i = 0; i < count; i++)
+        progress->Add(gang->Progress(i));
+    progress->Start();
+    Print(QString("Programming %1 Muribot(s)...").arg(count));
+    Print("Do not unplug them or turn them off until the operation is fully complete.");
+    Print(" ");
+}
+
+void MuriProg::GangDeviceFinished(int index, USB::ErrorCode result, double time)
+{
+    QString msg;
+    QTextStream ss(&msg);
+
+    ss << gang->DeviceName(index) << ": ";
+    switch(result)
+    {
+        case USB::Success:
+            ss << "Complete (" << time << "s)";
+            break;
+        case USB::NotConnected:
+            ss << "Failed. Muribot not connected.";
+            break;
+        case USB::IncorrectCommand:
+            ss << "Failed. Unable to communicate with Firmware.";
+            break;
+        case USB::Timeout:
+            ss << "Timed out waiting for response (" << time << "s)";
+            break;
+        case USB::Fail:
+        default:
+            ss << "Failed.";
+            break;
     }
 
-    emit IoWithDeviceCompleted("Write", result, ((double)elapsed.elapsed()) / 1000);
+    Print(msg);
+}
 
-    VerifyDevice();
+void MuriProg::GangFinished(void)
+{
+    progress->Stop();
+    emit SetProgressBar(100);
+    setBootloadBusy(false);
 }
 
 /*
- * Start a thread to erase the program memory
+ * Erase the program memory on the session thread
  */
 void MuriProg::Erase_Clicked()
 {
-    future = QtConcurrent::run(this, &MuriProg::EraseDevice);
+    EraseDevice();
 }
 
 /*
@@ -621,20 +719,7 @@ void MuriProg::Erase_Clicked()
  */
 void MuriProg::EraseDevice(void)
 {
-    QTime elapsed;
-    USB::ErrorCode result;    
-
-    emit IoWithDeviceStarted("Erasing memory... (no status update until complete, may take several seconds)");
-    elapsed.start();
-
-    result = comm->Erase();
-    if(result != USB::Success)
-    {
-        emit IoWithDeviceCompleted("Erase", result, ((double)elapsed.elapsed()) / 1000);
-        return;
-    }    
-
-    emit IoWithDeviceCompleted("Erase", result, ((double)elapsed.elapsed()) / 1000);
+    session->Post(NewOperation()->Then(new EraseStep()));
 }
 
 /*
@@ -648,7 +733,7 @@ void MuriProg::Open_Clicked()
 
     //Create an open file dialog box, so the user can select a .hex file.
     newFileName =
-        QFileDialog::getOpenFileName(this, "Open Hex File", fileName, "Hex Files (*.hex *.ehx)");
+        QFileDialog::getOpenFileName(this, "Open Hex File", fileName, "Hex Files (*.hex *.ehx);;Bundles (*." BUNDLE_SUFFIX ")");
 
     if(newFileName.isEmpty())
     {
@@ -659,45 +744,61 @@ void MuriProg::Open_Clicked()
 }
 
 /*
- * Parse each line of the selected file into a memory range and
- * load those ranges into hexData->ranges;
+ * Starts parsing the selected file off the GUI thread, see LoadFinished().
+ * With auto program on the Muribot is erased meanwhile and written once the
+ * file is in.
  */
 void MuriProg::LoadFile(QString newFileName)
 {
-    QString msg;
-    QTextStream stream(&msg);
     QFileInfo nfi(newFileName);
 
-    QApplication::setOverrideCursor(Qt::BusyCursor);
+    if(writePending)
+    {
+        Print("Wait for the write to start before opening another file.");
+        return;
+    }
 
-    HexLoader import;
-    HexLoader::ErrorCode result;
-    USB::ErrorCode commResultCode;
+    // Recent bundle images are listed as "bundle#image"
+    if(!nfi.exists() && newFileName.contains('#') && ImageBundle::IsBundle(newFileName.section('#', 0, -2)))
+    {
+        LoadBundle(newFileName.section('#', 0, -2), newFileName.section('#', -1));
+        return;
+    }
+    if(ImageBundle::IsBundle(newFileName))
+    {
+        LoadBundle(newFileName, QString());
+        return;
+    }
 
-    hexData->ranges.clear();
+    CreateImages();
 
     //Print some debug info to the debug window.
-    qDebug(QString("Total programmable regions reported by Firmware: " + QString::number(picData->ranges.count(), 10)).toLatin1());
-
-    //First duplicate the picData programmable region list and
-    //allocate some RAM buffers to hold the hex data that we are about to import.
+    LOG_DEBUG("%s", qPrintable("Total programmable regions reported by Firmware: " + QString::number(picData->ranges.count(), 10)));
     foreach(PICData::MemoryRange range, picData->ranges)
     {
-        //Allocate some RAM for the hex file data we are about to import.
-        //Initialize all bytes of the buffer to 0xFF, the default unprogrammed memory value,
-        //which is also the "assumed" value, if a value is missing inside the .hex file, but
-        //is still included in a programmable memory region.
-        range.pDataBuffer = new unsigned char[range.dataBufferLength];
-        memset(range.pDataBuffer, 0xFF, range.dataBufferLength);
-        hexData->ranges.append(range);
-
         //Print info regarding the programmable memory region to the debug window.
-        qDebug(QString("Programmable memory region: [" + QString::number(range.start, 16).toUpper() + " - " +
-                   QString::number(range.end, 16).toUpper() +")").toLatin1());
+        LOG_DEBUG("%s", qPrintable("Programmable memory region: [" + QString::number(range.start, 16).toUpper() + " - " +
+                  QString::number(range.end, 16).toUpper() + ")"));
     }
 
-    //Import the hex file data into the hexData->ranges[].pDataBuffer buffers.
-    result = import.ImportHexFile(newFileName, hexData, device);
+    //Import the hex file data into a new image, on the loader thread.
+    loader->Start(newFileName);
+    if(autoProgram && !deviceBusy && session->isConnected() && (writeFlash || writeEeprom))
+        Write_Clicked();
+    Print("Loading " + nfi.fileName() + "...");
+}
+
+/*
+ * The file started by LoadFile() is parsed.  Its snapshot replaces hexData
+ * unless it could not be loaded, then the file opened before stays.  A write
+ * still running goes on with the image it started with.
+ */
+void MuriProg::LoadFinished(QString newFileName, int result, double time)
+{
+    QString msg;
+    QTextStream stream(&msg);
+    QFileInfo nfi(newFileName);
+
     //Based on the result of the hex file import operation, decide how to proceed.
     switch(result)
     {
@@ -705,63 +806,145 @@ void MuriProg::LoadFile(QString newFileName)
             break;
 
         case HexLoader::CouldNotOpenFile:
-            QApplication::restoreOverrideCursor();
             stream << "Error: Could not open file " << nfi.fileName() << "\n";
-            ui->Output->appendPlainText(msg);
-            return;
+            break;
 
         case HexLoader::NoneInRange:
-            QApplication::restoreOverrideCursor();
             stream << "No address within range in file: " << nfi.fileName() << ".  Verify the correct file was selected.\n";
-            ui->Output->appendPlainText(msg);
-            return;
+            break;
 
         case HexLoader::ErrorInHexFile:
-            QApplication::restoreOverrideCursor();
             stream << "Error in hex file.  Please make sure the correct file was selected.\n";
-            ui->Output->appendPlainText(msg);
-            return;
+            break;
         case HexLoader::InsufficientMemory:
-            QApplication::restoreOverrideCursor();
             stream << "Memory allocation failed.  Please close other applications to free up system RAM and try again. \n";
-            ui->Output->appendPlainText(msg);
-            return;
+            break;
 
         default:
-            QApplication::restoreOverrideCursor();
             stream << "Failed to import: " << result << "\n";
-            ui->Output->appendPlainText(msg);
-            return;
+            break;
     }
 
+    if(result != HexLoader::Success)
+    {
+        Print(msg);
+        if(writePending)
+        {
+            writePending = false;
+            Print("Nothing was written.");
+        }
+        return;
+    }
+
+    LOG_INFO("Parsed %s in %.3fs.", qPrintable(newFileName), time);
+    hexData = loader->image();
     fileName = newFileName;
     watchFileName = newFileName;
+    AddRecentFile(fileName);
+
+    stream.setIntegerBase(10);
 
+    msg.clear();
+    QFileInfo fi(fileName);
+    QString name = fi.fileName();
+    stream << "Opened: " << name << "\n";
+    Print(msg);
+    hexOpen = true;
+    if((eraseAhead != Erasing) && !deviceBusy)
+        setBootloadEnabled(true);
+
+    StartPendingWrite();
+}
+
+/*
+ * Selects an image of a bundle, asking which one when image is empty.  The
+ * bundle stays mapped, so switching to another of its images only copies
+ * the image into a new snapshot.
+ */
+void MuriProg::LoadBundle(QString bundleFileName, QString image)
+{
+    QStringList names;
+    ImageBundle::ErrorCode result = ImageBundle::Success;
+    PICData* data;
+    bool ok = true;
+    int i;
+
+    if(writePending)
+    {
+        Print("Wait for the write to start before opening another file.");
+        return;
+    }
+
+    CreateImages();
+    loader->Cancel();
+    if(!bundle.isOpen() || (bundle.fileName() != bundleFileName))
+        result = bundle.Open(bundleFileName);
+    if(result != ImageBundle::Success)
+    {
+        Print(QString("Error: %1 is damaged or not a bundle.\n").arg(QFileInfo(bundleFileName).fileName()));
+        return;
+    }
+
+    if(image.isEmpty())
+    {
+        for(i = 0; i < bundle.count(); i++)
+            names.append(bundle.name(i));
+        image = QInputDialog::getItem(this, "Open Bundle", "Image:", names, 0, false, &ok);
+        if(!ok)
+            return;
+    }
+
+    data = new PICData();
+    result = bundle.Select(bundle.Find(image), data);
+    if(result != ImageBundle::Success)
+        PICData::Free(data);
+    switch(result)
+    {
+        case ImageBundle::Success:
+            break;
+        case ImageBundle::NotFound:
+            Print(QString("No image %1 in %2.\n").arg(image).arg(QFileInfo(bundleFileName).fileName()));
+            return;
+        case ImageBundle::LayoutMismatch:
+            Print(QString("Image %1 was built for another device.\n").arg(image));
+            return;
+        default:
+            Print(QString("Error: %1 is damaged.\n").arg(QFileInfo(bundleFileName).fileName()));
+            return;
+    }
+
+    hexData = PICData::Freeze(data);
+    fileName = bundleFileName + "#" + image;
+    watchFileName = bundleFileName;
+    AddRecentFile(fileName);
+
+    Print(QString("Opened: %1 from %2\n").arg(image).arg(QFileInfo(bundleFileName).fileName()));
+    hexOpen = true;
+    if(deviceBusy)
+        return;
+
+    setBootloadEnabled(true);
+    if(autoProgram && session->isConnected() && (writeFlash || writeEeprom))
+        Write_Clicked();
+}
+
+/*
+ * Moves a file (or bundle image) to the top of the recently opened list
+ */
+void MuriProg::AddRecentFile(QString entry)
+{
     QSettings settings;
     settings.beginGroup("MuriProg");
 
     QStringList files = settings.value("recentFileList").toStringList();
-    files.removeAll(fileName);
-    files.prepend(fileName);
+    files.removeAll(entry);
+    files.prepend(entry);
     while(files.size() > MAX_RECENT_FILES)
     {
         files.removeLast();
     }
     settings.setValue("recentFileList", files);
     UpdateRecentFileList();
-
-    stream.setIntegerBase(10);
-
-    msg.clear();
-    QFileInfo fi(fileName);
-    QString name = fi.fileName();
-    stream << "Opened: " << name << "\n";
-    ui->Output->appendPlainText(msg);
-    hexOpen = true;
-    setBootloadEnabled(true);
-    QApplication::restoreOverrideCursor();
-
-    return;
 }
 
 /*
@@ -770,7 +953,7 @@ void MuriProg::LoadFile(QString newFileName)
 void MuriProg::openRecentFile(void)
 {
     QAction *action = qobject_cast<QAction *>(sender());
-    if (action)
+    if (action && ui->OpenAction->isEnabled())
     {
         LoadFile(action->data().toString());
     }
@@ -797,7 +980,7 @@ void MuriProg::UpdateRecentFileList(void)
 
         recentFiles[i]->setText(text);
         recentFiles[i]->setData(files[i]);
-        recentFiles[i]->setVisible(comm->isConnected());
+        recentFiles[i]->setVisible(session->isConnected());
     }
 
     for(; i < MAX_RECENT_FILES; i++)
@@ -819,49 +1002,77 @@ void MuriProg::About_Clicked()
     delete dlg;
 }
 
-/* 
- * Loads firmwareInfo with information about the Muribots bootloader
- * bootloader.
+/*
+ * Events from the session thread.  Opening the Muribot also reads the
+ * information about its bootloader, a known one is ready at once and only
+ * reported again when reading it found something new.
  */
-void MuriProg::GetFirmwareInfo()
+void MuriProg::SessionCommandFinished(QString command, USB::ErrorCode result, double time)
 {
-    QTime totalTime;
-    PICData::MemoryRange range;
-    QString connectMsg;
-    QTextStream ss(&connectMsg);
-
-    qDebug("Executing GetFirmwareInfo() command.");
-
-    totalTime.start();
+    if((command == "Open") || (command == "Refresh"))
+    {
+        UpdateRecentFileList();
+        ShowFirmwareInfo(result, time);
+        DeviceReady();
+    }
+    else if((command == "Close") && gangPending)
+        StartGang();
+    else if((command == "Reset") && (result != USB::Success))
+        LOG_WARNING("Reset not sent, Muribot not connected");
+}
 
-    if(!comm->isConnected())
+void MuriProg::SessionStateChanged(int state)
+{
+    switch(state)
     {
-        qWarning("GetFirmwareInfo command not sent, Muribot not connected");
-        return;
+        case DeviceSession::Connecting:
+            deviceLabel.setText("Connecting...");
+            break;
+        case DeviceSession::Connected:
+        case DeviceSession::Busy:
+            deviceLabel.setText("Connected");
+            break;
+        case DeviceSession::Disconnected:
+        default:
+            deviceLabel.setText("Disconnected");
+            break;
     }
+}
+
+/* 
+ * Shows the information about the Muribots bootloader read when the
+ * session opened it.
+ */
+void MuriProg::ShowFirmwareInfo(USB::ErrorCode result, double time)
+{
+    QSharedPointer<const USB::FirmwareInfo> firmwareInfo = session->firmwareInfo();
+    QString connectMsg;
+    QTextStream ss(&connectMsg);
 
-    //Send the ReadFirmwareInfo command to the device over USB, and check the result status.
-    switch(comm->ReadFirmwareInfo(&firmwareInfo))
+    switch(result)
     {
         case USB::Fail:
         case USB::IncorrectCommand:
-            ui->Output->appendPlainText("Unable to communicate with firmware.\n");
+            Print("Unable to communicate with firmware.\n");
+            setBootloadEnabled(false);
             return;
         case USB::Timeout:
-            ss << "Operation timed out";
-            break;
+            ss << "Operation timed out (" << time << "s)\n";
+            Print(connectMsg);
+            setBootloadEnabled(false);
+            return;
 		case USB::Success:			
 			ss << "Connected to Muribot";
-			deviceLabel.setText("Connected");
 			break;
         default:
+            LOG_WARNING("Firmware information not read, Muribot not connected");
             return;
     }	
-    ss << " (" << (double)totalTime.elapsed() / 1000 << "s)\n";
-	ss << "Application Version: 0x" << QString::number(firmwareInfo.applicationVersion, 16) << "\n";
-	ss << "Bootloader Version: 0x" << QString::number(firmwareInfo.bootloaderVersion, 16) << "\n";
+    ss << " (" << time << "s)\n";
+	ss << "Application Version: 0x" << QString::number(firmwareInfo->applicationVersion, 16) << "\n";
+	ss << "Bootloader Version: 0x" << QString::number(firmwareInfo->bootloaderVersion, 16) << "\n";
 	
-    ui->Output->appendPlainText(connectMsg);    
+    Print(connectMsg);    
 		
     //Make sure user has allowed at least one region to be programmed
     if(!(writeFlash || writeEeprom))
@@ -881,15 +1092,20 @@ void MuriProg::Settings_Clicked()
     USB::ErrorCode result;
     Settings* dlg = new Settings(this);
 
+    CreateImages();
     dlg->enableEepromBox(device->EepromPresent());
 
     dlg->setWriteFlash(writeFlash);    
     dlg->setWriteEeprom(writeEeprom);
+    dlg->setVerifyPolicy(verifyPolicy);
+    dlg->setAutoProgram(autoProgram);
 
     if(dlg->exec() == QDialog::Accepted)
     {
         writeFlash = dlg->writeFlash;
         writeEeprom = dlg->writeEeprom;
+        verifyPolicy = (VerifyPlan::Policy)dlg->verifyPolicy;
+        autoProgram = dlg->autoProgram;
 		
         if(!(writeFlash || writeEeprom))
         {
@@ -910,13 +1126,13 @@ void MuriProg::Settings_Clicked()
  */
 void MuriProg::Reset_Clicked()
 {
-    if(!comm->isConnected())
+    if(!session->isConnected())
     {
         failed = -1;
-        qWarning("Reset not sent, Muribot not connected");
+        LOG_WARNING("Reset not sent, Muribot not connected");
         return;
     }
 
-    ui->Output->appendPlainText("Resetting firmware...");
-    comm->Reset();
+    Print("Resetting firmware...");
+    session->Reset();
 }
\ No newline at end of file
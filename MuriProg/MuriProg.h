@@ -25,12 +25,19 @@
 #include <QFileSystemWatcher>
 #include <QtCore/QProcess>
 #include <QtWidgets/QMenu>
-#include <QFuture>
+#include <QStringList>
+#include <QTimer>
 
 #include "USB.h"
 #include "PICData.h"
 #include "Bootloader.h"
 #include "HexLoader.h"
+#include "Programmer.h"
+#include "GangProgrammer.h"
+#include "DeviceMonitor.h"
+#include "DeviceSession.h"
+#include "ImageBundle.h"
+#include "ImageLoader.h"
 
 namespace Ui
 {
@@ -40,22 +47,41 @@ namespace Ui
 // Maximum number of recent files to display in the 
 #define MAX_RECENT_FILES 5
 
+// Lines kept in the output window, older ones are dropped
+#define OUTPUT_MAX_LINES 2000
+// Output is appended in batches, at most once per this many milliseconds
+#define OUTPUT_FLUSH_MS 100
+
+// Milliseconds after launch the device monitor starts if the window has not
+// been painted by then, normally it starts right after the first paint
+#define STARTUP_DEVICES_DELAY_MS 1000
+
 // The main Serial Bootloader GUI window.
 class MuriProg : public QMainWindow
 {
     Q_OBJECT
 
 public:
+	// Enums
+	// Where an erase sent ahead of the write it belongs to stands
+    enum EraseAhead
+    {
+        NotErasing = 0,
+        Erasing,
+        Erased,
+        EraseFailed
+    };
+
 	// Constructor/Destructor
     MuriProg(QWidget *parent = 0);
     ~MuriProg();
 
 	// Methods
-    void GetFirmwareInfo(void);
     void LoadFile(QString fileName);
+    void LoadBundle(QString bundleFileName, QString image);
     void EraseDevice(void);
     void BlankCheckDevice(void);
-    void WriteDevice(void);
+    void WriteDevice(bool erased = false);
     void VerifyDevice(void);
     void setBootloadBusy(bool busy);
 
@@ -67,36 +93,71 @@ signals:
 
 public slots:
     void Connection(void);
+    void SessionCommandFinished(QString command, USB::ErrorCode result, double time);
+    void SessionStateChanged(int state);
     void openRecentFile(void);
     void IoWithDeviceComplete(QString msg, USB::ErrorCode, double time);
     void IoWithDeviceStart(QString msg);
     void AppendStringToTextbox(QString msg);
     void UpdateProgressBar(int newValue);
+    void GangDeviceFinished(int index, USB::ErrorCode result, double time);
+    void GangFinished(void);
+    void WriteFinished(QString step, USB::ErrorCode result);
+    void OperationFinished(void);
+    void FlushOutput(void);
+    void StartDevices(void);
+    void LoadFinished(QString fileName, int result, double time);
+    void EraseAheadFinished(QString step, USB::ErrorCode result);
 
 protected:
 	// Members
-    USB* comm;
+    DeviceSession* session;
     PICData* picData;
-    PICData* hexData;
+    ImageSnapshot hexData;          // Open image, replaced whole by every load
     Bootloader* device;
-    QFuture<void> future;
+    GangProgrammer* gang;
+    ProgressModel* progress;
     QString fileName, watchFileName;
     QFileSystemWatcher* fileWatcher;
-    QTimer *timer;
+    DeviceMonitor* monitor;
     bool writeFlash;
     bool writeEeprom;    
+    VerifyPlan::Policy verifyPolicy;
     bool eraseDuringWrite;
     bool hexOpen;
+    bool deviceBusy;                // An operation is running against the Muribot
+    ProgressJournal journal;        // Spans of the current write verified so far, used by its WriteVerifyStep
+    bool resuming;                  // The current write carries on from an interrupted one
+    ImageBundle bundle;             // Bundle the open image came from, kept mapped
+    ImageLoader* loader;            // Parses hex files off the GUI thread
+    bool autoProgram;               // Write every file as soon as it is opened
+    bool writePending;              // A write waits for the file being loaded
+    EraseAhead eraseAhead;          // Erase sent while the file was still loading
+    bool gangPending;               // The gang starts once the session has let go of its Muribot
+    bool gangReopen;                // The session reopens quietly once the gang is done
 
 	// Methods
+    void paintEvent(QPaintEvent* event);
+    void DeviceReady(void);
+    void CreateImages(void);
+    void EraseDeviceAhead(void);
+    void StartPendingWrite(void);
+    void StartGang(void);
     void setBootloadEnabled(bool enable);
+    void ShowFirmwareInfo(USB::ErrorCode result, double time);
     void UpdateRecentFileList(void);
+    void AddRecentFile(QString entry);
+    AsyncOperation* NewOperation(void);
+    void Print(QString msg);
+    void ClearOutput(void);
     USB::ErrorCode RemapInterruptVectors(Bootloader* bootDevice, PICData* picData);
 
 private:
 	// Members
 	Ui::MuriProg* ui;
     QLabel deviceLabel;
+    QStringList pendingOutput;      // Printed, not yet in the output window
+    QTimer outputTimer;
     int failed;
     QAction *recentFiles[MAX_RECENT_FILES];    
 
@@ -109,6 +170,7 @@ private slots:
     void Open_Clicked();
     void Erase_Clicked();
     void Exit_Clicked();
+    void Gang_Clicked();
 };
 
 #endif // MAINWINDOW_H
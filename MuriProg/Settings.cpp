@@ -47,6 +47,18 @@ void Settings::setWriteEeprom(bool value)
     ui->EepromCheckBox->setChecked(value && EepromPresent);
 }
 
+void Settings::setVerifyPolicy(int value)
+{
+    verifyPolicy = value;
+    ui->VerifyComboBox->setCurrentIndex(value);
+}
+
+void Settings::setAutoProgram(bool value)
+{
+    autoProgram = value;
+    ui->AutoProgramCheckBox->setChecked(value);
+}
+
 void Settings::changeEvent(QEvent *e)
 {
     switch (e->type())
@@ -63,4 +75,6 @@ void Settings::on_buttonBox_accepted()
 {
     writeFlash = ui->FlashProgramMemorycheckBox->isChecked();    
     writeEeprom = ui->EepromCheckBox->isChecked();
+    verifyPolicy = ui->VerifyComboBox->currentIndex();
+    autoProgram = ui->AutoProgramCheckBox->isChecked();
 }
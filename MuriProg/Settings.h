@@ -41,10 +41,14 @@ public:
     void enableEepromBox(bool Eeprom);
     void setWriteFlash(bool value);
     void setWriteEeprom(bool value);    
+    void setVerifyPolicy(int value);
+    void setAutoProgram(bool value);
 
     bool writeFlash;
     bool writeEeprom;
     bool writeConfig;
+    int verifyPolicy;       // VerifyPlan::Policy, same order as the combo box
+    bool autoProgram;       // Write each file as soon as it is opened
 
     bool EepromPresent;
     bool hasConfig;
@@ -30,17 +30,48 @@
 
 #include <QtWidgets/QApplication>
 #include "MuriProg.h"
+#include "Trace.h"
+#include "Log.h"
+#include "RealtimeIo.h"
+#include "Startup.h"
 
 int main(int argc, char *argv[])
 {
+	// Startup phases are logged once the Muribot is ready, see Startup.h
+	Startup::Begin();
+	Startup::Phase("application");
     QApplication a(argc, argv);
 	// Setup organization, domain, and application.
     QCoreApplication::setOrganizationName("Mid-Ohio Area Robotics");
     QCoreApplication::setOrganizationDomain("moarobotics.com");
     QCoreApplication::setApplicationName("MuriProg");
 
+	// MURIPROG_LOG picks how much is logged, see Log.h
+	Startup::Phase("log");
+	Log::Init();
+
+	// Setting MURIPROG_TRACE to a file name records a timeline of the session
+	// and writes it there as Chrome trace-event JSON on exit.
+	QString traceFile = qgetenv("MURIPROG_TRACE");
+	if(!traceFile.isEmpty())
+		Trace::Enable();
+
+	// MURIPROG_REALTIME turns on the low jitter I/O thread, see RealtimeIo.h
+	RealtimeIo::Settings realtime;
+	if(RealtimeIo::Parse(qgetenv(REALTIME_ENV), &realtime))
+		RealtimeIo::Configure(realtime);
+	else
+		LOG_WARNING("Ignoring " REALTIME_ENV ", expected \"on\" or cpu=<n>,priority=<n>,poll=<us>.");
+
 	// Create the window
     MuriProg w;
+	Startup::Phase("show");
     w.show();
-    return a.exec();
+	Startup::End();
+    int result = a.exec();
+
+	if(!traceFile.isEmpty())
+		Trace::WriteJson(traceFile);
+
+    return result;
 }
@@ -0,0 +1,446 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <stdio.h>
+
+#include "../MuriCore/Session.h"
+#include "../MuriCore/SessionReport.h"
+#include "../MuriCore/DaemonProtocol.h"
+#include "../MuriCore/EmulatedUSB.h"
+#include "../MuriCore/RealtimeIo.h"
+#include "../MuriCore/Trace.h"
+#include "../MuriCore/Log.h"
+#include "../version.h"
+
+static bool verbose = false;
+
+/*
+ * qDebug()/qWarning() output from the programming code only goes to stderr
+ * with --verbose, so stdout carries nothing but the JSON result.
+ */
+static void MessageHandler(QtMsgType type, const QMessageLogContext& context, const QString& msg)
+{
+    Q_UNUSED(context);
+
+    if(verbose || (type == QtCriticalMsg) || (type == QtFatalMsg))
+        fprintf(stderr, "%s\n", qPrintable(msg));
+}
+
+/*
+ * Builds a bundle from every hex file in a directory
+ */
+static ExitCode BuildBundle(QString fileName, QString directory, QJsonObject& report)
+{
+    QDir dir(directory);
+    QStringList hexFiles, failed;
+    QJsonArray images;
+
+    foreach(QString name, dir.entryList(QStringList() << "*.hex", QDir::Files, QDir::Name))
+    {
+        hexFiles.append(dir.absoluteFilePath(name));
+        images.append(QFileInfo(name).completeBaseName());
+    }
+
+    switch(ImageBundle::Build(fileName, hexFiles, &failed))
+    {
+        case ImageBundle::Success:
+            report["images"] = images;
+            return ExitSuccess;
+        case ImageBundle::HexFileError:
+            report["error"] = QString("error in hex file");
+            report["failed"] = QJsonArray::fromStringList(failed);
+            return ExitFileError;
+        case ImageBundle::CouldNotWriteFile:
+            report["error"] = QString("could not write file");
+            return ExitFileError;
+        default:
+            report["error"] = QString("no hex files found");
+            return ExitFileError;
+    }
+}
+
+/*
+ * Lists the images of a bundle
+ */
+static ExitCode ListBundle(QString fileName, QJsonObject& report)
+{
+    ImageBundle bundle;
+    QJsonArray images;
+    int i;
+
+    if(bundle.Open(fileName) != ImageBundle::Success)
+    {
+        report["error"] = QString("bundle is damaged or not a bundle");
+        return ExitFileError;
+    }
+
+    for(i = 0; i < bundle.count(); i++)
+    {
+        QJsonObject image;
+        image["name"] = bundle.name(i);
+        image["fingerprint"] = QString(bundle.fingerprint(i).toHex());
+        images.append(image);
+    }
+    report["images"] = images;
+
+    return ExitSuccess;
+}
+
+/*
+ * Submits a job to muriprogd and waits for its result, which becomes the
+ * report.  The events before it are printed to stderr with --verbose.
+ */
+static ExitCode RunOnDaemon(QJsonObject job, QJsonObject& report)
+{
+    QLocalSocket socket;
+    QString name = qgetenv(DAEMON_NAME_ENV);
+    QByteArray line;
+    QJsonObject event;
+
+    if(name.isEmpty())
+        name = DAEMON_NAME;
+
+    socket.connectToServer(name);
+    if(!socket.waitForConnected(DAEMON_CONNECT_TIMEOUT_MS))
+    {
+        report["error"] = QString("daemon not running");
+        return ExitNotConnected;
+    }
+
+    line = QJsonDocument(job).toJson(QJsonDocument::Compact);
+    line.append('\n');
+    socket.write(line);
+
+    forever
+    {
+        while(!socket.canReadLine())
+        {
+            if(!socket.waitForReadyRead(-1))
+            {
+                report["error"] = QString("daemon went away");
+                return ExitNotConnected;
+            }
+        }
+
+        line = socket.readLine();
+        event = QJsonDocument::fromJson(line).object();
+        if(event.value("event").toString() == "result")
+            break;
+        if(verbose)
+            fprintf(stderr, "%s", line.constData());
+    }
+
+    event.remove("event");
+    report = event;
+    return (ExitCode)report.value("exitCode").toInt();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setOrganizationName("Mid-Ohio Area Robotics");
+    QCoreApplication::setOrganizationDomain("moarobotics.com");
+    QCoreApplication::setApplicationName("muriprog-cli");
+    QCoreApplication::setApplicationVersion(VERSION);
+
+    QCommandLineParser parser;
+    QCommandLineOption deviceOption("device", "Bootloader to use, as printed by the list command (default: the first one found).", "path");
+    QCommandLineOption emulateOption("emulate", "Talk to an emulated bootloader instead of the hardware.");
+    QCommandLineOption imageOption("image", "Image of a bundle to load, write or verify.", "name");
+    QCommandLineOption eepromOption("eeprom", "Include EEPROM in write, verify and readback.");
+    QCommandLineOption verifyOption("verify", "What write and verify read back: full (default), extents (only what the image programs, plus a\n"
+                                    "sample of the blank remainder) or sampled (random pages).", "policy", "full");
+    QCommandLineOption sampleOption("sample", "Percent of the blank packets (extents) or of the pages (sampled) read back.", "percent");
+    QCommandLineOption seedOption("seed", "Picks the samples of extents and sampled, to repeat a verify (default: random, see the result).", "n");
+    QCommandLineOption twoPassOption("two-pass", "Write everything before verifying, instead of verifying while writing.");
+    QCommandLineOption dropOption("emulate-drop", "With --emulate, lose every n-th report sent to the emulated bootloader.", "n");
+    QCommandLineOption unplugOption("emulate-unplug", "With --emulate, unplug the emulated bootloader after n reports (or \"random\") and plug it\n"
+                                    "back in, write then resumes.", "n");
+    QCommandLineOption packetOption("emulate-packet", "With --emulate, the emulated bootloader offers reports of this many bytes (64 - 256).", "bytes");
+    QCommandLineOption compressOption("emulate-compress", "With --emulate, the emulated bootloader takes compressed program payloads.");
+    QCommandLineOption realtimeOption("realtime", "Low jitter I/O: \"on\" or any of cpu=<n>,priority=<n>,poll=<us> (default: $" REALTIME_ENV ").\n"
+                                      "Real-time priority and locked memory fall back to normal ones without the privileges.", "settings");
+    QCommandLineOption resumeOption("resume", "Let write carry on from an interrupted write of the same image.");
+    QCommandLineOption daemonOption("daemon", "Run the command on muriprogd, which keeps devices open and images parsed between\n"
+                                    "jobs (list, load, erase, write, verify, blankcheck, readback and reset).");
+    QCommandLineOption verboseOption("verbose", "Print the programming log to stderr.");
+
+    parser.setApplicationDescription("Programs Muribots without the GUI.  Prints one line of JSON with the result\n"
+                                     "and the time spent in each phase, and exits with a non zero code on failure.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addOption(deviceOption);
+    parser.addOption(daemonOption);
+    parser.addOption(emulateOption);
+    parser.addOption(dropOption);
+    parser.addOption(unplugOption);
+    parser.addOption(packetOption);
+    parser.addOption(compressOption);
+    parser.addOption(realtimeOption);
+    parser.addOption(resumeOption);
+    parser.addOption(imageOption);
+    parser.addOption(eepromOption);
+    parser.addOption(verifyOption);
+    parser.addOption(sampleOption);
+    parser.addOption(seedOption);
+    parser.addOption(twoPassOption);
+    parser.addOption(verboseOption);
+    parser.addPositionalArgument("command", "list, load <hex>, erase, write <hex>, verify <hex>, blankcheck, readback <bin>, reset\n"
+                                 "or bundle <bundle> <directory>");
+    parser.addPositionalArgument("file", "Hex file (or bundle, with --image) to load, write or verify, the file readback saves to or\n"
+                                 "the bundle to build.", "[file]");
+    parser.addPositionalArgument("directory", "Directory of hex files a bundle is built from.", "[directory]");
+    parser.process(a);
+
+    verbose = parser.isSet(verboseOption);
+    qInstallMessageHandler(MessageHandler);
+
+    // Without --verbose the log is thrown away, so do not format it either
+    Log::Init();
+    if(!verbose)
+        Log::SetLevel(Log::Off);
+
+	// Same as the GUI, MURIPROG_TRACE names a Chrome trace-event file to write on exit
+	QString traceFile = qgetenv("MURIPROG_TRACE");
+	if(!traceFile.isEmpty())
+		Trace::Enable();
+
+    QStringList args = parser.positionalArguments();
+    QString command = args.value(0);
+    QString fileName = args.value(1);
+    bool needsFile = (command == "load") || (command == "write") || (command == "verify") || (command == "readback") || (command == "bundle");
+    bool isBundle = ((command == "load") || (command == "write") || (command == "verify")) && ImageBundle::IsBundle(fileName);
+    bool emulate = parser.isSet(emulateOption);
+    RealtimeIo::Settings realtime;
+    bool realtimeOk = RealtimeIo::Parse(parser.isSet(realtimeOption) ? parser.value(realtimeOption) : QString(qgetenv(REALTIME_ENV)), &realtime);
+    bool dropOk = true;
+    int dropEvery = parser.value(dropOption).toInt(&dropOk);
+    bool unplugOk = true;
+    int unplugAfter = parser.value(unplugOption).toInt(&unplugOk);
+    bool packetOk = true;
+    int packetSize = parser.value(packetOption).toInt(&packetOk);
+
+    VerifyPlan::Policy policy;
+    bool sampleOk = true;
+    int samplePercent = parser.value(sampleOption).toInt(&sampleOk);
+    bool seedOk = true;
+    uint seed = parser.value(seedOption).toUInt(&seedOk);
+
+    if(command.isEmpty() || (needsFile && fileName.isEmpty()) ||
+       !VerifyPlan::Parse(parser.value(verifyOption), &policy) || (parser.isSet(sampleOption) && (!sampleOk || (samplePercent < 0) || (samplePercent > 100))) ||
+       (parser.isSet(seedOption) && !seedOk) || (parser.isSet(daemonOption) && emulate) ||
+       (parser.isSet(dropOption) && (!emulate || !dropOk || (dropEvery < 2))) ||
+       (parser.isSet(unplugOption) && (!emulate || ((parser.value(unplugOption) != "random") && (!unplugOk || (unplugAfter < 1))))) ||
+       (parser.isSet(packetOption) && (!emulate || !packetOk || (packetSize < USB_PACKET_SIZE) || (packetSize > USB_MAX_PACKET_SIZE))) ||
+       (parser.isSet(compressOption) && !emulate) || !realtimeOk ||
+       ((command == "bundle") && (args.count() < 3)) || (isBundle && (command != "load") && !parser.isSet(imageOption)) ||
+       !(needsFile || (command == "list") || (command == "erase") || (command == "blankcheck") || (command == "reset")))
+    {
+        fprintf(stderr, "%s\n", qPrintable(parser.helpText()));
+        return ExitUsage;
+    }
+
+    QElapsedTimer total;
+    QJsonObject report;
+    QJsonArray phases;
+    ExitCode code = ExitSuccess;
+    SessionResult result;
+
+    total.start();
+    report["command"] = command;
+
+    // The session runs on this thread, it is the one to tune
+    RealtimeIo::Configure(realtime);
+    if(RealtimeIo::isEnabled())
+        report["realtime"] = RealtimeIo::Apply();
+
+    EmulatedUSB* emulated = emulate ? new EmulatedUSB("emulated:0") : NULL;
+    if(parser.isSet(unplugOption) && (parser.value(unplugOption) == "random"))
+    {
+        qsrand((uint)QDateTime::currentMSecsSinceEpoch());
+        unplugAfter = 1 + qrand() % EMULATED_UNPLUG_RANGE;
+    }
+    if(emulated != NULL)
+    {
+        emulated->dropEvery = parser.isSet(dropOption) ? dropEvery : 0;
+        emulated->unplugAfter = parser.isSet(unplugOption) ? unplugAfter : 0;
+        if(parser.isSet(packetOption))
+            emulated->offeredPacketSize = packetSize;
+        emulated->offerCompression = parser.isSet(compressOption);
+        if(parser.isSet(unplugOption))
+            report["unplugAfter"] = unplugAfter;
+    }
+
+    Session session(emulated);
+    session.writeEeprom = parser.isSet(eepromOption);
+    session.pipelined = !parser.isSet(twoPassOption);
+    session.resume = parser.isSet(resumeOption);
+    session.verifyPlan = VerifyPlan(policy);
+    if(parser.isSet(sampleOption))
+        session.verifyPlan.samplePercent = samplePercent;
+    if(parser.isSet(seedOption))
+        session.verifyPlan.seed = seed;
+
+    if(command == "bundle")
+    {
+        code = BuildBundle(fileName, args.value(2), report);
+    }
+    else if(isBundle && !parser.isSet(imageOption))
+    {
+        code = ListBundle(fileName, report);
+    }
+    else if(parser.isSet(daemonOption))
+    {
+        QJsonObject job;
+        job["command"] = command;
+        if(!fileName.isEmpty())
+            job["file"] = QFileInfo(fileName).absoluteFilePath();
+        job["image"] = parser.value(imageOption);
+        job["device"] = parser.value(deviceOption);
+        job["eeprom"] = session.writeEeprom;
+        job["verify"] = parser.value(verifyOption);
+        if(parser.isSet(sampleOption))
+            job["sample"] = samplePercent;
+        if(parser.isSet(seedOption))
+            job["seed"] = (double)seed;
+        job["twoPass"] = !session.pipelined;
+        job["resume"] = session.resume;
+
+        code = RunOnDaemon(job, report);
+        phases = report.value("phases").toArray();
+    }
+    else if(command == "list")
+    {
+        QJsonArray devices;
+        foreach(USB::DeviceInfo info, Session::Devices())
+        {
+            QJsonObject device;
+            device["path"] = info.path;
+            device["serialNumber"] = info.serialNumber;
+            devices.append(device);
+        }
+        report["devices"] = devices;
+    }
+    else
+    {
+        if((command == "load") || (command == "write") || (command == "verify"))
+        {
+            if(isBundle)
+                code = SessionReport::Record(session.LoadBundle(fileName, parser.value(imageOption)), phases, report);
+            else
+                code = SessionReport::Record(session.Load(fileName), phases, report);
+            if(code == ExitSuccess)
+                report["ranges"] = SessionReport::Ranges(session.image());
+            else
+                code = ExitFileError;
+        }
+
+        if((code == ExitSuccess) && (command != "load"))
+        {
+            code = SessionReport::Record(session.Open(parser.value(deviceOption)), phases, report);
+            report["device"] = session.devicePath();
+            if(code == ExitSuccess)
+                report["firmware"] = SessionReport::Firmware(session.firmwareInfo());
+        }
+
+        if((code == ExitSuccess) && (command != "load"))
+        {
+            if(command == "erase")
+            {
+                code = SessionReport::Record(session.Erase(), phases, report);
+            }
+            else if(command == "write")
+            {
+                code = SessionReport::Record(session.Write(), phases, report);
+
+                // The emulated robot was plugged back in, carry on from
+                // where it was unplugged like a rerun with --resume would
+                if((code != ExitSuccess) && (emulated != NULL) && parser.isSet(unplugOption) && !session.isOpen())
+                {
+                    report["interrupted"] = report.value("error");
+                    report.remove("error");
+                    session.resume = true;
+                    code = SessionReport::Record(session.Open(session.devicePath()), phases, report);
+                    if(code == ExitSuccess)
+                        code = SessionReport::Record(session.Write(), phases, report);
+                }
+                report["resumed"] = session.resumed();
+                report["verify"] = SessionReport::Verify(session.verifyPlan, session.diff());
+                if(!session.diff().isEmpty())
+                    report["mismatches"] = SessionReport::Mismatches(session.diff());
+            }
+            else if(command == "verify")
+            {
+                code = SessionReport::Record(session.Verify(), phases, report);
+                report["verify"] = SessionReport::Verify(session.verifyPlan, session.diff());
+                if(!session.diff().isEmpty())
+                    report["mismatches"] = SessionReport::Mismatches(session.diff());
+            }
+            else if(command == "blankcheck")
+            {
+                code = SessionReport::Record(session.BlankCheck(), phases, report);
+                if(!session.diff().isEmpty())
+                    report["mismatches"] = SessionReport::Mismatches(session.diff());
+            }
+            else if(command == "readback")
+            {
+                PICData deviceData;
+                code = SessionReport::Record(session.ReadBack(&deviceData), phases, report);
+                if(code == ExitSuccess)
+                    code = SessionReport::SaveReadback(fileName, &deviceData, session.writeEeprom, report);
+            }
+            else
+            {
+                code = SessionReport::Record(session.Reset(), phases, report);
+            }
+        }
+
+        session.Close();
+    }
+
+    if(session.progress()->LatencyPercentile(1000) > 0)
+        report["latency"] = SessionReport::Latency(session.progress());
+
+    // Every HID transaction with the emulated bootloader, to compare runs
+    if(emulated != NULL)
+    {
+        report["reports"] = (int)(emulated->packetsSent + emulated->packetsReceived);
+        if(emulated->packetsRejected > 0)
+            report["rejected"] = (int)emulated->packetsRejected;
+    }
+
+    SessionReport::Finish(report, code, phases, ((double)total.nsecsElapsed()) / 1000000000);
+
+    fprintf(stdout, "%s\n", QJsonDocument(report).toJson(QJsonDocument::Compact).constData());
+    fflush(stdout);
+
+	if(!traceFile.isEmpty())
+		Trace::WriteJson(traceFile);
+
+    return code;
+}
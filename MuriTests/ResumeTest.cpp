@@ -0,0 +1,325 @@
+/*
+ * This file is part of MuriProg.
+ *
+ * MuriProg is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MuriProg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with MuriProg.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * Unplugs the emulated Muribot at random points of a pipelined write and
+ * resumes from the journal, like a rerun with --resume after a robot came
+ * loose.  Each round checks that the flash ends up holding the hex file
+ * byte for byte (the signature word aside, which only SIGN_FLASH writes)
+ * and that no span the journal held was programmed again.
+ *
+ * The unplug points come from --seed, random unless given; it is printed
+ * first so a failing run can be repeated.  Exits with 0 when every round
+ * passed and 1 when one failed.
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QFile>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <stdio.h>
+
+#include "../MuriCore/Session.h"
+#include "../MuriCore/EmulatedUSB.h"
+#include "../MuriCore/ProgressJournal.h"
+#include "../MuriCore/ImageDiff.h"
+#include "../MuriCore/Log.h"
+#include "../version.h"
+
+// Start and size of the PROGRAM_MEM region, see PICData()
+#define TEST_FLASH_START        4096
+#define TEST_FLASH_BYTES        60416
+// Share of the 256 byte blocks of the image that are programmed
+#define TEST_IMAGE_DENSITY      75
+#define TEST_BLOCK_BYTES        256
+// Record type of a data line, see HexLoader::hexRecord
+#define TEST_DATA_RECORD        "00"
+// Rounds run unless --rounds says otherwise
+#define TEST_ROUNDS             8
+
+/*
+ * The emulated bootloader, counting the program packets that land on a span
+ * of journal.  Set journal once the write was cut short.
+ */
+class WatchedUSB : public EmulatedUSB
+{
+public:
+    explicit WatchedUSB(QString name) : EmulatedUSB(name) { journal = NULL; reprogrammed = 0; firstReprogrammed = 0; }
+
+    ErrorCode SendPacket(unsigned char *data, int size, int msecs);
+
+    const ProgressJournal* journal;
+    unsigned int reprogrammed;          // Program packets overlapping a journaled span
+    uint32_t firstReprogrammed;         // Address of the first of them
+};
+
+USB::ErrorCode WatchedUSB::SendPacket(unsigned char *data, int size, int msecs)
+{
+    WritePacket* packet = (WritePacket*)data;
+    const unsigned char* payload;
+    uint32_t length = 0;
+    uint32_t i;
+
+    // The payload is right justified, a compressed one starts with its
+    // decoded length
+    if((journal != NULL) && connected && (packet->command == PROGRAM_DEVICE))
+        length = packet->bytesPerPacket;
+    else if((journal != NULL) && connected && (packet->command == PROGRAM_COMPRESSED) && (packet->bytesPerPacket >= COMPRESSED_HEADER))
+    {
+        payload = &packet->data[size - 1 - USB_PACKET_HEADER - packet->bytesPerPacket];
+        length = payload[0] | (payload[1] << 8);
+    }
+
+    for(i = 0; i < length; i++)
+    {
+        if(journal->Contains(PROGRAM_MEM, packet->address + i, packet->address + i + 1))
+        {
+            if(reprogrammed == 0)
+                firstReprogrammed = packet->address + i;
+            reprogrammed++;
+            break;
+        }
+    }
+
+    return EmulatedUSB::SendPacket(data, size, msecs);
+}
+
+/*
+ * The spans of a journal as a rerun would load them, without opening it for
+ * writing, so the write it resumes can still delete it when done
+ */
+class JournalSnapshot : public ProgressJournal
+{
+public:
+    bool Read(QString serial, QByteArray imageHash) { return Load(FileName(serial), imageHash, &done) && !done.isEmpty(); }
+};
+
+static uint32_t Next(uint32_t* state)
+{
+    // xorshift32
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/*
+ * Writes an image of random code between erased gaps as an Intel hex file
+ * covering the PROGRAM_MEM region, in 16 byte lines
+ */
+static bool WriteHexFile(QString fileName, uint32_t seed)
+{
+    QFile file(fileName);
+    unsigned char image[TEST_FLASH_BYTES];
+    uint32_t state = seed | 1;
+    uint32_t offset, address, i, count;
+    unsigned char checksum;
+
+    memset(image, IMAGE_DIFF_BLANK, sizeof(image));
+    for(offset = 0; offset < TEST_FLASH_BYTES; offset += TEST_BLOCK_BYTES)
+    {
+        if((int)(Next(&state) % 100) >= TEST_IMAGE_DENSITY)
+            continue;
+        for(i = offset; (i < offset + TEST_BLOCK_BYTES) && (i < TEST_FLASH_BYTES); i++)
+            image[i] = (unsigned char)Next(&state);
+    }
+
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return false;
+
+    QTextStream stream(&file);
+    stream << ":020000040000FA\n";
+    for(offset = 0; offset < TEST_FLASH_BYTES; offset += 16)
+    {
+        count = qMin((uint32_t)16, TEST_FLASH_BYTES - offset);
+        if(ImageDiff::Mismatch(IMAGE_DIFF_BLANK, image + offset, count) >= count)
+            continue;
+
+        address = TEST_FLASH_START + offset;
+        checksum = (unsigned char)(count + ((address >> 8) & 0xFF) + (address & 0xFF));
+        stream << QString(":%1%2%3").arg(count, 2, 16, QChar('0')).arg(address & 0xFFFF, 4, 16, QChar('0')).arg(TEST_DATA_RECORD).toUpper();
+        for(i = 0; i < count; i++)
+        {
+            stream << QString("%1").arg(image[offset + i], 2, 16, QChar('0')).toUpper();
+            checksum += image[offset + i];
+        }
+        stream << QString("%1\n").arg((unsigned char)(0x100 - checksum) & 0xFF, 2, 16, QChar('0')).toUpper();
+    }
+    stream << ":00000001FF\n";
+
+    return stream.status() == QTextStream::Ok;
+}
+
+/*
+ * Compares the emulated flash against the loaded image.  Only the signature
+ * word may differ, it must hold the signature.
+ */
+static bool FlashMatches(const EmulatedUSB* usb, const PICData* image)
+{
+    PICData::MemoryRange range;
+    uint32_t address;
+    unsigned char expected;
+
+    foreach(range, image->ranges)
+    {
+        if(range.type != PROGRAM_MEM)
+            continue;
+
+        for(address = range.start; address < range.end; address++)
+        {
+            expected = range.pDataBuffer[address - range.start];
+            if(address == EMULATED_SIGNATURE_ADDRESS)
+                expected = (unsigned char)EMULATED_SIGNATURE_VALUE;
+            else if(address == EMULATED_SIGNATURE_ADDRESS + 1)
+                expected = (unsigned char)(EMULATED_SIGNATURE_VALUE >> 8);
+
+            if(usb->flash[address] != expected)
+            {
+                printf("  flash at 0x%04x is 0x%02x, the image has 0x%02x\n", address, usb->flash[address], expected);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * One write cut short after 1 to EMULATED_UNPLUG_RANGE reports and resumed.
+ * Compressed payloads are offered on every other round.
+ */
+static bool RunRound(QString fileName, int round, uint32_t* state)
+{
+    JournalSnapshot journal;
+    WatchedUSB* usb = new WatchedUSB(QString("emulated:resume%1").arg(round));
+    Session session(usb);
+    SessionResult result;
+    unsigned int unplugAfter;
+    bool journaled;
+
+    usb->packetTimeUs = 0;
+    usb->eraseTimeMs = 0;
+    usb->offerCompression = (round % 2) != 0;
+
+    result = session.Load(fileName);
+    if(result.ok())
+        result = session.Open();
+    if(!result.ok())
+    {
+        printf("round %d: %s\n", round, qPrintable(result.message));
+        return false;
+    }
+
+    unplugAfter = 1 + Next(state) % EMULATED_UNPLUG_RANGE;
+    usb->unplugAfter = usb->packetsSent + unplugAfter;
+    result = session.Write();
+    if(result.ok())
+    {
+        // The write needed fewer reports than that, nothing to resume
+        usb->unplugAfter = 0;
+        printf("round %d: not unplugged within %u reports\n", round, unplugAfter);
+        return FlashMatches(usb, session.image());
+    }
+    if(session.isOpen())
+    {
+        printf("round %d: write failed without being unplugged: %s\n", round, qPrintable(result.message));
+        return false;
+    }
+
+    // What a rerun finds on disk, the spans of the last unsynced batch are
+    // not in it and may be written again
+    journaled = journal.Read(usb->serialNumber(), ProgressJournal::ImageHash(session.image(), session.writeFlash, session.writeEeprom));
+    usb->journal = &journal;
+
+    session.resume = true;
+    result = session.Open(usb->path());
+    if(result.ok())
+        result = session.Write();
+    printf("round %d: unplugged after %u reports, %d spans journaled, %s\n", round, unplugAfter, journal.spans(),
+           result.ok() ? (session.resumed() ? "resumed" : "written again") : qPrintable(result.message));
+
+    if(!result.ok())
+        return false;
+    if(journaled && !session.resumed())
+    {
+        printf("  the journal was there but the write started over\n");
+        return false;
+    }
+    if(usb->reprogrammed > 0)
+    {
+        printf("  %u program packets went to journaled spans, the first at 0x%04x\n", usb->reprogrammed, usb->firstReprogrammed);
+        return false;
+    }
+
+    return FlashMatches(usb, session.image());
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setOrganizationName("Mid-Ohio Area Robotics");
+    QCoreApplication::setOrganizationDomain("moarobotics.com");
+    QCoreApplication::setApplicationName("muriprog-resume-test");
+    QCoreApplication::setApplicationVersion(VERSION);
+
+    QCommandLineParser parser;
+    QCommandLineOption seedOption("seed", "Picks the image and the unplug points (default: random).", "n");
+    QCommandLineOption roundsOption("rounds", "Writes to cut short and resume.", "count", QString::number(TEST_ROUNDS));
+
+    parser.setApplicationDescription("Unplugs the emulated bootloader at random points of a write, resumes it from\n"
+                                     "the journal and checks the flash against the hex file.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addOption(seedOption);
+    parser.addOption(roundsOption);
+    parser.process(a);
+
+    Log::Init();
+    Log::SetLevel(Log::Off);
+
+    // Journals go to a scratch location instead of the user's data directory
+    QStandardPaths::setTestModeEnabled(true);
+
+    QTemporaryDir dir;
+    QString fileName = dir.path() + "/image.hex";
+    uint32_t seed = parser.isSet(seedOption) ? parser.value(seedOption).toUInt() : (uint32_t)QDateTime::currentMSecsSinceEpoch();
+    uint32_t state = seed | 1;
+    int rounds = qMax(1, parser.value(roundsOption).toInt());
+    int failed = 0;
+    int i;
+
+    printf("seed %u\n", seed);
+    if(!dir.isValid() || !WriteHexFile(fileName, seed))
+    {
+        printf("Could not write %s.\n", qPrintable(fileName));
+        return 1;
+    }
+
+    for(i = 0; i < rounds; i++)
+    {
+        if(!RunRound(fileName, i, &state))
+            failed++;
+    }
+
+    printf("%d of %d rounds passed\n", rounds - failed, rounds);
+    return (failed == 0) ? 0 : 1;
+}